@@ -20,15 +20,20 @@
 #include "client/fishc_internal.h"
 #include "client/stub/xattrs.h"
 #include "mds/const.h"
+#include "msg/cenc.h"
+#include "msg/msg.h"
+#include "msg/xdr.h"
 #include "util/compiler.h"
 #include "util/dir.h"
 #include "util/error.h"
 #include "util/macro.h"
+#include "util/packed.h"
 #include "util/path.h"
 #include "util/platform/readdir.h"
 #include "util/run_cmd.h"
 #include "util/safe_io.h"
 #include "util/string.h"
+#include "util/time.h"
 #include "util/username.h"
 
 #include <atomic_ops.h>
@@ -49,6 +54,10 @@
 /****************************** macros ********************************/
 #define FAILTHREAD_LONG_SLEEP_MS 500
 #define FISHC_RPC_TIMEOUT 30
+/** Shortest time to back off after the MDS says it is busy, in milliseconds */
+#define FISHC_BUSY_BACKOFF_MIN_MS 10
+/** Longest time to back off after the MDS says it is busy, in milliseconds */
+#define FISHC_BUSY_BACKOFF_MAX_MS 5000
 #define RF_FILE_FLAG_WRITABLE 0x1
 #define RF_FILE_FLAG_SHUTDOWN 0x2
 
@@ -88,6 +97,13 @@ struct redfish_client {
 	pthread_cond_t rpc_cond;
 	/** Reference count */
 	int refcnt;
+	/** Client ID that the MDS uses to recognize retransmitted requests.
+	 * Unlike clid, this has to be unique across the whole cluster, so it
+	 * is chosen at random. */
+	uint64_t rid_clid;
+	/** Sequence number of the last request we sent which modified the
+	 * metadata */
+	uint64_t rid_seq;
 };
 
 /** Represents a chunk of a Redfish file */
@@ -130,6 +146,73 @@ static void rf_file_chunk_copy(struct rf_file_chunk_prealloc *dst,
 }
 
 /****************************** rpc ********************************/
+/** Pick a random client ID for request IDs.
+ *
+ * @return		A nonzero client ID
+ */
+static uint64_t fishc_pick_rid_clid(void)
+{
+	int fd;
+	uint64_t clid = 0;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		if (safe_read_exact(fd, &clid, sizeof(clid)) != 0)
+			clid = 0;
+		safe_close(fd);
+	}
+	if (clid == 0) {
+		/* Second best: the time and our process ID. */
+		clid = (mt_time_us() << 16) ^ (uint64_t)getpid();
+	}
+	return clid ? clid : 1;
+}
+
+/** Give a request which modifies the metadata a unique ID, so that we can
+ * safely send it again if we don't hear back from the MDS.
+ *
+ * @param cli		The Redfish client
+ * @param rid		(out param) the request ID
+ */
+static void fishc_next_rid(struct redfish_client *cli, struct rf_req_id *rid)
+{
+	rid->clid = cli->rid_clid;
+	rid->seq = __sync_add_and_fetch(&cli->rid_seq, 1);
+}
+
+/** Wait before retrying a request that the MDS turned away.
+ *
+ * We wait for whichever is longer: the time the MDS asked for, or our own
+ * backoff time, which doubles each time we are turned away.  A random extra
+ * delay of up to half that keeps clients that were turned away together from
+ * all coming back at once.
+ *
+ * @param backoff_ms	(inout) our current backoff time
+ * @param retry_ms	The time the MDS asked us to wait
+ * @param waited_ms	(inout) total time we have spent waiting so far
+ *
+ * @return		0 if we should try again; -EBUSY if we have been
+ *			waiting too long already
+ */
+static int fishc_busy_backoff(uint32_t *backoff_ms, uint32_t retry_ms,
+		uint32_t *waited_ms)
+{
+	uint32_t delay_ms;
+
+	if (*waited_ms >= FISHC_RPC_TIMEOUT * 1000)
+		return -EBUSY;
+	delay_ms = (retry_ms > *backoff_ms) ? retry_ms : *backoff_ms;
+	if (delay_ms > FISHC_BUSY_BACKOFF_MAX_MS)
+		delay_ms = FISHC_BUSY_BACKOFF_MAX_MS;
+	delay_ms += random() % (delay_ms / 2 + 1);
+	*backoff_ms *= 2;
+	if (*backoff_ms > FISHC_BUSY_BACKOFF_MAX_MS)
+		*backoff_ms = FISHC_BUSY_BACKOFF_MAX_MS;
+	*waited_ms += delay_ms;
+	mt_msleep(delay_ms);
+	return 0;
+}
+
 static struct msg *fishc_do_mds_rpc(struct redfish_client *cli,
 		struct rf_cli_tls *tls, struct msg *m)
 {
@@ -139,6 +222,8 @@ static struct msg *fishc_do_mds_rpc(struct redfish_client *cli,
 	uint16_t mds_addr;
 	struct timespec ts;
 	struct mtran *tr;
+	uint32_t retry_ms, backoff_ms = FISHC_BUSY_BACKOFF_MIN_MS;
+	uint32_t waited_ms = 0;
 
 	pthread_mutex_lock(&cli->lock);
 	while (1) {
@@ -172,6 +257,22 @@ static struct msg *fishc_do_mds_rpc(struct redfish_client *cli,
 			pthread_cond_signal(&cli->need_failover_cond);
 			continue;
 		}
+		retry_ms = msg_xdr_busy_retry_ms(tr->m);
+		if (retry_ms) {
+			/* The MDS is overloaded, or we have been sending it
+			 * too much.  Give it a break before trying again. */
+			bsend_reset(tls->ctx);
+			ret = fishc_busy_backoff(&backoff_ms, retry_ms,
+					&waited_ms);
+			if (ret)
+				return ERR_PTR(FORCE_POSITIVE(ret));
+			pthread_mutex_lock(&cli->lock);
+			continue;
+		}
+		resp = tr->m;
+		tr->m = NULL;
+		bsend_reset(tls->ctx);
+		break;
 	}
 	return resp;
 }
@@ -350,7 +451,8 @@ static struct redfish_block_loc **locate_resp_to_block_loc(
 	return blcs;
 }
 
-static int stat_resp_to_rf_stat(struct rf_stat *stat, struct redfish_stat *osa)
+static int stat_resp_to_rf_stat(const struct cenc_mmm_stat_resp *stat,
+		struct redfish_stat *osa)
 {
 	osa->length = stat->length;
 	osa->is_dir = (stat->mode_and_type & MMM_STAT_TYPE_DIR);
@@ -360,7 +462,7 @@ static int stat_resp_to_rf_stat(struct rf_stat *stat, struct redfish_stat *osa)
 	osa->atime = stat->atime;
 	osa->nid = stat->nid;
 	osa->mode = stat->mode_and_type & MMM_STAT_MODE_MASK;
-	osa->owner = strdup(stat->owner);
+	osa->owner = strdup(stat->user);
 	if (!osa->owner)
 		return -ENOMEM;
 	osa->group = strdup(stat->group);
@@ -371,6 +473,45 @@ static int stat_resp_to_rf_stat(struct rf_stat *stat, struct redfish_stat *osa)
 	return 0;
 }
 
+/** Decode a stat response, whichever encoding the MDS used for it
+ *
+ * @param r		The response message
+ * @param osa		(out param) the stat information
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int decode_stat_resp(const struct msg *r, struct redfish_stat *osa)
+{
+	int ret;
+	struct cenc_mmm_stat_resp cresp;
+	struct mmm_stat_resp resp;
+
+	if (unpack_from_be16(&r->ty) != mmm_stat_resp_ty) {
+		ret = msg_xdr_decode_as_generic(r);
+		return (ret == 0) ? -EIO : FORCE_NEGATIVE(ret);
+	}
+	if (cenc_is_compact(r)) {
+		if (CENC_DECODE_mmm_stat_resp(r, &cresp, NULL) < 0)
+			return -EIO;
+		return stat_resp_to_rf_stat(&cresp, osa);
+	}
+	memset(&resp, 0, sizeof(resp));
+	if (MSG_XDR_DECODE(mmm_stat_resp, r, &resp) < 0)
+		return -EIO;
+	cresp.mtime = resp.stat.mtime;
+	cresp.atime = resp.stat.atime;
+	cresp.length = resp.stat.length;
+	cresp.nid = resp.stat.nid;
+	cresp.block_sz = resp.stat.block_sz;
+	cresp.mode_and_type = resp.stat.mode_and_type;
+	cresp.man_repl = resp.stat.man_repl;
+	cresp.user = resp.stat.user;
+	cresp.group = resp.stat.group;
+	ret = stat_resp_to_rf_stat(&cresp, osa);
+	XDR_REQ_FREE(mmm_stat_resp, &resp);
+	return ret;
+}
+
 /****************************** tls ********************************/
 static struct rf_cli_tls *client_alloc_tls(struct redfish_thread *rt,
 		struct redfish_cli *cli)
@@ -495,6 +636,8 @@ struct redfish_client *redfish_connect(const char *conf_path,
 	pthread_mutex_lock(&g_highest_clid_lock);
 	cli->clid = ++g_highest_clid;
 	pthread_mutex_unlock(&g_highest_clid_lock);
+	cli->rid_clid = fishc_pick_rid_clid();
+	cli->rid_seq = 0;
 	cli->pri_mid = 0;
 	cli->fail = 0;
 	cli->disconnecting = 0;
@@ -578,6 +721,7 @@ int redfish_mkdirs(struct redfish_client *cli, int mode, const char *path)
 	if (ret < 0)
 		goto done; 
 	memset(&req, 0, sizeof(req));
+	fishc_next_rid(cli, &req.rid);
 	req.ctime = time(NULL);
 	req.mode = mode;
 	req.path = cpath;
@@ -665,8 +809,7 @@ int redfish_get_path_status(struct redfish_client *cli, const char *path,
 {
 	int ret;
 	char cpath[RF_PATH_MAX];
-	struct mmm_path_stat_req req;
-	struct mmm_stat_resp resp;
+	struct cenc_mmm_path_stat_req req;
 	struct msg *m, *r;
 	struct rf_cli_tls *tls;
 
@@ -681,7 +824,7 @@ int redfish_get_path_status(struct redfish_client *cli, const char *path,
 	memset(&req, 0, sizeof(req));
 	req.path = cpath;
 	req.user = cli->user;
-	m = MSG_XDR_ALLOC(mmm_path_stat_req, &req);
+	m = CENC_ALLOC_mmm_path_stat_req(&req, 0, NULL);
 	if (IS_ERR(m)) {
 		ret = PTR_ERR(m);
 		goto done;
@@ -691,21 +834,7 @@ int redfish_get_path_status(struct redfish_client *cli, const char *path,
 		ret = PTR_ERR(r);
 		goto done_release_m;
 	}
-	ret = msg_xdr_decode_as_generic(r);
-	if (ret > 0)
-		goto done_release_r;
-	ret = MSG_XDR_DECODE(mmm_stat_resp, r, &resp);
-	if (ret < 0) {
-		ret = -EIO;
-		goto done_release_r;
-	}
-	ret = stat_resp_to_rf_stat(&resp.stat, osa);
-	if (ret)
-		goto done_release_resp;
-	ret = 0;
-done_release_resp:
-	XDR_REQ_FREE(mmm_stat_resp, resp);
-done_release_r:
+	ret = decode_stat_resp(r, osa);
 	msg_release(r);
 done_release_m:
 	msg_release(m);
@@ -743,6 +872,7 @@ int redfish_chmod(struct redfish_client *cli, const char *path, int mode)
 	if (ret < 0)
 		goto done; 
 	memset(&req, 0, sizeof(req));
+	fishc_next_rid(cli, &req.rid);
 	req.ctime = time(NULL);
 	req.mode = mode;
 	req.path = cpath;
@@ -783,6 +913,7 @@ int redfish_chown(struct redfish_client *cli, const char *path,
 	if (ret < 0)
 		goto done; 
 	memset(&req, 0, sizeof(req));
+	fishc_next_rid(cli, &req.rid);
 	req.path = cpath;
 	req.user = cli->user;
 	req.new_user = owner;
@@ -823,6 +954,7 @@ int redfish_utimes(struct redfish_client *cli, const char *path,
 	if (ret < 0)
 		goto done; 
 	memset(&req, 0, sizeof(req));
+	fishc_next_rid(cli, &req.rid);
 	req.path = cpath;
 	req.user = cli->user;
 	req.new_atime = atime;
@@ -945,6 +1077,7 @@ static int redfish_unlink_impl(struct redfish_client *cli, const char *path,
 	if (ret < 0)
 		goto done; 
 	memset(&req, 0, sizeof(req));
+	fishc_next_rid(cli, &req.rid);
 	req.path = cpath;
 	req.user = cli->user;
 	req.new_atime = atime;
@@ -1002,6 +1135,7 @@ int redfish_rename(struct redfish_client *cli, const char *src, const char *dst)
 	if (ret < 0)
 		goto done; 
 	memset(&req, 0, sizeof(req));
+	fishc_next_rid(cli, &req.rid);
 	req.user = cli->user;
 	req.src = csrc;
 	req.dst = cdst;
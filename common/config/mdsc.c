@@ -26,6 +26,22 @@
 #define MDSC_DEFAULT_OSD_PORT 7001
 #define MDSC_DEFAULT_CLI_PORT 7002
 
+/** Default limit on client requests waiting to be handled */
+#define MDSC_DEFAULT_CLI_MAX_QUEUED 4096
+/** Default limit on requests per second from one client host */
+#define MDSC_DEFAULT_CLI_REQ_RATE 2000
+/** Default number of requests one client host may make in a burst */
+#define MDSC_DEFAULT_CLI_REQ_BURST 4000
+/** Default number of seconds between scans for chunks to copy */
+#define MDSC_DEFAULT_REPL_IVAL 60
+/** Default limit on chunk copies in progress at once */
+#define MDSC_DEFAULT_REPL_MAX_INFLIGHT 4
+/** Default limit on chunk copies started per second */
+#define MDSC_DEFAULT_REPL_RATE 10
+/** Default number of chunks one OSD may have over another before we move
+ * chunks between them */
+#define MDSC_DEFAULT_REPL_SLACK 64
+
 void harmonize_mdsc(struct mdsc *conf, char *err, size_t err_len)
 {
 	harmonize_logc(conf->lc, err, err_len);
@@ -46,6 +62,33 @@ void harmonize_mdsc(struct mdsc *conf, char *err, size_t err_len)
 		conf->mds_port = MDSC_DEFAULT_MDS_PORT;
 	if (conf->osd_port == JORM_INVAL_INT)
 		conf->mds_port = MDSC_DEFAULT_OSD_PORT;
+	if (conf->cli_max_queued == JORM_INVAL_INT)
+		conf->cli_max_queued = MDSC_DEFAULT_CLI_MAX_QUEUED;
+	if (conf->cli_req_rate == JORM_INVAL_INT)
+		conf->cli_req_rate = MDSC_DEFAULT_CLI_REQ_RATE;
+	if (conf->cli_req_burst == JORM_INVAL_INT)
+		conf->cli_req_burst = MDSC_DEFAULT_CLI_REQ_BURST;
+	if ((conf->cli_max_queued < 0) || (conf->cli_req_rate < 0) ||
+			(conf->cli_req_burst < 0)) {
+		snprintf(err, err_len, "cli_max_queued, cli_req_rate, and "
+			"cli_req_burst must not be negative");
+		return;
+	}
+	if (conf->repl_ival == JORM_INVAL_INT)
+		conf->repl_ival = MDSC_DEFAULT_REPL_IVAL;
+	if (conf->repl_max_inflight == JORM_INVAL_INT)
+		conf->repl_max_inflight = MDSC_DEFAULT_REPL_MAX_INFLIGHT;
+	if (conf->repl_rate == JORM_INVAL_INT)
+		conf->repl_rate = MDSC_DEFAULT_REPL_RATE;
+	if (conf->repl_slack == JORM_INVAL_INT)
+		conf->repl_slack = MDSC_DEFAULT_REPL_SLACK;
+	if ((conf->repl_ival < 0) || (conf->repl_max_inflight < 1) ||
+			(conf->repl_rate < 0) || (conf->repl_slack < 0)) {
+		snprintf(err, err_len, "repl_ival, repl_rate, and repl_slack "
+			"must not be negative, and repl_max_inflight must be "
+			"at least 1");
+		return;
+	}
 	if (conf->host == JORM_INVAL_STR) {
 		snprintf(err, err_len, "you must give a hostname");
 		return;
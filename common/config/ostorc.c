@@ -24,12 +24,38 @@
 
 #define DEFAULT_OSTOR_TIMEO 120
 
+#define DEFAULT_OSTOR_AIO_DEPTH 64
+
+#define DEFAULT_OSTOR_PACK_COMPACT_PCT 50
+
+#define DEFAULT_OSTOR_CACHE_READAHEAD 4
+
+#define DEFAULT_OSTOR_SCRUB_MB 4
+
+#define DEFAULT_OSTOR_SCRUB_IVAL 3600
+
 void harmonize_ostorc(struct ostorc *conf, char *err, size_t err_len)
 {
 	if (conf->ostor_max_open == JORM_INVAL_INT)
 		conf->ostor_max_open = sysconf(_SC_OPEN_MAX);
 	if (conf->ostor_timeo == JORM_INVAL_INT)
 		conf->ostor_timeo = DEFAULT_OSTOR_TIMEO;
+	if (conf->ostor_aio_depth == JORM_INVAL_INT)
+		conf->ostor_aio_depth = DEFAULT_OSTOR_AIO_DEPTH;
+	if (conf->ostor_pack_mb == JORM_INVAL_INT)
+		conf->ostor_pack_mb = 0;
+	if (conf->ostor_pack_compact_pct == JORM_INVAL_INT)
+		conf->ostor_pack_compact_pct = DEFAULT_OSTOR_PACK_COMPACT_PCT;
+	if (conf->ostor_direct_kb == JORM_INVAL_INT)
+		conf->ostor_direct_kb = 0;
+	if (conf->ostor_cache_mb == JORM_INVAL_INT)
+		conf->ostor_cache_mb = 0;
+	if (conf->ostor_cache_readahead == JORM_INVAL_INT)
+		conf->ostor_cache_readahead = DEFAULT_OSTOR_CACHE_READAHEAD;
+	if (conf->ostor_scrub_mb == JORM_INVAL_INT)
+		conf->ostor_scrub_mb = DEFAULT_OSTOR_SCRUB_MB;
+	if (conf->ostor_scrub_ival == JORM_INVAL_INT)
+		conf->ostor_scrub_ival = DEFAULT_OSTOR_SCRUB_IVAL;
 	if (conf->ostor_path == JORM_INVAL_STR) {
 		snprintf(err, err_len, "you must give a path to the ostor");
 		return;
@@ -44,4 +70,45 @@ void harmonize_ostorc(struct ostorc *conf, char *err, size_t err_len)
 			"than 0");
 		return;
 	}
+	if (conf->ostor_aio_depth < 0) {
+		snprintf(err, err_len, "ostor->ostor_aio_depth cannot be less "
+			"than 0");
+		return;
+	}
+	if (conf->ostor_pack_mb < 0) {
+		snprintf(err, err_len, "ostor->ostor_pack_mb cannot be less "
+			"than 0");
+		return;
+	}
+	if ((conf->ostor_pack_compact_pct < 0) ||
+			(conf->ostor_pack_compact_pct > 100)) {
+		snprintf(err, err_len, "ostor->ostor_pack_compact_pct must be "
+			"between 0 and 100");
+		return;
+	}
+	if (conf->ostor_direct_kb < 0) {
+		snprintf(err, err_len, "ostor->ostor_direct_kb cannot be less "
+			"than 0");
+		return;
+	}
+	if (conf->ostor_cache_mb < 0) {
+		snprintf(err, err_len, "ostor->ostor_cache_mb cannot be less "
+			"than 0");
+		return;
+	}
+	if (conf->ostor_cache_readahead < 0) {
+		snprintf(err, err_len, "ostor->ostor_cache_readahead cannot "
+			"be less than 0");
+		return;
+	}
+	if (conf->ostor_scrub_mb < 0) {
+		snprintf(err, err_len, "ostor->ostor_scrub_mb cannot be less "
+			"than 0");
+		return;
+	}
+	if (conf->ostor_scrub_ival < 0) {
+		snprintf(err, err_len, "ostor->ostor_scrub_ival cannot be "
+			"less than 0");
+		return;
+	}
 }
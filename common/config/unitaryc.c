@@ -19,10 +19,15 @@
 #include "common/config/osdc.h"
 #include "common/config/unitaryc.h"
 
+#include <limits.h>
+
 #define JORM_CUR_FILE "common/config/unitaryc.jorm"
 #include "jorm/jorm_generate_body.h"
 #undef JORM_CUR_FILE
 
+/** By default, messengers don't compress anything */
+#define UNITARYC_DEFAULT_MSGR_COMPRESS_KB 0
+
 struct unitaryc* parse_unitary_conf_file(const char *fname,
 		char *err, size_t err_len)
 {
@@ -65,6 +70,14 @@ void harmonize_unitary_conf(struct unitaryc *conf, char *err, size_t err_len)
 	struct mdsc **m;
 	struct osdc **o;
 
+	if (conf->msgr_compress_kb == JORM_INVAL_INT)
+		conf->msgr_compress_kb = UNITARYC_DEFAULT_MSGR_COMPRESS_KB;
+	if ((conf->msgr_compress_kb < 0) ||
+			(conf->msgr_compress_kb > INT_MAX / 1024)) {
+		snprintf(err, err_len, "msgr_compress_kb must be between 0 "
+			"and %d", INT_MAX / 1024);
+		return;
+	}
 	for (idx = 0, o = conf->osd; *o; ++o, ++idx) {
 		harmonize_osdc(*o, err, err_len);
 		if (err[0]) {
@@ -81,6 +94,11 @@ void harmonize_unitary_conf(struct unitaryc *conf, char *err, size_t err_len)
 	}
 }
 
+int unitaryc_compress_thresh(const struct unitaryc *conf)
+{
+	return conf->msgr_compress_kb * 1024;
+}
+
 void free_unitary_conf_file(struct unitaryc *conf)
 {
 	JORM_FREE_unitaryc(conf);
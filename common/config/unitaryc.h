@@ -50,6 +50,16 @@ extern struct unitaryc *parse_unitary_conf_file(const char *fname,
 extern void harmonize_unitary_conf(struct unitaryc *conf, char *err,
 					size_t err_len);
 
+/** Get the message body size at which messengers should start compressing.
+ * This is cluster-wide, so that every daemon and client agrees.
+ *
+ * @param conf		The harmonized unitary configuration
+ *
+ * @return		The threshold in bytes, suitable for
+ *			msgr_conf.compress_thresh.  0 means never compress.
+ */
+extern int unitaryc_compress_thresh(const struct unitaryc *conf);
+
 /** Free unitary configuration data.
  *
  * @param conf		The unitary configuration data
@@ -0,0 +1,382 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mds/drc.h"
+#include "msg/msg.h"
+#include "msg/msgr.h"
+#include "util/bitfield.h"
+#include "util/error.h"
+#include "util/hmap.h"
+#include "util/queue.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Maximum number of clients drc_evict looks at */
+#define DRC_EVICT_SCAN 16
+
+/** Number of sequence numbers, counting back from the highest one we have
+ * forgotten, for which we remember whether we forgot a finished request */
+#define DRC_FORGOT_WIN 1024
+
+enum drc_ent_state {
+	/** This entry has never been used */
+	DRC_ENT_FREE = 0,
+	/** The request is being carried out */
+	DRC_ENT_BUSY,
+	/** The request has been carried out */
+	DRC_ENT_DONE,
+};
+
+struct drc_ent {
+	/** Sequence number of the request */
+	uint64_t seq;
+	/** Result of the request, if state is DRC_ENT_DONE */
+	int32_t result;
+	/** enum drc_ent_state */
+	int state;
+	/** Transactors for retransmissions which are waiting for the request
+	 * to be finished */
+	struct drc_waiters waiters;
+};
+
+struct drc_client {
+	/** Entry in the LRU list */
+	TAILQ_ENTRY(drc_client) lru_entry;
+	/** Client ID */
+	uint64_t clid;
+	/** Highest sequence number we have reused an entry for */
+	uint64_t forgot_seq;
+	/** Finished requests whose entries we have reused.  Bit (seq %
+	 * DRC_FORGOT_WIN) is set for each such seq that is within
+	 * DRC_FORGOT_WIN of forgot_seq.  Client threads share one sequence
+	 * counter, so a request can arrive well after later ones have
+	 * finished and been forgotten; this lets us tell it apart from a
+	 * retransmission of one of them. */
+	BITFIELD_DECL(forgot, DRC_FORGOT_WIN);
+	/** Index of the entry to try to reuse next */
+	uint32_t next;
+	/** Number of entries in state DRC_ENT_BUSY.  We never reuse these,
+	 * and we never forget about a client that has any. */
+	uint32_t num_busy;
+	/** Array of max_per_client entries */
+	struct drc_ent ents[0];
+};
+
+TAILQ_HEAD(drc_lru, drc_client);
+
+struct drc {
+	/** Protects everything in this structure */
+	pthread_mutex_t lock;
+	/** Maximum number of clients to remember */
+	uint32_t max_clients;
+	/** Number of requests to remember for each client */
+	uint32_t max_per_client;
+	/** Map from client ID to struct drc_client */
+	struct hmap clients;
+	/** All clients, most recently heard from first */
+	struct drc_lru lru;
+	/** Statistics */
+	struct drc_stats stats;
+};
+
+struct drc *drc_init(uint32_t max_clients, uint32_t max_per_client)
+{
+	int ret;
+	struct drc *drc;
+
+	if ((max_clients == 0) || (max_per_client == 0))
+		return ERR_PTR(EINVAL);
+	drc = calloc(1, sizeof(struct drc));
+	if (!drc) {
+		ret = ENOMEM;
+		goto error;
+	}
+	drc->max_clients = max_clients;
+	drc->max_per_client = max_per_client;
+	ret = -hmap_init(&drc->clients, 0);
+	if (ret)
+		goto error_free_drc;
+	TAILQ_INIT(&drc->lru);
+	ret = pthread_mutex_init(&drc->lock, NULL);
+	if (ret)
+		goto error_free_clients;
+	return drc;
+
+error_free_clients:
+	hmap_free(&drc->clients);
+error_free_drc:
+	free(drc);
+error:
+	return ERR_PTR(ret);
+}
+
+static void drc_free_client(struct drc *drc, struct drc_client *cl)
+{
+	uint32_t i;
+	struct mtran *tr;
+
+	for (i = 0; i < drc->max_per_client; ++i) {
+		while (1) {
+			tr = STAILQ_FIRST(&cl->ents[i].waiters);
+			if (!tr)
+				break;
+			STAILQ_REMOVE_HEAD(&cl->ents[i].waiters,
+					u.pending_entry);
+			mtran_free(tr);
+		}
+	}
+	free(cl);
+}
+
+/** Make room for a new client by forgetting about the one we heard from least
+ * recently.  Clients with requests in progress are skipped.  If we can't find
+ * one without looking too far, we let the cache go over its limit instead. */
+static void drc_evict(struct drc *drc)
+{
+	int i;
+	struct drc_client *cl;
+
+	cl = TAILQ_LAST(&drc->lru, drc_lru);
+	for (i = 0; i < DRC_EVICT_SCAN; ++i) {
+		if (!cl)
+			return;
+		if (cl->num_busy == 0)
+			break;
+		cl = TAILQ_PREV(cl, drc_lru, lru_entry);
+	}
+	if ((!cl) || (cl->num_busy != 0))
+		return;
+	TAILQ_REMOVE(&drc->lru, cl, lru_entry);
+	hmap_remove(&drc->clients, cl->clid);
+	drc_free_client(drc, cl);
+	drc->stats.evicted++;
+}
+
+static struct drc_client *drc_add_client(struct drc *drc, uint64_t clid)
+{
+	int ret;
+	uint32_t i;
+	struct drc_client *cl;
+
+	if (drc->clients.num >= drc->max_clients)
+		drc_evict(drc);
+	cl = calloc(1, sizeof(struct drc_client) +
+		(drc->max_per_client * sizeof(struct drc_ent)));
+	if (!cl)
+		return ERR_PTR(ENOMEM);
+	cl->clid = clid;
+	for (i = 0; i < drc->max_per_client; ++i)
+		STAILQ_INIT(&cl->ents[i].waiters);
+	ret = hmap_put(&drc->clients, clid, cl);
+	if (ret) {
+		free(cl);
+		return ERR_PTR(-ret);
+	}
+	TAILQ_INSERT_HEAD(&drc->lru, cl, lru_entry);
+	return cl;
+}
+
+static struct drc_ent *drc_find_ent(struct drc *drc, struct drc_client *cl,
+		uint64_t seq)
+{
+	uint32_t i;
+
+	for (i = 0; i < drc->max_per_client; ++i) {
+		if ((cl->ents[i].state != DRC_ENT_FREE) &&
+				(cl->ents[i].seq == seq))
+			return &cl->ents[i];
+	}
+	return NULL;
+}
+
+/** Remember that we have forgotten the result of a finished request */
+static void drc_forget(struct drc_client *cl, uint64_t seq)
+{
+	uint64_t s;
+	uint32_t idx;
+
+	if (seq > cl->forgot_seq) {
+		/* Slide the window up.  The bits that now stand for the
+		 * sequence numbers between the old top and the new one are
+		 * left over from DRC_FORGOT_WIN ago; clear them. */
+		if (seq - cl->forgot_seq >= DRC_FORGOT_WIN) {
+			BITFIELD_ZERO(cl->forgot);
+		}
+		else {
+			for (s = cl->forgot_seq + 1; s < seq; ++s) {
+				idx = s % DRC_FORGOT_WIN;
+				BITFIELD_CLEAR(cl->forgot, idx);
+			}
+		}
+		cl->forgot_seq = seq;
+	}
+	else if (cl->forgot_seq - seq >= DRC_FORGOT_WIN) {
+		return;
+	}
+	idx = seq % DRC_FORGOT_WIN;
+	BITFIELD_SET(cl->forgot, idx);
+}
+
+/** Determine whether a request which is not in the cache might be one whose
+ * result we have forgotten */
+static int drc_is_forgotten(const struct drc_client *cl, uint64_t seq)
+{
+	uint32_t idx;
+
+	if (seq > cl->forgot_seq)
+		return 0;
+	if (cl->forgot_seq - seq >= DRC_FORGOT_WIN)
+		return 1;
+	idx = seq % DRC_FORGOT_WIN;
+	return BITFIELD_TEST(cl->forgot, idx);
+}
+
+/** Find an entry to use for a new request, forgetting about the oldest
+ * request that has finished.
+ *
+ * @return		The entry, or NULL if every entry is busy
+ */
+static struct drc_ent *drc_take_ent(struct drc *drc, struct drc_client *cl)
+{
+	uint32_t i, idx;
+	struct drc_ent *ent;
+
+	for (i = 0; i < drc->max_per_client; ++i) {
+		idx = (cl->next + i) % drc->max_per_client;
+		ent = &cl->ents[idx];
+		if (ent->state == DRC_ENT_BUSY)
+			continue;
+		if (ent->state == DRC_ENT_DONE)
+			drc_forget(cl, ent->seq);
+		cl->next = (idx + 1) % drc->max_per_client;
+		return ent;
+	}
+	return NULL;
+}
+
+int drc_begin(struct drc *drc, uint64_t clid, uint64_t seq,
+		struct mtran *tr, int32_t *result)
+{
+	int ret;
+	struct drc_client *cl;
+	struct drc_ent *ent;
+
+	if (clid == 0)
+		return DRC_NEW;
+	pthread_mutex_lock(&drc->lock);
+	cl = hmap_get(&drc->clients, clid);
+	if (cl) {
+		TAILQ_REMOVE(&drc->lru, cl, lru_entry);
+		TAILQ_INSERT_HEAD(&drc->lru, cl, lru_entry);
+	}
+	else {
+		cl = drc_add_client(drc, clid);
+		if (IS_ERR(cl)) {
+			/* If we can't remember this request, we can still
+			 * carry it out. */
+			ret = DRC_NEW;
+			goto done;
+		}
+	}
+	ent = drc_find_ent(drc, cl, seq);
+	if (ent) {
+		if (ent->state == DRC_ENT_DONE) {
+			*result = ent->result;
+			drc->stats.replayed++;
+			ret = DRC_DONE;
+		}
+		else {
+			STAILQ_INSERT_TAIL(&ent->waiters, tr,
+					u.pending_entry);
+			drc->stats.joined++;
+			ret = DRC_IN_PROGRESS;
+		}
+		goto done;
+	}
+	if (drc_is_forgotten(cl, seq)) {
+		/* We have done this one, or it is too old for us to tell.
+		 * Either way, better to say that we don't know than to
+		 * guess. */
+		*result = -ESTALE;
+		drc->stats.stale++;
+		ret = DRC_DONE;
+		goto done;
+	}
+	ent = drc_take_ent(drc, cl);
+	if (ent) {
+		ent->seq = seq;
+		ent->state = DRC_ENT_BUSY;
+		cl->num_busy++;
+	}
+	ret = DRC_NEW;
+done:
+	pthread_mutex_unlock(&drc->lock);
+	return ret;
+}
+
+void drc_finish(struct drc *drc, uint64_t clid, uint64_t seq,
+		int32_t result, struct drc_waiters *waiters)
+{
+	struct drc_client *cl;
+	struct drc_ent *ent;
+
+	STAILQ_INIT(waiters);
+	if (clid == 0)
+		return;
+	pthread_mutex_lock(&drc->lock);
+	cl = hmap_get(&drc->clients, clid);
+	if (!cl)
+		goto done;
+	ent = drc_find_ent(drc, cl, seq);
+	if ((!ent) || (ent->state != DRC_ENT_BUSY))
+		goto done;
+	ent->state = DRC_ENT_DONE;
+	ent->result = result;
+	cl->num_busy--;
+	STAILQ_CONCAT(waiters, &ent->waiters);
+done:
+	pthread_mutex_unlock(&drc->lock);
+}
+
+void drc_get_stats(struct drc *drc, struct drc_stats *stats)
+{
+	pthread_mutex_lock(&drc->lock);
+	memcpy(stats, &drc->stats, sizeof(struct drc_stats));
+	stats->num_clients = drc->clients.num;
+	pthread_mutex_unlock(&drc->lock);
+}
+
+void drc_free(struct drc *drc)
+{
+	struct drc_client *cl;
+
+	while (1) {
+		cl = TAILQ_FIRST(&drc->lru);
+		if (!cl)
+			break;
+		TAILQ_REMOVE(&drc->lru, cl, lru_entry);
+		drc_free_client(drc, cl);
+	}
+	hmap_free(&drc->clients);
+	pthread_mutex_destroy(&drc->lock);
+	free(drc);
+}
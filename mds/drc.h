@@ -0,0 +1,136 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_MDS_DRC_DOT_H
+#define REDFISH_MDS_DRC_DOT_H
+
+#include "util/queue.h"
+
+#include <stdint.h> /* for uint64_t, etc. */
+
+/* The duplicate request cache remembers the outcome of recent operations which
+ * modified the metadata, keyed by (client ID, sequence number).  When a client
+ * doesn't hear back about an operation, it can simply send it again.  If we
+ * have already done the operation, we send back the answer we gave the first
+ * time, rather than doing it twice.
+ *
+ * Each client gets a fixed number of entries, which are reused oldest first.
+ * Clients which haven't been heard from in a while are forgotten when we need
+ * room for new ones.
+ *
+ * Replicas run every operation they get from the primary through the cache as
+ * well, so that a new primary knows about the operations the old one did.
+ */
+
+struct drc;
+struct mtran;
+
+STAILQ_HEAD(drc_waiters, mtran);
+
+enum drc_state {
+	/** We haven't seen this request before.  The caller should carry it
+	 * out and then call drc_finish. */
+	DRC_NEW = 0,
+	/** We have already carried out this request.  The answer is in
+	 * *result. */
+	DRC_DONE = 1,
+	/** Someone else is carrying out this request right now.  The
+	 * transactor has been added to the list of waiters, which they will
+	 * get back from drc_finish. */
+	DRC_IN_PROGRESS = 2,
+};
+
+/** Duplicate request cache statistics */
+struct drc_stats {
+	/** Number of clients we are remembering requests for */
+	uint32_t num_clients;
+	/** Number of requests we answered from the cache */
+	uint64_t replayed;
+	/** Number of requests that arrived while the original was still being
+	 * carried out */
+	uint64_t joined;
+	/** Number of requests that were too old for us to know what happened
+	 * to them */
+	uint64_t stale;
+	/** Number of clients we forgot about to make room for others */
+	uint64_t evicted;
+};
+
+/** Create a duplicate request cache
+ *
+ * @param max_clients	Maximum number of clients to remember
+ * @param max_per_client Number of requests to remember for each client
+ *
+ * @return		The cache, or an error pointer
+ */
+extern struct drc *drc_init(uint32_t max_clients, uint32_t max_per_client);
+
+/** Look up a request in the duplicate request cache
+ *
+ * Requests with a client ID of 0 are not tracked; drc_begin always returns
+ * DRC_NEW for them.
+ *
+ * If we have finished the request but no longer remember the result, or the
+ * request is so old that we can't tell, this returns DRC_DONE with a result of
+ * -ESTALE.  A request that arrives late, but that we have never seen, is new.
+ *
+ * @param drc		The cache
+ * @param clid		The client ID
+ * @param seq		The request's sequence number
+ * @param tr		The transactor that the request arrived on.  If we
+ *			return DRC_IN_PROGRESS, the cache owns this now.
+ * @param result	(out param) the result of the request, if we return
+ *			DRC_DONE
+ *
+ * @return		enum drc_state
+ */
+extern int drc_begin(struct drc *drc, uint64_t clid, uint64_t seq,
+		struct mtran *tr, int32_t *result);
+
+/** Record the result of a request
+ *
+ * This should be called once for every call to drc_begin that returned
+ * DRC_NEW.
+ *
+ * @param drc		The cache
+ * @param clid		The client ID
+ * @param seq		The request's sequence number
+ * @param result	The result of the request
+ * @param waiters	(out param) transactors for retransmissions of this
+ *			request which arrived while we were carrying it out.
+ *			The caller must send each of them the result.
+ */
+extern void drc_finish(struct drc *drc, uint64_t clid, uint64_t seq,
+		int32_t result, struct drc_waiters *waiters);
+
+/** Get duplicate request cache statistics
+ *
+ * @param drc		The cache
+ * @param stats		(out param) the statistics
+ */
+extern void drc_get_stats(struct drc *drc, struct drc_stats *stats);
+
+/** Free a duplicate request cache
+ *
+ * Any transactors still waiting for requests to finish are freed.
+ *
+ * @param drc		The cache
+ */
+extern void drc_free(struct drc *drc);
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mds/drc.h"
+#include "msg/msg.h"
+#include "util/error.h"
+#include "util/test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DRC_UNIT_MAX_CLIENTS 4
+#define DRC_UNIT_MAX_PER_CLIENT 8
+
+static int drc_num_waiters(const struct drc_waiters *waiters)
+{
+	int num = 0;
+	struct mtran *tr;
+
+	STAILQ_FOREACH(tr, waiters, u.pending_entry) {
+		++num;
+	}
+	return num;
+}
+
+static int test_drc_replay(void)
+{
+	struct drc *drc;
+	struct drc_waiters waiters;
+	struct drc_stats stats;
+	struct mtran tr1, tr2;
+	int32_t result;
+
+	drc = drc_init(DRC_UNIT_MAX_CLIENTS, DRC_UNIT_MAX_PER_CLIENT);
+	EXPECT_NOT_ERRPTR(drc);
+	memset(&tr1, 0, sizeof(tr1));
+	memset(&tr2, 0, sizeof(tr2));
+	EXPECT_EQ(drc_begin(drc, 123, 1, &tr1, &result), DRC_NEW);
+	/* Two retransmissions arrive while the original is in progress */
+	EXPECT_EQ(drc_begin(drc, 123, 1, &tr1, &result), DRC_IN_PROGRESS);
+	EXPECT_EQ(drc_begin(drc, 123, 1, &tr2, &result), DRC_IN_PROGRESS);
+	/* A different request from the same client is unaffected */
+	EXPECT_EQ(drc_begin(drc, 123, 2, &tr1, &result), DRC_NEW);
+	drc_finish(drc, 123, 1, -EEXIST, &waiters);
+	EXPECT_EQ(drc_num_waiters(&waiters), 2);
+	EXPECT_EQ(STAILQ_FIRST(&waiters), &tr1);
+	drc_finish(drc, 123, 2, 0, &waiters);
+	EXPECT_EQ(drc_num_waiters(&waiters), 0);
+	result = 0;
+	EXPECT_EQ(drc_begin(drc, 123, 1, &tr1, &result), DRC_DONE);
+	EXPECT_EQ(result, -EEXIST);
+	result = -1;
+	EXPECT_EQ(drc_begin(drc, 123, 2, &tr1, &result), DRC_DONE);
+	EXPECT_EQ(result, 0);
+	/* Client 0 is never tracked */
+	EXPECT_EQ(drc_begin(drc, 0, 1, &tr1, &result), DRC_NEW);
+	EXPECT_EQ(drc_begin(drc, 0, 1, &tr1, &result), DRC_NEW);
+	drc_get_stats(drc, &stats);
+	EXPECT_EQ(stats.num_clients, 1);
+	EXPECT_EQ(stats.replayed, 2);
+	EXPECT_EQ(stats.joined, 2);
+	drc_free(drc);
+	return 0;
+}
+
+static int test_drc_limits(void)
+{
+	struct drc *drc;
+	struct drc_waiters waiters;
+	struct drc_stats stats;
+	struct mtran tr;
+	int32_t result;
+	uint64_t seq, clid;
+
+	drc = drc_init(DRC_UNIT_MAX_CLIENTS, DRC_UNIT_MAX_PER_CLIENT);
+	EXPECT_NOT_ERRPTR(drc);
+	memset(&tr, 0, sizeof(tr));
+	for (seq = 1; seq <= DRC_UNIT_MAX_PER_CLIENT * 2; ++seq) {
+		EXPECT_EQ(drc_begin(drc, 1, seq, &tr, &result), DRC_NEW);
+		drc_finish(drc, 1, seq, (int32_t)seq, &waiters);
+	}
+	/* The most recent requests are remembered... */
+	for (seq = DRC_UNIT_MAX_PER_CLIENT + 1;
+			seq <= DRC_UNIT_MAX_PER_CLIENT * 2; ++seq) {
+		EXPECT_EQ(drc_begin(drc, 1, seq, &tr, &result), DRC_DONE);
+		EXPECT_EQ(result, (int32_t)seq);
+	}
+	/* ...and we admit that we have forgotten about the older ones */
+	EXPECT_EQ(drc_begin(drc, 1, 1, &tr, &result), DRC_DONE);
+	EXPECT_EQ(result, -ESTALE);
+
+	/* A client with a request in progress is never evicted */
+	EXPECT_EQ(drc_begin(drc, 2, 1, &tr, &result), DRC_NEW);
+	for (clid = 3; clid < 3 + DRC_UNIT_MAX_CLIENTS * 2; ++clid) {
+		EXPECT_EQ(drc_begin(drc, clid, 1, &tr, &result), DRC_NEW);
+		drc_finish(drc, clid, 1, 0, &waiters);
+	}
+	drc_get_stats(drc, &stats);
+	EXPECT_EQ(stats.num_clients, DRC_UNIT_MAX_CLIENTS);
+	EXPECT_GT(stats.evicted, 0);
+	EXPECT_EQ(drc_begin(drc, 2, 1, &tr, &result), DRC_IN_PROGRESS);
+	drc_finish(drc, 2, 1, 0, &waiters);
+	EXPECT_EQ(drc_num_waiters(&waiters), 1);
+	/* Client 1 has been forgotten, so its requests look new again */
+	EXPECT_EQ(drc_begin(drc, 1, 1, &tr, &result), DRC_NEW);
+	drc_free(drc);
+	return 0;
+}
+
+static int test_drc_out_of_order(void)
+{
+	struct drc *drc;
+	struct drc_waiters waiters;
+	struct mtran tr;
+	int32_t result;
+	uint64_t seq;
+
+	drc = drc_init(DRC_UNIT_MAX_CLIENTS, DRC_UNIT_MAX_PER_CLIENT);
+	EXPECT_NOT_ERRPTR(drc);
+	memset(&tr, 0, sizeof(tr));
+	/* Request 1 is held up, while many later requests from the same
+	 * client are done and forgotten */
+	for (seq = 2; seq <= DRC_UNIT_MAX_PER_CLIENT * 5; ++seq) {
+		EXPECT_EQ(drc_begin(drc, 1, seq, &tr, &result), DRC_NEW);
+		drc_finish(drc, 1, seq, 0, &waiters);
+	}
+	/* When it finally arrives, we carry it out */
+	EXPECT_EQ(drc_begin(drc, 1, 1, &tr, &result), DRC_NEW);
+	drc_finish(drc, 1, 1, -ENOENT, &waiters);
+	result = 0;
+	EXPECT_EQ(drc_begin(drc, 1, 1, &tr, &result), DRC_DONE);
+	EXPECT_EQ(result, -ENOENT);
+	/* But we won't do one of the forgotten ones again */
+	EXPECT_EQ(drc_begin(drc, 1, 3, &tr, &result), DRC_DONE);
+	EXPECT_EQ(result, -ESTALE);
+
+	/* Requests that are far older than anything we have forgotten are
+	 * too old to tell about */
+	for (seq = 100000; seq < 100000 + DRC_UNIT_MAX_PER_CLIENT * 2; ++seq) {
+		EXPECT_EQ(drc_begin(drc, 2, seq, &tr, &result), DRC_NEW);
+		drc_finish(drc, 2, seq, 0, &waiters);
+	}
+	EXPECT_EQ(drc_begin(drc, 2, 1, &tr, &result), DRC_DONE);
+	EXPECT_EQ(result, -ESTALE);
+	/* ...but nearby ones we never saw are still new */
+	EXPECT_EQ(drc_begin(drc, 2, 99990, &tr, &result), DRC_NEW);
+	drc_finish(drc, 2, 99990, 0, &waiters);
+	drc_free(drc);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ERRPTR(drc_init(0, DRC_UNIT_MAX_PER_CLIENT));
+	EXPECT_ZERO(test_drc_replay());
+	EXPECT_ZERO(test_drc_limits());
+	EXPECT_ZERO(test_drc_out_of_order());
+	return EXIT_SUCCESS;
+}
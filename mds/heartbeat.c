@@ -79,6 +79,9 @@ int mds_send_hb_thread(struct redfish_thread *rt)
 	if (IS_ERR(r)) {
 		abort();
 	}
+	/* If heartbeats get stuck behind other traffic, our peers will think
+	 * we're dead. */
+	msg_set_prio(r, MSG_PRIO_HIGH);
 
 	/* We want a pretty short timeout here.  If we fail to send a heartbeat
 	 * to an MDS, hopefully it will receive the next heartbeat that we send.
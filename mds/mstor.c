@@ -142,6 +142,9 @@ struct mstor {
 	uint64_t next_cid;
 	/** Protects next_cid */
 	pthread_mutex_t next_cid_lock;
+	/** Serializes changes to the OSDs that existing chunks are stored
+	 * on */
+	pthread_mutex_t chunk_osds_lock;
 	/** user data.  You cannot modify this without quiescing all threads
 	 * that modify the mstor. */
 	struct udata *udata;
@@ -199,6 +202,8 @@ static int mstor_range_lock_by_op(struct mstor *mstor, struct mreq *mreq)
 	case MSTOR_OP_CHUNKALLOC:
 	case MSTOR_OP_FIND_ZOMBIES:
 	case MSTOR_OP_DESTROY_ZOMBIE:
+	case MSTOR_OP_FIND_CHUNKS:
+	case MSTOR_OP_SET_CHUNK_OSDS:
 		strat = RL_STRAT_NO_LOCK;
 		break;
 	case MSTOR_OP_NODE_SEARCH:
@@ -338,6 +343,10 @@ const char *mstor_op_ty_to_str(enum mstor_op_ty op)
 		return "MSTOR_OP_RENAME";
 	case MSTOR_OP_NODE_SEARCH:
 		return "MSTOR_OP_NODE_SEARCH";
+	case MSTOR_OP_FIND_CHUNKS:
+		return "MSTOR_OP_FIND_CHUNKS";
+	case MSTOR_OP_SET_CHUNK_OSDS:
+		return "MSTOR_OP_SET_CHUNK_OSDS";
 	default:
 		break;
 	}
@@ -770,9 +779,12 @@ struct mstor* mstor_init(POSSIBLY_UNUSED(struct fast_log_mgr *mgr),
 	ret = pthread_mutex_init(&mstor->next_cid_lock, NULL);
 	if (ret)
 		goto error_srange_tracker_free;
-	ret = mstor_leveldb_init(mstor, conf);
+	ret = pthread_mutex_init(&mstor->chunk_osds_lock, NULL);
 	if (ret)
 		goto error_destroy_next_cid_lock;
+	ret = mstor_leveldb_init(mstor, conf);
+	if (ret)
+		goto error_destroy_chunk_osds_lock;
 	ret = mstor_leveldb_is_empty(mstor);
 	if (ret < 0)
 		goto error_leveldb_shutdown;
@@ -790,6 +802,8 @@ struct mstor* mstor_init(POSSIBLY_UNUSED(struct fast_log_mgr *mgr),
 
 error_leveldb_shutdown:
 	mstor_leveldb_shutdown(mstor);
+error_destroy_chunk_osds_lock:
+	pthread_mutex_destroy(&mstor->chunk_osds_lock);
 error_destroy_next_cid_lock:
 	pthread_mutex_destroy(&mstor->next_cid_lock);
 error_srange_tracker_free:
@@ -817,6 +831,7 @@ void mstor_shutdown(struct mstor *mstor)
 	mstor_leveldb_shutdown(mstor);
 	pthread_mutex_destroy(&mstor->next_nid_lock);
 	pthread_mutex_destroy(&mstor->next_cid_lock);
+	pthread_mutex_destroy(&mstor->chunk_osds_lock);
 	srange_tracker_free(mstor->tk);
 	free(mstor);
 }
@@ -2065,6 +2080,108 @@ done:
 	return ret;
 }
 
+static int mstor_do_find_chunks(struct mstor *mstor, struct mreq *mreq)
+{
+	int ret, num_res;
+	leveldb_iterator_t *iter = NULL;
+	const char *k, *v;
+	char hkey[MCHUNK_KEY_LEN];
+	size_t klen, vlen;
+	struct mreq_find_chunks *req;
+	struct chunk_oids *res;
+
+	req = (struct mreq_find_chunks*)mreq;
+	iter = leveldb_create_iterator(mstor->ldb, mstor->lreadopt);
+	if (!iter) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	hkey[0] = 'h';
+	pack_to_be64(hkey + 1, req->start);
+	leveldb_iter_seek(iter, hkey, MCHUNK_KEY_LEN);
+	num_res = 0;
+	while (num_res < req->max_res) {
+		if (!leveldb_iter_valid(iter))
+			break;
+		k = leveldb_iter_key(iter, &klen);
+		if ((klen < 1) || (k[0] != 'h'))
+			break;
+		v = leveldb_iter_value(iter, &vlen);
+		if ((klen != MCHUNK_KEY_LEN) ||
+				(vlen > sizeof(uint32_t) * RF_MAX_OID) ||
+				(vlen % sizeof(uint32_t))) {
+			glitch_log("mstor_do_find_chunks: invalid chunk "
+				"entry with key length %Zd and value length "
+				"%Zd\n", klen, vlen);
+			ret = -EIO;
+			goto done;
+		}
+		res = &req->res[num_res];
+		res->cid = unpack_from_be64(k + 1);
+		memcpy(res->oid, v, vlen);
+		res->num_oid = vlen / sizeof(uint32_t);
+		++num_res;
+		leveldb_iter_next(iter);
+	}
+	req->num_res = num_res;
+	ret = 0;
+done:
+	if (iter)
+		leveldb_iter_destroy(iter);
+	return ret;
+}
+
+static int mstor_do_set_chunk_osds(struct mstor *mstor, struct mreq *mreq)
+{
+	int ret;
+	char hkey[MCHUNK_KEY_LEN], *val = NULL, *err = NULL;
+	size_t vlen;
+	struct mreq_set_chunk_osds *req;
+
+	req = (struct mreq_set_chunk_osds*)mreq;
+	if ((req->num_old_oid < 0) || (req->num_old_oid > RF_MAX_OID) ||
+			(req->num_new_oid < 0) ||
+			(req->num_new_oid > RF_MAX_OID))
+		return -EINVAL;
+	hkey[0] = 'h';
+	pack_to_be64(hkey + 1, req->cid);
+	/* The check and the update have to happen together, or else two
+	 * changes to the same chunk could both succeed. */
+	pthread_mutex_lock(&mstor->chunk_osds_lock);
+	val = leveldb_get(mstor->ldb, mstor->lreadopt, hkey, MCHUNK_KEY_LEN,
+		&vlen, &err);
+	if (err) {
+		glitch_log("mstor_do_set_chunk_osds(0x%"PRIx64"): leveldb_get "
+			"returned error '%s'\n", req->cid, err);
+		ret = -EIO;
+		goto done;
+	}
+	if (!val) {
+		ret = -ENOENT;
+		goto done;
+	}
+	if ((vlen != sizeof(uint32_t) * req->num_old_oid) ||
+			memcmp(val, req->old_oid, vlen)) {
+		ret = -ESTALE;
+		goto done;
+	}
+	leveldb_put(mstor->ldb, mstor->lwropt, hkey, MCHUNK_KEY_LEN,
+		(const char*)req->new_oid,
+		sizeof(uint32_t) * req->num_new_oid, &err);
+	if (err) {
+		glitch_log("mstor_do_set_chunk_osds(0x%"PRIx64"): leveldb_put "
+			"returned error '%s'\n", req->cid, err);
+		ret = -EIO;
+		goto done;
+	}
+	ret = 0;
+done:
+	pthread_mutex_unlock(&mstor->chunk_osds_lock);
+	free(val);
+	free(err);
+	return ret;
+}
+
 static int mstor_do_path_operation(struct mstor *mstor, struct mreq *mreq,
 			    struct mnode *pnode, struct mnode *cnode)
 {
@@ -2379,6 +2496,12 @@ int mstor_do_operation(struct mstor *mstor, struct mreq *mreq)
 	case MSTOR_OP_DESTROY_ZOMBIE:
 		ret = mstor_do_destroy_zombie(mstor, mreq);
 		break;
+	case MSTOR_OP_FIND_CHUNKS:
+		ret = mstor_do_find_chunks(mstor, mreq);
+		break;
+	case MSTOR_OP_SET_CHUNK_OSDS:
+		ret = mstor_do_set_chunk_osds(mstor, mreq);
+		break;
 	case MSTOR_OP_NID_STAT:
 		ret = mstor_do_nid_stat(mstor, mreq);
 		break;
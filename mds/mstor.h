@@ -97,6 +97,12 @@ enum mstor_op_ty {
 	/** Operation that renames a directory or file
 	 * Locking: uses range locker */
 	MSTOR_OP_RENAME,
+	/** Operation that lists chunks and the OSDs they are stored on
+	 * Locking: external */
+	MSTOR_OP_FIND_CHUNKS,
+	/** Operation that changes the OSDs a chunk is stored on
+	 * Locking: not required */
+	MSTOR_OP_SET_CHUNK_OSDS,
 	/** For mstor internal use only */
 	MSTOR_OP_NODE_SEARCH,
 };
@@ -290,6 +296,43 @@ struct mreq_destroy_zombie {
 	struct zombie_info zinfo;
 };
 
+struct chunk_oids {
+	/** chunk ID */
+	uint64_t cid;
+	/** OSDs which hold the chunk */
+	uint32_t oid[RF_MAX_OID];
+	/** length of oid array */
+	int num_oid;
+};
+
+struct mreq_find_chunks {
+	struct mreq base;
+	/** The lowest chunk ID to find */
+	uint64_t start;
+	/** Size of result buffer */
+	int max_res;
+	/** (out param) number of results found */
+	int num_res;
+	/** (out param) an array of size max_res where we'll store chunk
+	 * information, in order of chunk ID. */
+	struct chunk_oids *res;
+};
+
+struct mreq_set_chunk_osds {
+	struct mreq base;
+	/** The chunk to change */
+	uint64_t cid;
+	/** The OSDs which we expect the chunk to be stored on now.  If it
+	 * is stored on different OSDs, the operation fails with -ESTALE. */
+	uint32_t old_oid[RF_MAX_OID];
+	/** length of old_oid array */
+	int num_old_oid;
+	/** The OSDs which the chunk is stored on from now on */
+	uint32_t new_oid[RF_MAX_OID];
+	/** length of new_oid array */
+	int num_new_oid;
+};
+
 struct mreq_rename {
 	struct mreq base;
 	/** destination path */
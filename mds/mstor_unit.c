@@ -60,6 +60,7 @@
 #define MSTORU_MAX_NID 32
 #define MSTORU_MAX_CINFOS 64
 #define MSTORU_MAX_ZINFOS 64
+#define MSTORU_MAX_CHUNKS 64
 
 static pthread_key_t g_tls_key;
 
@@ -374,6 +375,43 @@ static int mstoru_do_destroy_zombie(struct mstor *mstor,
 	return mstor_do_operation(mstor, (struct mreq*)&mreq);
 }
 
+static int mstoru_do_find_chunks(struct mstor *mstor, uint64_t start,
+		int max_res, struct chunk_oids *res)
+{
+	int ret;
+	struct mreq_find_chunks mreq;
+	struct mstoru_tls *tls = mstoru_tls_get();
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.base.lk = tls->lk;
+	mreq.base.op = MSTOR_OP_FIND_CHUNKS;
+	mreq.start = start;
+	mreq.max_res = max_res;
+	mreq.res = res;
+	ret = mstor_do_operation(mstor, (struct mreq*)&mreq);
+	if (ret < 0)
+		return ret;
+	return mreq.num_res;
+}
+
+static int mstoru_do_set_chunk_osds(struct mstor *mstor, uint64_t cid,
+		const struct chunk_oids *old, const uint32_t *new_oid,
+		int num_new_oid)
+{
+	struct mreq_set_chunk_osds mreq;
+	struct mstoru_tls *tls = mstoru_tls_get();
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.base.lk = tls->lk;
+	mreq.base.op = MSTOR_OP_SET_CHUNK_OSDS;
+	mreq.cid = cid;
+	memcpy(mreq.old_oid, old->oid, sizeof(uint32_t) * old->num_oid);
+	mreq.num_old_oid = old->num_oid;
+	memcpy(mreq.new_oid, new_oid, sizeof(uint32_t) * num_new_oid);
+	mreq.num_new_oid = num_new_oid;
+	return mstor_do_operation(mstor, (struct mreq*)&mreq);
+}
+
 static int mstoru_do_chunkfind(struct mstor *mstor, const char *full_path,
 		uint64_t start, uint64_t end, const char *user_name,
 		int max_cinfos, struct chunk_info *cinfos)
@@ -607,6 +645,8 @@ static int mstoru_test1(const char *tdir)
 	struct chunk_info cinfos2[MSTORU_MAX_CINFOS];
 	struct zombie_info lower_bound;
 	struct zombie_info zinfos[MSTORU_MAX_ZINFOS];
+	struct chunk_oids chunks[MSTORU_MAX_CHUNKS];
+	const uint32_t new_oid[] = { 456, 789, 1011 };
 	uint64_t csize = 134217728ULL;
 	struct mstoru_atime_and_mtime times;
 
@@ -710,6 +750,26 @@ static int mstoru_test1(const char *tdir)
 		MSTORU_WOOT_USER, &nid));
 	EXPECT_ZERO(mstoru_do_chunkalloc(mstor, nid, 0, &cinfos1[3]));
 
+	/* test changing the OSDs that chunks are stored on */
+	EXPECT_EQ(mstoru_do_find_chunks(mstor, 0, MSTORU_MAX_CHUNKS,
+			chunks), 4);
+	EXPECT_EQ(chunks[0].cid, cinfos1[0].cid);
+	EXPECT_EQ(chunks[3].cid, cinfos1[3].cid);
+	EXPECT_EQ(chunks[1].num_oid, 2);
+	EXPECT_ZERO(mstoru_do_set_chunk_osds(mstor, chunks[1].cid,
+			&chunks[1], new_oid, 3));
+	EXPECT_EQ(mstoru_do_set_chunk_osds(mstor, chunks[1].cid,
+			&chunks[1], new_oid, 3), -ESTALE);
+	EXPECT_EQ(mstoru_do_set_chunk_osds(mstor, cinfos1[3].cid + 1,
+			&chunks[1], new_oid, 3), -ENOENT);
+	EXPECT_EQ(mstoru_do_find_chunks(mstor, cinfos1[1].cid, 1,
+			chunks), 1);
+	EXPECT_EQ(chunks[0].cid, cinfos1[1].cid);
+	EXPECT_EQ(chunks[0].num_oid, 3);
+	EXPECT_EQ(chunks[0].oid[2], 1011);
+	EXPECT_EQ(mstoru_do_find_chunks(mstor, cinfos1[3].cid + 1,
+			MSTORU_MAX_CHUNKS, chunks), 0);
+
 	/* test rename */
 	EXPECT_EQ(mstoru_do_rename(mstor, "/b/c/d/foo", "/b/c/d/bar",
 		MSTORU_WOOT_USER), -EEXIST);
@@ -22,12 +22,17 @@
 #include "jorm/jorm_const.h"
 #include "mds/const.h"
 #include "mds/delegation.h"
+#include "mds/drc.h"
 #include "mds/heartbeat.h"
 #include "mds/mstor.h"
 #include "mds/net.h"
+#include "mds/osd_load.h"
+#include "mds/repl.h"
 #include "mds/srange_lock.h"
 #include "mds/user.h"
+#include "msg/asend.h"
 #include "msg/bsend.h"
+#include "msg/cenc.h"
 #include "msg/msg.h"
 #include "msg/msgr.h"
 #include "msg/recv_pool.h"
@@ -44,6 +49,7 @@
 #include "util/time.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -55,11 +61,25 @@
 
 #define MDS_NET_REPLICA_TIMEO 60
 
+/** Maximum number of clients to remember recent requests for */
+#define MDS_NET_DRC_MAX_CLIENTS 16384
+
+/** Number of recent requests to remember for each client */
+#define MDS_NET_DRC_PER_CLIENT 32
+
 /****************************** types ********************************/
 struct mnrp_tls {
 	struct srange_locker lk;
 };
 
+/** An operation which the replicas are carrying out on our behalf */
+struct mds_net_op {
+	/** Transactor to send the reply on */
+	struct mtran *tr;
+	/** Request ID of the operation */
+	struct rf_req_id rid;
+};
+
 /****************************** globals ********************************/
 /** recv_pool */
 struct recv_pool *g_rpool[RF_ENTITY_TY_NUM];
@@ -70,6 +90,9 @@ struct mnrp_tls g_mnrp_tls[RF_ENTITY_TY_NUM];
 /** Thread that sends heartbeats */
 struct redfish_thread g_mds_send_hb_thread;
 
+/** Thread that re-replicates chunks */
+struct redfish_thread g_mds_repl_thread;
+
 /** The metadata store */
 struct mstor *g_mstor;
 
@@ -82,12 +105,18 @@ uint16_t g_mid;
 /** The primary metadata server ID */
 uint16_t g_pri_mid;
 
+/** Duplicate request cache */
+struct drc *g_drc;
+
 /** Current cluster map */
 struct cmap *g_cmap;
 
 /** Lock that protects the cluster map */
 pthread_mutex_t g_cmap_lock;
 
+/** The load of each OSD, from its heartbeats */
+struct osd_load_tbl *g_osd_load;
+
 /** MDS messengers */
 struct msgr *g_msgr[RF_ENTITY_TY_NUM];
 
@@ -97,56 +126,184 @@ static void fail_replica_mds(POSSIBLY_UNUSED(int mid))
 	// TODO: implement
 }
 
-static void handle_primary_role(struct recv_pool_thread *rt, struct msg *m,
-		int op_ret)
+/** Get the request ID of an operation which modifies the metadata.
+ *
+ * Every such request starts with a struct rf_req_id.  If we can't decode it,
+ * we return a client ID of 0, which the duplicate request cache ignores.
+ */
+static void mds_net_get_rid(const struct msg *m, struct rf_req_id *rid)
 {
-	struct daemon_info *di;
+	if (MSG_XDR_DECODE(rf_req_id, m, rid) < 0)
+		memset(rid, 0, sizeof(struct rf_req_id));
+}
+
+/** Check whether a request which modifies the metadata is a retransmission of
+ * one which we have already seen.
+ *
+ * @param tr		The transactor the request arrived on
+ * @param m		The request
+ *
+ * @return		0 if the request should be carried out; 1 if it has
+ *			been taken care of, in which case tr is no longer ours
+ */
+static int mds_net_drc_begin(struct mtran *tr, const struct msg *m)
+{
+	struct rf_req_id rid;
+	int32_t result;
+
+	mds_net_get_rid(m, &rid);
+	switch (drc_begin(g_drc, rid.clid, rid.seq, tr, &result)) {
+	case DRC_DONE:
+		asend_std_reply(tr, result);
+		return 1;
+	case DRC_IN_PROGRESS:
+		/* The reply will go out when the original finishes. */
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/** Record the result of an operation in the duplicate request cache, and send
+ * it to the client.  Any retransmissions of the request which arrived in the
+ * meantime get the same answer.
+ *
+ * @param tr		The transactor to reply on, or NULL to reply only to
+ *			the retransmissions
+ * @param rid		The request ID of the operation
+ * @param result	The result of the operation
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int mds_net_drc_finish(struct mtran *tr, const struct rf_req_id *rid,
+		int32_t result)
+{
+	struct drc_waiters waiters;
+	struct mtran *wtr;
+
+	drc_finish(g_drc, rid->clid, rid->seq, result, &waiters);
+	while (1) {
+		wtr = STAILQ_FIRST(&waiters);
+		if (!wtr)
+			break;
+		STAILQ_REMOVE_HEAD(&waiters, u.pending_entry);
+		asend_std_reply(wtr, result);
+	}
+	if (!tr)
+		return 0;
+	return asend_std_reply(tr, result);
+}
+
+/** Runs once all of the replicas have answered (or failed to answer) an
+ * operation which we forwarded to them.  Now we can reply to the client. */
+static int handle_primary_role_done(
+		POSSIBLY_UNUSED(struct recv_pool_thread *rt), struct asend *as)
+{
+	struct mds_net_op *op;
 	struct mtran *tr;
-	int i;
+	int i, mid, ret;
 
+	op = asend_get_priv(as);
+	if (asend_get_err(as)) {
+		/* We're shutting down.  Nobody is going to hear the reply. */
+		asend_free(as);
+		mtran_free(op->tr);
+		free(op);
+		return 0;
+	}
+	for (i = 0; i < asend_get_num_sent(as); ++i) {
+		tr = asend_get_mtran(as, i);
+		if ((tr->m == NULL) || (IS_ERR(tr->m))) {
+			mid = (int)(uintptr_t)asend_get_mtran_tag(as, i);
+			glitch_log("fail_replica_mds(%d)\n", mid);
+			fail_replica_mds(mid);
+		}
+		// TOOD: ... check resp ...
+	}
+	asend_free(as);
+	ret = mds_net_drc_finish(op->tr, &op->rid, 0);
+	free(op);
+	return ret;
+}
+
+static int handle_primary_role(struct recv_pool_thread *rt, struct mtran *tr,
+		struct msg *m, int op_ret)
+{
+	struct daemon_info *di;
+	struct mds_net_op *op;
+	struct rf_req_id rid;
+	struct asend *as;
+	struct msg *rm;
+	int i, ret;
+
+	mds_net_get_rid(m, &rid);
 	if (op_ret) {
 		/* If the operation failed, we don't have to tell the replicas
 		 * to do it.  */
-		return;
+		return mds_net_drc_finish(tr, &rid, op_ret);
 	}
+	op = calloc(1, sizeof(struct mds_net_op));
+	if (!op)
+		return mds_net_drc_finish(tr, &rid, -ENOMEM);
+	op->tr = tr;
+	op->rid = rid;
 
 	/* Since we're the primary, we tell the replicas to perform the
-	 * same operation */ 
-	msg_addref(m);
+	 * same operation.  We don't wait for them here; the reply to the
+	 * client goes out from handle_primary_role_done once they have all
+	 * answered.  Meanwhile, this thread can get on with other requests. */
 	pthread_mutex_lock(&g_cmap_lock);
+	as = asend_init(rt->rpool, g_cmap->num_mds, op);
+	if (IS_ERR(as)) {
+		pthread_mutex_unlock(&g_cmap_lock);
+		free(op);
+		return mds_net_drc_finish(tr, &rid, -PTR_ERR(as));
+	}
 	for (i = 0; i < g_cmap->num_mds; ++i) {
 		if (i == g_mid)
 			continue;
 		di = &g_cmap->minfo[i];
 		if (!di->in)
 			continue;
-		bsend_add(rt->ctx, g_msgr[RF_ENTITY_TY_MDS], BSF_RESP,
-			m, di->ip, di->port[RF_ENTITY_TY_MDS],
+		/* Each replica gets its own copy of the message, since the
+		 * original goes away as soon as we return. */
+		rm = msg_dup(m);
+		if (!rm) {
+			glitch_log("fail_replica_mds(%d): out of memory\n", i);
+			fail_replica_mds(i);
+			continue;
+		}
+		pack_to_8(&rm->flags, unpack_from_8(&rm->flags) |
+			MSG_FLAG_MUSTDO);
+		ret = asend_add(as, g_msgr[RF_ENTITY_TY_MDS], BSF_RESP,
+			rm, di->ip, di->port[RF_ENTITY_TY_MDS],
 			MDS_NET_REPLICA_TIMEO, (void*)(uintptr_t)i);
-	}
-	bsend_join(rt->ctx);
-	for (i = 0; i < bsend_get_num_sent(rt->ctx); ++i) {
-		tr = bsend_get_mtran(rt->ctx, i);
-		if ((tr->m == NULL) || (IS_ERR(tr->m))) {
-			int mid = (int)(uintptr_t)bsend_get_mtran_tag(rt->ctx, i);
-			glitch_log("fail_replica_mds(%d)\n", mid);
-			fail_replica_mds(mid);
+		if (ret) {
+			msg_release(rm);
+			glitch_log("fail_replica_mds(%d): error %d\n", i, ret);
+			fail_replica_mds(i);
 		}
-		// TOOD: ... check resp ...
 	}
-	bsend_reset(rt->ctx);
 	pthread_mutex_unlock(&g_cmap_lock);
+	asend_join(as, handle_primary_role_done);
+	return 0;
 }
 
-static void handle_replica_role(struct recv_pool_thread *rt, struct mtran *tr,
+static int handle_replica_role(struct recv_pool_thread *rt, struct mtran *tr,
 		struct msg *m, int op_ret)
 {
 	char *buf;
+	struct rf_req_id rid;
 
-	if (op_ret == 0)
-		return;
+	if (op_ret == 0) {
+		/* Remember the result, in case we become the primary and the
+		 * client asks again. */
+		mds_net_get_rid(m, &rid);
+		return mds_net_drc_finish(tr, &rid, 0);
+	}
 	/* Replicas can't fail to perform an operation, or else
-	 * they get out of sync with the primary. */
+	 * they get out of sync with the primary.  Wait for the reply to go out
+	 * before we abort. */
 	bsend_std_reply(rt->base.fb, rt->ctx, tr, op_ret);
 	buf = malloc(MDS_NET_MSG_DUMP_SZ);
 	if (buf)
@@ -158,14 +315,20 @@ static void handle_replica_role(struct recv_pool_thread *rt, struct mtran *tr,
 	abort();
 }
 
-static void handle_mds_role(struct recv_pool_thread *rt, struct mtran *tr,
+/** Finish up an operation which modifies the metadata, and send the reply.
+ *
+ * The reply may be sent later, from another thread, after the replicas have
+ * been told about the operation.  Either way, the transactor is no longer ours
+ * after this returns.
+ */
+static int handle_mds_role(struct recv_pool_thread *rt, struct mtran *tr,
 	struct msg *m, int op_ret)
 {
 	if (g_mid == g_pri_mid) {
-		handle_primary_role(rt, m, op_ret);
+		return handle_primary_role(rt, tr, m, op_ret);
 	}
 	else {
-		handle_replica_role(rt, tr, m, op_ret);
+		return handle_replica_role(rt, tr, m, op_ret);
 	}
 }
 
@@ -237,9 +400,7 @@ static int handle_mmm_mkdirs_req(struct recv_pool_thread *rt,
 	mreq.mode = req.mode;
 	mreq.ctime = req.ctime;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	handle_mds_role(rt, tr, m, ret);
-	ret = 0;
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	ret = handle_mds_role(rt, tr, m, ret);
 	XDR_REQ_FREE(mmm_mkdirs_req, &req);
 	return ret;
 }
@@ -296,39 +457,74 @@ done:
 	return ret;
 }
 
+/** Send the result of a stat operation, in the same encoding that the request
+ * used. */
+static int send_stat_resp(struct recv_pool_thread *rt, struct mtran *tr,
+		const struct msg *m, struct rf_stat *stat)
+{
+	struct cenc_mmm_stat_resp cresp;
+	struct mmm_stat_resp resp;
+	struct msg *r;
+
+	if (cenc_is_compact(m)) {
+		cresp.mtime = stat->mtime;
+		cresp.atime = stat->atime;
+		cresp.length = stat->length;
+		cresp.nid = stat->nid;
+		cresp.block_sz = stat->block_sz;
+		cresp.mode_and_type = stat->mode_and_type;
+		cresp.man_repl = stat->man_repl;
+		cresp.user = stat->user;
+		cresp.group = stat->group;
+		r = CENC_ALLOC_mmm_stat_resp(&cresp, 0, NULL);
+	}
+	else {
+		resp.stat = *stat;
+		r = MSG_XDR_ALLOC(mmm_stat_resp, &resp);
+	}
+	if (IS_ERR(r))
+		return PTR_ERR(r);
+	return bsend_reply(rt->base.fb, rt->ctx, tr, r);
+}
+
 static int handle_mmm_path_stat_req(struct recv_pool_thread *rt,
 		struct mtran *tr, struct msg *m)
 {
 	int ret;
-	struct mmm_path_stat_req req;
-	struct mmm_stat_resp resp;
+	struct mmm_path_stat_req xreq;
+	struct cenc_mmm_path_stat_req req;
+	struct rf_stat stat;
 	struct mreq_stat mreq;
 	struct mnrp_tls *tls = rt->base.priv;
-	struct msg *r;
 
-	ret = MSG_XDR_DECODE(mmm_path_stat_req, m, &req);
-	if (ret)
-		goto done;
+	if (cenc_is_compact(m)) {
+		ret = CENC_DECODE_mmm_path_stat_req(m, &req, NULL);
+		if (ret < 0)
+			goto done;
+	}
+	else {
+		ret = MSG_XDR_DECODE(mmm_path_stat_req, m, &xreq);
+		if (ret)
+			goto done;
+		req.path = xreq.path;
+		req.user = xreq.user;
+	}
+	memset(&stat, 0, sizeof(stat));
 	memset(&mreq, 0, sizeof(mreq));
 	mreq.base.lk = &tls->lk;
 	mreq.base.op = MSTOR_OP_STAT;
 	mreq.base.full_path = req.path;
 	mreq.base.user_name = req.user;
-	mreq.stat = &resp.stat;
+	mreq.stat = &stat;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret < 0) {
+	if (ret < 0)
 		ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
-		goto done_free_req;
-	}
-	memset(&resp, 0, sizeof(resp));
-	r = MSG_XDR_ALLOC(mmm_stat_resp, &resp);
-	if (IS_ERR(r)) {
-		ret = PTR_ERR(r);
-		goto done_free_req;
-	}
-	ret = bsend_reply(rt->base.fb, rt->ctx, tr, r);
-done_free_req:
-	XDR_REQ_FREE(mmm_path_stat_req, &req);
+	else
+		ret = send_stat_resp(rt, tr, m, &stat);
+	free(stat.user);
+	free(stat.group);
+	if (!cenc_is_compact(m))
+		XDR_REQ_FREE(mmm_path_stat_req, &xreq);
 done:
 	return ret;
 }
@@ -337,34 +533,38 @@ static int handle_mmm_nid_stat_req(struct recv_pool_thread *rt,
 		struct mtran *tr, struct msg *m)
 {
 	int ret;
-	struct mmm_nid_stat_req req;
-	struct mmm_stat_resp resp;
+	struct mmm_nid_stat_req xreq;
+	struct cenc_mmm_nid_stat_req req;
+	struct rf_stat stat;
 	struct mreq_nid_stat mreq;
 	struct mnrp_tls *tls = rt->base.priv;
-	struct msg *r;
 
-	ret = MSG_XDR_DECODE(mmm_nid_stat_req, m, &req);
-	if (ret)
-		goto done;
+	if (cenc_is_compact(m)) {
+		ret = CENC_DECODE_mmm_nid_stat_req(m, &req, NULL);
+		if (ret < 0)
+			goto done;
+	}
+	else {
+		ret = MSG_XDR_DECODE(mmm_nid_stat_req, m, &xreq);
+		if (ret)
+			goto done;
+		req.nid = xreq.nid;
+	}
+	memset(&stat, 0, sizeof(stat));
 	memset(&mreq, 0, sizeof(mreq));
 	mreq.base.lk = &tls->lk;
 	mreq.base.op = MSTOR_OP_STAT;
 	mreq.nid = req.nid;
-	mreq.stat = &resp.stat;
+	mreq.stat = &stat;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret < 0) {
+	if (ret < 0)
 		ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
-		goto done_free_req;
-	}
-	memset(&resp, 0, sizeof(resp));
-	r = MSG_XDR_ALLOC(mmm_stat_resp, &resp);
-	if (IS_ERR(r)) {
-		ret = PTR_ERR(r);
-		goto done_free_req;
-	}
-	ret = bsend_reply(rt->base.fb, rt->ctx, tr, r);
-done_free_req:
-	XDR_REQ_FREE(mmm_nid_stat_req, &req);
+	else
+		ret = send_stat_resp(rt, tr, m, &stat);
+	free(stat.user);
+	free(stat.group);
+	if (!cenc_is_compact(m))
+		XDR_REQ_FREE(mmm_nid_stat_req, &xreq);
 done:
 	return ret;
 }
@@ -387,12 +587,7 @@ static int handle_mmm_chmod_req(struct recv_pool_thread *rt,
 	mreq.base.user_name = req.user;
 	mreq.mode = req.mode;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret)
-		goto done_send_reply;
-	handle_mds_role(rt, tr, m, ret);
-	ret = 0;
-done_send_reply:
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	ret = handle_mds_role(rt, tr, m, ret);
 	XDR_REQ_FREE(mmm_mkdirs_req, &req);
 done:
 	return ret;
@@ -417,12 +612,7 @@ static int handle_mmm_chown_req(struct recv_pool_thread *rt,
 	mreq.new_user = req.new_user;
 	mreq.new_group = req.new_group;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret)
-		goto done_send_reply;
-	handle_mds_role(rt, tr, m, ret);
-	ret = 0;
-done_send_reply:
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	ret = handle_mds_role(rt, tr, m, ret);
 	XDR_REQ_FREE(mmm_chown_req, &req);
 done:
 	return ret;
@@ -447,12 +637,7 @@ static int handle_mmm_utimes_req(struct recv_pool_thread *rt,
 	mreq.new_atime = req.new_atime;
 	mreq.new_mtime = req.new_mtime;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret)
-		goto done_send_reply;
-	handle_mds_role(rt, tr, m, ret);
-	ret = 0;
-done_send_reply:
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	ret = handle_mds_role(rt, tr, m, ret);
 	XDR_REQ_FREE(mmm_utimes_req, &req);
 done:
 	return ret;
@@ -476,12 +661,7 @@ static int handle_mmm_unlink_req(struct recv_pool_thread *rt,
 	mreq.base.user_name = req.user;
 	mreq.uop = req.uop;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret)
-		goto done_send_reply;
-	handle_mds_role(rt, tr, m, ret);
-	ret = 0;
-done_send_reply:
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	ret = handle_mds_role(rt, tr, m, ret);
 	XDR_REQ_FREE(mmm_unlink_req, &req);
 done:
 	return ret;
@@ -505,31 +685,114 @@ static int handle_mmm_rename_req(struct recv_pool_thread *rt,
 	mreq.base.user_name = req.user;
 	mreq.dst_path = req.dst;
 	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
-	if (ret)
-		goto done_send_reply;
-	handle_mds_role(rt, tr, m, ret);
-	ret = 0;
-done_send_reply:
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	ret = handle_mds_role(rt, tr, m, ret);
 	XDR_REQ_FREE(mmm_rename_req, &req);
 done:
 	return ret;
 }
 
-static int mds_net_handle_tr(struct recv_pool_thread *rt, struct mtran *tr)
+static int handle_mmm_chunk_osds_req(struct recv_pool_thread *rt,
+		struct mtran *tr, struct msg *m)
+{
+	int ret;
+	struct mmm_chunk_osds_req req;
+	struct mreq_set_chunk_osds mreq;
+	struct mnrp_tls *tls = rt->base.priv;
+
+	ret = MSG_XDR_DECODE(mmm_chunk_osds_req, m, &req);
+	if (ret)
+		goto done;
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.base.lk = &tls->lk;
+	mreq.base.op = MSTOR_OP_SET_CHUNK_OSDS;
+	mreq.cid = req.cid;
+	memcpy(mreq.old_oid, req.old_oid.old_oid_val,
+		sizeof(uint32_t) * req.old_oid.old_oid_len);
+	mreq.num_old_oid = req.old_oid.old_oid_len;
+	memcpy(mreq.new_oid, req.new_oid.new_oid_val,
+		sizeof(uint32_t) * req.new_oid.new_oid_len);
+	mreq.num_new_oid = req.new_oid.new_oid_len;
+	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
+	ret = handle_mds_role(rt, tr, m, ret);
+	XDR_REQ_FREE(mmm_chunk_osds_req, &req);
+done:
+	return ret;
+}
+
+static int handle_mmm_osd_bad_chunk(struct recv_pool_thread *rt,
+		struct mtran *tr, struct msg *m)
 {
 	int ret;
+	struct mmm_osd_bad_chunk req;
+
+	ret = MSG_XDR_DECODE(mmm_osd_bad_chunk, m, &req);
+	if (ret)
+		return ret;
+	glitch_log("handle_mmm_osd_bad_chunk: OSD %d reports that its copy "
+		"of chunk 0x%"PRIx64" is corrupt\n", req.oid, req.cid);
+	ret = mds_repl_report_bad(req.cid, req.oid);
+	XDR_REQ_FREE(mmm_osd_bad_chunk, &req);
+	return bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+}
+
+static int handle_mmm_osd_heartbeat(struct mtran *tr, struct msg *m)
+{
+	int ret;
+	struct mmm_osd_heartbeat hb;
+	struct osd_load load;
+
+	/* Heartbeats don't get a reply */
+	mtran_free(tr);
+	ret = MSG_XDR_DECODE(mmm_osd_heartbeat, m, &hb);
+	if (ret)
+		return ret;
+	load.last_hb = mt_time();
+	load.free_bytes = hb.free_bytes;
+	load.used_bytes = hb.used_bytes;
+	load.num_chunks = hb.num_chunks;
+	load.queue_depth = hb.queue_depth;
+	load.read_p50_us = hb.read_p50_us;
+	load.read_p99_us = hb.read_p99_us;
+	load.write_p50_us = hb.write_p50_us;
+	load.write_p99_us = hb.write_p99_us;
+	ret = osd_load_tbl_update(g_osd_load, hb.oid, &load);
+	XDR_REQ_FREE(mmm_osd_heartbeat, &hb);
+	return ret;
+}
+
+static int mds_net_handle_tr(struct recv_pool_thread *rt, struct mtran *tr)
+{
+	int ret, tracked = 0;
 	uint16_t ty;
 	struct msg *m;
+	struct rf_req_id rid;
 	char ep_buf[128];
 
 	m = tr->m;
 	tr->m = NULL;
-	ty = unpack_from_be16(&tr->m->ty);
+	ty = unpack_from_be16(&m->ty);
 	mtran_ep_to_str(tr, ep_buf, sizeof(ep_buf));
 	glitch_log("mds_net_handle_mds_tr: incoming message of type %d "
 		"from %s\n", ty, ep_buf);
 	switch (ty) {
+	case mmm_create_file_req_ty:
+	case mmm_mkdirs_req_ty:
+	case mmm_chmod_req_ty:
+	case mmm_chown_req_ty:
+	case mmm_utimes_req_ty:
+	case mmm_unlink_req_ty:
+	case mmm_rename_req_ty:
+	case mmm_chunk_osds_req_ty:
+		if (mds_net_drc_begin(tr, m)) {
+			msg_release(m);
+			return 0;
+		}
+		tracked = 1;
+		break;
+	default:
+		break;
+	}
+	switch (ty) {
 	case mmm_heartbeat_ty:
 		// FIXME: record this
 		ret = 0;
@@ -579,12 +842,28 @@ static int mds_net_handle_tr(struct recv_pool_thread *rt, struct mtran *tr)
 	case mmm_rename_req_ty:
 		ret = handle_mmm_rename_req(rt, tr, m);
 		break;
+	case mmm_chunk_osds_req_ty:
+		ret = handle_mmm_chunk_osds_req(rt, tr, m);
+		break;
+	case mmm_osd_bad_chunk_ty:
+		ret = handle_mmm_osd_bad_chunk(rt, tr, m);
+		break;
+	case mmm_osd_heartbeat_ty:
+		ret = handle_mmm_osd_heartbeat(tr, m);
+		break;
 	default:
 		glitch_log("mds_net_handle_mds_tr: unhandled message "
 			   "type %d\n", ty);
 		ret = -ENOSYS;
 		break;
 	}
+	if (ret && tracked) {
+		/* The handler gave up before getting as far as
+		 * handle_mds_role.  Don't leave any retransmissions waiting
+		 * forever. */
+		mds_net_get_rid(m, &rid);
+		mds_net_drc_finish(NULL, &rid, ret);
+	}
 	msg_release(m);
 	if (ret) {
 		glitch_log("mds_net_handle_mds_tr: error %d handling "
@@ -607,6 +886,7 @@ void mds_net_init(POSSIBLY_UNUSED(struct fast_log_buf *fb),
 	int i, j, ret;
 	char err[512] = { 0 };
 	size_t err_len = sizeof(err);
+	struct recv_pool_limits lim;
 	const char *recv_pool_names[RF_ENTITY_TY_NUM] =
 		{ "mds_rpool", "osd_rpool", "cli_rpool" };
 	const int recv_pool_nthreads[RF_ENTITY_TY_NUM] =
@@ -645,9 +925,21 @@ void mds_net_init(POSSIBLY_UNUSED(struct fast_log_buf *fb),
 			"from configuration: error %s\n", err);
 		abort();
 	}
+	g_osd_load = osd_load_tbl_init(g_cmap->num_osd);
+	if (IS_ERR(g_osd_load)) {
+		glitch_log("mds_net_init: failed to create the OSD load "
+			"table: error %d\n", PTR_ERR(g_osd_load));
+		abort();
+	}
 	g_udata = udata_create_default();
 	if (IS_ERR(g_udata))
 		abort();
+	g_drc = drc_init(MDS_NET_DRC_MAX_CLIENTS, MDS_NET_DRC_PER_CLIENT);
+	if (IS_ERR(g_drc)) {
+		glitch_log("mds_net_init: failed to create the duplicate "
+			"request cache: error %d\n", PTR_ERR(g_drc));
+		abort();
+	}
 	g_mstor = mstor_init(g_fast_log_mgr, mdsc->mc, g_udata);
 	if (IS_ERR(g_mstor)) {
 		glitch_log("failed to initialize the mstor: error %d\n",
@@ -655,6 +947,7 @@ void mds_net_init(POSSIBLY_UNUSED(struct fast_log_buf *fb),
 		abort();
 	}
 	for (i = 0; i < RF_ENTITY_TY_NUM; ++i) {
+		msgr_conf[i].compress_thresh = unitaryc_compress_thresh(conf);
 		g_msgr[i] = msgr_init(err, err_len, &msgr_conf[i]);
 		if (err[0]) {
 			glitch_log("osd_net_init: failed to create %s "
@@ -680,6 +973,15 @@ void mds_net_init(POSSIBLY_UNUSED(struct fast_log_buf *fb),
 				ret, terror(ret));
 			abort();
 		}
+		if (i == RF_ENTITY_TY_CLI) {
+			/* Turn clients away when we're overloaded, rather
+			 * than letting one of them starve the others. */
+			memset(&lim, 0, sizeof(lim));
+			lim.max_queued = mdsc->cli_max_queued;
+			lim.client_rate = mdsc->cli_req_rate;
+			lim.client_burst = mdsc->cli_req_burst;
+			recv_pool_set_limits(g_rpool[i], &lim);
+		}
 		for (j = 0; j < recv_pool_nthreads[i]; ++j) {
 			ret = recv_pool_thread_create(g_rpool[i],
 				g_fast_log_mgr, mds_net_handle_tr, &g_mnrp_tls[i]);
@@ -715,6 +1017,15 @@ void mds_net_init(POSSIBLY_UNUSED(struct fast_log_buf *fb),
 			"mds_send_hb_thread: error %d\n", ret);
 		abort();
 	}
+	if (mdsc->repl_ival > 0) {
+		ret = redfish_thread_create(g_fast_log_mgr,
+			&g_mds_repl_thread, mds_repl_thread, mdsc);
+		if (ret) {
+			glitch_log("mds_net_init: failed to create "
+				"mds_repl_thread: error %d\n", ret);
+			abort();
+		}
+	}
 }
 
 int mds_main_loop(void)
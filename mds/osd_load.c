@@ -0,0 +1,90 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mds/osd_load.h"
+#include "util/error.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct osd_load_tbl {
+	/** Protects loads */
+	pthread_mutex_t lock;
+	/** Number of OSDs */
+	int num_osd;
+	/** Array of num_osd loads, indexed by OSD ID */
+	struct osd_load loads[0];
+};
+
+struct osd_load_tbl *osd_load_tbl_init(int num_osd)
+{
+	int ret;
+	struct osd_load_tbl *tbl;
+
+	if (num_osd < 0)
+		return ERR_PTR(EINVAL);
+	tbl = calloc(1, sizeof(struct osd_load_tbl) +
+		(sizeof(struct osd_load) * num_osd));
+	if (!tbl)
+		return ERR_PTR(ENOMEM);
+	ret = pthread_mutex_init(&tbl->lock, NULL);
+	if (ret) {
+		free(tbl);
+		return ERR_PTR(ret);
+	}
+	tbl->num_osd = num_osd;
+	return tbl;
+}
+
+int osd_load_tbl_update(struct osd_load_tbl *tbl, uint32_t oid,
+		const struct osd_load *load)
+{
+	if (oid >= (uint32_t)tbl->num_osd)
+		return -EINVAL;
+	pthread_mutex_lock(&tbl->lock);
+	memcpy(&tbl->loads[oid], load, sizeof(struct osd_load));
+	pthread_mutex_unlock(&tbl->lock);
+	return 0;
+}
+
+int osd_load_tbl_get(struct osd_load_tbl *tbl, uint32_t oid,
+		struct osd_load *load)
+{
+	if (oid >= (uint32_t)tbl->num_osd)
+		return -EINVAL;
+	pthread_mutex_lock(&tbl->lock);
+	memcpy(load, &tbl->loads[oid], sizeof(struct osd_load));
+	pthread_mutex_unlock(&tbl->lock);
+	return (load->last_hb == 0) ? -ENOENT : 0;
+}
+
+void osd_load_tbl_snapshot(struct osd_load_tbl *tbl, struct osd_load *loads)
+{
+	pthread_mutex_lock(&tbl->lock);
+	memcpy(loads, tbl->loads, sizeof(struct osd_load) * tbl->num_osd);
+	pthread_mutex_unlock(&tbl->lock);
+}
+
+void osd_load_tbl_free(struct osd_load_tbl *tbl)
+{
+	pthread_mutex_destroy(&tbl->lock);
+	free(tbl);
+}
@@ -0,0 +1,106 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_MDS_OSD_LOAD_DOT_H
+#define REDFISH_MDS_OSD_LOAD_DOT_H
+
+#include <stdint.h> /* for uint64_t, etc. */
+#include <time.h> /* for time_t */
+
+/* The OSD load table keeps what each OSD told us about itself in its most
+ * recent heartbeat: how full it is, and how busy it is.  Placement and
+ * read-replica selection can use this to steer clear of OSDs that are full or
+ * slow.
+ *
+ * The table only remembers the latest heartbeat from each OSD.  It is up to
+ * the caller to decide how old a heartbeat can be before it is no use.
+ */
+
+struct osd_load_tbl;
+
+/** The load of one OSD */
+struct osd_load {
+	/** Monotonic time at which we heard the heartbeat, or 0 if we have
+	 * never heard from this OSD */
+	time_t last_hb;
+	/** Bytes free on the OSD's filesystem */
+	uint64_t free_bytes;
+	/** Bytes used on the OSD's filesystem */
+	uint64_t used_bytes;
+	/** Number of chunks stored on the OSD */
+	uint64_t num_chunks;
+	/** Number of requests waiting to be handled */
+	uint32_t queue_depth;
+	/** Median read latency, in microseconds */
+	uint32_t read_p50_us;
+	/** 99th percentile read latency, in microseconds */
+	uint32_t read_p99_us;
+	/** Median write latency, in microseconds */
+	uint32_t write_p50_us;
+	/** 99th percentile write latency, in microseconds */
+	uint32_t write_p99_us;
+};
+
+/** Create an OSD load table
+ *
+ * @param num_osd	Number of OSDs in the cluster
+ *
+ * @return		The table, or an error pointer
+ */
+extern struct osd_load_tbl *osd_load_tbl_init(int num_osd);
+
+/** Record a heartbeat from an OSD
+ *
+ * @param tbl		The table
+ * @param oid		The OSD ID
+ * @param load		The OSD's load.  last_hb should be set to the time at
+ *			which we heard the heartbeat.
+ *
+ * @return		0 on success; -EINVAL if there is no such OSD
+ */
+extern int osd_load_tbl_update(struct osd_load_tbl *tbl, uint32_t oid,
+		const struct osd_load *load);
+
+/** Look up the load of one OSD
+ *
+ * @param tbl		The table
+ * @param oid		The OSD ID
+ * @param load		(out param) the OSD's load
+ *
+ * @return		0 on success; -EINVAL if there is no such OSD;
+ *			-ENOENT if we have never heard from it
+ */
+extern int osd_load_tbl_get(struct osd_load_tbl *tbl, uint32_t oid,
+		struct osd_load *load);
+
+/** Copy the whole table at once
+ *
+ * @param tbl		The table
+ * @param loads		(out param) an array with room for num_osd entries,
+ *			indexed by OSD ID
+ */
+extern void osd_load_tbl_snapshot(struct osd_load_tbl *tbl,
+		struct osd_load *loads);
+
+/** Free an OSD load table
+ *
+ * @param tbl		The table
+ */
+extern void osd_load_tbl_free(struct osd_load_tbl *tbl);
+
+#endif
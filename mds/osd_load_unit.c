@@ -0,0 +1,73 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mds/osd_load.h"
+#include "util/error.h"
+#include "util/test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OSD_LOAD_UNIT_NUM_OSD 3
+
+static int test_osd_load_tbl(void)
+{
+	struct osd_load_tbl *tbl;
+	struct osd_load load, loads[OSD_LOAD_UNIT_NUM_OSD];
+
+	tbl = osd_load_tbl_init(OSD_LOAD_UNIT_NUM_OSD);
+	EXPECT_NOT_ERRPTR(tbl);
+	EXPECT_EQ(osd_load_tbl_get(tbl, 1, &load), -ENOENT);
+	EXPECT_EQ(osd_load_tbl_get(tbl, OSD_LOAD_UNIT_NUM_OSD, &load),
+		-EINVAL);
+
+	memset(&load, 0, sizeof(load));
+	load.last_hb = 100;
+	load.free_bytes = 1000;
+	load.num_chunks = 7;
+	load.read_p99_us = 255;
+	EXPECT_ZERO(osd_load_tbl_update(tbl, 1, &load));
+	EXPECT_EQ(osd_load_tbl_update(tbl, OSD_LOAD_UNIT_NUM_OSD, &load),
+		-EINVAL);
+	memset(&load, 0, sizeof(load));
+	EXPECT_ZERO(osd_load_tbl_get(tbl, 1, &load));
+	EXPECT_EQ(load.last_hb, 100);
+	EXPECT_EQ(load.free_bytes, 1000);
+	EXPECT_EQ(load.num_chunks, 7);
+	EXPECT_EQ(load.read_p99_us, 255);
+
+	/* A newer heartbeat replaces the older one */
+	load.last_hb = 103;
+	load.num_chunks = 8;
+	EXPECT_ZERO(osd_load_tbl_update(tbl, 1, &load));
+	osd_load_tbl_snapshot(tbl, loads);
+	EXPECT_ZERO(loads[0].last_hb);
+	EXPECT_EQ(loads[1].last_hb, 103);
+	EXPECT_EQ(loads[1].num_chunks, 8);
+	EXPECT_ZERO(loads[2].last_hb);
+	osd_load_tbl_free(tbl);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ERRPTR(osd_load_tbl_init(-1));
+	EXPECT_ZERO(test_osd_load_tbl());
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,832 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/cluster_map.h"
+#include "common/config/mdsc.h"
+#include "common/config/mstorc.h"
+#include "core/glitch_log.h"
+#include "mds/mstor.h"
+#include "mds/repl.h"
+#include "mds/repl_plan.h"
+#include "mds/srange_lock.h"
+#include "msg/bsend.h"
+#include "msg/msg.h"
+#include "msg/types.h"
+#include "msg/xdr.h"
+#include "util/error.h"
+#include "util/thread.h"
+#include "util/time.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern uint16_t g_mid;
+
+extern uint16_t g_pri_mid;
+
+extern pthread_mutex_t g_cmap_lock;
+
+extern struct cmap *g_cmap;
+
+extern struct msgr *g_msgr[];
+
+extern struct mstor *g_mstor;
+
+/** Number of chunk records to look at at once */
+#define MDS_REPL_BATCH 256
+
+/** How long an OSD has to copy a chunk, in seconds */
+#define MDS_REPL_COPY_TIMEO 600
+
+/** Maximum number of copies we ask one OSD to do at once.  This matches the
+ * number of copy threads the OSD has, so extra copies wait here rather than in
+ * the OSD's queue, where they could time out. */
+#define MDS_REPL_MAX_SRC_COPIES 2
+
+/** How long to wait for answers to other requests, in seconds */
+#define MDS_REPL_TIMEO 30
+
+/** Maximum number of corrupt chunk reports waiting to be dealt with */
+#define MDS_REPL_MAX_BAD 1024
+
+/** How often to check for corrupt chunk reports between scans, in seconds */
+#define MDS_REPL_BAD_IVAL 1
+
+/** A report of a corrupt copy of a chunk */
+struct mds_repl_bad {
+	/** The chunk ID */
+	uint64_t cid;
+	/** The OSD whose copy is corrupt */
+	uint32_t oid;
+};
+
+/** Protects g_bad and g_num_bad */
+static pthread_mutex_t g_bad_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Corrupt chunk reports waiting to be dealt with */
+static struct mds_repl_bad g_bad[MDS_REPL_MAX_BAD];
+
+/** Number of entries in g_bad */
+static int g_num_bad;
+
+/** A chunk that we are copying */
+struct mds_repl_job {
+	/** The chunk ID */
+	uint64_t cid;
+	/** The OSDs the chunk record listed when we looked at it */
+	uint32_t old_oid[RF_MAX_OID];
+	/** Length of old_oid array */
+	int num_old_oid;
+	/** What to do */
+	struct repl_plan plan;
+	/** The OSD to unlink the chunk from once its record has been changed,
+	 * or -1 */
+	int unlink_oid;
+	/** 0 if everything has worked so far; error code otherwise */
+	int ret;
+	/** The round of mds_repl_send_copies in which we asked for the copy,
+	 * or 0 if we haven't asked yet */
+	int copy_round;
+};
+
+/** Counters for one pass through the chunk records */
+struct mds_repl_stats {
+	/** Chunks looked at */
+	uint64_t scanned;
+	/** Chunks with fewer than man_repl copies on OSDs that are in */
+	uint64_t under;
+	/** Chunks with fewer than min_repl copies on OSDs that are in */
+	uint64_t urgent;
+	/** Chunks with no copies on OSDs that are in */
+	uint64_t lost;
+	/** Chunks copied to new OSDs */
+	uint64_t copied;
+	/** Chunks moved to less loaded OSDs */
+	uint64_t moved;
+	/** Corrupt copies replaced */
+	uint64_t repaired;
+	/** Copies or moves that failed */
+	uint64_t failed;
+};
+
+struct mds_repl {
+	/** The MDS configuration */
+	const struct mdsc *conf;
+	/** Replication parameters */
+	struct repl_params params;
+	/** RPC context */
+	struct bsend *ctx;
+	/** Range locker to use for mstor operations */
+	struct srange_locker lk;
+	/** Our copy of the cluster map for this pass */
+	struct cmap *cmap;
+	/** Number of chunks on each OSD */
+	uint64_t *load;
+	/** Chunk records we are looking at */
+	struct chunk_oids *chunks;
+	/** What to do about each chunk in chunks */
+	struct repl_plan *plans;
+	/** Corrupt chunk reports we are dealing with */
+	struct mds_repl_bad *bad;
+	/** Copies waiting to be carried out */
+	struct mds_repl_job *jobs;
+	/** Number of entries in jobs */
+	int num_jobs;
+	/** Chunks with IDs at or above this are too new to copy */
+	uint64_t cid_limit;
+	/** One more than the highest chunk ID seen during this pass */
+	uint64_t next_cid_limit;
+	/** The second in which we most recently started a copy */
+	time_t rate_sec;
+	/** Number of copies started during rate_sec */
+	int rate_num;
+	/** Counters for this pass */
+	struct mds_repl_stats stats;
+};
+
+static void mds_repl_free(struct mds_repl *repl)
+{
+	if (repl->ctx)
+		bsend_free(repl->ctx);
+	free(repl->chunks);
+	free(repl->plans);
+	free(repl->bad);
+	free(repl->jobs);
+	free(repl);
+}
+
+static struct mds_repl *mds_repl_init(struct fast_log_buf *fb,
+		const struct mdsc *conf)
+{
+	struct mds_repl *repl;
+	int ret;
+
+	repl = calloc(1, sizeof(struct mds_repl));
+	if (!repl)
+		return ERR_PTR(ENOMEM);
+	repl->conf = conf;
+	repl->params.min_repl = conf->mc->min_repl;
+	repl->params.man_repl = conf->mc->man_repl;
+	repl->params.slack = conf->repl_slack;
+	repl->chunks = calloc(MDS_REPL_BATCH, sizeof(struct chunk_oids));
+	repl->plans = calloc(MDS_REPL_BATCH, sizeof(struct repl_plan));
+	repl->bad = calloc(MDS_REPL_MAX_BAD, sizeof(struct mds_repl_bad));
+	repl->jobs = calloc(conf->repl_max_inflight,
+		sizeof(struct mds_repl_job));
+	if ((!repl->chunks) || (!repl->plans) || (!repl->bad) ||
+			(!repl->jobs)) {
+		ret = ENOMEM;
+		goto error;
+	}
+	repl->ctx = bsend_init(fb, conf->repl_max_inflight);
+	if (IS_ERR(repl->ctx)) {
+		ret = PTR_ERR(repl->ctx);
+		repl->ctx = NULL;
+		goto error;
+	}
+	return repl;
+
+error:
+	mds_repl_free(repl);
+	return ERR_PTR(ret);
+}
+
+/** Take a copy of the current cluster map
+ *
+ * @param repl		The re-replication state
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int mds_repl_get_cmap(struct mds_repl *repl)
+{
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err), buf_len;
+	char *buf;
+
+	pthread_mutex_lock(&g_cmap_lock);
+	buf = cmap_to_buffer(g_cmap, &buf_len);
+	pthread_mutex_unlock(&g_cmap_lock);
+	if (!buf)
+		return -ENOMEM;
+	repl->cmap = cmap_from_buffer(buf, buf_len, err, err_len);
+	free(buf);
+	if (err[0]) {
+		glitch_log("mds_repl_get_cmap: cmap_from_buffer failed: "
+			"%s\n", err);
+		return -EIO;
+	}
+	return 0;
+}
+
+/** Get the next batch of chunk records
+ *
+ * @param repl		The re-replication state
+ * @param start		The lowest chunk ID to look at
+ *
+ * @return		The number of records in repl->chunks; a negative
+ *			error code otherwise
+ */
+static int mds_repl_find_chunks(struct mds_repl *repl, uint64_t start)
+{
+	int ret;
+	struct mreq_find_chunks mreq;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.base.lk = &repl->lk;
+	mreq.base.op = MSTOR_OP_FIND_CHUNKS;
+	mreq.start = start;
+	mreq.max_res = MDS_REPL_BATCH;
+	mreq.res = repl->chunks;
+	ret = mstor_do_operation(g_mstor, (struct mreq*)&mreq);
+	if (ret)
+		return ret;
+	return mreq.num_res;
+}
+
+/** Count how many chunks each OSD holds
+ *
+ * @param repl		The re-replication state
+ * @param next_cid_limit (out param) one more than the highest chunk ID seen
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int mds_repl_count_load(struct mds_repl *repl,
+		uint64_t *next_cid_limit)
+{
+	int i, j, num;
+	uint64_t start = 0;
+	const struct chunk_oids *ch;
+
+	while (1) {
+		num = mds_repl_find_chunks(repl, start);
+		if (num < 0)
+			return num;
+		for (i = 0; i < num; ++i) {
+			ch = &repl->chunks[i];
+			for (j = 0; j < ch->num_oid; ++j) {
+				if (ch->oid[j] < (uint32_t)repl->cmap->num_osd)
+					repl->load[ch->oid[j]]++;
+			}
+			*next_cid_limit = ch->cid + 1;
+		}
+		if (num < MDS_REPL_BATCH)
+			break;
+		start = repl->chunks[num - 1].cid + 1;
+	}
+	return 0;
+}
+
+/** Wait until we are allowed to start another copy */
+static void mds_repl_wait_rate(struct mds_repl *repl)
+{
+	time_t now;
+
+	if (repl->conf->repl_rate == 0)
+		return;
+	now = mt_time();
+	if (now != repl->rate_sec) {
+		repl->rate_sec = now;
+		repl->rate_num = 0;
+	}
+	if (repl->rate_num >= repl->conf->repl_rate) {
+		mt_sleep_until(now + 1);
+		repl->rate_sec = mt_time();
+		repl->rate_num = 0;
+	}
+	repl->rate_num++;
+}
+
+/** Wait for the RPCs we sent out, and record their results in the jobs they
+ * were sent for.
+ *
+ * @param repl		The re-replication state
+ */
+static void mds_repl_join(struct mds_repl *repl)
+{
+	int i, num_sent;
+	int32_t ret;
+	uintptr_t idx;
+	struct mtran *tr;
+	struct mds_repl_job *job;
+
+	num_sent = bsend_join(repl->ctx);
+	for (i = 0; i < num_sent; ++i) {
+		tr = bsend_get_mtran(repl->ctx, i);
+		idx = (uintptr_t)bsend_get_mtran_tag(repl->ctx, i);
+		job = &repl->jobs[idx];
+		if (IS_ERR(tr->m)) {
+			job->ret = FORCE_NEGATIVE(PTR_ERR(tr->m));
+			continue;
+		}
+		ret = msg_xdr_decode_as_generic(tr->m);
+		job->ret = (ret < 0) ? -EIO : FORCE_NEGATIVE(ret);
+	}
+	bsend_reset(repl->ctx);
+}
+
+/** Send a message for a job
+ *
+ * @param repl		The re-replication state
+ * @param idx		Index of the job
+ * @param msgr		The messenger to use
+ * @param m		The message, or an error pointer
+ * @param ip		The IP address to send to
+ * @param port		The port to send to
+ * @param timeo		How long to wait for the answer
+ */
+static void mds_repl_send(struct mds_repl *repl, int idx, struct msgr *msgr,
+		struct msg *m, uint32_t ip, uint16_t port, int timeo)
+{
+	int ret;
+
+	if (IS_ERR(m)) {
+		repl->jobs[idx].ret = FORCE_NEGATIVE(PTR_ERR(m));
+		return;
+	}
+	ret = bsend_add(repl->ctx, msgr, BSF_RESP, m, ip, port, timeo,
+		(void*)(uintptr_t)idx);
+	if (ret) {
+		msg_release(m);
+		repl->jobs[idx].ret = ret;
+	}
+}
+
+/** Count the copies we asked an OSD to do in a round
+ *
+ * @param repl		The re-replication state
+ * @param src		The source OSD
+ * @param round		The round
+ *
+ * @return		Number of jobs copying from src in this round
+ */
+static int mds_repl_count_copies(const struct mds_repl *repl, uint32_t src,
+		int round)
+{
+	int i, num = 0;
+
+	for (i = 0; i < repl->num_jobs; ++i) {
+		if ((repl->jobs[i].copy_round == round) &&
+				(repl->jobs[i].plan.src == src))
+			++num;
+	}
+	return num;
+}
+
+/** Ask the source OSDs to copy the chunks.
+ *
+ * No OSD gets more than MDS_REPL_MAX_SRC_COPIES copies at once.  If some
+ * chunks all come from the same OSD, we copy them over several rounds.
+ */
+static void mds_repl_send_copies(struct mds_repl *repl)
+{
+	int i, j, round, left;
+	struct mds_repl_job *job;
+	struct mmm_osd_copy_req req;
+	struct endpoint dst[RF_MAX_OID];
+	const struct daemon_info *di;
+
+	round = 0;
+	do {
+		++round;
+		left = 0;
+		for (i = 0; i < repl->num_jobs; ++i) {
+			job = &repl->jobs[i];
+			if ((job->plan.num_dst == 0) || (job->copy_round))
+				continue;
+			if (mds_repl_count_copies(repl, job->plan.src,
+					round) >= MDS_REPL_MAX_SRC_COPIES) {
+				left = 1;
+				continue;
+			}
+			job->copy_round = round;
+			for (j = 0; j < job->plan.num_dst; ++j) {
+				di = &repl->cmap->oinfo[job->plan.dst[j]];
+				dst[j].ip = di->ip;
+				dst[j].port = di->port[RF_ENTITY_TY_OSD];
+			}
+			req.cid = job->cid;
+			req.dst.dst_len = job->plan.num_dst;
+			req.dst.dst_val = dst;
+			mds_repl_wait_rate(repl);
+			di = &repl->cmap->oinfo[job->plan.src];
+			mds_repl_send(repl, i, g_msgr[RF_ENTITY_TY_OSD],
+				MSG_XDR_ALLOC(mmm_osd_copy_req, &req), di->ip,
+				di->port[RF_ENTITY_TY_MDS],
+				MDS_REPL_COPY_TIMEO);
+		}
+		mds_repl_join(repl);
+	} while (left);
+}
+
+/** Change the records of the chunks that were copied.
+ *
+ * We send the change to ourselves, so that it goes to the replicas the same
+ * way that changes from clients do.
+ */
+static void mds_repl_send_records(struct mds_repl *repl)
+{
+	int i;
+	struct mds_repl_job *job;
+	struct mmm_chunk_osds_req req;
+	const struct daemon_info *di;
+
+	di = &repl->cmap->minfo[g_mid];
+	for (i = 0; i < repl->num_jobs; ++i) {
+		job = &repl->jobs[i];
+		if (job->ret)
+			continue;
+		memset(&req, 0, sizeof(req));
+		req.cid = job->cid;
+		req.old_oid.old_oid_len = job->num_old_oid;
+		req.old_oid.old_oid_val = job->old_oid;
+		req.new_oid.new_oid_len = job->plan.num_oid;
+		req.new_oid.new_oid_val = job->plan.oid;
+		mds_repl_send(repl, i, g_msgr[RF_ENTITY_TY_MDS],
+			MSG_XDR_ALLOC(mmm_chunk_osds_req, &req), di->ip,
+			di->port[RF_ENTITY_TY_MDS], MDS_REPL_TIMEO);
+	}
+	mds_repl_join(repl);
+}
+
+/** Unlink moved chunks from the OSDs they were moved off, and corrupt copies
+ * from the OSDs they were found on */
+static void mds_repl_send_unlinks(struct mds_repl *repl)
+{
+	int i;
+	struct mds_repl_job *job;
+	struct mmm_osd_unlink_req req;
+	const struct daemon_info *di;
+
+	for (i = 0; i < repl->num_jobs; ++i) {
+		job = &repl->jobs[i];
+		if ((job->ret) || (job->unlink_oid < 0))
+			continue;
+		req.cid = job->cid;
+		di = &repl->cmap->oinfo[job->unlink_oid];
+		mds_repl_send(repl, i, g_msgr[RF_ENTITY_TY_OSD],
+			MSG_XDR_ALLOC(mmm_osd_unlink_req, &req), di->ip,
+			di->port[RF_ENTITY_TY_MDS], MDS_REPL_TIMEO);
+	}
+	mds_repl_join(repl);
+}
+
+/** Carry out the jobs which are waiting */
+static void mds_repl_run_jobs(struct mds_repl *repl)
+{
+	int i;
+	struct mds_repl_job *job;
+
+	if (repl->num_jobs == 0)
+		return;
+	mds_repl_send_copies(repl);
+	mds_repl_send_records(repl);
+	mds_repl_send_unlinks(repl);
+	for (i = 0; i < repl->num_jobs; ++i) {
+		job = &repl->jobs[i];
+		if (job->ret) {
+			glitch_log("mds_repl_run_jobs: failed to %s chunk "
+				"0x%"PRIx64" from OSD %d: error %d\n",
+				(job->plan.act == REPL_ACT_MOVE) ? "move" :
+				(job->unlink_oid >= 0) ? "repair" : "copy",
+				job->cid, job->plan.src, job->ret);
+			repl->stats.failed++;
+		}
+		else if (job->plan.act == REPL_ACT_MOVE)
+			repl->stats.moved++;
+		else if (job->unlink_oid >= 0)
+			repl->stats.repaired++;
+		else if (job->plan.num_dst > 0)
+			repl->stats.copied++;
+	}
+	repl->num_jobs = 0;
+}
+
+/** Add a job, and carry out the jobs if there are enough of them */
+static void mds_repl_add_job(struct mds_repl *repl,
+		const struct chunk_oids *ch, const struct repl_plan *plan,
+		int unlink_oid)
+{
+	struct mds_repl_job *job;
+
+	job = &repl->jobs[repl->num_jobs++];
+	job->cid = ch->cid;
+	memcpy(job->old_oid, ch->oid, sizeof(uint32_t) * ch->num_oid);
+	job->num_old_oid = ch->num_oid;
+	memcpy(&job->plan, plan, sizeof(struct repl_plan));
+	job->unlink_oid = unlink_oid;
+	job->ret = 0;
+	job->copy_round = 0;
+	if (repl->num_jobs >= repl->conf->repl_max_inflight)
+		mds_repl_run_jobs(repl);
+}
+
+/** Decide what to do about a batch of chunks, and do it.
+ *
+ * @param repl		The re-replication state
+ * @param num		Number of chunks in repl->chunks
+ */
+static void mds_repl_batch(struct mds_repl *repl, int num)
+{
+	int i, prio;
+	const struct chunk_oids *ch;
+	struct repl_plan *plan;
+
+	for (i = 0; i < num; ++i) {
+		ch = &repl->chunks[i];
+		plan = &repl->plans[i];
+		if (ch->cid >= repl->cid_limit) {
+			plan->act = REPL_ACT_NONE;
+			continue;
+		}
+		repl_plan_chunk(repl->cmap, repl->load, &repl->params,
+			ch->oid, ch->num_oid, plan);
+		repl->stats.scanned++;
+		if (plan->act == REPL_ACT_LOST) {
+			glitch_log("mds_repl_batch: chunk 0x%"PRIx64" has "
+				"no copies on any OSD that is in!\n", ch->cid);
+			repl->stats.lost++;
+		}
+		if (plan->prio == REPL_PRIO_URGENT)
+			repl->stats.urgent++;
+		if (plan->prio != REPL_PRIO_LOW)
+			repl->stats.under++;
+		/* Later plans in this batch should take this one into
+		 * account. */
+		repl_plan_apply_load(repl->load, plan);
+	}
+	for (prio = REPL_PRIO_URGENT; prio <= REPL_PRIO_LOW; ++prio) {
+		for (i = 0; i < num; ++i) {
+			plan = &repl->plans[i];
+			if (plan->prio != prio)
+				continue;
+			if ((plan->act != REPL_ACT_COPY) &&
+					(plan->act != REPL_ACT_MOVE))
+				continue;
+			mds_repl_add_job(repl, &repl->chunks[i], plan,
+				(plan->act == REPL_ACT_MOVE) ?
+					(int)plan->src : -1);
+		}
+	}
+}
+
+/** Add a corrupt chunk report to the queue
+ *
+ * Should be called with g_bad_lock held.
+ *
+ * @return		0 on success; -ENOBUFS if the queue is full
+ */
+static int mds_repl_queue_bad(uint64_t cid, uint32_t oid)
+{
+	int i;
+
+	for (i = 0; i < g_num_bad; ++i) {
+		if ((g_bad[i].cid == cid) && (g_bad[i].oid == oid))
+			return 0;
+	}
+	if (g_num_bad >= MDS_REPL_MAX_BAD)
+		return -ENOBUFS;
+	g_bad[g_num_bad].cid = cid;
+	g_bad[g_num_bad].oid = oid;
+	g_num_bad++;
+	return 0;
+}
+
+int mds_repl_report_bad(uint64_t cid, uint32_t oid)
+{
+	int ret;
+
+	if (g_mid != g_pri_mid)
+		return -EAGAIN;
+	pthread_mutex_lock(&g_bad_lock);
+	ret = mds_repl_queue_bad(cid, oid);
+	pthread_mutex_unlock(&g_bad_lock);
+	if (ret) {
+		glitch_log("mds_repl_report_bad: too many reports waiting.  "
+			"Dropping the report of chunk 0x%"PRIx64" on OSD "
+			"%"PRIu32"\n", cid, oid);
+	}
+	return ret;
+}
+
+/** Check whether there are any corrupt chunk reports that we can deal with
+ *
+ * @param cid_limit	Chunks with IDs at or above this are too new to copy
+ *
+ * @return		1 if there are; 0 otherwise
+ */
+static int mds_repl_have_bad(uint64_t cid_limit)
+{
+	int i, ret = 0;
+
+	pthread_mutex_lock(&g_bad_lock);
+	for (i = 0; i < g_num_bad; ++i) {
+		if (g_bad[i].cid < cid_limit) {
+			ret = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_bad_lock);
+	return ret;
+}
+
+/** Plan the repair of a corrupt copy of a chunk, and add a job for it.
+ *
+ * @param repl		The re-replication state
+ * @param bad		The report
+ */
+static void mds_repl_fix_bad(struct mds_repl *repl,
+		const struct mds_repl_bad *bad)
+{
+	int i, num, num_good = 0;
+	uint32_t good[RF_MAX_OID];
+	struct repl_params params;
+	struct repl_plan plan;
+	const struct chunk_oids *ch;
+
+	if (bad->oid >= (uint32_t)repl->cmap->num_osd) {
+		glitch_log("mds_repl_fix_bad: ignoring report of chunk "
+			"0x%"PRIx64" on nonexistent OSD %"PRIu32"\n",
+			bad->cid, bad->oid);
+		return;
+	}
+	num = mds_repl_find_chunks(repl, bad->cid);
+	if (num < 0) {
+		glitch_log("mds_repl_fix_bad: failed to look up chunk "
+			"0x%"PRIx64": error %d\n", bad->cid, num);
+		return;
+	}
+	ch = &repl->chunks[0];
+	/* If the chunk has been deleted, or the record doesn't list the OSD
+	 * any more, there is nothing to do. */
+	if ((num == 0) || (ch->cid != bad->cid))
+		return;
+	for (i = 0; i < ch->num_oid; ++i) {
+		if (ch->oid[i] != bad->oid)
+			good[num_good++] = ch->oid[i];
+	}
+	if (num_good == ch->num_oid)
+		return;
+	/* This is no time to move the chunk around as well */
+	memcpy(&params, &repl->params, sizeof(struct repl_params));
+	params.slack = 0;
+	repl_plan_chunk(repl->cmap, repl->load, &params, good, num_good,
+		&plan);
+	if (plan.act == REPL_ACT_LOST) {
+		glitch_log("mds_repl_fix_bad: the corrupt copy of chunk "
+			"0x%"PRIx64" on OSD %"PRIu32" is the only copy on any "
+			"OSD that is in.  Leaving it alone.\n",
+			bad->cid, bad->oid);
+		repl->stats.lost++;
+		return;
+	}
+	/* Even if there are enough good copies, the record has to change */
+	plan.act = REPL_ACT_COPY;
+	plan.prio = REPL_PRIO_URGENT;
+	repl_plan_apply_load(repl->load, &plan);
+	if (repl->load[bad->oid] > 0)
+		repl->load[bad->oid]--;
+	mds_repl_add_job(repl, ch, &plan, bad->oid);
+}
+
+/** Deal with the corrupt chunk reports which are waiting
+ *
+ * Reports of chunks which are too new to copy are put back in the queue.
+ *
+ * @param repl		The re-replication state
+ */
+static void mds_repl_fix_all_bad(struct mds_repl *repl)
+{
+	int i, num;
+
+	pthread_mutex_lock(&g_bad_lock);
+	num = g_num_bad;
+	memcpy(repl->bad, g_bad, sizeof(struct mds_repl_bad) * num);
+	g_num_bad = 0;
+	pthread_mutex_unlock(&g_bad_lock);
+	for (i = 0; i < num; ++i) {
+		if (repl->bad[i].cid >= repl->cid_limit) {
+			pthread_mutex_lock(&g_bad_lock);
+			mds_repl_queue_bad(repl->bad[i].cid,
+				repl->bad[i].oid);
+			pthread_mutex_unlock(&g_bad_lock);
+			continue;
+		}
+		mds_repl_fix_bad(repl, &repl->bad[i]);
+	}
+}
+
+/** Go through all of the chunk records once, or just deal with corrupt chunk
+ * reports.
+ *
+ * @param repl		The re-replication state
+ * @param full		If nonzero, go through all of the chunk records
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int mds_repl_pass(struct mds_repl *repl, int full)
+{
+	int ret, num;
+	uint64_t start = 0, next_cid_limit;
+
+	memset(&repl->stats, 0, sizeof(repl->stats));
+	if (full)
+		repl->cid_limit = repl->next_cid_limit;
+	next_cid_limit = repl->next_cid_limit;
+	ret = mds_repl_get_cmap(repl);
+	if (ret)
+		return ret;
+	repl->load = calloc(repl->cmap->num_osd + 1, sizeof(uint64_t));
+	if (!repl->load) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	ret = mds_repl_count_load(repl, &next_cid_limit);
+	if (ret)
+		goto done;
+	/* Only a full pass makes newer chunks fair game */
+	if (full)
+		repl->next_cid_limit = next_cid_limit;
+	mds_repl_fix_all_bad(repl);
+	while ((full) && (g_mid == g_pri_mid)) {
+		num = mds_repl_find_chunks(repl, start);
+		if (num < 0) {
+			ret = num;
+			goto done;
+		}
+		mds_repl_batch(repl, num);
+		if (num < MDS_REPL_BATCH)
+			break;
+		start = repl->chunks[num - 1].cid + 1;
+	}
+	mds_repl_run_jobs(repl);
+	glitch_log("mds_repl_pass: looked at %"PRIu64" chunks: "
+		"%"PRIu64" under-replicated (%"PRIu64" urgently), "
+		"%"PRIu64" lost.  Copied %"PRIu64", moved %"PRIu64", "
+		"repaired %"PRIu64", failed %"PRIu64".\n",
+		repl->stats.scanned, repl->stats.under, repl->stats.urgent,
+		repl->stats.lost, repl->stats.copied, repl->stats.moved,
+		repl->stats.repaired, repl->stats.failed);
+	ret = 0;
+done:
+	free(repl->load);
+	repl->load = NULL;
+	cmap_free(repl->cmap);
+	repl->cmap = NULL;
+	return ret;
+}
+
+int mds_repl_thread(struct redfish_thread *rt)
+{
+	int ret, full;
+	time_t until;
+	struct mds_repl *repl;
+	const struct mdsc *conf = rt->priv;
+
+	repl = mds_repl_init(rt->fb, conf);
+	if (IS_ERR(repl)) {
+		glitch_log("mds_repl_thread: failed to initialize: "
+			"error %d\n", PTR_ERR(repl));
+		return PTR_ERR(repl);
+	}
+	until = mt_time() + conf->repl_ival;
+	while (1) {
+		mt_sleep_until(mt_time() + MDS_REPL_BAD_IVAL);
+		/* Corrupt chunks shouldn't have to wait for the next scan */
+		full = (mt_time() >= until);
+		if ((!full) && (!mds_repl_have_bad(repl->cid_limit)))
+			continue;
+		if (full)
+			until = mt_time() + conf->repl_ival;
+		/* Only the primary changes the metadata */
+		if (g_mid != g_pri_mid)
+			continue;
+		ret = mds_repl_pass(repl, full);
+		if (ret) {
+			glitch_log("mds_repl_thread: error %d while looking "
+				"for chunks to copy\n", ret);
+		}
+	}
+	mds_repl_free(repl);
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_MDS_REPL_DOT_H
+#define REDFISH_MDS_REPL_DOT_H
+
+#include <stdint.h> /* for uint64_t, etc. */
+
+struct redfish_thread;
+
+/* The re-replication thread
+ *
+ * Every repl_ival seconds, the primary MDS goes through all of the chunk
+ * records, and uses repl_plan_chunk to decide which chunks need to be copied
+ * to other OSDs.  The most urgent copies in each batch of records are done
+ * first.
+ *
+ * The MDS doesn't move any data itself.  It asks an OSD which has the chunk to
+ * copy it to the new OSDs.  Once that has worked, it changes the chunk record
+ * with an mmm_chunk_osds_req, which it sends to itself so that the replicas
+ * hear about it too.  If the chunk was being moved rather than copied, it is
+ * then unlinked from the OSD it was moved off.
+ *
+ * No more than repl_max_inflight copies are in progress at once, and no more
+ * than repl_rate are started per second.
+ *
+ * A chunk which is still being written to shouldn't be copied, since the
+ * writer doesn't know about the new OSD.  Chunk IDs only go up, so we leave
+ * alone any chunk which wasn't there at the time of the previous scan.  This
+ * gives writers at least repl_ival seconds to finish.
+ *
+ * OSDs report the chunks which their scrubbers find to be corrupt.  The thread
+ * doesn't wait for the next scan to deal with those.  The corrupt copy is left
+ * out of the record, a good copy is made elsewhere if that leaves too few, and
+ * then the corrupt copy is unlinked.  If the corrupt copy is the only one, it
+ * is left alone.
+ */
+
+/** Report that an OSD's copy of a chunk is corrupt
+ *
+ * Only the primary MDS accepts reports.
+ *
+ * @param cid		The chunk ID
+ * @param oid		The OSD whose copy is corrupt
+ *
+ * @return		0 on success; -EAGAIN if we are not the primary;
+ *			-ENOBUFS if too many reports are waiting already
+ */
+extern int mds_repl_report_bad(uint64_t cid, uint32_t oid);
+
+/** Runs the MDS re-replication thread
+ *
+ * @param rt		The Redfish thread object.  rt->priv must point to
+ *			the MDS configuration.
+ *
+ * @return		(never returns)
+ */
+extern int mds_repl_thread(struct redfish_thread *rt);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/cluster_map.h"
+#include "mds/repl_plan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static int repl_osd_is_in(const struct cmap *cmap, uint32_t oid)
+{
+	return (oid < (uint32_t)cmap->num_osd) && cmap->oinfo[oid].in;
+}
+
+static int repl_has_oid(const uint32_t *oid, int num_oid, uint32_t o)
+{
+	int i;
+
+	for (i = 0; i < num_oid; ++i) {
+		if (oid[i] == o)
+			return 1;
+	}
+	return 0;
+}
+
+/** Find the least loaded OSD which is in, and isn't in a given list
+ *
+ * @param cmap		The cluster map
+ * @param load		OSD loads
+ * @param oid		The OSDs to leave out
+ * @param num_oid	Length of oid
+ *
+ * @return		The OSD ID, or -1 if there are no such OSDs
+ */
+static int repl_least_loaded(const struct cmap *cmap, const uint64_t *load,
+		const uint32_t *oid, int num_oid)
+{
+	int i, best = -1;
+
+	for (i = 0; i < cmap->num_osd; ++i) {
+		if (!cmap->oinfo[i].in)
+			continue;
+		if (repl_has_oid(oid, num_oid, i))
+			continue;
+		if ((best < 0) || (load[i] < load[best]))
+			best = i;
+	}
+	return best;
+}
+
+/** Find the index of the least or most loaded OSD in a list
+ *
+ * @param load		OSD loads
+ * @param oid		The OSDs.  There must be at least one.
+ * @param num_oid	Length of oid
+ * @param most		1 to find the most loaded OSD; 0 for the least
+ *
+ * @return		The index in oid of the OSD
+ */
+static int repl_extreme_idx(const uint64_t *load, const uint32_t *oid,
+		int num_oid, int most)
+{
+	int i, best = 0;
+
+	for (i = 1; i < num_oid; ++i) {
+		if (most ? (load[oid[i]] > load[oid[best]]) :
+				(load[oid[i]] < load[oid[best]]))
+			best = i;
+	}
+	return best;
+}
+
+void repl_plan_chunk(const struct cmap *cmap, const uint64_t *load,
+		const struct repl_params *params, const uint32_t *oid,
+		int num_oid, struct repl_plan *plan)
+{
+	int i, d, hi, num_live;
+
+	memset(plan, 0, sizeof(struct repl_plan));
+	plan->act = REPL_ACT_NONE;
+	plan->prio = REPL_PRIO_LOW;
+	for (i = 0; i < num_oid; ++i) {
+		if (!repl_osd_is_in(cmap, oid[i]))
+			continue;
+		if (repl_has_oid(plan->oid, plan->num_oid, oid[i]))
+			continue;
+		plan->oid[plan->num_oid++] = oid[i];
+	}
+	num_live = plan->num_oid;
+	if (num_live == 0) {
+		plan->act = REPL_ACT_LOST;
+		plan->prio = REPL_PRIO_URGENT;
+		return;
+	}
+	/* Read from whichever copy is the least busy */
+	plan->src = plan->oid[repl_extreme_idx(load, plan->oid,
+		plan->num_oid, 0)];
+	if (num_live < params->man_repl) {
+		plan->prio = (num_live < params->min_repl) ?
+			REPL_PRIO_URGENT : REPL_PRIO_NORMAL;
+		while (plan->num_oid < params->man_repl) {
+			d = repl_least_loaded(cmap, load, plan->oid,
+				plan->num_oid);
+			if (d < 0)
+				break;
+			plan->dst[plan->num_dst++] = d;
+			plan->oid[plan->num_oid++] = d;
+		}
+		/* If there is nowhere to copy the chunk to, leave the record
+		 * alone.  The OSDs that are out might come back. */
+		if (plan->num_dst > 0)
+			plan->act = REPL_ACT_COPY;
+		return;
+	}
+	if (num_live < num_oid) {
+		/* There are enough copies without the OSDs that are out.
+		 * Forget about those. */
+		plan->act = REPL_ACT_COPY;
+		return;
+	}
+	if (params->slack == 0)
+		return;
+	hi = repl_extreme_idx(load, plan->oid, plan->num_oid, 1);
+	d = repl_least_loaded(cmap, load, plan->oid, plan->num_oid);
+	if (d < 0)
+		return;
+	if (load[plan->oid[hi]] <= load[d] + params->slack)
+		return;
+	plan->act = REPL_ACT_MOVE;
+	plan->src = plan->oid[hi];
+	plan->dst[0] = d;
+	plan->num_dst = 1;
+	plan->oid[hi] = d;
+}
+
+void repl_plan_apply_load(uint64_t *load, const struct repl_plan *plan)
+{
+	int i;
+
+	if ((plan->act != REPL_ACT_COPY) && (plan->act != REPL_ACT_MOVE))
+		return;
+	for (i = 0; i < plan->num_dst; ++i)
+		++load[plan->dst[i]];
+	if (plan->act == REPL_ACT_MOVE)
+		--load[plan->src];
+}
@@ -0,0 +1,116 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_MDS_REPL_PLAN_DOT_H
+#define REDFISH_MDS_REPL_PLAN_DOT_H
+
+#include "msg/types.h" /* for RF_MAX_OID */
+
+#include <stdint.h> /* for uint32_t, etc. */
+
+/* Replication planning
+ *
+ * Given the OSDs that a chunk is stored on, and the cluster map, we decide
+ * whether the chunk needs to be copied anywhere.
+ *
+ * A chunk stored on fewer OSDs that are in than the mandated replication level
+ * is copied to the least loaded OSDs which don't have it yet.  OSDs which are
+ * out are dropped from the chunk's record once that is done.
+ *
+ * A chunk which is fully replicated may be moved off the most loaded OSD that
+ * holds it, onto the least loaded OSD that doesn't, if their loads differ by
+ * more than a given slack.  This is how OSDs which have just been added to the
+ * cluster get data.
+ *
+ * The load of an OSD is the number of chunks stored on it.  The caller counts
+ * them up, and keeps them up to date as it carries out plans.
+ */
+
+struct cmap;
+
+enum repl_act {
+	/** Nothing to do */
+	REPL_ACT_NONE = 0,
+	/** Copy the chunk from src to the dst OSDs, then change its record
+	 * to oid.  There may be no dst OSDs, if all we have to do is drop
+	 * OSDs which are out from the record. */
+	REPL_ACT_COPY,
+	/** Copy the chunk from src to the dst OSD, change its record to oid,
+	 * and then unlink it from the src OSD. */
+	REPL_ACT_MOVE,
+	/** None of the OSDs which hold the chunk are in */
+	REPL_ACT_LOST,
+};
+
+/** The chunk is stored on fewer than min_repl OSDs which are in */
+#define REPL_PRIO_URGENT 0
+/** The chunk is stored on fewer than man_repl OSDs which are in */
+#define REPL_PRIO_NORMAL 1
+/** The chunk is safe, but we'd like to move it */
+#define REPL_PRIO_LOW 2
+
+struct repl_params {
+	/** Minimum replication level */
+	int min_repl;
+	/** Mandated replication level */
+	int man_repl;
+	/** How many more chunks one OSD can have than another before we
+	 * move chunks between them.  0 disables rebalancing. */
+	uint64_t slack;
+};
+
+struct repl_plan {
+	/** What to do */
+	enum repl_act act;
+	/** How urgent this is: one of REPL_PRIO_* */
+	int prio;
+	/** The OSD to copy the chunk from */
+	uint32_t src;
+	/** The OSDs to copy the chunk to */
+	uint32_t dst[RF_MAX_OID];
+	/** Length of dst array */
+	int num_dst;
+	/** The OSDs which should hold the chunk afterwards */
+	uint32_t oid[RF_MAX_OID];
+	/** Length of oid array */
+	int num_oid;
+};
+
+/** Decide what to do about a chunk
+ *
+ * @param cmap		The cluster map
+ * @param load		Array of OSD loads, indexed by OSD ID.  It must have
+ *			cmap->num_osd entries.
+ * @param params	Replication parameters
+ * @param oid		The OSDs which hold the chunk now
+ * @param num_oid	Length of oid array
+ * @param plan		(out param) what to do
+ */
+extern void repl_plan_chunk(const struct cmap *cmap, const uint64_t *load,
+		const struct repl_params *params, const uint32_t *oid,
+		int num_oid, struct repl_plan *plan);
+
+/** Update OSD loads to account for a plan that has been carried out
+ *
+ * @param load		Array of OSD loads, indexed by OSD ID
+ * @param plan		The plan
+ */
+extern void repl_plan_apply_load(uint64_t *load,
+		const struct repl_plan *plan);
+
+#endif
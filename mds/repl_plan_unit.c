@@ -0,0 +1,158 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/cluster_map.h"
+#include "mds/repl_plan.h"
+#include "util/test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPL_PLAN_UNIT_NUM_OSD 4
+
+static void repl_plan_unit_cmap(struct cmap *cmap, struct daemon_info *oinfo)
+{
+	int i;
+
+	memset(cmap, 0, sizeof(struct cmap));
+	memset(oinfo, 0, sizeof(struct daemon_info) * REPL_PLAN_UNIT_NUM_OSD);
+	for (i = 0; i < REPL_PLAN_UNIT_NUM_OSD; ++i)
+		oinfo[i].in = 1;
+	cmap->num_osd = REPL_PLAN_UNIT_NUM_OSD;
+	cmap->oinfo = oinfo;
+}
+
+static int test_repl_plan_copy(void)
+{
+	struct cmap cmap;
+	struct daemon_info oinfo[REPL_PLAN_UNIT_NUM_OSD];
+	struct repl_params params = { .min_repl = 1, .man_repl = 2 };
+	struct repl_plan plan;
+	uint64_t load[REPL_PLAN_UNIT_NUM_OSD] = { 5, 5, 9, 3 };
+	const uint32_t oid[] = { 0, 1 };
+
+	repl_plan_unit_cmap(&cmap, oinfo);
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_NONE);
+	EXPECT_EQ(plan.prio, REPL_PRIO_LOW);
+
+	/* OSD 1 goes out.  The chunk should go to the least loaded OSD. */
+	oinfo[1].in = 0;
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_COPY);
+	EXPECT_EQ(plan.prio, REPL_PRIO_NORMAL);
+	EXPECT_EQ(plan.src, 0);
+	EXPECT_EQ(plan.num_dst, 1);
+	EXPECT_EQ(plan.dst[0], 3);
+	EXPECT_EQ(plan.num_oid, 2);
+	EXPECT_EQ(plan.oid[0], 0);
+	EXPECT_EQ(plan.oid[1], 3);
+	repl_plan_apply_load(load, &plan);
+	EXPECT_EQ(load[3], 4);
+	EXPECT_EQ(load[0], 5);
+
+	params.min_repl = 2;
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_COPY);
+	EXPECT_EQ(plan.prio, REPL_PRIO_URGENT);
+
+	/* Both copies are gone */
+	oinfo[0].in = 0;
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_LOST);
+	return 0;
+}
+
+static int test_repl_plan_nowhere(void)
+{
+	struct cmap cmap;
+	struct daemon_info oinfo[REPL_PLAN_UNIT_NUM_OSD];
+	struct repl_params params = { .min_repl = 1, .man_repl = 3 };
+	struct repl_plan plan;
+	uint64_t load[REPL_PLAN_UNIT_NUM_OSD] = { 0, 0, 0, 0 };
+	const uint32_t oid[] = { 0, 1, 2 };
+	const uint32_t bogus_oid[] = { 123, 2 };
+
+	repl_plan_unit_cmap(&cmap, oinfo);
+	cmap.num_osd = 3;
+	oinfo[1].in = 0;
+	/* There is nowhere else to put the chunk, so we leave it be */
+	repl_plan_chunk(&cmap, load, &params, oid, 3, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_NONE);
+	EXPECT_EQ(plan.prio, REPL_PRIO_NORMAL);
+
+	/* With a lower replication level, OSD 1 can be dropped */
+	params.man_repl = 2;
+	repl_plan_chunk(&cmap, load, &params, oid, 3, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_COPY);
+	EXPECT_EQ(plan.prio, REPL_PRIO_LOW);
+	EXPECT_EQ(plan.num_dst, 0);
+	EXPECT_EQ(plan.num_oid, 2);
+	EXPECT_EQ(plan.oid[0], 0);
+	EXPECT_EQ(plan.oid[1], 2);
+
+	/* OSDs which aren't in the cluster map count as out */
+	repl_plan_chunk(&cmap, load, &params, bogus_oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_COPY);
+	EXPECT_EQ(plan.num_dst, 1);
+	EXPECT_EQ(plan.dst[0], 0);
+	EXPECT_EQ(plan.src, 2);
+	return 0;
+}
+
+static int test_repl_plan_rebalance(void)
+{
+	struct cmap cmap;
+	struct daemon_info oinfo[REPL_PLAN_UNIT_NUM_OSD];
+	struct repl_params params = { .min_repl = 1, .man_repl = 2,
+		.slack = 4 };
+	struct repl_plan plan;
+	uint64_t load[REPL_PLAN_UNIT_NUM_OSD] = { 10, 2, 0, 8 };
+	const uint32_t oid[] = { 0, 1 };
+
+	repl_plan_unit_cmap(&cmap, oinfo);
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_MOVE);
+	EXPECT_EQ(plan.prio, REPL_PRIO_LOW);
+	EXPECT_EQ(plan.src, 0);
+	EXPECT_EQ(plan.num_dst, 1);
+	EXPECT_EQ(plan.dst[0], 2);
+	EXPECT_EQ(plan.num_oid, 2);
+	EXPECT_EQ(plan.oid[0], 2);
+	EXPECT_EQ(plan.oid[1], 1);
+	repl_plan_apply_load(load, &plan);
+	EXPECT_EQ(load[0], 9);
+	EXPECT_EQ(load[2], 1);
+
+	/* Within the slack, nothing moves */
+	params.slack = 8;
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_NONE);
+	params.slack = 0;
+	repl_plan_chunk(&cmap, load, &params, oid, 2, &plan);
+	EXPECT_EQ(plan.act, REPL_ACT_NONE);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ZERO(test_repl_plan_copy());
+	EXPECT_ZERO(test_repl_plan_nowhere());
+	EXPECT_ZERO(test_repl_plan_rebalance());
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "msg/asend.h"
+#include "msg/bsend.h"
+#include "msg/msg.h"
+#include "msg/msgr.h"
+#include "msg/recv_pool.h"
+#include "util/error.h"
+#include "util/macro.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Timeout, in seconds, for sending a reply */
+#define ASEND_REPLY_TIMEO 60
+
+struct asend_mtran {
+	struct mtran *tr;
+	struct asend *as;
+	void *tag;
+	uint8_t flags;
+};
+
+/** An asynchronous RPC context */
+struct asend {
+	/** Continuation which we post to the receive pool */
+	struct recv_pool_cont cont;
+	/** Receive pool to post the continuation to */
+	struct recv_pool *rpool;
+	/** The user's continuation function */
+	asend_cont_fn_t fn;
+	/** Private data for the continuation */
+	void *priv;
+	/** Number of RPCs that haven't completed yet, plus one until
+	 * asend_join is called.  Whoever brings this to zero posts the
+	 * continuation. */
+	volatile int num_pending;
+	/** Current number of transactors */
+	int num_tr;
+	/** Length of atrs */
+	int max_tr;
+	/** The transactors */
+	struct asend_mtran atrs[0];
+};
+
+struct asend *asend_init(struct recv_pool *rpool, int max_tr, void *priv)
+{
+	struct asend *as;
+
+	as = calloc(1, sizeof(struct asend) +
+			(max_tr * sizeof(struct asend_mtran)));
+	if (!as)
+		return ERR_PTR(ENOMEM);
+	as->rpool = rpool;
+	as->priv = priv;
+	as->num_pending = 1;
+	as->max_tr = max_tr;
+	return as;
+}
+
+static int asend_cont_trampoline(struct recv_pool_thread *rt,
+		struct recv_pool_cont *cont)
+{
+	struct asend *as = GET_OUTER(cont, struct asend, cont);
+
+	return as->fn(rt, as);
+}
+
+static void asend_put(struct asend *as)
+{
+	if (__sync_sub_and_fetch(&as->num_pending, 1) != 0)
+		return;
+	as->cont.fn = asend_cont_trampoline;
+	if (recv_pool_post(as->rpool, &as->cont)) {
+		/* The receive pool is gone, so nobody else is going to run the
+		 * continuation.  It still has to free the context, and
+		 * whatever request it was going to finish off. */
+		as->cont.err = -ECANCELED;
+		as->fn(NULL, as);
+	}
+}
+
+static void asend_cb(struct mconn *conn, struct mtran *tr)
+{
+	struct asend_mtran *atr = (struct asend_mtran *)tr->priv;
+
+	if (atr->flags & BSF_RESP) {
+		if (tr->state == MTRAN_STATE_SENT) {
+			if (tr->m == NULL) {
+				mtran_recv_next(conn, tr);
+				return;
+			}
+		}
+		else if (tr->state != MTRAN_STATE_RECV) {
+			abort();
+		}
+	}
+	else if (tr->state != MTRAN_STATE_SENT) {
+		abort();
+	}
+	asend_put(atr->as);
+}
+
+int asend_add(struct asend *as, struct msgr *msgr, uint8_t flags,
+	struct msg *msg, uint32_t addr, uint16_t port, int timeo, void *tag)
+{
+	struct mtran *tr;
+
+	tr = mtran_alloc(msgr);
+	if (!tr)
+		return -ENOMEM;
+	tr->ip = addr;
+	tr->port = port;
+	return asend_add_tr_or_free(as, msgr, flags, msg, tr, timeo, tag);
+}
+
+int asend_add_tr_or_free(struct asend *as, struct msgr *msgr, uint8_t flags,
+		struct msg *msg, struct mtran *tr, int timeo, void *tag)
+{
+	struct asend_mtran *atr;
+
+	if (as->num_tr >= as->max_tr) {
+		mtran_free(tr);
+		return -EMFILE;
+	}
+	atr = &as->atrs[as->num_tr];
+	atr->tr = tr;
+	atr->as = as;
+	atr->tag = tag;
+	atr->flags = flags;
+	as->num_tr++;
+	__sync_fetch_and_add(&as->num_pending, 1);
+	mtran_send(msgr, tr, asend_cb, atr, msg, timeo);
+	return 0;
+}
+
+void asend_join(struct asend *as, asend_cont_fn_t fn)
+{
+	as->fn = fn;
+	asend_put(as);
+}
+
+struct mtran *asend_get_mtran(struct asend *as, int ntr)
+{
+	if (ntr >= as->num_tr)
+		return NULL;
+	return as->atrs[ntr].tr;
+}
+
+void *asend_get_mtran_tag(struct asend *as, int ntr)
+{
+	if (ntr >= as->num_tr)
+		return NULL;
+	return as->atrs[ntr].tag;
+}
+
+int asend_get_num_sent(const struct asend *as)
+{
+	return as->num_tr;
+}
+
+int asend_get_err(const struct asend *as)
+{
+	return as->cont.err;
+}
+
+void *asend_get_priv(const struct asend *as)
+{
+	return as->priv;
+}
+
+void asend_free(struct asend *as)
+{
+	int i;
+
+	for (i = 0; i < as->num_tr; ++i)
+		mtran_free(as->atrs[i].tr);
+	free(as);
+}
+
+static void asend_reply_cb(POSSIBLY_UNUSED(struct mconn *conn),
+		struct mtran *tr)
+{
+	if (tr->state != MTRAN_STATE_SENT)
+		abort();
+	mtran_free(tr);
+}
+
+void asend_reply(struct mtran *tr, struct msg *r)
+{
+	mtran_send(tr->priv, tr, asend_reply_cb, NULL, r, ASEND_REPLY_TIMEO);
+}
+
+int asend_std_reply(struct mtran *tr, int32_t ret)
+{
+	struct msg *r;
+
+	r = resp_alloc(ret);
+	if (IS_ERR(r)) {
+		mtran_free(tr);
+		return -ENOMEM;
+	}
+	asend_reply(tr, r);
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_MSG_ASEND_DOT_H
+#define REDFISH_MSG_ASEND_DOT_H
+
+/*
+ * Redfish asynchronous RPC implementation
+ *
+ * This is the non-blocking counterpart of bsend.  A recv_pool handler which
+ * needs to make RPCs of its own creates an asend context, adds the RPCs to it,
+ * and then calls asend_join with a continuation.  Instead of waiting, the
+ * handler returns, and its thread goes on to handle other messages.  Once all
+ * the RPCs have completed, the continuation is run by some thread of the
+ * receive pool.  This way, a few threads can keep many requests in flight.
+ */
+
+#include <stdint.h> /* for uint32_t, etc. */
+
+struct asend;
+struct msg;
+struct msgr;
+struct mtran;
+struct recv_pool;
+struct recv_pool_thread;
+
+/** Continuation for an asend context
+ *
+ * The return value is treated the same way as the return value of a
+ * recv_pool_handler_fn_t.  The continuation is responsible for calling
+ * asend_free.
+ *
+ * If the receive pool was joined before the continuation could run, it is
+ * called with rt set to NULL, and asend_get_err returns -ECANCELED.  In that
+ * case it should free the context and its private data without sending
+ * anything.
+ */
+typedef int (*asend_cont_fn_t)(struct recv_pool_thread *rt, struct asend *as);
+
+/** Create an asynchronous RPC sending context
+ *
+ * @param rpool		Receive pool which will run the continuation
+ * @param max_tr	Maximum number of RPCs that can be added
+ * @param priv		Private data for the continuation
+ *
+ * @return		Pointer to a valid asend context, or an error pointer
+ */
+extern struct asend *asend_init(struct recv_pool *rpool, int max_tr,
+		void *priv);
+
+/** Send out an RPC message
+ *
+ * This function will allocate a transactor for you.  If the add fails, msg
+ * still belongs to the caller.
+ *
+ * @param as		The asend context
+ * @param msgr		Messenger to send the message on
+ * @param flags		Flags to use (see BSF_RESP)
+ * @param msg		The message
+ * @param addr		The destination address
+ * @param port		The destination port
+ * @param timeo		Timeout in seconds
+ * @param tag		Tag to associate with this RPC
+ *
+ * @return		0 on success; error code otherwise
+ */
+extern int asend_add(struct asend *as, struct msgr *msgr, uint8_t flags,
+	struct msg *msg, uint32_t addr, uint16_t port, int timeo, void *tag);
+
+/** Send out an RPC message on an existing transactor
+ *
+ * If the add fails, the transactor will be freed using mtran_free, but msg
+ * still belongs to the caller.
+ *
+ * @param as		The asend context
+ * @param msgr		Messenger to send the message on
+ * @param flags		Flags to use (see BSF_RESP)
+ * @param msg		The message
+ * @param tr		The transactor to use
+ * @param timeo		Timeout in seconds
+ * @param tag		Tag to associate with this RPC
+ *
+ * @return		0 on success; error code otherwise
+ */
+extern int asend_add_tr_or_free(struct asend *as, struct msgr *msgr,
+		uint8_t flags, struct msg *msg, struct mtran *tr, int timeo,
+		void *tag);
+
+/** Arrange for a continuation to run once all the RPCs have completed
+ *
+ * This does not block.  No more RPCs may be added after this is called, and
+ * the caller must not touch the context again; from now on it belongs to the
+ * continuation.  If no RPCs were added, the continuation is posted right away.
+ *
+ * If the receive pool has already been joined by the time the RPCs complete,
+ * the continuation is called right away with rt set to NULL, from whichever
+ * thread completed the last RPC, so that it can clean up.
+ *
+ * @param as		The asend context
+ * @param fn		The continuation
+ */
+extern void asend_join(struct asend *as, asend_cont_fn_t fn);
+
+/** Access an mtran
+ *
+ * This must be invoked from the continuation.  The meaning of tr->m is the
+ * same as for bsend_get_mtran.
+ *
+ * @param as		The asend context
+ * @param ntr		The mtran to get
+ *
+ * @return		the mtran, or NULL if ntr is out of range
+ */
+extern struct mtran *asend_get_mtran(struct asend *as, int ntr);
+
+/** Get the tag for an mtran.
+ *
+ * @param as		The asend context
+ * @param ntr		Index of the tag to get
+ *
+ * @return		The mtran tag
+ */
+extern void *asend_get_mtran_tag(struct asend *as, int ntr);
+
+/** Get the number of messages sent
+ *
+ * @param as		The asend context
+ *
+ * @return		The number of messages sent
+ */
+extern int asend_get_num_sent(const struct asend *as);
+
+/** Get the error status of a continuation
+ *
+ * @param as		The asend context
+ *
+ * @return		0 normally; -ECANCELED if the continuation is only
+ *			being run so that it can clean up
+ */
+extern int asend_get_err(const struct asend *as);
+
+/** Get the private data that was passed to asend_init
+ *
+ * @param as		The asend context
+ *
+ * @return		The private data
+ */
+extern void *asend_get_priv(const struct asend *as);
+
+/** Free an asend context, along with all of its transactors
+ *
+ * This may be called from the continuation, or on a context which has not been
+ * joined yet and has no RPCs in flight.
+ *
+ * @param as		The asend context
+ */
+extern void asend_free(struct asend *as);
+
+/** Send a reply back to the sender, without waiting for it to go out
+ *
+ * The transactor will be freed once the reply has been sent, or sending has
+ * failed.
+ * Note: we assume that tr->priv holds the originating messenger
+ *
+ * @param tr		The transactor
+ * @param r		The reply to send
+ */
+extern void asend_reply(struct mtran *tr, struct msg *r);
+
+/** Send an mmm_resp reply back to the sender, without waiting for it to go out
+ *
+ * Note: we assume that tr->priv holds the originating messenger
+ *
+ * @param tr		The transactor
+ * @param ret		The error code to put into mmm_resp
+ *
+ * @return		0 on success; -ENOMEM if we couldn't allocate the
+ *			reply, in which case the transactor is freed
+ */
+extern int asend_std_reply(struct mtran *tr, int32_t ret);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/alarm.h"
+#include "core/process_ctx.h"
+#include "msg/asend.h"
+#include "msg/bsend.h"
+#include "msg/msg.h"
+#include "msg/msgr.h"
+#include "msg/recv_pool.h"
+#include "util/compiler.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/macro.h"
+#include "util/packed.h"
+#include "util/test.h"
+#include "util/time.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ASEND_UNIT_BAR_PORT 9096
+#define ASEND_UNIT_BAZ_PORT 9097
+
+/** Number of requests we keep in flight at once */
+#define ASEND_UNIT_NUM_REQ 50
+
+/** Number of threads in the receive pool.  This is much smaller than
+ * ASEND_UNIT_NUM_REQ, so if the handlers blocked waiting for their sub-RPCs,
+ * the test would never finish. */
+#define ASEND_UNIT_NUM_THREADS 2
+
+enum {
+	mmm_test50_ty = 9050,
+	mmm_test51_ty,
+};
+
+PACKED(
+struct mmm_test50 {
+	struct msg base;
+	uint32_t x;
+	uint32_t y;
+});
+
+PACKED(
+struct mmm_test51 {
+	struct msg base;
+	uint32_t z;
+});
+
+static uint32_t g_localhost;
+
+static struct msgr *g_baz_msgr;
+
+/** Requests which baz is sitting on.  Only touched by baz's messenger
+ * thread. */
+static struct mtran *g_baz_held[ASEND_UNIT_NUM_REQ];
+
+static int g_baz_num_held;
+
+static struct msg *test51_alloc(uint32_t z)
+{
+	struct mmm_test51 *m;
+
+	m = calloc_msg(mmm_test51_ty, sizeof(struct mmm_test51));
+	if (!m)
+		abort();
+	pack_to_be32(&m->z, z);
+	return (struct msg*)m;
+}
+
+/** baz doesn't answer any requests until it has all of them.  This can only
+ * happen if bar has every request in flight at once. */
+static void baz_cb(POSSIBLY_UNUSED(struct mconn *conn), struct mtran *tr)
+{
+	struct mmm_test50 *m;
+	uint32_t x, y;
+	int i;
+
+	if (tr->state == MTRAN_STATE_SENT) {
+		mtran_free(tr);
+		return;
+	}
+	if (tr->state != MTRAN_STATE_RECV)
+		abort();
+	g_baz_held[g_baz_num_held++] = tr;
+	if (g_baz_num_held < ASEND_UNIT_NUM_REQ)
+		return;
+	for (i = 0; i < g_baz_num_held; ++i) {
+		tr = g_baz_held[i];
+		m = (struct mmm_test50*)tr->m;
+		x = unpack_from_be32(&m->x);
+		y = unpack_from_be32(&m->y);
+		msg_release(tr->m);
+		tr->m = NULL;
+		mtran_send(g_baz_msgr, tr, baz_cb, NULL, test51_alloc(x + y),
+			60);
+	}
+	g_baz_num_held = 0;
+}
+
+static int bar_cont(POSSIBLY_UNUSED(struct recv_pool_thread *rt),
+		struct asend *as)
+{
+	struct mtran *tr, *ctr;
+	struct mmm_test51 *m;
+
+	ctr = asend_get_priv(as);
+	if (asend_get_err(as)) {
+		asend_free(as);
+		mtran_free(ctr);
+		return 0;
+	}
+	tr = asend_get_mtran(as, 0);
+	if ((tr == NULL) || IS_ERR(tr->m) || (tr->m == NULL))
+		abort();
+	m = (struct mmm_test51*)tr->m;
+	if (unpack_from_be16(&m->base.ty) != mmm_test51_ty)
+		abort();
+	asend_reply(ctr, test51_alloc(unpack_from_be32(&m->z)));
+	asend_free(as);
+	return 0;
+}
+
+/** bar passes each request on to baz, and replies once baz has answered */
+static int bar_handler(struct recv_pool_thread *rt, struct mtran *tr)
+{
+	struct mmm_test50 *m, *mout;
+	struct asend *as;
+
+	m = (struct mmm_test50*)tr->m;
+	tr->m = NULL;
+	if (unpack_from_be16(&m->base.ty) != mmm_test50_ty)
+		abort();
+	mout = calloc_msg(mmm_test50_ty, sizeof(struct mmm_test50));
+	if (!mout)
+		abort();
+	mout->x = m->x;
+	mout->y = m->y;
+	msg_release((struct msg*)m);
+	as = asend_init(rt->rpool, 1, tr);
+	if (IS_ERR(as))
+		abort();
+	/* tr->priv holds the messenger that the request came in on */
+	if (asend_add(as, tr->priv, BSF_RESP, (struct msg*)mout,
+			g_localhost, ASEND_UNIT_BAZ_PORT, 60, NULL))
+		abort();
+	asend_join(as, bar_cont);
+	return 0;
+}
+
+static struct msgr *asend_test_msgr_init(const char *name)
+{
+	char err[512] = { 0 };
+	struct msgr *msgr;
+	struct msgr_conf conf;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.max_conn = 10;
+	conf.max_tran = 1000;
+	conf.tcp_teardown_timeo = 360;
+	conf.name = name;
+	conf.fl_mgr = g_fast_log_mgr;
+	msgr = msgr_init(err, sizeof(err), &conf);
+	if (err[0]) {
+		fprintf(stderr, "msgr_init failed: %s\n", err);
+		return NULL;
+	}
+	return msgr;
+}
+
+static int asend_test_in_flight(struct fast_log_buf *fb)
+{
+	int i;
+	char err[512] = { 0 };
+	struct msgr *foo_msgr, *bar_msgr;
+	struct recv_pool *rpool;
+	struct listen_info linfo;
+	struct recv_pool_stats stats;
+	struct bsend *ctx;
+	struct mmm_test50 *m;
+	struct mmm_test51 *r;
+	struct mtran *tr;
+
+	foo_msgr = asend_test_msgr_init("foo_msgr");
+	EXPECT_NOT_EQ(foo_msgr, NULL);
+	bar_msgr = asend_test_msgr_init("bar_msgr");
+	EXPECT_NOT_EQ(bar_msgr, NULL);
+	g_baz_msgr = asend_test_msgr_init("baz_msgr");
+	EXPECT_NOT_EQ(g_baz_msgr, NULL);
+	memset(&linfo, 0, sizeof(linfo));
+	linfo.cb = baz_cb;
+	linfo.port = ASEND_UNIT_BAZ_PORT;
+	msgr_listen(g_baz_msgr, &linfo, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	rpool = recv_pool_init("asend_rpool");
+	EXPECT_NOT_ERRPTR(rpool);
+	for (i = 0; i < ASEND_UNIT_NUM_THREADS; ++i) {
+		EXPECT_ZERO(recv_pool_thread_create(rpool, g_fast_log_mgr,
+			bar_handler, NULL));
+	}
+	recv_pool_msgr_listen(rpool, bar_msgr, ASEND_UNIT_BAR_PORT,
+			err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(foo_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(bar_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(g_baz_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+
+	ctx = bsend_init(fb, ASEND_UNIT_NUM_REQ);
+	EXPECT_NOT_ERRPTR(ctx);
+	for (i = 0; i < ASEND_UNIT_NUM_REQ; ++i) {
+		m = calloc_msg(mmm_test50_ty, sizeof(struct mmm_test50));
+		EXPECT_NOT_EQ(m, NULL);
+		pack_to_be32(&m->x, i);
+		pack_to_be32(&m->y, 1000);
+		EXPECT_ZERO(bsend_add(ctx, foo_msgr, BSF_RESP, (struct msg*)m,
+			g_localhost, ASEND_UNIT_BAR_PORT, 60, NULL));
+	}
+	EXPECT_EQ(bsend_join(ctx), ASEND_UNIT_NUM_REQ);
+	for (i = 0; i < ASEND_UNIT_NUM_REQ; ++i) {
+		tr = bsend_get_mtran(ctx, i);
+		EXPECT_NOT_ERRPTR(tr->m);
+		EXPECT_NOT_EQ(tr->m, NULL);
+		r = (struct mmm_test51*)tr->m;
+		EXPECT_EQ(unpack_from_be16(&r->base.ty), mmm_test51_ty);
+		EXPECT_EQ(unpack_from_be32(&r->z), (uint32_t)(i + 1000));
+	}
+	bsend_reset(ctx);
+	bsend_free(ctx);
+
+	recv_pool_join(rpool);
+	/* Each request was handled once, and its continuation run once */
+	recv_pool_get_stats(rpool, &stats);
+	EXPECT_EQ(stats.handled, 2 * ASEND_UNIT_NUM_REQ);
+	recv_pool_free(rpool);
+	msgr_shutdown(foo_msgr);
+	msgr_shutdown(bar_msgr);
+	msgr_shutdown(g_baz_msgr);
+	msgr_free(foo_msgr);
+	msgr_free(bar_msgr);
+	msgr_free(g_baz_msgr);
+	return 0;
+}
+
+int main(POSSIBLY_UNUSED(int argc), char **argv)
+{
+	struct fast_log_buf *fb;
+	timer_t timer;
+	time_t t;
+
+	EXPECT_ZERO(utility_ctx_init(argv[0]));
+	t = mt_time() + 600;
+	EXPECT_ZERO(mt_set_alarm(t, "asend_unit timed out", &timer));
+	EXPECT_ZERO(get_localhost_ipv4(&g_localhost));
+	fb = fast_log_create(g_fast_log_mgr, "main");
+	EXPECT_NOT_ERRPTR(fb);
+	EXPECT_ZERO(asend_test_in_flight(fb));
+	fast_log_free(fb);
+	EXPECT_ZERO(mt_deactivate_alarm(timer));
+	process_ctx_shutdown();
+
+	return EXIT_SUCCESS;
+}
@@ -30,45 +30,155 @@
 #include "util/packed.h"
 #include "util/terror.h"
 #include "util/thread.h"
+#include "util/time.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+/** Number of slots in the first chunk of a bsend context.  Each chunk after
+ * that is twice as big as the one before. */
+#define BSEND_CHUNK0_SLOTS 8
+
+/** Maximum number of chunks in a bsend context */
+#define BSEND_MAX_CHUNKS 24
+
+/** Number of chunks that bsend_reset keeps around for the next round of
+ * RPCs.  Anything past this was only needed for an unusually big round, so we
+ * give it back. */
+#define BSEND_KEEP_CHUNKS 4
+
 struct bsend_mtran {
 	struct mtran *tr;
 	struct bsend *ctx;
 	void *tag;
 	uint8_t flags;
+	/** Nonzero once the RPC has finished.  Protected by ctx->lock. */
+	uint8_t done;
 };
 
 /** A blocking RPC context */
 struct bsend {
-	/** Protects num_finished */
+	/** Protects num_finished, num_ok, quorum, num_orphans, the done flags
+	 * of the slots, and the priv fields of the transactors */
 	pthread_mutex_t lock;
 	/** Condition variable to wait for completion of RPCs */
 	pthread_cond_t cond;
 	/** Fast log buffer we use for operations */
 	struct fast_log_buf *fb;
-	/** Array of pointers to bsend transactors */
-	struct bsend_mtran *btrs;
-	/** Length of btrs */
+	/** The bsend transactors.  Chunk i holds (BSEND_CHUNK0_SLOTS << i)
+	 * slots.  We never move a slot once it has been handed out, since the
+	 * messenger holds a pointer to it. */
+	struct bsend_mtran *chunks[BSEND_MAX_CHUNKS];
+	/** Number of chunks allocated */
+	int num_chunks;
+	/** Total number of slots in the allocated chunks */
+	int num_slots;
+	/** Maximum number of transactors */
 	int max_tr;
 	/** Current number of transactions */
 	int num_tr;
 	/** Number of finished transactors */
 	int num_finished;
+	/** Number of transactors that finished successfully */
+	int num_ok;
+	/** The number of successes that the current join is waiting for */
+	int quorum;
+	/** Transactors which were still in flight when the context was reset
+	 * are handed over to one of these, depending on whether they expect a
+	 * response.  They free themselves when they finish. */
+	struct bsend_mtran orphans[2];
+	/** Number of orphaned transactors still in flight */
+	int num_orphans;
+	/** Monotonic time in milliseconds after which RPCs made with this
+	 * context are pointless, or 0 if there is no deadline */
+	uint64_t deadline_ms;
 };
 
+/** Memory used by all bsend contexts */
+static struct bsend_mem_stats g_bsend_mem_stats;
+
+static int bsend_chunk_slots(int chunk)
+{
+	return BSEND_CHUNK0_SLOTS << chunk;
+}
+
+/** Find the bsend transactor in a given slot */
+static struct bsend_mtran *bsend_slot(const struct bsend *ctx, int ntr)
+{
+	int chunk;
+	unsigned int n;
+
+	/* Chunk i starts at slot BSEND_CHUNK0_SLOTS * ((1 << i) - 1) */
+	n = (ntr + BSEND_CHUNK0_SLOTS) / BSEND_CHUNK0_SLOTS;
+	chunk = (sizeof(unsigned int) * 8) - 1 - __builtin_clz(n);
+	return &ctx->chunks[chunk][ntr -
+		(BSEND_CHUNK0_SLOTS * ((1 << chunk) - 1))];
+}
+
+static void bsend_mem_account(int64_t bytes)
+{
+	uint64_t cur, peak;
+
+	cur = __sync_add_and_fetch(&g_bsend_mem_stats.cur_bytes, bytes);
+	while (1) {
+		peak = g_bsend_mem_stats.peak_bytes;
+		if (cur <= peak)
+			break;
+		if (__sync_bool_compare_and_swap(&g_bsend_mem_stats.peak_bytes,
+				peak, cur))
+			break;
+	}
+}
+
+/** Add another chunk of slots to a bsend context
+ *
+ * @return		0 on success; -ENOMEM on OOM, or -EMFILE if the
+ *			context can't grow any more
+ */
+static int bsend_grow(struct bsend *ctx)
+{
+	int slots;
+	struct bsend_mtran *chunk;
+
+	if (ctx->num_chunks >= BSEND_MAX_CHUNKS)
+		return -EMFILE;
+	slots = bsend_chunk_slots(ctx->num_chunks);
+	chunk = calloc(slots, sizeof(struct bsend_mtran));
+	if (!chunk)
+		return -ENOMEM;
+	ctx->chunks[ctx->num_chunks++] = chunk;
+	ctx->num_slots += slots;
+	__sync_fetch_and_add(&g_bsend_mem_stats.num_grow, 1);
+	bsend_mem_account(slots * sizeof(struct bsend_mtran));
+	return 0;
+}
+
+/** Free all the chunks of a bsend context past the first 'keep' */
+static void bsend_shrink(struct bsend *ctx, int keep)
+{
+	int slots;
+
+	while (ctx->num_chunks > keep) {
+		ctx->num_chunks--;
+		slots = bsend_chunk_slots(ctx->num_chunks);
+		free(ctx->chunks[ctx->num_chunks]);
+		ctx->chunks[ctx->num_chunks] = NULL;
+		ctx->num_slots -= slots;
+		bsend_mem_account(-(int64_t)(slots *
+				sizeof(struct bsend_mtran)));
+	}
+}
+
 struct bsend *bsend_init(struct fast_log_buf *fb, int max_tr)
 {
 	int ret;
 	struct bsend *ctx;
-	struct bsend_mtran *btrs;
 
 	ctx = calloc(1, sizeof(struct bsend));
 	if (!ctx) {
@@ -76,20 +186,25 @@ struct bsend *bsend_init(struct fast_log_buf *fb, int max_tr)
 		goto error;
 	}
 	ctx->fb = fb;
-	btrs = calloc(max_tr, sizeof(struct bsend_mtran));
-	if (!btrs) {
-		ret = ENOMEM;
-		goto error_free_ctx;
-	}
 	ctx->max_tr = max_tr;
-	ctx->btrs = btrs;
 	ctx->num_tr = 0;
+	ctx->quorum = INT_MAX;
+	ctx->orphans[0].ctx = ctx;
+	ctx->orphans[1].ctx = ctx;
+	ctx->orphans[1].flags = BSF_RESP;
+	/* Start out small.  Most contexts never make more than a handful of
+	 * RPCs at once; bsend_add will grow the context if it needs to. */
+	ret = bsend_grow(ctx);
+	if (ret)
+		goto error_free_ctx;
 	ret = pthread_mutex_init(&ctx->lock, NULL);
 	if (ret)
 		goto error_free_btrs;
 	ret = pthread_cond_init_mt(&ctx->cond);
 	if (ret)
 		goto error_destroy_lock;
+	__sync_fetch_and_add(&g_bsend_mem_stats.num_ctx, 1);
+	bsend_mem_account(sizeof(struct bsend));
 	fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_INIT,
 			0, 0, 0, 0, max_tr);
 	return ctx;
@@ -97,40 +212,47 @@ struct bsend *bsend_init(struct fast_log_buf *fb, int max_tr)
 error_destroy_lock:
 	pthread_mutex_destroy(&ctx->lock);
 error_free_btrs:
-	free(btrs);
+	bsend_shrink(ctx, 0);
 error_free_ctx:
 	free(ctx);
 error:
 	ret = FORCE_POSITIVE(ret);
-	fast_log_bsend(ctx->fb, FAST_LOG_BSEND_ERROR, FLBS_INIT,
+	fast_log_bsend(fb, FAST_LOG_BSEND_ERROR, FLBS_INIT,
 		0, 0, 0, cram_into_u16(ret), max_tr);
 	return ERR_PTR(ret);
 }
 
-static void bsend_cb_complete(struct bsend *ctx)
+static int bsend_btr_is_orphan(const struct bsend *ctx,
+		const struct bsend_mtran *btr)
 {
-	pthread_mutex_lock(&ctx->lock);
-	++ctx->num_finished;
-	if (ctx->num_finished == ctx->num_tr)
-		pthread_cond_signal(&ctx->cond);
-	pthread_mutex_unlock(&ctx->lock);
+	return (btr == &ctx->orphans[0]) || (btr == &ctx->orphans[1]);
 }
 
 static void bsend_cb(struct mconn *conn, struct mtran *tr)
 {
 	struct bsend_mtran *btr = (struct bsend_mtran *)tr->priv;
 	struct bsend *ctx = btr->ctx;
+	int ok;
 
+	/* bsend_reset may hand this transactor over to an orphan slot at any
+	 * time, so look at tr->priv again once we hold the lock. */
+	pthread_mutex_lock(&ctx->lock);
+	btr = (struct bsend_mtran *)tr->priv;
 	if (btr->flags & BSF_RESP) {
-		/* Let's get the response */
 		if (tr->state == MTRAN_STATE_SENT) {
-			if (tr->m == NULL)
+			if (tr->m == NULL) {
+				/* Let's get the response.  mtran_recv_next
+				 * may call us right back, so drop the lock
+				 * first. */
+				pthread_mutex_unlock(&ctx->lock);
 				mtran_recv_next(conn, tr);
-			return;
+				return;
+			}
+			/* We couldn't send the request */
+			ok = 0;
 		}
 		else if (tr->state == MTRAN_STATE_RECV) {
-			bsend_cb_complete(ctx);
-			return;
+			ok = !IS_ERR(tr->m);
 		}
 		else {
 			abort();
@@ -139,13 +261,28 @@ static void bsend_cb(struct mconn *conn, struct mtran *tr)
 	else {
 		/* We don't expect a response */
 		if (tr->state == MTRAN_STATE_SENT) {
-			bsend_cb_complete(ctx);
-			return;
+			ok = (tr->m == NULL);
 		}
 		else {
 			abort();
 		}
 	}
+	if (bsend_btr_is_orphan(ctx, btr)) {
+		/* Nobody is interested in this transactor any more. */
+		mtran_free(tr);
+		if (--ctx->num_orphans == 0)
+			pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+		return;
+	}
+	btr->done = 1;
+	++ctx->num_finished;
+	if (ok)
+		++ctx->num_ok;
+	if ((ctx->num_finished == ctx->num_tr) ||
+			(ok && (ctx->num_ok == ctx->quorum)))
+		pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
 }
 
 int bsend_add(struct bsend *ctx, struct msgr *msgr, uint8_t flags,
@@ -167,22 +304,52 @@ int bsend_add(struct bsend *ctx, struct msgr *msgr, uint8_t flags,
 int bsend_add_tr_or_free(struct bsend *ctx, struct msgr *msgr, uint8_t flags,
 		struct msg *msg, struct mtran *tr, int timeo, void *tag)
 {
+	int ret;
+	uint64_t now;
 	struct bsend_mtran *btr;
 
+	if (ctx->deadline_ms) {
+		now = mt_time_ms();
+		if (now >= ctx->deadline_ms) {
+			fast_log_bsend(ctx->fb, FAST_LOG_BSEND_ERROR,
+				FLBS_ADD_TR, tr->port, tr->ip, flags,
+				ETIMEDOUT, ctx->num_tr);
+			mtran_free(tr);
+			return -ETIMEDOUT;
+		}
+	}
 	if (ctx->num_tr >= ctx->max_tr) {
 		fast_log_bsend(ctx->fb, FAST_LOG_BSEND_ERROR, FLBS_ADD_TR,
 			       tr->port, tr->ip, flags, EMFILE, ctx->num_tr);
 		mtran_free(tr);
 		return -EMFILE;
 	}
-	btr = &ctx->btrs[ctx->num_tr];
+	if (ctx->num_tr >= ctx->num_slots) {
+		ret = bsend_grow(ctx);
+		if (ret) {
+			fast_log_bsend(ctx->fb, FAST_LOG_BSEND_ERROR,
+				FLBS_ADD_TR, tr->port, tr->ip, flags,
+				FORCE_POSITIVE(ret), ctx->num_tr);
+			mtran_free(tr);
+			return ret;
+		}
+	}
+	btr = bsend_slot(ctx, ctx->num_tr);
 	btr->tr = tr;
 	btr->ctx = ctx;
 	btr->tag = tag;
 	btr->flags = flags;
+	btr->done = 0;
 	ctx->num_tr++;
 	fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_ADD_TR,
 			tr->port, tr->ip, flags, 0, ctx->num_tr);
+	if (ctx->deadline_ms && (timeo <= MSGR_TIMEOUT_MAX) &&
+			(ctx->deadline_ms - now < (uint64_t)timeo * 1000)) {
+		/* Don't wait any longer than whoever we're working for. */
+		mtran_send_ms(msgr, tr, bsend_cb, btr, msg,
+			ctx->deadline_ms - now);
+		return 0;
+	}
 	mtran_send(msgr, tr, bsend_cb, btr, msg, timeo);
 	return 0;
 }
@@ -203,18 +370,54 @@ int bsend_join(struct bsend *ctx)
 	}
 }
 
+int bsend_join_quorum(struct bsend *ctx, int quorum)
+{
+	int num_ok;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->quorum = quorum;
+	while (1) {
+		fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_JOIN,
+			       0, 0, 0, 0, ctx->num_tr - ctx->num_finished);
+		if ((ctx->num_ok >= quorum) ||
+				(ctx->num_finished == ctx->num_tr))
+			break;
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
+	}
+	ctx->quorum = INT_MAX;
+	num_ok = ctx->num_ok;
+	pthread_mutex_unlock(&ctx->lock);
+	fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_JOIN,
+			0, 0, 1, 0, num_ok);
+	return num_ok;
+}
+
+int bsend_join_any(struct bsend *ctx)
+{
+	return bsend_join_quorum(ctx, 1);
+}
+
 struct mtran *bsend_get_mtran(struct bsend *ctx, int ntr)
 {
+	struct bsend_mtran *btr;
+	int done;
+
 	if (ntr >= ctx->num_tr)
 		return NULL;
-	return ctx->btrs[ntr].tr;
+	btr = bsend_slot(ctx, ntr);
+	pthread_mutex_lock(&ctx->lock);
+	done = btr->done;
+	pthread_mutex_unlock(&ctx->lock);
+	if (!done)
+		return ERR_PTR(EINPROGRESS);
+	return btr->tr;
 }
 
 void *bsend_get_mtran_tag(struct bsend *ctx, int ntr)
 {
 	if (ntr >= ctx->num_tr)
 		return NULL;
-	return ctx->btrs[ntr].tag;
+	return bsend_slot(ctx, ntr)->tag;
 }
 
 int bsend_get_num_sent(const struct bsend *ctx)
@@ -224,40 +427,76 @@ int bsend_get_num_sent(const struct bsend *ctx)
 
 void bsend_reset(struct bsend *ctx)
 {
-	int i;
+	int i, keep;
 	int32_t diff;
+	struct bsend_mtran *btr;
 
+	pthread_mutex_lock(&ctx->lock);
 	diff = ctx->num_tr;
 	diff -= ctx->num_finished;
-	if (diff != 0) {
-		/* We should not reset a bsend context that still has unfinished
-		 * transactors. */
-		fast_log_bsend(ctx->fb, FAST_LOG_BSEND_ERROR, FLBS_RESET,
-				0, 0, 0, EINVAL, (uint32_t)diff);
-	}
-	else {
-		fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_RESET,
-				0, 0, 0, 0, 0);
-	}
+	fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_RESET,
+			0, 0, 0, 0, (uint32_t)diff);
 	for (i = 0; i < ctx->num_tr; ++i) {
-		mtran_free(ctx->btrs[i].tr);
-		ctx->btrs[i].tr = NULL;
-		ctx->btrs[i].flags = 0;
+		btr = bsend_slot(ctx, i);
+		if (btr->done) {
+			mtran_free(btr->tr);
+		}
+		else {
+			/* This RPC is still in flight; presumably we stopped
+			 * waiting for it after reaching a quorum.  Let it
+			 * finish in the background.  bsend_cb will free the
+			 * transactor. */
+			btr->tr->priv = &ctx->orphans[
+				(btr->flags & BSF_RESP) ? 1 : 0];
+			ctx->num_orphans++;
+		}
+		btr->tr = NULL;
+		btr->flags = 0;
+		btr->done = 0;
 	}
 	ctx->num_tr = 0;
 	ctx->num_finished = 0;
+	ctx->num_ok = 0;
+	/* Keep the first few chunks for next time, so that a context which is
+	 * used over and over again doesn't keep going back to malloc.  If
+	 * there are orphans, bsend_cb may be about to look at the slots they
+	 * came from, so we can't free any chunks yet. */
+	keep = (ctx->num_orphans == 0) ? BSEND_KEEP_CHUNKS : ctx->num_chunks;
+	pthread_mutex_unlock(&ctx->lock);
+	bsend_shrink(ctx, keep);
 }
 
 void bsend_free(struct bsend *ctx)
 {
 	fast_log_bsend(ctx->fb, FAST_LOG_BSEND_DEBUG, FLBS_FREE,
 		0, 0, 0, 0, 0);
+	/* Wait for any orphans to finish.  They will all time out eventually,
+	 * even if nothing else happens to them. */
+	pthread_mutex_lock(&ctx->lock);
+	while (ctx->num_orphans != 0)
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
+	pthread_mutex_unlock(&ctx->lock);
 	pthread_mutex_destroy(&ctx->lock);
 	pthread_cond_destroy(&ctx->cond);
-	free(ctx->btrs);
+	bsend_shrink(ctx, 0);
+	__sync_fetch_and_sub(&g_bsend_mem_stats.num_ctx, 1);
+	bsend_mem_account(-(int64_t)sizeof(struct bsend));
 	free(ctx);
 }
 
+void bsend_set_deadline(struct bsend *ctx, uint64_t deadline_ms)
+{
+	ctx->deadline_ms = deadline_ms;
+}
+
+void bsend_get_mem_stats(struct bsend_mem_stats *stats)
+{
+	stats->num_ctx = g_bsend_mem_stats.num_ctx;
+	stats->cur_bytes = g_bsend_mem_stats.cur_bytes;
+	stats->peak_bytes = g_bsend_mem_stats.peak_bytes;
+	stats->num_grow = g_bsend_mem_stats.num_grow;
+}
+
 int bsend_reply(struct fast_log_buf *fb, struct bsend *ctx, struct mtran *tr,
 		struct msg *r)
 {
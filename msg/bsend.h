@@ -35,11 +35,26 @@ struct bsend;
 /** Blocking RPC flag: listen for a response to this message */
 #define BSF_RESP 0x1
 
+/** Memory used by bsend contexts, summed over the whole process */
+struct bsend_mem_stats {
+	/** Number of bsend contexts */
+	uint64_t num_ctx;
+	/** Bytes currently allocated */
+	uint64_t cur_bytes;
+	/** Highest value that cur_bytes has ever reached */
+	uint64_t peak_bytes;
+	/** Number of times a context has had to grow */
+	uint64_t num_grow;
+};
+
 /** Create a blocking RPC sending context
  *
  * There is no timeout parameter here; timeouts are determined by the messengers
  * that you use to send messages.
  *
+ * The context starts out with room for only a few procedure calls, and grows
+ * as needed, so max_tr can be generous.
+ *
  * @param fb		Fast log buffer to use for the bsend operations
  * @param max_tr	Maximum simultaneous procedure calls that can be made at
  *			a time with this context
@@ -50,7 +65,8 @@ extern struct bsend *bsend_init(struct fast_log_buf *fb, int max_tr);
 
 /** Send out an RPC message
  *
- * This function will allocate a transactor for you.
+ * This function will allocate a transactor for you.  If the add fails, msg
+ * still belongs to the caller.
  *
  * @param ctx		The blocking RPC context
  * @param msgr		Messenger to send the message on
@@ -68,7 +84,8 @@ extern int bsend_add(struct bsend *ctx, struct msgr *msgr, uint8_t flags,
 /** Send out an RPC message
  *
  * This function takes as a parameter an existing transactor.
- * If the add fails, the transactor will be freed using mtran_free.
+ * If the add fails, the transactor will be freed using mtran_free, but msg
+ * still belongs to the caller.
  *
  * @param ctx		The blocking RPC context
  * @param msgr		Messenger to send the message on
@@ -97,9 +114,40 @@ extern int bsend_add_tr_or_free(struct bsend *ctx, struct msgr *msgr,
  */
 extern int bsend_join(struct bsend *ctx);
 
+/** Block until enough of the RPC calls have succeeded.
+ *
+ * An RPC succeeds if it was sent and, if it has BSF_RESP, a response came
+ * back.  We return as soon as 'quorum' RPCs have succeeded, or once every RPC
+ * has finished, whichever comes first.
+ *
+ * The RPCs we didn't wait for keep going in the background.  Until they
+ * finish, bsend_get_mtran will return ERR_PTR(EINPROGRESS) for them.  It is
+ * fine to call bsend_reset without waiting for them: they will be freed when
+ * they finish or time out.
+ *
+ * @param ctx		The blocking RPC context
+ * @param quorum	The number of successful RPCs to wait for
+ *
+ * @return		The number of RPCs that have succeeded.  This is less
+ *			than quorum only if a quorum can no longer be reached.
+ */
+extern int bsend_join_quorum(struct bsend *ctx, int quorum);
+
+/** Block until the first RPC call succeeds, or all of them have failed.
+ *
+ * This is the same as bsend_join_quorum(ctx, 1).  It is meant for hedged
+ * requests, where the same question is asked of several servers.
+ *
+ * @param ctx		The blocking RPC context
+ *
+ * @return		The number of RPCs that have succeeded.  0 means that
+ *			they all failed.
+ */
+extern int bsend_join_any(struct bsend *ctx);
+
 /** Access an mtran
  *
- * This must be invoked after bsend_join.
+ * This must be invoked after bsend_join, bsend_join_quorum, or bsend_join_any.
  *
  * If a response is an ERR_PTR(ETIMEDOUT), that means that we timed out
  * waiting for a response.  If a response is some other error pointer, that
@@ -111,7 +159,9 @@ extern int bsend_join(struct bsend *ctx);
  * @param ctx		The blocking RPC context
  * @param ntr		The mtran to get
  *
- * @return		the mtran, or an error pointer on error
+ * @return		the mtran, or an error pointer on error.
+ *			ERR_PTR(EINPROGRESS) means that the RPC has not
+ *			finished yet.
  */
 extern struct mtran *bsend_get_mtran(struct bsend *ctx, int ntr);
 
@@ -139,13 +189,39 @@ extern int bsend_get_num_sent(const struct bsend *ctx);
  * After this is called, we can call bsend_add again to again begin making RPCs
  * with this context.
  *
+ * RPCs which are still in flight after bsend_join_quorum are left to finish in
+ * the background.
+ *
+ * Some of the memory used by the context is kept around for the next round of
+ * RPCs, but if the context grew unusually large, the excess is freed.
+ *
  * @param ctx		The blocking RPC context
  */
 extern void bsend_reset(struct bsend *ctx);
 
+/** Set a deadline for the RPCs made with a context
+ *
+ * RPCs added after this will time out no later than the deadline, whatever
+ * timeout they ask for.  Once the deadline has passed, bsend_add fails with
+ * -ETIMEDOUT.  recv_pool sets this to the deadline of the request being
+ * handled, so that sub-RPCs don't outlive the request that caused them.
+ *
+ * @param ctx		The blocking RPC context
+ * @param deadline_ms	Monotonic time in milliseconds (see mt_time_ms), or 0
+ *			for no deadline
+ */
+extern void bsend_set_deadline(struct bsend *ctx, uint64_t deadline_ms);
+
+/** Get memory usage statistics for all bsend contexts in this process
+ *
+ * @param stats		(out param) the statistics
+ */
+extern void bsend_get_mem_stats(struct bsend_mem_stats *stats);
+
 /** Free a blocking RPC context
  *
- * Must not be used on active contexts!
+ * Must not be used on active contexts!  If RPCs abandoned by bsend_reset are
+ * still in flight, this waits for them to finish.
  *
  * @param ctx		The blocking RPC context
  */
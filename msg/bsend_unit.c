@@ -102,17 +102,17 @@ static void bsend_test_cb(struct mconn *conn, struct mtran *tr)
 			"type %d\n", mmm_test30_ty, ty);
 		abort();
 	}
-	mout = calloc_msg(mmm_test31_ty, sizeof(struct mmm_test31));
-	if (!mout) {
-		fprintf(stderr, "bsend_test_cb: oom\n");
-		abort();
-	}
 	x = unpack_from_be32(&m->x);
 	y = unpack_from_be32(&m->y);
 	if ((x == 0) && (y == 0)) {
 		mtran_free(tr);
 		return;
 	}
+	mout = calloc_msg(mmm_test31_ty, sizeof(struct mmm_test31));
+	if (!mout) {
+		fprintf(stderr, "bsend_test_cb: oom\n");
+		abort();
+	}
 	pack_to_be32(&mout->z, x + y);
 	mtran_send_next(conn, tr, (struct msg*)mout, 60);
 	free(m);
@@ -140,6 +140,9 @@ static int bsend_test30(struct bsend *ctx, struct msgr *msgr, int flags,
 	pack_to_be32(&m->y, y);
 	EXPECT_EQ(bsend_add(ctx, msgr, flags, (struct msg*)m,
 			g_localhost, MSGR_UNIT_PORT, timeo, NULL), ex);
+	/* If the add failed, the message is still ours */
+	if (ex)
+		msg_release((struct msg*)m);
 	return 0;
 }
 
@@ -255,6 +258,88 @@ static int bsend_test_tr_timeo(struct fast_log_buf *fb, int simult)
 	return 0;
 }
 
+static int bsend_test_quorum(struct fast_log_buf *fb)
+{
+	int i;
+	struct bsend *ctx;
+	struct msgr *foo_msgr, *bar_msgr;
+	struct mtran *tr;
+
+	EXPECT_ZERO(bsend_test_setup(fb, &foo_msgr, &bar_msgr,
+			&ctx, 4, 1));
+	/* bsend_test_cb never answers a message with x = y = 0 */
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 0, 0, 0, 2));
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 1, 1, 0, 60));
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 2, 1, 0, 60));
+	EXPECT_EQ(bsend_join_quorum(ctx, 2), 2);
+	EXPECT_EQ(bsend_get_mtran(ctx, 0), ERR_PTR(EINPROGRESS));
+	for (i = 1; i < 3; ++i) {
+		tr = bsend_get_mtran(ctx, i);
+		EXPECT_NOT_ERRPTR(tr);
+		EXPECT_NOT_ERRPTR(tr->m);
+		EXPECT_NOT_EQ(tr->m, NULL);
+	}
+	/* The straggler finishes in the background, and the context can be
+	 * used again in the meantime. */
+	bsend_reset(ctx);
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 0, 0, 0, 2));
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 3, 1, 0, 60));
+	EXPECT_EQ(bsend_join_any(ctx), 1);
+	tr = bsend_get_mtran(ctx, 1);
+	EXPECT_NOT_ERRPTR(tr);
+	EXPECT_NOT_ERRPTR(tr->m);
+	bsend_reset(ctx);
+	/* If nothing can succeed, we still return once everything has
+	 * finished. */
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 0, 0, 0, 1));
+	EXPECT_EQ(bsend_join_any(ctx), 0);
+	tr = bsend_get_mtran(ctx, 0);
+	EXPECT_EQ(tr->m, ERR_PTR(ETIMEDOUT));
+	bsend_reset(ctx);
+	bsend_test_teardown(foo_msgr, bar_msgr, ctx);
+	return 0;
+}
+
+static int bsend_test_deadline(struct fast_log_buf *fb)
+{
+	struct bsend *ctx;
+	struct msgr *foo_msgr, *bar_msgr;
+	struct mtran *tr;
+
+	EXPECT_ZERO(bsend_test_setup(fb, &foo_msgr, &bar_msgr,
+			&ctx, 2, 1));
+	/* The deadline cuts the RPC's own 60 second timeout short */
+	bsend_set_deadline(ctx, mt_time_ms() + 200);
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 0, 0, 0, 60));
+	EXPECT_EQ(bsend_join(ctx), 1);
+	tr = bsend_get_mtran(ctx, 0);
+	EXPECT_EQ(tr->m, ERR_PTR(ETIMEDOUT));
+	bsend_reset(ctx);
+	/* Once the deadline has passed, we don't even try */
+	EXPECT_ZERO(bsend_test30(ctx, foo_msgr, BSF_RESP, 1, 1,
+			-ETIMEDOUT, 60));
+	bsend_set_deadline(ctx, 0);
+	bsend_test_teardown(foo_msgr, bar_msgr, ctx);
+	return 0;
+}
+
+static int bsend_test_grow(struct fast_log_buf *fb)
+{
+	struct bsend_mem_stats before, peak, after;
+
+	bsend_get_mem_stats(&before);
+	/* A context that can make a lot of RPCs doesn't cost a lot until it
+	 * makes them. */
+	EXPECT_ZERO(bsend_test_send(fb, 300, 2, 1));
+	bsend_get_mem_stats(&peak);
+	EXPECT_GT(peak.num_grow, before.num_grow);
+	EXPECT_GT(peak.peak_bytes, 300 * sizeof(void*));
+	bsend_get_mem_stats(&after);
+	EXPECT_EQ(after.num_ctx, before.num_ctx);
+	EXPECT_EQ(after.cur_bytes, before.cur_bytes);
+	return 0;
+}
+
 int main(POSSIBLY_UNUSED(int argc), char **argv)
 {
 	struct fast_log_buf *fb;
@@ -275,6 +360,9 @@ int main(POSSIBLY_UNUSED(int argc), char **argv)
 	EXPECT_ZERO(bsend_test_send(fb, 1, 1, 0));
 	EXPECT_ZERO(bsend_test_send(fb, 10, 5, 0));
 	EXPECT_ZERO(bsend_test_tr_timeo(fb, 5));
+	EXPECT_ZERO(bsend_test_grow(fb));
+	EXPECT_ZERO(bsend_test_quorum(fb));
+	EXPECT_ZERO(bsend_test_deadline(fb));
 	fast_log_free(fb);
 	EXPECT_ZERO(mt_deactivate_alarm(timer));
 	process_ctx_shutdown();
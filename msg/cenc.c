@@ -0,0 +1,160 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "msg/cenc.h"
+#include "msg/msg.h"
+#include "util/compiler.h"
+#include "util/error.h"
+#include "util/packed.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int cenc_is_compact(const struct msg *m)
+{
+	return !!(unpack_from_8(&m->flags) & MSG_FLAG_COMPACT);
+}
+
+void cenc_ep_set(struct cenc_ep *ep, uint32_t ip, uint16_t port)
+{
+	pack_to_be32(&ep->ip, ip);
+	pack_to_be32(&ep->port, port);
+}
+
+uint32_t cenc_ep_ip(const struct cenc_ep *ep)
+{
+	return unpack_from_be32(&ep->ip);
+}
+
+uint16_t cenc_ep_port(const struct cenc_ep *ep)
+{
+	return (uint16_t)unpack_from_be32(&ep->port);
+}
+
+static struct msg *cenc_msg_alloc(uint16_t ty, int32_t len, size_t extra_len)
+{
+	struct msg *m;
+	size_t tot;
+
+	tot = sizeof(struct msg) + len + extra_len;
+	if ((extra_len > INT32_MAX) || (tot > INT32_MAX))
+		return ERR_PTR(EINVAL);
+	m = calloc(1, tot);
+	if (!m)
+		return ERR_PTR(ENOMEM);
+	pack_to_be32(&m->len, tot);
+	pack_to_be16(&m->ty, ty);
+	pack_to_8(&m->flags, MSG_FLAG_COMPACT);
+	pack_to_8(&m->refcnt, 1);
+	return m;
+}
+
+/** Check that a message has the given type and uses the compact encoding
+ *
+ * @param m		The message
+ * @param ty		The expected message type
+ * @param b		(out param) start of the message data
+ * @param e		(out param) end of the message data
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int cenc_msg_check(const struct msg *m, uint16_t ty,
+		const char **b, const char **e)
+{
+	uint32_t len;
+
+	if (!cenc_is_compact(m))
+		return EINVAL;
+	if (unpack_from_be16(&m->ty) != ty)
+		return EINVAL;
+	len = unpack_from_be32(&m->len);
+	if ((len < sizeof(struct msg)) || (len > INT32_MAX))
+		return EINVAL;
+	*b = m->data;
+	*e = ((const char*)m) + len;
+	return 0;
+}
+
+static char *cenc_put_str(char *b, const char *str)
+{
+	size_t sl;
+
+	sl = str ? strlen(str) : 0;
+	pack_to_be16(b, sl);
+	b += sizeof(uint16_t);
+	if (sl)
+		memcpy(b, str, sl);
+	b += sl;
+	*b++ = '\0';
+	return b;
+}
+
+/** Get a view of a string in the message buffer
+ *
+ * @return		Pointer to the byte after the string, or NULL if the
+ *			string is malformed
+ */
+static const char *cenc_get_str(const char *b, const char *e, size_t max,
+		const char **str)
+{
+	uint16_t sl;
+
+	if (e - b < (ptrdiff_t)sizeof(uint16_t))
+		return NULL;
+	sl = unpack_from_be16(b);
+	b += sizeof(uint16_t);
+	if ((sl > max) || (e - b < (ptrdiff_t)sl + 1))
+		return NULL;
+	/* The terminator has to be where the length says it is; otherwise
+	 * callers would see a different string than we checked. */
+	if ((b[sl] != '\0') || memchr(b, '\0', sl))
+		return NULL;
+	*str = b;
+	return b + sl + 1;
+}
+
+static char *cenc_put_eps(char *b, const struct cenc_ep *eps, uint32_t num)
+{
+	pack_to_be32(b, num);
+	b += sizeof(uint32_t);
+	memcpy(b, eps, num * sizeof(struct cenc_ep));
+	return b + (num * sizeof(struct cenc_ep));
+}
+
+static const char *cenc_get_eps(const char *b, const char *e, uint32_t max,
+		const struct cenc_ep **eps, uint32_t *num)
+{
+	uint32_t n;
+
+	if (e - b < (ptrdiff_t)sizeof(uint32_t))
+		return NULL;
+	n = unpack_from_be32(b);
+	b += sizeof(uint32_t);
+	if ((n > max) || ((size_t)(e - b) < n * sizeof(struct cenc_ep)))
+		return NULL;
+	*eps = (const struct cenc_ep*)b;
+	*num = n;
+	return b + (n * sizeof(struct cenc_ep));
+}
+
+#define CENC_CUR_FILE "msg/types.cenc"
+#include "msg/cenc_generate_body.h"
+#undef CENC_CUR_FILE
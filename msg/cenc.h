@@ -0,0 +1,112 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_MSG_CENC_DOT_H
+#define REDFISH_MSG_CENC_DOT_H
+
+#include "msg/types.h"
+#include "util/compiler.h"
+
+#include <stdint.h> /* for uint32_t, etc. */
+
+/*
+ * Compact message encoding
+ *
+ * XDR is flexible, but decoding it means copying every string and array into
+ * freshly allocated memory.  For the handful of messages that make up most of
+ * the traffic, we use a simpler encoding instead: fixed-size integers in
+ * big-endian order with no padding, and strings as a 16-bit length followed by
+ * the bytes and a NUL terminator.  Decoding fills in a structure whose strings
+ * and arrays point straight into the message buffer, so nothing is allocated
+ * and nothing has to be freed.
+ *
+ * The messages are described in msg/types.cenc, which is expanded into
+ * structures and functions the same way as the jorm files are.  For each
+ * message type 'foo' we get:
+ *
+ * struct cenc_foo
+ *	The message fields
+ *
+ * struct msg *CENC_ALLOC_foo(const struct cenc_foo *in, size_t extra_len,
+ *		void **extra)
+ *	Allocate and encode a message, reserving extra_len bytes after it.
+ *	Returns the message or an error pointer.  If extra is non-NULL, it is
+ *	set to the extra space.
+ *
+ * int32_t CENC_DECODE_foo(const struct msg *m, struct cenc_foo *out,
+ *		const void **extra)
+ *	Decode a message.  Returns the number of extra bytes at the end of
+ *	the message, or a negative error code.  If extra is non-NULL, it is
+ *	set to the extra bytes.
+ *
+ * Messages in the compact encoding have MSG_FLAG_COMPACT set.  A peer that
+ * sends a request in the compact encoding will understand a reply in it, so
+ * servers answer each request in the encoding that it arrived in.  Older peers
+ * never set the flag and keep getting XDR.
+ */
+
+/** An endpoint, in network byte order.  Arrays of these appear in the
+ * message buffer as-is. */
+PACKED(
+struct cenc_ep {
+	uint32_t ip;
+	uint32_t port;
+});
+
+#define CENC_CUR_FILE "msg/types.cenc"
+#include "msg/cenc_generate_include.h"
+#undef CENC_CUR_FILE
+
+#if 0 /* Give the dependency scanner a clue */
+#include "msg/types.cenc"
+#endif
+
+/** Determine whether a message uses the compact encoding
+ *
+ * @param m		The message
+ *
+ * @return		1 if the message uses the compact encoding; 0 if it
+ *			uses XDR
+ */
+extern int cenc_is_compact(const struct msg *m);
+
+/** Fill in an endpoint
+ *
+ * @param ep		The endpoint
+ * @param ip		IPv4 address
+ * @param port		Port
+ */
+extern void cenc_ep_set(struct cenc_ep *ep, uint32_t ip, uint16_t port);
+
+/** Get the IPv4 address of an endpoint
+ *
+ * @param ep		The endpoint
+ *
+ * @return		The IPv4 address
+ */
+extern uint32_t cenc_ep_ip(const struct cenc_ep *ep);
+
+/** Get the port of an endpoint
+ *
+ * @param ep		The endpoint
+ *
+ * @return		The port
+ */
+extern uint16_t cenc_ep_port(const struct cenc_ep *ep);
+
+#endif
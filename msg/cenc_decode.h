@@ -0,0 +1,63 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Decoding never copies anything.  Strings and arrays in the output structure
+ * point into the message buffer, so they are only valid as long as the
+ * message is.
+ */
+
+#define CENC_MSG_BEGIN(ty) \
+int32_t CENC_DECODE_##ty(const struct msg *m, struct cenc_##ty *out, \
+		const void **extra) { \
+	const char *b, *e; \
+	if (cenc_msg_check(m, ty##_ty, &b, &e)) \
+		return -EINVAL;
+
+#define CENC_U32(name) \
+	if (e - b < (ptrdiff_t)sizeof(uint32_t)) \
+		return -EINVAL; \
+	out->name = unpack_from_be32(b); \
+	b += sizeof(uint32_t);
+
+#define CENC_I32(name) \
+	if (e - b < (ptrdiff_t)sizeof(int32_t)) \
+		return -EINVAL; \
+	out->name = (int32_t)unpack_from_be32(b); \
+	b += sizeof(int32_t);
+
+#define CENC_U64(name) \
+	if (e - b < (ptrdiff_t)sizeof(uint64_t)) \
+		return -EINVAL; \
+	out->name = unpack_from_be64(b); \
+	b += sizeof(uint64_t);
+
+#define CENC_STR(name, max) \
+	b = cenc_get_str(b, e, max, &out->name); \
+	if (!b) \
+		return -EINVAL;
+
+#define CENC_EP_ARRAY(name, max) \
+	b = cenc_get_eps(b, e, max, &out->name, &out->num_##name); \
+	if (!b) \
+		return -EINVAL;
+
+#define CENC_MSG_END \
+	if (extra) \
+		*extra = b; \
+	return e - b; \
+}
@@ -0,0 +1,55 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define CENC_MSG_BEGIN(ty) \
+struct msg *CENC_ALLOC_##ty(const struct cenc_##ty *in, \
+		size_t extra_len, void **extra) { \
+	int32_t len; \
+	struct msg *m; \
+	char *b; \
+	len = cenc_len_##ty(in); \
+	if (len < 0) \
+		return ERR_PTR(-len); \
+	m = cenc_msg_alloc(ty##_ty, len, extra_len); \
+	if (IS_ERR(m)) \
+		return m; \
+	b = m->data;
+
+#define CENC_U32(name) \
+	pack_to_be32(b, in->name); \
+	b += sizeof(uint32_t);
+
+#define CENC_I32(name) \
+	pack_to_be32(b, (uint32_t)in->name); \
+	b += sizeof(int32_t);
+
+#define CENC_U64(name) \
+	pack_to_be64(b, in->name); \
+	b += sizeof(uint64_t);
+
+#define CENC_STR(name, max) \
+	b = cenc_put_str(b, in->name);
+
+#define CENC_EP_ARRAY(name, max) \
+	b = cenc_put_eps(b, in->name, in->num_##name);
+
+#define CENC_MSG_END \
+	if (extra) \
+		*extra = b; \
+	return m; \
+}
@@ -0,0 +1,35 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h> /* for int32_t */
+#include <unistd.h> /* for size_t */
+
+struct msg;
+
+#define CENC_MSG_BEGIN(ty) \
+	struct cenc_##ty; \
+	extern struct msg *CENC_ALLOC_##ty(const struct cenc_##ty *in, \
+		size_t extra_len, void **extra); \
+	extern int32_t CENC_DECODE_##ty(const struct msg *m, \
+		struct cenc_##ty *out, const void **extra);
+#define CENC_U32(name)
+#define CENC_I32(name)
+#define CENC_U64(name)
+#define CENC_STR(name, max)
+#define CENC_EP_ARRAY(name, max)
+#define CENC_MSG_END
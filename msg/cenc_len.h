@@ -0,0 +1,51 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Generates a static function which calculates how long the encoded form of a
+ * message will be, not counting the header or any extra data.  Returns a
+ * negative error code if the message can't be encoded.
+ */
+
+#define CENC_MSG_BEGIN(ty) \
+static int32_t cenc_len_##ty(POSSIBLY_UNUSED(const struct cenc_##ty *in)) { \
+	int32_t len = 0; \
+	size_t POSSIBLY_UNUSED(sl);
+
+#define CENC_U32(name) \
+	len += sizeof(uint32_t);
+
+#define CENC_I32(name) \
+	len += sizeof(int32_t);
+
+#define CENC_U64(name) \
+	len += sizeof(uint64_t);
+
+#define CENC_STR(name, max) \
+	sl = in->name ? strlen(in->name) : 0; \
+	if (sl > max) \
+		return -ENAMETOOLONG; \
+	len += sizeof(uint16_t) + sl + 1;
+
+#define CENC_EP_ARRAY(name, max) \
+	if (in->num_##name > max) \
+		return -EINVAL; \
+	len += sizeof(uint32_t) + (in->num_##name * sizeof(struct cenc_ep));
+
+#define CENC_MSG_END \
+	return len; \
+}
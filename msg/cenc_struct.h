@@ -0,0 +1,27 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define CENC_MSG_BEGIN(ty) struct cenc_##ty {
+#define CENC_U32(name) uint32_t name;
+#define CENC_I32(name) int32_t name;
+#define CENC_U64(name) uint64_t name;
+#define CENC_STR(name, max) const char *name;
+#define CENC_EP_ARRAY(name, max) \
+	const struct cenc_ep *name; \
+	uint32_t num_##name;
+#define CENC_MSG_END };
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "msg/cenc.h"
+#include "msg/msg.h"
+#include "msg/types.h"
+#include "msg/xdr.h"
+#include "util/error.h"
+#include "util/packed.h"
+#include "util/test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Nonzero if ptr points somewhere inside the message */
+#define CENC_IN_MSG(m, ptr) \
+	((((const char*)(ptr)) >= ((const char*)(m))) && \
+	 (((const char*)(ptr)) < \
+	  (((const char*)(m)) + unpack_from_be32(&(m)->len))))
+
+static int test_cenc_stat(void)
+{
+	struct cenc_mmm_path_stat_req req, dreq;
+	struct cenc_mmm_stat_resp resp, dresp;
+	struct mmm_stat_resp xresp;
+	struct msg *m, *x;
+
+	memset(&req, 0, sizeof(req));
+	req.path = "/foo/bar";
+	req.user = "alice";
+	m = CENC_ALLOC_mmm_path_stat_req(&req, 0, NULL);
+	EXPECT_NOT_ERRPTR(m);
+	EXPECT_EQ(cenc_is_compact(m), 1);
+	EXPECT_EQ(unpack_from_be16(&m->ty), mmm_path_stat_req_ty);
+	EXPECT_EQ(CENC_DECODE_mmm_path_stat_req(m, &dreq, NULL), 0);
+	EXPECT_ZERO(strcmp(dreq.path, "/foo/bar"));
+	EXPECT_ZERO(strcmp(dreq.user, "alice"));
+	/* Decoding doesn't copy */
+	EXPECT_EQ(CENC_IN_MSG(m, dreq.path), 1);
+	EXPECT_EQ(CENC_IN_MSG(m, dreq.user), 1);
+	/* Decoding as the wrong type fails */
+	EXPECT_EQ(CENC_DECODE_mmm_nid_stat_req(m, NULL, NULL), -EINVAL);
+	msg_release(m);
+
+	memset(&resp, 0, sizeof(resp));
+	resp.mtime = 0x123456789abcdefULL;
+	resp.atime = 2;
+	resp.length = 0xffffffffffffffffULL;
+	resp.nid = 4;
+	resp.block_sz = 5;
+	resp.mode_and_type = -1;
+	resp.man_repl = 3;
+	resp.user = "alice";
+	resp.group = NULL;
+	m = CENC_ALLOC_mmm_stat_resp(&resp, 0, NULL);
+	EXPECT_NOT_ERRPTR(m);
+	EXPECT_EQ(CENC_DECODE_mmm_stat_resp(m, &dresp, NULL), 0);
+	EXPECT_EQ(dresp.mtime, resp.mtime);
+	EXPECT_EQ(dresp.atime, resp.atime);
+	EXPECT_EQ(dresp.length, resp.length);
+	EXPECT_EQ(dresp.nid, resp.nid);
+	EXPECT_EQ(dresp.block_sz, resp.block_sz);
+	EXPECT_EQ(dresp.mode_and_type, -1);
+	EXPECT_EQ(dresp.man_repl, 3);
+	EXPECT_ZERO(strcmp(dresp.user, "alice"));
+	EXPECT_ZERO(strcmp(dresp.group, ""));
+
+	/* The compact encoding is smaller than the XDR one */
+	memset(&xresp, 0, sizeof(xresp));
+	xresp.stat.user = "alice";
+	xresp.stat.group = "";
+	x = MSG_XDR_ALLOC(mmm_stat_resp, &xresp);
+	EXPECT_NOT_ERRPTR(x);
+	EXPECT_EQ(cenc_is_compact(x), 0);
+	EXPECT_LT(unpack_from_be32(&m->len), unpack_from_be32(&x->len));
+	/* An XDR message can't be decoded as a compact one */
+	EXPECT_EQ(CENC_DECODE_mmm_stat_resp(x, &dresp, NULL), -EINVAL);
+	msg_release(x);
+	msg_release(m);
+	return 0;
+}
+
+static int test_cenc_extra(void)
+{
+	int i;
+	struct cenc_ep chain[2];
+	struct cenc_mmm_osd_hflush_req req, dreq;
+	struct msg *m;
+	char *extra;
+	const char *dextra;
+
+	cenc_ep_set(&chain[0], 0x7f000002, 9001);
+	cenc_ep_set(&chain[1], 0x7f000003, 9002);
+	memset(&req, 0, sizeof(req));
+	req.cid = 0xdeadbeefULL;
+	req.off = 0x123456789ULL;
+	req.flags = 7;
+	req.crc = 0x89abcdefU;
+	req.chain = chain;
+	req.num_chain = 2;
+	m = CENC_ALLOC_mmm_osd_hflush_req(&req, 100, (void**)&extra);
+	EXPECT_NOT_ERRPTR(m);
+	for (i = 0; i < 100; ++i)
+		extra[i] = i;
+	EXPECT_EQ(CENC_DECODE_mmm_osd_hflush_req(m, &dreq,
+			(const void**)&dextra), 100);
+	EXPECT_EQ(dreq.cid, 0xdeadbeefULL);
+	EXPECT_EQ(dreq.off, 0x123456789ULL);
+	EXPECT_EQ(dreq.flags, 7);
+	EXPECT_EQ(dreq.crc, 0x89abcdefU);
+	EXPECT_EQ(dreq.num_chain, 2);
+	EXPECT_EQ(cenc_ep_ip(&dreq.chain[1]), 0x7f000003);
+	EXPECT_EQ(cenc_ep_port(&dreq.chain[1]), 9002);
+	EXPECT_EQ(dextra, extra);
+	/* Shrinking the message only takes away extra data */
+	m = msg_shrink(m, 40);
+	EXPECT_EQ(CENC_DECODE_mmm_osd_hflush_req(m, &dreq, NULL), 60);
+	m = msg_shrink(m, 60);
+	EXPECT_EQ(CENC_DECODE_mmm_osd_hflush_req(m, &dreq, NULL), 0);
+	m = msg_shrink(m, 1);
+	EXPECT_EQ(CENC_DECODE_mmm_osd_hflush_req(m, &dreq, NULL), -EINVAL);
+	msg_release(m);
+	return 0;
+}
+
+static int test_cenc_eps(void)
+{
+	uint32_t i;
+	struct cenc_ep eps[RF_MAX_OID + 1];
+	struct cenc_mmm_chunkalloc_resp resp, dresp;
+	struct msg *m;
+
+	for (i = 0; i < RF_MAX_OID + 1; ++i)
+		cenc_ep_set(&eps[i], 0x7f000001 + i, 9000 + i);
+	memset(&resp, 0, sizeof(resp));
+	resp.cid = 123;
+	resp.ep = eps;
+	resp.num_ep = RF_MAX_OID;
+	m = CENC_ALLOC_mmm_chunkalloc_resp(&resp, 0, NULL);
+	EXPECT_NOT_ERRPTR(m);
+	EXPECT_EQ(CENC_DECODE_mmm_chunkalloc_resp(m, &dresp, NULL), 0);
+	EXPECT_EQ(dresp.cid, 123);
+	EXPECT_EQ(dresp.num_ep, RF_MAX_OID);
+	EXPECT_EQ(CENC_IN_MSG(m, dresp.ep), 1);
+	for (i = 0; i < RF_MAX_OID; ++i) {
+		EXPECT_EQ(cenc_ep_ip(&dresp.ep[i]), 0x7f000001 + i);
+		EXPECT_EQ(cenc_ep_port(&dresp.ep[i]), 9000 + i);
+	}
+	msg_release(m);
+	/* Too many endpoints */
+	resp.num_ep = RF_MAX_OID + 1;
+	EXPECT_EQ(PTR_ERR(CENC_ALLOC_mmm_chunkalloc_resp(&resp, 0, NULL)),
+		EINVAL);
+	return 0;
+}
+
+static int test_cenc_malformed(void)
+{
+	char path[RF_PATH_MAX + 2];
+	struct cenc_mmm_nid_stat_req req, dreq;
+	struct cenc_mmm_path_stat_req preq;
+	struct msg *m;
+
+	memset(path, 'a', sizeof(path));
+	path[RF_PATH_MAX] = '\0';
+	memset(&preq, 0, sizeof(preq));
+	preq.path = path;
+	preq.user = "bob";
+	m = CENC_ALLOC_mmm_path_stat_req(&preq, 0, NULL);
+	EXPECT_NOT_ERRPTR(m);
+	msg_release(m);
+	path[RF_PATH_MAX] = 'a';
+	path[RF_PATH_MAX + 1] = '\0';
+	EXPECT_EQ(PTR_ERR(CENC_ALLOC_mmm_path_stat_req(&preq, 0, NULL)),
+		ENAMETOOLONG);
+
+	memset(&req, 0, sizeof(req));
+	req.nid = 1;
+	req.user = "bob";
+	m = CENC_ALLOC_mmm_nid_stat_req(&req, 0, NULL);
+	EXPECT_NOT_ERRPTR(m);
+	EXPECT_EQ(CENC_DECODE_mmm_nid_stat_req(m, &dreq, NULL), 0);
+	/* A string that isn't terminated where its length says it is */
+	m->data[sizeof(uint64_t) + sizeof(uint16_t) + 3] = 'x';
+	EXPECT_EQ(CENC_DECODE_mmm_nid_stat_req(m, &dreq, NULL), -EINVAL);
+	/* A string with a NUL in the middle */
+	m->data[sizeof(uint64_t) + sizeof(uint16_t) + 3] = '\0';
+	m->data[sizeof(uint64_t) + sizeof(uint16_t) + 1] = '\0';
+	EXPECT_EQ(CENC_DECODE_mmm_nid_stat_req(m, &dreq, NULL), -EINVAL);
+	/* A string length that runs off the end of the message */
+	pack_to_be16(m->data + sizeof(uint64_t), 1000);
+	EXPECT_EQ(CENC_DECODE_mmm_nid_stat_req(m, &dreq, NULL), -EINVAL);
+	msg_release(m);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ZERO(test_cenc_stat());
+	EXPECT_ZERO(test_cenc_extra());
+	EXPECT_ZERO(test_cenc_eps());
+	EXPECT_ZERO(test_cenc_malformed());
+	return EXIT_SUCCESS;
+}
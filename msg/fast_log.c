@@ -195,6 +195,20 @@ void fast_log_msgr_dump(struct fast_log_msgr_entry *fe, char *buf)
 			"error writing message body: error %d\n",
 			fe->event_data);
 		break;
+	case FLME_HELLO:
+		snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"got hello: remote features 0x%x\n", fe->event_data);
+		break;
+	case FLME_DECOMPRESS_FAILED:
+		snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"failed to decompress message: error %d\n",
+			fe->event_data);
+		break;
+	case FLME_COMPRESS_RATIO:
+		snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"closing connection: sent data compressed to %d%% "
+			"of its original size\n", fe->event_data);
+		break;
 	default:
 		snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
 			 "(unknown event %d\n)", fe->event);
@@ -284,6 +298,12 @@ void fast_log_bsend_dump(struct fast_log_bsend_entry *fe, char *buf)
 				"transactor %d: bsend context was cancelled.\n",
 				fe->event_data);
 		}
+		else if (fe->err == ETIMEDOUT) {
+			snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+				"bsend_add_tr_or_free: failed to add "
+				"transactor %d: the deadline has already "
+				"passed.\n", fe->event_data);
+		}
 		else if (fe->err) {
 			snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
 				"bsend_add_tr_or_free: failed to add "
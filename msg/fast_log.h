@@ -46,6 +46,9 @@ enum fast_log_msgr_event {
 	FLME_HDR_READ_ERROR,
 	FLME_READ_ERROR,
 	FLME_WRITE_ERROR,
+	FLME_HELLO,
+	FLME_DECOMPRESS_FAILED,
+	FLME_COMPRESS_RATIO,
 	FLME_MAX,
 };
 
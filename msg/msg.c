@@ -66,6 +66,29 @@ struct msg *resp_alloc(int error)
 	return r;
 }
 
+struct msg *busy_resp_alloc(uint32_t retry_after_ms)
+{
+	struct mmm_busy_resp resp;
+
+	resp.error = EBUSY;
+	resp.retry_after_ms = retry_after_ms;
+	return MSG_XDR_ALLOC(mmm_busy_resp, &resp);
+}
+
+struct msg *msg_dup(const struct msg *m)
+{
+	uint32_t len;
+	struct msg *r;
+
+	len = unpack_from_be32(&m->len);
+	r = malloc(len);
+	if (!r)
+		return NULL;
+	memcpy(r, m, len);
+	pack_to_8(&r->refcnt, 1);
+	return r;
+}
+
 struct msg *msg_shrink(struct msg *m, uint32_t amt)
 {
 	uint32_t cur_len, new_len;
@@ -80,6 +103,42 @@ struct msg *msg_shrink(struct msg *m, uint32_t amt)
 	return r ? r : m;
 }
 
+void msg_set_prio(struct msg *m, int prio)
+{
+	uint8_t flags;
+
+	flags = unpack_from_8(&m->flags);
+	flags &= ~MSG_FLAG_PRIO_MASK;
+	flags |= (prio << MSG_FLAG_PRIO_SHIFT) & MSG_FLAG_PRIO_MASK;
+	pack_to_8(&m->flags, flags);
+}
+
+int msg_get_prio(const struct msg *m)
+{
+	int prio;
+
+	prio = (unpack_from_8(&m->flags) & MSG_FLAG_PRIO_MASK) >>
+		MSG_FLAG_PRIO_SHIFT;
+	if (prio >= MSG_PRIO_NUM)
+		return MSG_PRIO_NORMAL;
+	return prio;
+}
+
+const char *msg_prio_to_str(int prio)
+{
+	switch (prio) {
+	case MSG_PRIO_NORMAL:
+		return "MSG_PRIO_NORMAL";
+	case MSG_PRIO_HIGH:
+		return "MSG_PRIO_HIGH";
+	case MSG_PRIO_BULK:
+		return "MSG_PRIO_BULK";
+	default:
+		break;
+	}
+	return "(unknown)";
+}
+
 void msg_addref(struct msg *msg)
 {
 	int refcnt;
@@ -18,8 +18,9 @@
 #define REDFISH_MSG_MSG_DOT_H
 
 #include "util/compiler.h"
+#include "util/mpsc_queue.h"
 #include "util/queue.h"
-#include "util/tree.h"
+#include "util/timer_wheel.h"
 
 #include <stdint.h> /* for uint32_t */
 #include <unistd.h> /* for size_t */
@@ -29,14 +30,53 @@ struct mtran;
 
 /** When present on message from a client, this flag indicates that the primary
  * MDS we were talking to earlier died after reading our message, but before
- * responding.  We should make a guess as to whether the operation succeeded.
- * TODO: eliminate this fudge with a duplicate request cache? */
+ * responding.  Requests which modify the metadata carry a struct rf_req_id,
+ * which the MDS duplicate request cache uses to tell whether they were already
+ * done, so there is no need to guess about those. */
 #define MSG_FLAG_RETRANSMIT	0x1
 
 /** When present on a message to an MDS, indicates that the operation must
  * succeed.  All messages from the primary to replicas should set this flag. */
 #define MSG_FLAG_MUSTDO		0x2
 
+/** When present, the message body uses the compact encoding described in
+ * msg/cenc.h rather than XDR. */
+#define MSG_FLAG_COMPACT	0x4
+
+/** When present, the message body has been compressed by the messenger.  The
+ * messenger decompresses messages before delivering them, so callbacks never
+ * see this flag. */
+#define MSG_FLAG_LZ		0x8
+
+/** These bits of the message flags hold the priority class of the message.
+ * See enum msg_prio. */
+#define MSG_FLAG_PRIO_MASK	0x30
+#define MSG_FLAG_PRIO_SHIFT	4
+
+/** When present on the wire, the header is followed by a 32-bit big-endian
+ * timeout: the number of milliseconds the sender will still wait for an
+ * answer.  The header length includes these 4 bytes.  Only sent to peers that
+ * asked for it in their hello message.  The messenger strips the timeout off
+ * before delivering the message, so callbacks never see this flag. */
+#define MSG_FLAG_TIMEO		0x40
+
+/** Message priority classes.
+ *
+ * Each connection keeps a separate send queue for each class, and the
+ * messenger shares the connection between them with a weighted fair
+ * scheduler.  Messages which don't ask for anything in particular are
+ * MSG_PRIO_NORMAL.
+ */
+enum msg_prio {
+	/** Ordinary RPCs */
+	MSG_PRIO_NORMAL = 0,
+	/** Heartbeats and other messages that must not be held up by load */
+	MSG_PRIO_HIGH = 1,
+	/** Bulk data */
+	MSG_PRIO_BULK = 2,
+	MSG_PRIO_NUM = 3,
+};
+
 /** Represents a message sent or received over the network */
 PACKED(
 struct msg {
@@ -88,10 +128,15 @@ enum mtran_state {
 /** Transactor */
 struct mtran {
 	union {
-		RB_ENTRY(mtran) active_entry;
 		STAILQ_ENTRY(mtran) pending_entry;
+		struct mpsc_node submit_entry;
 	} u;
-	RB_ENTRY(mtran) timeo_entry;
+	/** Timeout timer.  timeo.expire holds the monotonic time, in
+	 * milliseconds, at which this transactor should be timed out. */
+	struct twheel_tm timeo;
+	/** The connection this transactor is queued on or waiting for a
+	 * response from, if any.  Only touched by the messenger thread. */
+	struct mconn *conn;
 	/** The message.
 	 *
 	 * This is an overloaded field (maybe too overloaded?)
@@ -127,11 +172,17 @@ struct mtran {
 	uint16_t port;
 	/** transactor state */
 	uint16_t state;
-	/** The messenger timeout period ID at which this transactor should be
-	 * timed out.  Messenger timeout period IDs repeat after a few hours.
-	 * To get around this issue, we use circular comparisons whenever
-	 * comparing them. */
-	uint16_t timeo_id;
+	/** Priority class (enum msg_prio) of the last message sent or
+	 * received on this transactor */
+	uint8_t prio;
+	/** Monotonic time in microseconds at which this transactor was queued
+	 * for a recv_pool worker */
+	uint64_t queued_us;
+	/** Monotonic time in milliseconds after which the sender of the
+	 * message we received will have given up waiting for an answer, or 0
+	 * if it will wait forever.  Derived from the timeout the sender put
+	 * after the message header; see MSG_FLAG_TIMEO. */
+	uint64_t deadline_ms;
 	/** private data. */
 	void *priv;
 };
@@ -170,6 +221,27 @@ extern void *calloc_msg(uint32_t ty, uint32_t len);
  */
 extern struct msg *resp_alloc(int error);
 
+/** Allocate a new busy response message.
+ *
+ * The error code in the message is EBUSY.
+ *
+ * @param retry_after_ms	How long the sender should wait before trying
+ *				again, in milliseconds
+ *
+ * @return		The new response message, or an error pointer
+ */
+extern struct msg *busy_resp_alloc(uint32_t retry_after_ms);
+
+/** Make a copy of a message.
+ *
+ * The copy has a reference count of 1, and shares nothing with the original.
+ *
+ * @param m		The message
+ *
+ * @return		The copy, or NULL on OOM
+ */
+extern struct msg *msg_dup(const struct msg *m);
+
 /** Shrink a message.
  *
  * This is used to shrink a message.  If possible, it will reduce the amount of
@@ -184,6 +256,30 @@ extern struct msg *resp_alloc(int error);
  */
 extern struct msg *msg_shrink(struct msg *m, uint32_t amt);
 
+/** Set the priority class of a message.
+ *
+ * @param m		The message
+ * @param prio		The priority class (enum msg_prio)
+ */
+extern void msg_set_prio(struct msg *m, int prio);
+
+/** Get the priority class of a message.
+ *
+ * @param m		The message
+ *
+ * @return		The priority class (enum msg_prio).  Unknown values
+ *			are treated as MSG_PRIO_NORMAL.
+ */
+extern int msg_get_prio(const struct msg *m);
+
+/** Convert a message priority class to a string
+ *
+ * @param prio		The priority class
+ *
+ * @return		A statically allocated string
+ */
+extern const char *msg_prio_to_str(int prio);
+
 /** Increment a message's reference count.
  *
  * @param msg		The message
@@ -17,30 +17,35 @@
 #include "msg/fast_log.h"
 #include "msg/msg.h"
 #include "msg/msgr.h"
-#include "util/circ_compare.h"
 #include "util/cram.h"
 #include "util/error.h"
 #include "util/fast_log.h"
 #include "util/fast_log_types.h"
+#include "util/hmap.h"
+#include "util/lz.h"
 #include "util/macro.h"
+#include "util/mpsc_queue.h"
 #include "util/net.h"
 #include "util/packed.h"
 #include "util/platform/socket.h"
 #include "util/queue.h"
 #include "util/thread.h"
-#include "util/tree.h"
+#include "util/time.h"
+#include "util/timer_wheel.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <ev.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 /****************************** prototypes ********************************/
-static int mconn_compare(struct mconn *a, struct mconn *b);
 static void mconn_teardown(struct mconn *conn, int failcode);
 static void mconn_writable_cb(struct ev_loop *loop, struct ev_io *w,
 		int revents);
@@ -48,11 +53,20 @@ static void mconn_readable_cb(struct ev_loop *loop, struct ev_io *w,
 		int revents);
 static void run_msgr_timeout_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
                struct ev_timer *w, int revents);
+static void mtran_timeo_cb(struct twheel_tm *tm);
+static void mconn_idle_cb(struct twheel_tm *tm);
 static void run_msgr_notify_cb(struct ev_loop *loop, struct ev_async *w,
 		int revents);
+static void run_msgr_prepare_cb(struct ev_loop *loop, struct ev_prepare *w,
+		int revents);
 static void mtran_deliver_netfail(struct mtran *tr, int err);
-static int mtran_compare_trid(struct mtran *a, struct mtran *b) PURE;
-static int mtran_compare_timeo(struct mtran *a, struct mtran *b) PURE;
+static void msgr_take_submitted(struct msgr *msgr);
+static void mconn_enqueue(struct mconn *conn, struct mtran *tr);
+static void msgr_cancel_all_pending_tr(struct msgr *msgr);
+static void mconn_send_hello(struct mconn *conn);
+static void mconn_handle_hello(struct mconn *conn, struct msg *m);
+static void mconn_compress(struct mconn *conn, struct mtran *tr);
+static int mconn_decompress(struct mconn *conn);
 
 /****************************** types ********************************/
 enum mconn_state_t {
@@ -65,11 +79,44 @@ enum {
 	MSGR_RET_STOP = 1,
 };
 
+/** Initial number of slots in a connection's active transactor table */
+#define MCONN_ACTIVE_INIT_CAP 16
+
+/** Initial number of slots in the messenger's connection table */
+#define MSGR_CONN_INIT_CAP 64
+
+/** Number of bytes a priority class of weight 1 may send on a connection each
+ * time the scheduler comes around to it */
+#define MCONN_DRR_QUANTUM 16384
+
+/** Per-round sending allowance for each priority class.  High priority
+ * messages are small, so in practice they are never held back; the weights
+ * mostly matter for keeping bulk data from starving ordinary RPCs. */
+static const uint32_t g_drr_quantum[MSG_PRIO_NUM] = {
+	[MSG_PRIO_NORMAL] = 4 * MCONN_DRR_QUANTUM,
+	[MSG_PRIO_HIGH] = 16 * MCONN_DRR_QUANTUM,
+	[MSG_PRIO_BULK] = 1 * MCONN_DRR_QUANTUM,
+};
+
+/** Message type of the hello message that starts each connection we open.
+ * The messenger handles these itself; no message type in msg/types.x may use
+ * this value. */
+#define MSGR_HELLO_TY 0xffff
+
+/** Hello message feature bit: we can decompress MSG_FLAG_LZ messages */
+#define MSGR_FEAT_LZ 0x1
+
+/** Hello message feature bit: we understand MSG_FLAG_TIMEO headers */
+#define MSGR_FEAT_TIMEO 0x2
+
+/** The features this messenger supports */
+#define MSGR_FEATURES (MSGR_FEAT_LZ | MSGR_FEAT_TIMEO)
+
+/** Number of milliseconds to allow for sending a hello message and hearing
+ * back from the remote end */
+#define MSGR_HELLO_TIMEO_MS 30000
+
 STAILQ_HEAD(pending_tr, mtran);
-RB_HEAD(active_tr, mtran);
-RB_GENERATE(active_tr, mtran, u.active_entry, mtran_compare_trid);
-RB_HEAD(timeo_tr, mtran);
-RB_GENERATE(timeo_tr, mtran, timeo_entry, mtran_compare_timeo);
 
 struct conn_cancel {
 	SLIST_ENTRY(conn_cancel) entry;
@@ -82,6 +129,8 @@ SLIST_HEAD(conn_cancels, conn_cancel);
 struct mlisten {
 	/** Callback to invoke on sent/recv */
 	msgr_cb_t cb;
+	/** Callback to invoke after delivering messages, or NULL */
+	msgr_flush_cb_t flush;
 	/** Private data to store in transactor */
 	void *priv;
 	/** File descriptor */
@@ -91,7 +140,7 @@ struct mlisten {
 };
 
 struct mconn {
-	RB_ENTRY(mconn) entry;
+	LIST_ENTRY(mconn) entry;
 	/** The messenger this connection is associated with */
 	struct msgr *msgr;
 	/** remote IP address */
@@ -99,29 +148,68 @@ struct mconn {
 	/** remote port */
 	uint16_t port;
 	/** state of this connection */
-	uint16_t state;
+	uint8_t state;
+	/** Which of the connections to the remote endpoint this is.  Lane 0
+	 * carries control messages; the others carry bulk data.  Inbound
+	 * connections are always lane 0. */
+	uint8_t lane;
+	/** Nonzero if we have sent a hello message on this connection */
+	uint8_t sent_hello;
+	/** Nonzero if the remote end has sent us a hello message */
+	uint8_t got_hello;
+	/** The transactor carrying our hello message, until it has been sent
+	 * and, if we opened the connection, answered.  NULL otherwise. */
+	struct mtran *hello_tr;
+	/** The features (MSGR_FEAT_*) that the remote end told us about in its
+	 * hello message.  0 if it hasn't sent one. */
+	uint32_t peer_feat;
+	/** Compression statistics */
+	struct msgr_compress_stats cstats;
 	/** the socket, if connected. -1 if not */
 	int sock;
 	/** number of bytes sent */
 	int sent_cnt;
 	/** number of bytes received */
 	int recv_cnt;
+	/** The header we're sending for the message we're in the middle of
+	 * sending.  A copy of its struct msg header, plus the timeout if the
+	 * remote end wants one. */
+	char out_hdr[sizeof(struct msg) + sizeof(uint32_t)];
+	/** Number of bytes in out_hdr */
+	int out_hdr_len;
 	/** message that we're in the middle of reading, or NULL */
 	struct msg *inbound_msg;
+	/** The timeout that came after the header of inbound_msg, in network
+	 * byte order, or 0 if there was none */
+	uint32_t inbound_timeo;
+	/** Number of bytes of inbound_timeo that we still have to read */
+	int inbound_timeo_left;
 	/** transaction that we're in the middle of reading, or NULL */
 	struct mtran *inbound_tr;
 	/** writable event watcher for sock */
 	struct ev_io w_write;
 	/** readable event watcher for sock */
 	struct ev_io w_read;
-	/** Active transactions. Keyed on transaction id. */
-	struct active_tr active_head;
-	/** Pending transactions */
-	struct pending_tr pending_head;
-	/** All transactions. Keyed on transactor timeout. */
-	struct timeo_tr timeo_head;
-	/** Number of timeout periods that have passed without any TCP traffic */
-	int timeout_cnt;
+	/** Active transactions. Hash table keyed on transaction id. */
+	struct hmap active;
+	/** Pending transactions, one queue for each priority class */
+	struct pending_tr pending_head[MSG_PRIO_NUM];
+	/** Total size of the messages in the pending queues, in bytes */
+	uint64_t pending_bytes;
+	/** The transactor whose message we are sending, or NULL.  Once we
+	 * start sending a message, we have to finish it before starting on
+	 * another. */
+	struct mtran *sending;
+	/** The priority class whose turn it is to send */
+	int drr_cur;
+	/** Number of bytes each priority class may send before it has to give
+	 * up its turn */
+	uint32_t drr_deficit[MSG_PRIO_NUM];
+	/** Monotonic time in milliseconds of the last TCP traffic */
+	uint64_t last_active;
+	/** Timer which tears down the connection when it has been idle for too
+	 * long */
+	struct twheel_tm idle_tm;
 };
 
 enum msgr_state_t {
@@ -130,15 +218,14 @@ enum msgr_state_t {
 	MSGR_STATE_THREAD_STOPPING,
 };
 
-RB_HEAD(msgr_conn, mconn);
-RB_GENERATE(msgr_conn, mconn, entry, mconn_compare);
+LIST_HEAD(msgr_conn, mconn);
 
 struct msgr {
-	/** lock that protects thread state, pending_tr_head,
-	 * conn_cancels_head, and (sort of) timeo_id */
+	/** lock that protects thread state and conn_cancels_head */
 	pthread_spinlock_t lock;
-	/** messenger thread state */
-	enum msgr_state_t state;
+	/** messenger thread state.  Only modified under the lock, but
+	 * mtran_send reads it without taking the lock. */
+	volatile enum msgr_state_t state;
 	/** thread */
 	struct redfish_thread rt;
 	/** Main loop */
@@ -159,27 +246,62 @@ struct msgr {
 	int cur_conn;
 	/** Maximum number of simultaneous connections to allow */
 	int max_conn;
-	/** TCP connections. Keyed on remote IP address */
+	/** All TCP connections, in no particular order */
 	struct msgr_conn conn_head;
+	/** TCP connections. Hash table keyed on MCONN_KEY(ip, port, lane) */
+	struct hmap conn_map;
+	/** Number of connections to open to each remote endpoint */
+	int conns_per_peer;
+	/** Messages of at least this size go on the bulk lanes */
+	uint32_t bulk_msg_thresh;
+	/** Message bodies of at least this size are compressed, if the remote
+	 * end can take it.  0 means never compress. */
+	uint32_t compress_thresh;
+	/** Compression statistics for all connections, past and present.
+	 * Only modified by the messenger thread. */
+	struct msgr_compress_stats compress_stats;
 	/** Async watcher. Lets us know that another thread asked us to shut
 	 * down or send a message. */
 	struct ev_async w_notify;
-	/** event watcher for connection timeout */
+	/** event watcher for the timer wheel.  Armed to go off at the next
+	 * tick that the wheel cares about, if any. */
 	struct ev_timer w_timeout;
-	/** Pending transactions not yet assigned to a connection */
+	/** Prepare watcher which calls listen.flush before the loop blocks */
+	struct ev_prepare w_prepare;
+	/** Nonzero if we have delivered a message since we last called
+	 * listen.flush.  Only touched by the messenger thread. */
+	int need_flush;
+	/** Transactor and connection timeouts, in milliseconds.  Only touched
+	 * by the messenger thread. */
+	struct twheel wheel;
+	/** The tick at which w_timeout is set to go off, or UINT64_MAX if
+	 * it is not armed */
+	uint64_t wheel_wakeup;
+	/** Send queue statistics.  Only modified by the messenger thread. */
+	struct msgr_prio_stats prio_stats;
+	/** Transactors submitted by mtran_send, but not yet picked up by the
+	 * messenger thread.  Lock-free; see util/mpsc_queue.h */
+	struct mpsc_queue submit_q;
+	/** Number of threads currently inside mtran_send_ms.  msgr_shutdown
+	 * waits for this to drop to 0 before its last drain of submit_q. */
+	int num_senders;
+	/** Pending transactions not yet assigned to a connection.  Only touched
+	 * by the messenger thread. */
 	struct pending_tr pending_tr_head;
 	/** Fast log buffer manager */
 	struct fast_log_mgr *fl_mgr;
-	/** Maximum number of timeout periods to wait for before timing out a
-	 * connection or transactor */
-	int tcp_teardown_timeo;
-	/** Current timeout period ID. */
-	uint16_t timeo_id;
+	/** Number of milliseconds to allow a TCP connection to sit idle before
+	 * tearing it down */
+	uint64_t tcp_teardown_timeo_ms;
 	/** The name of this messenger */
 	char *name;
 };
 
 /****************************** utility ********************************/
+/** The key we use for a connection to a remote endpoint in msgr->conn_map */
+#define MCONN_KEY(ip, port, lane) ((((uint64_t)(lane)) << 48) | \
+	(((uint64_t)(ip)) << 16) | ((uint64_t)(port)))
+
 static int is_temporary_socket_error(int err)
 {
 	return ((err == EAGAIN) || (err == EWOULDBLOCK) || (err == EINTR));
@@ -194,12 +316,58 @@ void fast_log_msgr(struct msgr *msgr, uint16_t ty,
 		port, ip, trid, rem_trid, event, event_data);
 }
 
+/** Arm w_timeout to go off at the next tick the timer wheel cares about. */
+static void msgr_timer_rearm(struct msgr *msgr)
+{
+	uint64_t next, now;
+	ev_tstamp delay;
+
+	next = twheel_next(&msgr->wheel);
+	if (next == msgr->wheel_wakeup)
+		return;
+	ev_timer_stop(msgr->loop, &msgr->w_timeout);
+	msgr->wheel_wakeup = next;
+	if (next == UINT64_MAX)
+		return;
+	now = mt_time_ms();
+	delay = (next > now) ? ((next - now) / 1000.0) : 0.0;
+	ev_timer_set(&msgr->w_timeout, delay, 0.0);
+	ev_timer_start(msgr->loop, &msgr->w_timeout);
+}
+
+/** Arm a timer in the messenger's timer wheel.
+ *
+ * Must be called from the messenger thread.
+ */
+static void msgr_timer_add(struct msgr *msgr, struct twheel_tm *tm,
+		uint64_t expire)
+{
+	twheel_add(&msgr->wheel, tm, expire);
+	if (expire < msgr->wheel_wakeup)
+		msgr_timer_rearm(msgr);
+}
+
 /****************************** mtran ********************************/
+/** Unless told otherwise, a reply goes out in the same priority class as the
+ * message it is replying to.
+ *
+ * @param tr		The transactor.  tr->prio is the class of the last
+ *			message received on it, or MSG_PRIO_NORMAL.
+ * @param m		The message we're about to send on tr
+ */
+static void mtran_inherit_prio(const struct mtran *tr, struct msg *m)
+{
+	if ((tr->prio != MSG_PRIO_NORMAL) &&
+			(msg_get_prio(m) == MSG_PRIO_NORMAL))
+		msg_set_prio(m, tr->prio);
+}
+
 void *mtran_alloc(struct msgr *msgr)
 {
 	struct mtran *tr = calloc(1, sizeof(struct mtran));
 	if (!tr)
 		return NULL;
+	twheel_tm_init(&tr->timeo, mtran_timeo_cb);
 	// TODO: should really make this thread-local so we don't have to suffer
 	// through an atomic operation here
 	tr->trid = __sync_fetch_and_add(&msgr->next_trid, 1);
@@ -216,72 +384,82 @@ void mtran_free(struct mtran *tr)
 	free(tr);
 }
 
-static int mtran_compare_trid(struct mtran *a, struct mtran *b)
+static struct mtran *mtran_lookup_by_id(struct mconn *conn, uint32_t trid)
 {
-	if (a->trid < b->trid)
-		return -1;
-	else if (a->trid > b->trid)
-		return 1;
-	else
-		return 0;
+	return hmap_get(&conn->active, trid);
 }
 
-static int mtran_compare_timeo(struct mtran *a, struct mtran *b)
+static int mtran_activate(struct mconn *conn, struct mtran *tr)
 {
-	int c;
+	int ret;
 
-	/* Do a circular comparison of the timeout period.  The correctness of
-	 * this function is based on the fact that we'll never have a transactor
-	 * lingering for 546 hours (2**15 seconds)  */
-	c = circ_compare16(a->timeo_id, b->timeo_id);
-	if (c)
-		return c;
-	return mtran_compare_trid(a, b);
+	ret = hmap_put(&conn->active, tr->trid, tr);
+	if (ret) {
+		fast_log_msgr(conn->msgr, FAST_LOG_MSGR_ERROR,
+			conn->port, conn->ip, tr->trid, tr->rem_trid,
+			FLME_OOM, 5);
+	}
+	return ret;
 }
 
-static struct mtran *mtran_lookup_by_id(struct mconn *conn, uint32_t trid)
+void mtran_send(struct msgr *msgr, struct mtran *tr,
+		msgr_cb_t cb, void *priv, struct msg *m, int timeo)
 {
-	struct mtran exemplar;
-	memset(&exemplar, 0, sizeof(exemplar));
-	exemplar.trid = trid;
-	return RB_FIND(active_tr, &conn->active_head, &exemplar);
+	if (timeo > MSGR_TIMEOUT_MAX)
+		timeo = MSGR_TIMEOUT_MAX + 1;
+	mtran_send_ms(msgr, tr, cb, priv, m, timeo * 1000);
 }
 
-void mtran_send(struct msgr *msgr, struct mtran *tr,
-		msgr_cb_t cb, void *priv, struct msg *m, int timeo)
+void mtran_send_ms(struct msgr *msgr, struct mtran *tr,
+		msgr_cb_t cb, void *priv, struct msg *m, int timeo_ms)
 {
-	if (timeo > MSGR_TIMEOUT_MAX) {
+	if (timeo_ms > MSGR_TIMEOUT_MAX_MS) {
 		mtran_deliver_netfail(tr, EINVAL);
 		return;
 	}
+	/* The messenger thread will arm the timer when it assigns the
+	 * transactor to a connection. */
+	tr->timeo.expire = mt_time_ms() + timeo_ms;
+	mtran_inherit_prio(tr, m);
 	tr->state = MTRAN_STATE_SENDING;
 	tr->cb = cb;
 	tr->priv = priv;
 	tr->m = m;
 	m->rem_trid = htobe32(tr->trid);
 	m->trid = htobe32(tr->rem_trid);
-	pthread_spin_lock(&msgr->lock);
+	/* Announce ourselves before looking at msgr->state.  msgr_shutdown
+	 * sets the state first and then waits for num_senders to drop to 0,
+	 * so either we see MSGR_STATE_THREAD_STOPPING here, or msgr_shutdown
+	 * waits for our push to land before its final drain of submit_q. */
+	__sync_fetch_and_add(&msgr->num_senders, 1);
 	if (msgr->state == MSGR_STATE_THREAD_STOPPING) {
 		/* Once the messenger is in shutdown, we don't want to add any
-		 * new transactors to the pending queue.
-		 */
-		pthread_spin_unlock(&msgr->lock);
+		 * new transactors to the submission queue. */
+		__sync_fetch_and_sub(&msgr->num_senders, 1);
 		mtran_deliver_netfail(tr, ECANCELED);
 		return;
 	}
-	tr->timeo_id = (uint16_t)msgr->timeo_id + (uint16_t)timeo;
-	/* Add our transactor to the pending queue and poke the messenger
-	 * thread.  It will decide which connection (mconn) to give the
-	 * transactor to. */
-	STAILQ_INSERT_TAIL(&msgr->pending_tr_head, tr, u.pending_entry);
-	pthread_spin_unlock(&msgr->lock);
-	ev_async_send(msgr->loop, &msgr->w_notify);
+	/* Add our transactor to the submission queue.  The messenger thread
+	 * will decide which connection (mconn) to give the transactor to.  It
+	 * drains the whole queue each time it wakes up, so we only need to
+	 * poke it if the queue was empty. */
+	if (mpsc_queue_push(&msgr->submit_q, &tr->u.submit_entry))
+		ev_async_send(msgr->loop, &msgr->w_notify);
+	__sync_fetch_and_sub(&msgr->num_senders, 1);
 }
 
 void mtran_send_next(struct mconn *conn, struct mtran *tr, struct msg *m,
 		int timeo)
 {
-	if (timeo > MSGR_TIMEOUT_MAX) {
+	if (timeo > MSGR_TIMEOUT_MAX)
+		timeo = MSGR_TIMEOUT_MAX + 1;
+	mtran_send_next_ms(conn, tr, m, timeo * 1000);
+}
+
+void mtran_send_next_ms(struct mconn *conn, struct mtran *tr, struct msg *m,
+		int timeo_ms)
+{
+	if (timeo_ms > MSGR_TIMEOUT_MAX_MS) {
 		mtran_deliver_netfail(tr, EINVAL);
 		return;
 	}
@@ -289,24 +467,32 @@ void mtran_send_next(struct mconn *conn, struct mtran *tr, struct msg *m,
 	 * only be invoked from the context of a callback made by the messenger
 	 * thread itself.  Since all modifications to struct mconn are made from
 	 * that same messenger thread, there is no concurrency hazard. */
+	mtran_inherit_prio(tr, m);
 	tr->state = MTRAN_STATE_SENDING;
 	tr->m = m;
-	tr->timeo_id = (uint16_t)conn->msgr->timeo_id + (uint16_t)timeo;
 	m->rem_trid = htobe32(tr->trid);
 	m->trid = htobe32(tr->rem_trid);
-	STAILQ_INSERT_TAIL(&conn->pending_head, tr, u.pending_entry);
-	RB_INSERT(timeo_tr, &conn->timeo_head, tr);
 	fast_log_msgr(conn->msgr, FAST_LOG_MSGR_DEBUG,
 		tr->port, tr->ip, tr->trid,
 		tr->rem_trid, FLME_MTRAN_SEND_NEXT, be16toh(m->ty));
+	/* mconn_enqueue may replace the message with a compressed copy, so
+	 * don't touch m after this. */
+	mconn_enqueue(conn, tr);
+	msgr_timer_add(conn->msgr, &tr->timeo, mt_time_ms() + timeo_ms);
 	ev_io_start(conn->msgr->loop, &conn->w_write);
 }
 
 void mtran_recv_next(struct mconn *conn, struct mtran *tr)
 {
 	tr->state = MTRAN_STATE_ACTIVE;
-	RB_INSERT(active_tr, &conn->active_head, tr);
-	RB_INSERT(timeo_tr, &conn->timeo_head, tr);
+	if (mtran_activate(conn, tr)) {
+		mtran_deliver_netfail(tr, ENOMEM);
+		return;
+	}
+	/* The timeout covers both sending the request and receiving the
+	 * response, so we re-arm with the same expiry time we used before. */
+	tr->conn = conn;
+	msgr_timer_add(conn->msgr, &tr->timeo, tr->timeo.expire);
 }
 
 int mconn_cancel(struct msgr *msgr, uint32_t addr, uint16_t port)
@@ -334,6 +520,25 @@ struct msgr *mconn_get_msgr(struct mconn *conn)
 	return conn->msgr;
 }
 
+void msgr_get_prio_stats(const struct msgr *msgr,
+		struct msgr_prio_stats *stats)
+{
+	memcpy(stats, &msgr->prio_stats, sizeof(struct msgr_prio_stats));
+}
+
+void mconn_get_compress_stats(const struct mconn *conn,
+		struct msgr_compress_stats *stats)
+{
+	memcpy(stats, &conn->cstats, sizeof(struct msgr_compress_stats));
+}
+
+void msgr_get_compress_stats(const struct msgr *msgr,
+		struct msgr_compress_stats *stats)
+{
+	memcpy(stats, &msgr->compress_stats,
+		sizeof(struct msgr_compress_stats));
+}
+
 static void mtran_deliver_netfail(struct mtran *tr, int err)
 {
 	if (tr->state == MTRAN_STATE_SENDING)
@@ -348,9 +553,9 @@ static void mtran_deliver_netfail(struct mtran *tr, int err)
 
 /****************************** mconn ********************************/
 static struct mconn *mconn_create(struct msgr *msgr,
-		uint32_t ip, uint16_t port, int sock)
+		uint32_t ip, uint16_t port, int lane, int sock)
 {
-	int ret;
+	int i, ret;
 	struct mconn *conn;
 	struct sockaddr_in addr;
 
@@ -362,19 +567,36 @@ static struct mconn *mconn_create(struct msgr *msgr,
 	conn = calloc(1, sizeof(struct mconn));
 	if (!conn)
 		return ERR_PTR(ENOMEM);
+	if (hmap_init(&conn->active, MCONN_ACTIVE_INIT_CAP)) {
+		free(conn);
+		return ERR_PTR(ENOMEM);
+	}
+	if (hmap_put(&msgr->conn_map, MCONN_KEY(ip, port, lane), conn)) {
+		hmap_free(&conn->active);
+		free(conn);
+		return ERR_PTR(ENOMEM);
+	}
+	msgr->cur_conn++;
 	ev_init(&conn->w_write, NULL);
 	ev_init(&conn->w_read, NULL);
 	conn->msgr = msgr;
 	conn->ip = ip;
 	conn->port = port;
+	conn->lane = lane;
 	conn->sent_cnt = 0;
 	conn->recv_cnt = 0;
 	conn->inbound_tr = NULL;
 	conn->inbound_msg = NULL;
-	RB_INIT(&conn->active_head);
-	RB_INIT(&conn->timeo_head);
-	STAILQ_INIT(&conn->pending_head);
-	RB_INSERT(msgr_conn, &msgr->conn_head, conn);
+	for (i = 0; i < MSG_PRIO_NUM; ++i)
+		STAILQ_INIT(&conn->pending_head[i]);
+	conn->pending_bytes = 0;
+	conn->sending = NULL;
+	conn->drr_cur = 0;
+	LIST_INSERT_HEAD(&msgr->conn_head, conn, entry);
+	conn->last_active = mt_time_ms();
+	twheel_tm_init(&conn->idle_tm, mconn_idle_cb);
+	msgr_timer_add(msgr, &conn->idle_tm,
+		conn->last_active + msgr->tcp_teardown_timeo_ms);
 	if (sock < 0) {
 		conn->sock = do_socket(AF_INET, SOCK_STREAM, 0,
 				WANT_O_CLOEXEC | WANT_O_NONBLOCK);
@@ -422,16 +644,93 @@ static struct mconn *mconn_create(struct msgr *msgr,
 	ev_io_init(&conn->w_read, mconn_readable_cb,
 		conn->sock, EV_READ);
 	ev_io_start(msgr->loop, &conn->w_read);
+	if (sock < 0)
+		mconn_send_hello(conn);
 	return conn;
 }
 
-static struct mconn* mconn_find(struct msgr* msgr, uint32_t ip, uint16_t port)
+static struct mconn* mconn_find(struct msgr* msgr, uint32_t ip, uint16_t port,
+		int lane)
+{
+	return hmap_get(&msgr->conn_map, MCONN_KEY(ip, port, lane));
+}
+
+/** Add a transactor to the end of a connection's pending queue.
+ *
+ * @param conn		The connection
+ * @param tr		The transactor.  tr->m must be the message to send.
+ */
+static void mconn_enqueue(struct mconn *conn, struct mtran *tr)
+{
+	struct msgr_prio_stats *stats = &conn->msgr->prio_stats;
+
+	mconn_compress(conn, tr);
+	tr->conn = conn;
+	tr->prio = msg_get_prio(tr->m);
+	STAILQ_INSERT_TAIL(&conn->pending_head[tr->prio], tr,
+			u.pending_entry);
+	conn->pending_bytes += be32toh(tr->m->len);
+	if (++stats->depth[tr->prio] > stats->max_depth[tr->prio])
+		stats->max_depth[tr->prio] = stats->depth[tr->prio];
+}
+
+/** Remove a transactor from a connection's pending queue.
+ *
+ * @param conn		The connection
+ * @param tr		The transactor.  tr->m must still be the message.
+ */
+static void mconn_dequeue(struct mconn *conn, struct mtran *tr)
+{
+	STAILQ_REMOVE(&conn->pending_head[tr->prio], tr, mtran,
+			u.pending_entry);
+	conn->pending_bytes -= be32toh(tr->m->len);
+	conn->msgr->prio_stats.depth[tr->prio]--;
+	if (conn->sending == tr)
+		conn->sending = NULL;
+}
+
+/** Choose the next transactor to send on a connection.
+ *
+ * The priority classes share the connection by deficit round robin.  When it
+ * is a class's turn, it gets g_drr_quantum bytes added to its deficit, and it
+ * may keep sending for as long as the message at the head of its queue fits
+ * into the deficit.  A class that empties its queue loses whatever deficit it
+ * had left over.
+ *
+ * @param conn		The connection
+ *
+ * @return		The transactor to send, or NULL if there is nothing to
+ *			send
+ */
+static struct mtran *mconn_next_send(struct mconn *conn)
 {
-	struct mconn exemplar;
-	memset(&exemplar, 0, sizeof(exemplar));
-	exemplar.ip = ip;
-	exemplar.port = port;
-	return RB_FIND(msgr_conn, &msgr->conn_head, &exemplar);
+	struct mtran *tr;
+	uint32_t len;
+	int c;
+
+	if (conn->sending)
+		return conn->sending;
+	if (conn->pending_bytes == 0)
+		return NULL;
+	while (1) {
+		c = conn->drr_cur;
+		tr = STAILQ_FIRST(&conn->pending_head[c]);
+		if (!tr) {
+			conn->drr_deficit[c] = 0;
+		}
+		else {
+			len = be32toh(tr->m->len);
+			if (len <= conn->drr_deficit[c]) {
+				conn->drr_deficit[c] -= len;
+				conn->sending = tr;
+				return tr;
+			}
+		}
+		c = (c + 1) % MSG_PRIO_NUM;
+		conn->drr_cur = c;
+		if (!STAILQ_EMPTY(&conn->pending_head[c]))
+			conn->drr_deficit[c] += g_drr_quantum[c];
+	}
 }
 
 /** Tear down a connection.
@@ -441,13 +740,15 @@ static struct mconn* mconn_find(struct msgr* msgr, uint32_t ip, uint16_t port)
  */
 static void mconn_teardown(struct mconn *conn, int failcode)
 {
-	int res, num_failed;
+	int i, res, num_failed;
 	struct msgr *msgr = conn->msgr;
-	struct mtran *tr, *tr_tmp;
+	struct mtran *tr;
+	uint32_t idx;
 
-	/* NOTE: we don't bother removing transactors from the timeout tree
-	 * here.  There isn't any reason to do it. */
-	RB_REMOVE(msgr_conn, &msgr->conn_head, conn);
+	LIST_REMOVE(conn, entry);
+	twheel_del(&msgr->wheel, &conn->idle_tm);
+	hmap_remove(&msgr->conn_map,
+		MCONN_KEY(conn->ip, conn->port, conn->lane));
 	conn->msgr->cur_conn--;
 	ev_io_stop(conn->msgr->loop, &conn->w_write);
 	ev_io_stop(conn->msgr->loop, &conn->w_read);
@@ -462,19 +763,35 @@ static void mconn_teardown(struct mconn *conn, int failcode)
 	}
 	/* Deliver a failure message to all pending transactors */
 	num_failed = 0;
-	while (1) {
-		tr = STAILQ_FIRST(&conn->pending_head);
-		if (!tr)
-			break;
-		STAILQ_REMOVE_HEAD(&conn->pending_head, u.pending_entry);
-		mtran_deliver_netfail(tr, failcode);
-		++num_failed;
+	for (i = 0; i < MSG_PRIO_NUM; ++i) {
+		while (1) {
+			tr = STAILQ_FIRST(&conn->pending_head[i]);
+			if (!tr)
+				break;
+			mconn_dequeue(conn, tr);
+			twheel_del(&msgr->wheel, &tr->timeo);
+			if (tr != conn->hello_tr)
+				++num_failed;
+			mtran_deliver_netfail(tr, failcode);
+		}
 	}
-	/* Deliver a failure message to all active transactors */
-	RB_FOREACH_SAFE(tr, active_tr, &conn->active_head, tr_tmp) {
-		RB_REMOVE(active_tr, &conn->active_head, tr);
+	/* Deliver a failure message to all active transactors.  The
+	 * connection is no longer reachable through conn_map, so nothing can
+	 * modify the active table while we walk it. */
+	HMAP_FOREACH(&conn->active, idx, tr) {
+		twheel_del(&msgr->wheel, &tr->timeo);
+		if (tr != conn->hello_tr)
+			++num_failed;
 		mtran_deliver_netfail(tr, failcode);
-		++num_failed;
+	}
+	hmap_free(&conn->active);
+	/* ECANCELED teardowns may come from msgr_shutdown, after the
+	 * messenger thread and the log buffer that went with it are gone. */
+	if ((conn->cstats.tx_raw != 0) && (failcode != ECANCELED)) {
+		fast_log_msgr(msgr, FAST_LOG_MSGR_INFO, conn->port, conn->ip,
+			0, 0, FLME_COMPRESS_RATIO,
+			cram_into_u16((conn->cstats.tx_wire * 100) /
+				conn->cstats.tx_raw));
 	}
 	if (failcode == ETIMEDOUT) {
 		int severity = (num_failed == 0) ?
@@ -485,19 +802,6 @@ static void mconn_teardown(struct mconn *conn, int failcode)
 	free(conn);
 }
 
-static int mconn_compare(struct mconn *a, struct mconn *b)
-{
-	if (a->ip < b->ip)
-		return -1;
-	else if (a->ip > b->ip)
-		return 1;
-	if (a->port < b->port)
-		return -1;
-	else if (a->port > b->port)
-		return 1;
-	return 0;
-}
-
 static void mconn_handle_connect(struct msgr *msgr, struct mconn *conn)
 {
 	int val = 0, ret;
@@ -522,11 +826,41 @@ static void mconn_handle_connect(struct msgr *msgr, struct mconn *conn)
 	conn->state = MCONN_ESTABLISHED;
 }
 
+/** Fill in conn->out_hdr for a message that we are about to start sending.
+ *
+ * Remote ends that asked for it in their hello get told how long we will still
+ * wait for an answer, so that they don't start work we will no longer wait
+ * for.  Everyone else gets the struct msg header as it is.
+ *
+ * @param conn		The connection
+ * @param tr		The transactor whose message we are about to send
+ */
+static void mconn_fill_out_hdr(struct mconn *conn, const struct mtran *tr)
+{
+	struct msg *hdr = (struct msg*)conn->out_hdr;
+	uint64_t now;
+	uint32_t left;
+
+	memcpy(hdr, tr->m, sizeof(struct msg));
+	conn->out_hdr_len = sizeof(struct msg);
+	if (!(conn->peer_feat & MSGR_FEAT_TIMEO))
+		return;
+	/* We send a relative time rather than an absolute deadline, since the
+	 * clocks on different nodes can't be trusted to agree. */
+	now = mt_time_ms();
+	left = (tr->timeo.expire > now) ? (tr->timeo.expire - now) : 1;
+	pack_to_be32(hdr->data, left);
+	pack_to_be32(&hdr->len, be32toh(tr->m->len) + sizeof(uint32_t));
+	pack_to_8(&hdr->flags, unpack_from_8(&hdr->flags) | MSG_FLAG_TIMEO);
+	conn->out_hdr_len += sizeof(uint32_t);
+}
+
 static void mconn_writable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 		struct ev_io *w, int revents)
 {
 	int ret;
-	int full, amt, res;
+	int full, amt, res, body_len;
+	struct iovec iov[2];
 	struct mconn *conn = GET_OUTER(w, struct mconn, w_write);
 	struct msgr *msgr = conn->msgr;
 	struct mtran *tr;
@@ -539,13 +873,13 @@ static void mconn_writable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	}
 	if (!(revents & EV_WRITE))
 		return;
-	conn->timeout_cnt = 0; /* register some activity */
+	conn->last_active = mt_time_ms(); /* register some activity */
 	if (conn->state == MCONN_CONNECTING) {
 		mconn_handle_connect(msgr, conn);
 		return;
 	}
 	/* let's send some data */
-	tr = STAILQ_FIRST(&conn->pending_head);
+	tr = mconn_next_send(conn);
 	if (!tr) {
 		fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR,
 			conn->port, conn->ip, 0, 0,
@@ -555,11 +889,24 @@ static void mconn_writable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	}
 	if (tr->state != MTRAN_STATE_SENDING)
 		abort();
-	full = be32toh(tr->m->len);
+	if (conn->sent_cnt == 0)
+		mconn_fill_out_hdr(conn, tr);
+	body_len = be32toh(tr->m->len) - sizeof(struct msg);
+	full = conn->out_hdr_len + body_len;
 	amt = full - conn->sent_cnt;
 	if (amt <= 0)
 		abort();
-	res = send(conn->sock, tr->m, amt, 0);
+	if (conn->sent_cnt < conn->out_hdr_len) {
+		iov[0].iov_base = conn->out_hdr + conn->sent_cnt;
+		iov[0].iov_len = conn->out_hdr_len - conn->sent_cnt;
+		iov[1].iov_base = tr->m->data;
+		iov[1].iov_len = body_len;
+		res = writev(conn->sock, iov, 2);
+	}
+	else {
+		res = send(conn->sock, tr->m->data +
+			(conn->sent_cnt - conn->out_hdr_len), amt, 0);
+	}
 	if (res < 0) {
 		ret = errno;
 		if (is_temporary_socket_error(ret))
@@ -575,10 +922,18 @@ static void mconn_writable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	if (conn->sent_cnt != full)
 		return;
 	conn->sent_cnt = 0;
-	STAILQ_REMOVE_HEAD(&conn->pending_head, u.pending_entry);
-	RB_REMOVE(timeo_tr, &conn->timeo_head, tr);
-	if (!STAILQ_FIRST(&conn->pending_head))
+	mconn_dequeue(conn, tr);
+	if (tr != conn->hello_tr)
+		msgr->prio_stats.sent[tr->prio]++;
+	if (conn->pending_bytes == 0)
 		ev_io_stop(msgr->loop, &conn->w_write);
+	if (!twheel_tm_armed(&tr->timeo)) {
+		/* The transactor timed out while we were in the middle of
+		 * sending it.  See mtran_timeo_cb. */
+		mtran_deliver_netfail(tr, ETIMEDOUT);
+		return;
+	}
+	twheel_del(&msgr->wheel, &tr->timeo);
 	msg_release(tr->m);
 	tr->m = NULL;
 	tr->state = MTRAN_STATE_SENT;
@@ -605,9 +960,14 @@ static struct mtran* mconn_create_mtran(struct msgr *msgr, struct mconn *conn,
 	tr->cb = cb;
 	tr->priv = msgr->listen.priv;
 	tr->state = MTRAN_STATE_ACTIVE;
-	tr->timeo_id = (uint16_t)msgr->timeo_id +
-		(uint16_t)MSGR_INCOMING_TIMEO;
-	RB_INSERT(active_tr, &conn->active_head, tr);
+	tr->conn = conn;
+	if (mtran_activate(conn, tr)) {
+		mtran_free(tr);
+		mconn_teardown(conn, ENOMEM);
+		return ERR_PTR(MSGR_RET_STOP);
+	}
+	msgr_timer_add(msgr, &tr->timeo,
+		mt_time_ms() + MSGR_INCOMING_TIMEO_MS);
 	return tr;
 }
 
@@ -630,7 +990,9 @@ static int mconn_read_msg_hdr(struct msgr *msgr, struct mconn *conn)
 {
 	struct mtran *tr;
 	struct msg *m;
+	char *buf;
 	int amt, res, ret;
+	uint8_t flags;
 	uint32_t m_len, trid, rem_trid;
 
 	/* The message header tells us how long the complete message will be */
@@ -646,26 +1008,61 @@ static int mconn_read_msg_hdr(struct msgr *msgr, struct mconn *conn)
 			return MSGR_RET_STOP;
 		}
 	}
-	amt = sizeof(struct msg) - conn->recv_cnt;
-	res = read(conn->sock,
-		((char*)conn->inbound_msg) + conn->recv_cnt, amt);
-	/* refcnt needs to stay at 1 so that if we shut down this connection,
-	 * the message gets properly freed. */
-	pack_to_8(&conn->inbound_msg->refcnt, 1);
-	if (res < 0) {
-		ret = errno;
-		if (is_temporary_socket_error(ret))
+	while (1) {
+		if (conn->recv_cnt < (int)sizeof(struct msg)) {
+			buf = ((char*)conn->inbound_msg) + conn->recv_cnt;
+			amt = sizeof(struct msg) - conn->recv_cnt;
+		}
+		else if (conn->inbound_timeo_left > 0) {
+			buf = ((char*)&conn->inbound_timeo) + sizeof(uint32_t) -
+				conn->inbound_timeo_left;
+			amt = conn->inbound_timeo_left;
+		}
+		else {
+			break;
+		}
+		res = read(conn->sock, buf, amt);
+		/* refcnt needs to stay at 1 so that if we shut down this
+		 * connection, the message gets properly freed. */
+		pack_to_8(&conn->inbound_msg->refcnt, 1);
+		if (res <= 0) {
+			/* A zero-byte read means that the remote end closed
+			 * the connection. */
+			ret = (res == 0) ? ECONNRESET : errno;
+			if (is_temporary_socket_error(ret))
+				return MSGR_RET_STOP;
+			fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR, conn->port,
+				conn->ip, 0, 0, FLME_HDR_READ_ERROR, ret);
+			mconn_teardown(conn, ret);
+			return MSGR_RET_STOP;
+		}
+		if (conn->recv_cnt < (int)sizeof(struct msg)) {
+			conn->recv_cnt += res;
+			if (conn->recv_cnt == (int)sizeof(struct msg)) {
+				conn->inbound_timeo = 0;
+				if (unpack_from_8(&conn->inbound_msg->flags) &
+						MSG_FLAG_TIMEO) {
+					conn->inbound_timeo_left =
+						sizeof(uint32_t);
+				}
+			}
+		}
+		else {
+			conn->inbound_timeo_left -= res;
+		}
+		if (res < amt)
 			return MSGR_RET_STOP;
-		fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR, conn->port,
-			conn->ip, 0, 0, FLME_HDR_READ_ERROR, ret);
-		mconn_teardown(conn, ret);
-		return MSGR_RET_STOP;
-	}
-	conn->recv_cnt += res;
-	if (conn->recv_cnt < (int)sizeof(struct msg)) {
-		return MSGR_RET_STOP;
 	}
 	m_len = be32toh(conn->inbound_msg->len);
+	flags = unpack_from_8(&conn->inbound_msg->flags);
+	if (flags & MSG_FLAG_TIMEO) {
+		/* Strip the timeout off, so that the message looks the same as
+		 * it would have without one. */
+		m_len = (m_len >= sizeof(struct msg) + sizeof(uint32_t)) ?
+			(m_len - sizeof(uint32_t)) : 0;
+		pack_to_be32(&conn->inbound_msg->len, m_len);
+		pack_to_8(&conn->inbound_msg->flags, flags & ~MSG_FLAG_TIMEO);
+	}
 	if (m_len < sizeof(struct msg)) {
 		fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR, conn->port,
 			conn->ip, 0, 0, FLME_HDR_READ_ERROR, ENODATA);
@@ -680,6 +1077,12 @@ static int mconn_read_msg_hdr(struct msgr *msgr, struct mconn *conn)
 		return MSGR_RET_STOP;
 	}
 	conn->inbound_msg = m;
+	if (be16toh(m->ty) == MSGR_HELLO_TY) {
+		/* Hello messages don't belong to any transactor.  We deal
+		 * with them ourselves once they have arrived. */
+		conn->inbound_tr = NULL;
+		return MSGR_RET_CONTINUE;
+	}
 	trid = be32toh(conn->inbound_msg->trid);
 	if (trid == 0) {
 		/* A trid of 0 means that no transactor has been allocated yet
@@ -720,7 +1123,9 @@ static void mconn_readable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	struct mconn *conn = GET_OUTER(w, struct mconn, w_read);
 	struct msgr *msgr = conn->msgr;
 	struct mtran *tr;
-	uint32_t m_len;
+	struct msg *m;
+	uint32_t m_len, timeo_ms;
+	int ret;
 
 	if (revents & EV_ERROR) {
 		fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR, conn->port,
@@ -730,8 +1135,9 @@ static void mconn_readable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	}
 	if (!(revents & EV_READ))
 		return;
-	conn->timeout_cnt = 0; /* register some activity */
-	if (conn->recv_cnt < (int)sizeof(struct msg)) {
+	conn->last_active = mt_time_ms(); /* register some activity */
+	if ((conn->recv_cnt < (int)sizeof(struct msg)) ||
+			(conn->inbound_timeo_left > 0)) {
 		if (mconn_read_msg_hdr(msgr, conn) != MSGR_RET_CONTINUE)
 			return;
 	}
@@ -739,9 +1145,10 @@ static void mconn_readable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	m_len = be32toh(conn->inbound_msg->len);
 	amt = m_len - conn->recv_cnt;
 	if (amt > 0) {
-		res = recv(conn->sock, conn->inbound_msg->data, amt, 0);
+		res = recv(conn->sock,
+			((char*)conn->inbound_msg) + conn->recv_cnt, amt, 0);
 		if (res <= 0) {
-			int ret = errno;
+			ret = (res == 0) ? ECONNRESET : errno;
 			if (is_temporary_socket_error(ret))
 				return;
 			fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR,
@@ -755,18 +1162,232 @@ static void mconn_readable_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 			return;
 		}
 	}
+	if (!conn->inbound_tr) {
+		conn->recv_cnt = 0;
+		m = conn->inbound_msg;
+		conn->inbound_msg = NULL;
+		mconn_handle_hello(conn, m);
+		return;
+	}
+	if (unpack_from_8(&conn->inbound_msg->flags) & MSG_FLAG_LZ) {
+		ret = mconn_decompress(conn);
+		if (ret) {
+			fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR,
+				conn->port, conn->ip, 0, 0,
+				FLME_DECOMPRESS_FAILED, ret);
+			mconn_teardown(conn, ret);
+			return;
+		}
+	}
 	/* deliver the message */
 	tr = conn->inbound_tr;
 	conn->inbound_tr = NULL;
-	RB_REMOVE(active_tr, &conn->active_head, tr);
-	RB_REMOVE(timeo_tr, &conn->timeo_head, tr);
+	hmap_remove(&conn->active, tr->trid);
+	twheel_del(&msgr->wheel, &tr->timeo);
 	conn->recv_cnt = 0;
 	tr->m = conn->inbound_msg;
 	conn->inbound_msg = NULL;
+	tr->prio = msg_get_prio(tr->m);
+	/* Turn the sender's timeout into a deadline on our own clock.  We
+	 * don't know how long the message spent in transit, so this errs on
+	 * the side of doing the work. */
+	timeo_ms = be32toh(conn->inbound_timeo);
+	tr->deadline_ms = timeo_ms ? (conn->last_active + timeo_ms) : 0;
 	tr->state = MTRAN_STATE_RECV;
+	msgr->need_flush = 1;
 	tr->cb(conn, tr);
 }
 
+/****************************** compression ********************************/
+static void mtran_hello_cb(struct mconn *conn, struct mtran *tr)
+{
+	/* conn is NULL if we are being told about a failure, but tr->conn is
+	 * still valid. */
+	struct mconn *tr_conn = tr->conn;
+
+	if ((tr->state == MTRAN_STATE_SENT) && (tr->m == NULL) &&
+			(!tr_conn->got_hello)) {
+		/* We spoke first, and the remote end hasn't answered yet.  A
+		 * remote end that knows about hello messages answers with one
+		 * of its own.  An older one hands ours to its normal message
+		 * handlers, and any reply comes back to this transactor.
+		 * Either way, we stop waiting as soon as we hear something. */
+		tr->state = MTRAN_STATE_ACTIVE;
+		if (mtran_activate(conn, tr) == 0) {
+			msgr_timer_add(conn->msgr, &tr->timeo,
+				tr->timeo.expire);
+			return;
+		}
+	}
+	tr_conn->hello_tr = NULL;
+	mtran_free(tr);
+}
+
+/** Queue a hello message telling the remote end which features we support.
+ *
+ * If we run out of memory, we just don't send it.  The connection works fine
+ * without it; it just won't use compression or send timeouts.
+ *
+ * @param conn		The connection
+ */
+static void mconn_send_hello(struct mconn *conn)
+{
+	struct msgr *msgr = conn->msgr;
+	struct mtran *tr;
+	struct msg *m;
+
+	m = calloc_msg(MSGR_HELLO_TY, sizeof(struct msg) + sizeof(uint32_t));
+	if (!m)
+		return;
+	pack_to_be32(m->data, MSGR_FEATURES);
+	msg_set_prio(m, MSG_PRIO_HIGH);
+	tr = mtran_alloc(msgr);
+	if (!tr) {
+		msg_release(m);
+		return;
+	}
+	tr->ip = conn->ip;
+	tr->port = conn->port;
+	tr->cb = mtran_hello_cb;
+	tr->state = MTRAN_STATE_SENDING;
+	tr->m = m;
+	/* If the remote end doesn't know about hello messages, it will treat
+	 * this as a request, and address any reply to this transactor. */
+	m->rem_trid = htobe32(tr->trid);
+	conn->sent_hello = 1;
+	conn->hello_tr = tr;
+	mconn_enqueue(conn, tr);
+	msgr_timer_add(msgr, &tr->timeo, mt_time_ms() + MSGR_HELLO_TIMEO_MS);
+	ev_io_start(msgr->loop, &conn->w_write);
+}
+
+/** Handle a hello message from the remote end.  If the remote end opened the
+ * connection, we answer with a hello of our own, so that it knows what we
+ * support.
+ *
+ * @param conn		The connection
+ * @param m		The hello message.  We will release it.
+ */
+static void mconn_handle_hello(struct mconn *conn, struct msg *m)
+{
+	uint32_t feat = 0;
+	struct mtran *tr;
+
+	if (be32toh(m->len) >= sizeof(struct msg) + sizeof(uint32_t))
+		feat = unpack_from_be32(m->data);
+	msg_release(m);
+	fast_log_msgr(conn->msgr, FAST_LOG_MSGR_DEBUG, conn->port, conn->ip,
+		0, 0, FLME_HELLO, feat & 0xffff);
+	conn->peer_feat = feat & MSGR_FEATURES;
+	conn->got_hello = 1;
+	tr = conn->hello_tr;
+	if (tr && (tr->state == MTRAN_STATE_ACTIVE)) {
+		/* This is the answer to our own hello. */
+		hmap_remove(&conn->active, tr->trid);
+		twheel_del(&conn->msgr->wheel, &tr->timeo);
+		conn->hello_tr = NULL;
+		mtran_free(tr);
+	}
+	if (!conn->sent_hello)
+		mconn_send_hello(conn);
+}
+
+/** Compress the message on a transactor that is about to be queued on a
+ * connection, if the message is big enough but not too big, and the remote end
+ * can decompress it.  If compression doesn't save at least 1/16th of the size, we send the
+ * message as it is.
+ *
+ * A compressed message has the same header as the original, plus
+ * MSG_FLAG_LZ.  The body is the 32-bit length of the original body, followed
+ * by the compressed data.
+ *
+ * @param conn		The connection
+ * @param tr		The transactor.  We may replace tr->m.
+ */
+static void mconn_compress(struct mconn *conn, struct mtran *tr)
+{
+	struct msgr *msgr = conn->msgr;
+	struct msg *m = tr->m, *z;
+	uint32_t len, limit;
+	size_t clen;
+
+	if (msgr->compress_thresh == 0)
+		return;
+	if (!(conn->peer_feat & MSGR_FEAT_LZ))
+		return;
+	if (unpack_from_8(&m->flags) & MSG_FLAG_LZ)
+		return;
+	len = be32toh(m->len) - sizeof(struct msg);
+	if ((len < msgr->compress_thresh) || (len > MSGR_COMPRESS_MAX))
+		return;
+	limit = len - (len / 16);
+	if (limit <= sizeof(uint32_t))
+		return;
+	z = malloc(sizeof(struct msg) + limit);
+	if (!z)
+		return;
+	clen = lz_compress(m->data, len, z->data + sizeof(uint32_t),
+		limit - sizeof(uint32_t));
+	if (clen == 0) {
+		free(z);
+		conn->cstats.tx_skipped++;
+		msgr->compress_stats.tx_skipped++;
+		return;
+	}
+	memcpy(z, m, sizeof(struct msg));
+	pack_to_be32(&z->len, sizeof(struct msg) + limit);
+	pack_to_8(&z->flags, unpack_from_8(&m->flags) | MSG_FLAG_LZ);
+	pack_to_8(&z->refcnt, 1);
+	pack_to_be32(z->data, len);
+	z = msg_shrink(z, limit - sizeof(uint32_t) - clen);
+	conn->cstats.tx_raw += len;
+	conn->cstats.tx_wire += clen + sizeof(uint32_t);
+	msgr->compress_stats.tx_raw += len;
+	msgr->compress_stats.tx_wire += clen + sizeof(uint32_t);
+	msg_release(m);
+	tr->m = z;
+}
+
+/** Decompress the message we just received on a connection.
+ *
+ * @param conn		The connection.  We will replace conn->inbound_msg.
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int mconn_decompress(struct mconn *conn)
+{
+	struct msgr *msgr = conn->msgr;
+	struct msg *z = conn->inbound_msg, *m;
+	uint32_t zlen, len;
+
+	zlen = be32toh(z->len) - sizeof(struct msg);
+	if (zlen < sizeof(uint32_t))
+		return EINVAL;
+	len = unpack_from_be32(z->data);
+	zlen -= sizeof(uint32_t);
+	/* Don't let a corrupt length make us allocate a huge buffer. */
+	if ((len / LZ_MAX_RATIO > zlen) ||
+			(len > INT_MAX - sizeof(struct msg)))
+		return EINVAL;
+	m = malloc(sizeof(struct msg) + len);
+	if (!m)
+		return ENOMEM;
+	if (lz_decompress(z->data + sizeof(uint32_t), zlen, m->data, len)) {
+		free(m);
+		return EINVAL;
+	}
+	memcpy(m, z, sizeof(struct msg));
+	pack_to_be32(&m->len, sizeof(struct msg) + len);
+	pack_to_8(&m->flags, unpack_from_8(&z->flags) & ~MSG_FLAG_LZ);
+	conn->cstats.rx_wire += zlen + sizeof(uint32_t);
+	conn->cstats.rx_raw += len;
+	msgr->compress_stats.rx_wire += zlen + sizeof(uint32_t);
+	msgr->compress_stats.rx_raw += len;
+	msg_release(z);
+	conn->inbound_msg = m;
+	return 0;
+}
+
 /****************************** msgr ********************************/
 struct msgr *msgr_init(char *err, size_t err_len,
 	const struct msgr_conf *conf)
@@ -800,13 +1421,34 @@ struct msgr *msgr_init(char *err, size_t err_len,
 	msgr->max_tran = conf->max_tran;
 	msgr->cur_conn = 0;
 	msgr->max_conn = conf->max_conn;
-	msgr->tcp_teardown_timeo = conf->tcp_teardown_timeo;
-	RB_INIT(&msgr->conn_head);
+	msgr->tcp_teardown_timeo_ms =
+		((uint64_t)conf->tcp_teardown_timeo) * 1000;
+	msgr->conns_per_peer = conf->conns_per_peer;
+	if (msgr->conns_per_peer <= 0)
+		msgr->conns_per_peer = 1;
+	else if (msgr->conns_per_peer > MSGR_MAX_CONNS_PER_PEER)
+		msgr->conns_per_peer = MSGR_MAX_CONNS_PER_PEER;
+	msgr->bulk_msg_thresh = conf->bulk_msg_thresh;
+	if (conf->bulk_msg_thresh <= 0)
+		msgr->bulk_msg_thresh = MSGR_BULK_MSG_THRESH_DEFAULT;
+	msgr->compress_thresh = (conf->compress_thresh > 0) ?
+		conf->compress_thresh : 0;
+	LIST_INIT(&msgr->conn_head);
+	if (hmap_init(&msgr->conn_map, MSGR_CONN_INIT_CAP)) {
+		snprintf(err, err_len, "msgr_init: out of memory");
+		pthread_spin_destroy(&msgr->lock);
+		free(msgr->name);
+		free(msgr);
+		return NULL;
+	}
 	ev_init(&msgr->w_listen_fd, NULL);
+	mpsc_queue_init(&msgr->submit_q);
 	STAILQ_INIT(&msgr->pending_tr_head);
 	ev_async_init(&msgr->w_notify, run_msgr_notify_cb);
-	ev_timer_init(&msgr->w_timeout, run_msgr_timeout_cb,
-			MSGR_TIMEOUT_PERIOD, MSGR_TIMEOUT_PERIOD);
+	ev_timer_init(&msgr->w_timeout, run_msgr_timeout_cb, 0.0, 0.0);
+	ev_prepare_init(&msgr->w_prepare, run_msgr_prepare_cb);
+	twheel_init(&msgr->wheel, mt_time_ms());
+	msgr->wheel_wakeup = UINT64_MAX;
 	msgr->loop = ev_loop_new(0);
 	if (!msgr->loop) {
 		snprintf(err, err_len, "msgr_init: ev_loop_new failed.");
@@ -814,7 +1456,6 @@ struct msgr *msgr_init(char *err, size_t err_len,
 		return NULL;
 	}
 	ev_async_start(msgr->loop, &msgr->w_notify);
-	ev_timer_start(msgr->loop, &msgr->w_timeout);
 	msgr->fl_mgr = conf->fl_mgr;
 	return msgr;
 }
@@ -834,8 +1475,17 @@ void msgr_shutdown(struct msgr *msgr)
 		ev_async_send(msgr->loop, &msgr->w_notify);
 		redfish_thread_join(&msgr->rt);
 	}
-	RB_FOREACH_SAFE(conn, msgr_conn, &msgr->conn_head, conn_tmp) {
-		RB_REMOVE(msgr_conn, &msgr->conn_head, conn);
+	/* A sender that checked msgr->state just before we changed it may
+	 * still be pushing a transactor, or may have pushed one after the
+	 * messenger thread's last look at the submission queue.  Wait for
+	 * such senders to get out of mtran_send_ms; any later sender will see
+	 * MSGR_STATE_THREAD_STOPPING and cancel its own transactor. */
+	__sync_synchronize();
+	while (((volatile struct msgr*)msgr)->num_senders != 0)
+		sched_yield();
+	msgr_take_submitted(msgr);
+	msgr_cancel_all_pending_tr(msgr);
+	LIST_FOREACH_SAFE(conn, &msgr->conn_head, entry, conn_tmp) {
 		mconn_teardown(conn, ECANCELED);
 	}
 }
@@ -848,9 +1498,11 @@ void msgr_free(struct msgr *msgr)
 	ev_io_stop(msgr->loop, &msgr->w_listen_fd);
 	ev_async_stop(msgr->loop, &msgr->w_notify);
 	ev_timer_stop(msgr->loop, &msgr->w_timeout);
+	ev_prepare_stop(msgr->loop, &msgr->w_prepare);
 	ev_loop_destroy(msgr->loop);
 	if (msgr->listen.fd > 0)
 		RETRY_ON_EINTR(res, close(msgr->listen.fd));
+	hmap_free(&msgr->conn_map);
 	free(msgr->name);
 	free(msgr);
 }
@@ -902,56 +1554,68 @@ void msgr_listen(struct msgr *msgr, const struct listen_info *linfo,
 	msgr->listen.fd = fd;
 	msgr->listen.port = linfo->port;
 	msgr->listen.cb = linfo->cb;
+	msgr->listen.flush = linfo->flush;
 	msgr->listen.priv = linfo->priv;
+	if (linfo->flush)
+		ev_prepare_start(msgr->loop, &msgr->w_prepare);
+}
+
+static void mtran_timeo_cb(struct twheel_tm *tm)
+{
+	struct mtran *tr = GET_OUTER(tm, struct mtran, timeo);
+	struct mconn *conn = tr->conn;
+
+	if (tr->state == MTRAN_STATE_SENDING) {
+		if ((tr == conn->sending) && (conn->sent_cnt != 0)) {
+			/* We can't pull a half-sent message out of the TCP
+			 * stream.  mconn_writable_cb will notice that the
+			 * timer is no longer armed and fail the transactor
+			 * once the rest of the message has gone out. */
+			return;
+		}
+		mconn_dequeue(conn, tr);
+	}
+	else {
+		if (tr == conn->inbound_tr) {
+			/* The response is already arriving.  We might as well
+			 * deliver it. */
+			return;
+		}
+		hmap_remove(&conn->active, tr->trid);
+	}
+	mtran_deliver_netfail(tr, ETIMEDOUT);
+}
+
+static void mconn_idle_cb(struct twheel_tm *tm)
+{
+	struct mconn *conn = GET_OUTER(tm, struct mconn, idle_tm);
+	struct msgr *msgr = conn->msgr;
+	uint64_t deadline;
+
+	deadline = conn->last_active + msgr->tcp_teardown_timeo_ms;
+	if (deadline > mt_time_ms()) {
+		/* There has been some activity since we armed this timer. */
+		msgr_timer_add(msgr, &conn->idle_tm, deadline);
+		return;
+	}
+	/* Tear down the whole TCP connection because it's been inactive for
+	 * too long. */
+	mconn_teardown(conn, ETIMEDOUT);
 }
 
 static void run_msgr_timeout_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
                struct ev_timer *w, int revents)
 {
 	struct msgr *msgr = GET_OUTER(w, struct msgr, w_timeout);
-	struct mconn *conn, *conn_tmp;
-	struct mtran *tr, *tr_tmp;
-	int tcp_teardown_timeo = msgr->tcp_teardown_timeo;
-	uint16_t timeo_id;
 
-	pthread_spin_lock(&msgr->lock);
-	/* Locking rules for timeo_id:
-	 *              MSGR THREAD             OTHER THREADS
-	 * READ:        no locking              need msgr_lock
-	 * WRITE:       need msgr_lock          don't!
-	 */
-	timeo_id = ++msgr->timeo_id;
-	pthread_spin_unlock(&msgr->lock);
+	msgr->wheel_wakeup = UINT64_MAX;
 	if (revents & EV_ERROR) {
 		fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR, 0, 0, 0,
 			0, FLME_EV_ERROR, 3);
 		return;
 	}
-	RB_FOREACH_SAFE(conn, msgr_conn, &msgr->conn_head, conn_tmp) {
-		conn->timeout_cnt++;
-		if (conn->timeout_cnt >= tcp_teardown_timeo) {
-			/* Tear down the whole TCP connection because it's been
-			 * inactive for too long. */
-			mconn_teardown(conn, ETIMEDOUT);
-			continue;
-		}
-		RB_FOREACH_SAFE(tr, timeo_tr, &conn->timeo_head, tr_tmp) {
-			if (circ_compare16(timeo_id, tr->timeo_id) < 0) {
-				/* This transactor is not yet ready to be timed
-				 * out.  Since the tree is sorted, this means we
-				 * can stop looking for transactors to time out.
-				 * */
-				break;
-			}
-			/* Time out transactor */
-			RB_REMOVE(timeo_tr, &conn->timeo_head, tr);
-			if (!(RB_REMOVE(active_tr, &conn->active_head, tr))) {
-				STAILQ_REMOVE(&conn->pending_head, tr, mtran,
-					u.pending_entry);
-			}
-			mtran_deliver_netfail(tr, ETIMEDOUT);
-		}
-	}
+	twheel_advance(&msgr->wheel, mt_time_ms());
+	msgr_timer_rearm(msgr);
 }
 
 static void run_msgr_listen_fd_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
@@ -987,13 +1651,13 @@ static void run_msgr_listen_fd_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
 	}
 	ip = ntohl(remote.sin_addr.s_addr);
 	port = ntohs(remote.sin_port);
-	conn = mconn_find(msgr, ip, port);
+	conn = mconn_find(msgr, ip, port, 0);
 	if (conn) {
 		fast_log_msgr(msgr, FAST_LOG_MSGR_ERROR, conn->port,
 			      conn->ip, 0, 0, FLME_MTRAN_MULTI_CONN, 0);
 		goto error;
 	}
-	conn = mconn_create(msgr, ip, port, fd);
+	conn = mconn_create(msgr, ip, port, 0, fd);
 	if (IS_ERR(conn)) {
 		goto error;
 	}
@@ -1007,15 +1671,66 @@ error:
 	}
 }
 
+/** Pick the connection to send a new transactor on.
+ *
+ * Small messages always go on lane 0, so that they never sit behind bulk
+ * data.  So do high priority messages, whatever their size.  Bulk messages,
+ * and messages in the bulk priority class, go on whichever of the other lanes
+ * has the fewest bytes
+ * queued.  We only open another bulk connection when all of the existing ones
+ * are busy.
+ *
+ * @param msgr		The messenger
+ * @param tr		The transactor
+ * @param lane		(out param) the lane to use
+ *
+ * @return		The connection to use, or NULL if a new connection
+ *			should be opened for *lane
+ */
+static struct mconn *msgr_pick_conn(struct msgr *msgr,
+		const struct mtran *tr, int *lane)
+{
+	struct mconn *conn, *best;
+	int i, unused, prio;
+
+	*lane = 0;
+	prio = msg_get_prio(tr->m);
+	if ((msgr->conns_per_peer == 1) || (prio == MSG_PRIO_HIGH) ||
+			((prio != MSG_PRIO_BULK) &&
+			 (be32toh(tr->m->len) < msgr->bulk_msg_thresh)))
+		return mconn_find(msgr, tr->ip, tr->port, 0);
+	best = NULL;
+	unused = -1;
+	for (i = 1; i < msgr->conns_per_peer; ++i) {
+		conn = mconn_find(msgr, tr->ip, tr->port, i);
+		if (!conn) {
+			if (unused < 0)
+				unused = i;
+			continue;
+		}
+		if ((!best) || (conn->pending_bytes < best->pending_bytes))
+			best = conn;
+	}
+	if ((unused >= 0) && ((!best) || (best->pending_bytes != 0))) {
+		*lane = unused;
+		return NULL;
+	}
+	*lane = best->lane;
+	return best;
+}
+
 static void run_msgr_setup_pending(struct msgr *msgr, struct mtran *tr)
 {
 	struct mconn *conn;
+	int lane;
 
-	conn = mconn_find(msgr, tr->ip, tr->port);
+	conn = msgr_pick_conn(msgr, tr, &lane);
 	if (!conn) {
-		conn = mconn_create(msgr, tr->ip, tr->port, -1);
-		if (IS_ERR(conn))
+		conn = mconn_create(msgr, tr->ip, tr->port, lane, -1);
+		if (IS_ERR(conn)) {
+			mtran_deliver_netfail(tr, PTR_ERR(conn));
 			return;
+		}
 		fast_log_msgr(msgr, FAST_LOG_MSGR_DEBUG,
 			tr->port, tr->ip, tr->trid, tr->rem_trid,
 			FLME_OUTBOUND_CONN_CREATED, be16toh(tr->m->ty));
@@ -1026,8 +1741,30 @@ static void run_msgr_setup_pending(struct msgr *msgr, struct mtran *tr)
 			tr->rem_trid, FLME_CONN_REUSED, be16toh(tr->m->ty));
 		ev_io_start(msgr->loop, &conn->w_write);
 	}
-	RB_INSERT(timeo_tr, &conn->timeo_head, tr);
-	STAILQ_INSERT_TAIL(&conn->pending_head, tr, u.pending_entry);
+	mconn_enqueue(conn, tr);
+	msgr_timer_add(msgr, &tr->timeo, tr->timeo.expire);
+}
+
+/** Move everything that has been submitted with mtran_send onto
+ * msgr->pending_tr_head, in the order it was submitted.
+ *
+ * Must be called from the messenger thread, or after it has exited.
+ */
+static void msgr_take_submitted(struct msgr *msgr)
+{
+	struct mpsc_node *node, *next;
+	struct mtran *tr;
+
+	node = mpsc_queue_take_all(&msgr->submit_q);
+	while (node) {
+		/* submit_entry shares storage with pending_entry, so grab the
+		 * next pointer before re-linking the transactor. */
+		next = node->next;
+		tr = GET_OUTER(node, struct mtran, u.submit_entry);
+		STAILQ_INSERT_TAIL(&msgr->pending_tr_head, tr,
+				u.pending_entry);
+		node = next;
+	}
 }
 
 static void msgr_cancel_all_pending_tr(struct msgr *msgr)
@@ -1044,6 +1781,23 @@ static void msgr_cancel_all_pending_tr(struct msgr *msgr)
 	}
 }
 
+/** Let the listener know that we have finished delivering a batch of
+ * messages.  Must be called from the messenger thread. */
+static void msgr_flush(struct msgr *msgr)
+{
+	if (!msgr->need_flush)
+		return;
+	msgr->need_flush = 0;
+	if (msgr->listen.flush)
+		msgr->listen.flush(msgr->listen.priv);
+}
+
+static void run_msgr_prepare_cb(POSSIBLY_UNUSED(struct ev_loop *loop),
+		struct ev_prepare *w, POSSIBLY_UNUSED(int revents))
+{
+	msgr_flush(GET_OUTER(w, struct msgr, w_prepare));
+}
+
 static void run_msgr_notify_cb(struct ev_loop *loop, struct ev_async *w,
 					POSSIBLY_UNUSED(int revents))
 {
@@ -1053,61 +1807,53 @@ static void run_msgr_notify_cb(struct ev_loop *loop, struct ev_async *w,
 	struct conn_cancels conn_cancels_head =
 		SLIST_HEAD_INITIALIZER(conn_cancels_head);
 	struct conn_cancel *cancel;
-	struct mconn exemplar, *conn;
-
-	while (1) {
-		pthread_spin_lock(&msgr->lock);
-		tr = STAILQ_FIRST(&msgr->pending_tr_head);
-		if (tr) {
-			STAILQ_REMOVE_HEAD(&msgr->pending_tr_head,
-				u.pending_entry);
-		}
-		new_state = msgr->state;
-		SLIST_SWAP(&msgr->conn_cancels_head, &conn_cancels_head,
-			conn_cancel);
-		pthread_spin_unlock(&msgr->lock);
+	struct mconn *conn;
+	int lane;
 
-		if (new_state == MSGR_STATE_THREAD_STOPPING) {
-			/* Free all pending cancellations.  They're irrelevant
-			 * now because soon everything will be cancelled. */
-			while (1) {
-				cancel = SLIST_FIRST(&conn_cancels_head);
-				if (!cancel)
-					break;
-				SLIST_REMOVE_HEAD(&conn_cancels_head, entry);
-				free(cancel);
-			}
-			/* We don't need to take the msgr->lock here.  The other
-			 * place where msgr->pending_tr_head could be modified,
-			 * in mtran_send, will never touch the queue when we're
-			 * in state MSGR_STATE_THREAD_STOPPING.
-			 */
-			if (tr) {
-				STAILQ_INSERT_TAIL(&msgr->pending_tr_head,
-						tr, u.pending_entry);
-			}
-			msgr_cancel_all_pending_tr(msgr);
-			ev_unloop(loop, EVUNLOOP_ALL);
-			return;
-		}
-		/* Execute all pending cancellations. */
+	pthread_spin_lock(&msgr->lock);
+	new_state = msgr->state;
+	SLIST_SWAP(&msgr->conn_cancels_head, &conn_cancels_head,
+		conn_cancel);
+	pthread_spin_unlock(&msgr->lock);
+	/* Take the whole batch of submitted transactors at once.  Anything
+	 * submitted after this point will find the queue empty and poke us
+	 * again. */
+	msgr_take_submitted(msgr);
+
+	if (new_state == MSGR_STATE_THREAD_STOPPING) {
+		/* Free all pending cancellations.  They're irrelevant now
+		 * because soon everything will be cancelled. */
 		while (1) {
 			cancel = SLIST_FIRST(&conn_cancels_head);
 			if (!cancel)
 				break;
-			memset(&exemplar, 0, sizeof(exemplar));
-			exemplar.ip = cancel->addr;
-			exemplar.port = cancel->port;
-			conn = RB_FIND(msgr_conn, &msgr->conn_head, &exemplar);
-			if (!conn) {
-				continue;
-			}
-			mconn_teardown(conn, ECANCELED);
 			SLIST_REMOVE_HEAD(&conn_cancels_head, entry);
 			free(cancel);
 		}
+		msgr_cancel_all_pending_tr(msgr);
+		ev_unloop(loop, EVUNLOOP_ALL);
+		return;
+	}
+	/* Execute all pending cancellations. */
+	while (1) {
+		cancel = SLIST_FIRST(&conn_cancels_head);
+		if (!cancel)
+			break;
+		SLIST_REMOVE_HEAD(&conn_cancels_head, entry);
+		for (lane = 0; lane < msgr->conns_per_peer; ++lane) {
+			conn = mconn_find(msgr, cancel->addr, cancel->port,
+					lane);
+			if (conn)
+				mconn_teardown(conn, ECANCELED);
+		}
+		free(cancel);
+	}
+	/* Hand out the batch of transactors to connections. */
+	while (1) {
+		tr = STAILQ_FIRST(&msgr->pending_tr_head);
 		if (!tr)
-			return;
+			break;
+		STAILQ_REMOVE_HEAD(&msgr->pending_tr_head, u.pending_entry);
 		run_msgr_setup_pending(msgr, tr);
 	}
 }
@@ -1126,6 +1872,9 @@ static int run_msgr(struct redfish_thread *rt)
 			0, 0, 0, FLME_LISTENING, msgr->listen.port);
 	}
 	ev_loop(msgr->loop, 0);
+	/* Don't strand anything the listener collected during the last loop
+	 * iteration. */
+	msgr_flush(msgr);
 	fast_log_msgr(msgr, FAST_LOG_MSGR_INFO, 0,
 		0, 0, 0, FLME_MSGR_SHUTDOWN, cram_into_u16(rt->thread_id));
 	return 0;
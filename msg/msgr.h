@@ -22,24 +22,45 @@
 #include <stdint.h> /* for uint32_t, etc. */
 #include <unistd.h> /* for size_t */
 
-/** Length of a messenger timeout period in seconds */
-#define MSGR_TIMEOUT_PERIOD 1.0
-
-/** Number of messenger time periods to wait before timing out an incoming
- * transactor */
-#define MSGR_INCOMING_TIMEO 30
+/** Number of milliseconds to wait before timing out an incoming transactor */
+#define MSGR_INCOMING_TIMEO_MS 30000
 
 /** The maximum timeout that can be specified, in seconds */
 #define MSGR_TIMEOUT_MAX 16384
 
+/** The maximum timeout that can be specified, in milliseconds */
+#define MSGR_TIMEOUT_MAX_MS (MSGR_TIMEOUT_MAX * 1000)
+
+/** The maximum number of TCP connections we will open to a single remote
+ * endpoint */
+#define MSGR_MAX_CONNS_PER_PEER 16
+
+/** Default size, in bytes, at which a message is considered bulk data rather
+ * than a control message */
+#define MSGR_BULK_MSG_THRESH_DEFAULT 16384
+
+/** Largest message body, in bytes, that a messenger will compress.
+ * Compression runs on the messenger thread, so compressing a bigger body would
+ * hold up every other connection on the messenger. */
+#define MSGR_COMPRESS_MAX (256 * 1024)
+
 struct fast_log_mgr;
 struct mconn;
 struct msgr;
 
+/** Callback invoked by the messenger thread when it has finished delivering a
+ * batch of incoming messages */
+typedef void (*msgr_flush_cb_t)(void *priv);
+
 /** Information about a port we are listening on */
 struct listen_info {
 	/** Callback to invoke on sent/recv */
 	msgr_cb_t cb;
+	/** If non-NULL, this is invoked with priv after the messenger thread
+	 * has delivered one or more messages, just before it goes back to
+	 * waiting for I/O.  A receiver can use this to collect incoming
+	 * transactors in cb and hand them off all at once. */
+	msgr_flush_cb_t flush;
 	/** Private data to store in transactor */
 	void *priv;
 	/** TCP port number */
@@ -55,12 +76,55 @@ struct msgr_conf {
 	/* Number of seconds to allow a TCP connection to sit idle before
 	 * tearing it down */
 	int tcp_teardown_timeo;
+	/** Number of TCP connections to open to each remote endpoint.  0 means
+	 * 1.  If there is more than one, the first connection carries only
+	 * small messages, and the others carry bulk data.  This keeps a big
+	 * write from holding up the small RPCs behind it. */
+	int conns_per_peer;
+	/** Messages of at least this many bytes are sent on the bulk
+	 * connections.  0 means MSGR_BULK_MSG_THRESH_DEFAULT. */
+	int bulk_msg_thresh;
+	/** Message bodies of at least this many bytes are compressed before
+	 * they are sent, if the remote end said in its hello message that it
+	 * can decompress them.  0 means never compress.  Bodies bigger than
+	 * MSGR_COMPRESS_MAX are always sent as they are. */
+	int compress_thresh;
 	/** Messenger name.  Will be deep-copied */
 	const char *name;
 	/** Fast log manager to use for fast logs.  Will be shallow-copied */
 	struct fast_log_mgr *fl_mgr;
 };
 
+/** Send queue statistics for a messenger, broken down by priority class
+ * (enum msg_prio) */
+struct msgr_prio_stats {
+	/** Number of messages currently waiting to be sent */
+	uint32_t depth[MSG_PRIO_NUM];
+	/** Highest value that depth has ever reached */
+	uint32_t max_depth[MSG_PRIO_NUM];
+	/** Total number of messages sent, not counting the hello messages
+	 * that the messenger sends on its own behalf */
+	uint64_t sent[MSG_PRIO_NUM];
+};
+
+/** Compression statistics for a connection or a whole messenger.  The
+ * compression ratio for sent data is tx_raw / tx_wire, and for received data
+ * rx_raw / rx_wire. */
+struct msgr_compress_stats {
+	/** Bytes of message bodies that we compressed, before compression */
+	uint64_t tx_raw;
+	/** Bytes of message bodies that we compressed, after compression */
+	uint64_t tx_wire;
+	/** Number of messages that were big enough to compress, but didn't
+	 * get any smaller, so were sent as they were */
+	uint64_t tx_skipped;
+	/** Bytes of compressed message bodies that we received */
+	uint64_t rx_wire;
+	/** Bytes of compressed message bodies that we received, after
+	 * decompression */
+	uint64_t rx_raw;
+};
+
 /* The messenger
  *
  * Each messenger has a single thread which is handling potentially thousands of
@@ -81,7 +145,9 @@ struct msgr_conf {
  * Opening new TCP sockets is expensive in terms of latency, because of the
  * overhead of the 3-way handshake and other things. So we open a connection
  * (mconn) to service one transactor, we will keep it open and potentially use
- * it for other transactors. The messenger handles all these details behind the
+ * it for other transactors. If conns_per_peer is set, we keep a small pool of
+ * connections to each endpoint, so that small messages don't have to wait
+ * behind large ones. The messenger handles all these details behind the
  * scenes. If there is a network problem, the messenger will invoke the callback
  * with an error pointer set to the errno code.
  */
@@ -158,6 +224,22 @@ extern void mtran_free(struct mtran *tr);
 extern void mtran_send(struct msgr *msgr, struct mtran *tr,
 		msgr_cb_t cb, void *priv, struct msg *m, int timeo);
 
+/** Queue a message for sending, with a timeout in milliseconds
+ *
+ * Identical to mtran_send, except for the units of the timeout.
+ *
+ * @param msgr		the messenger
+ * @param tr		the transactor
+ * @param cb		Callback to invoke when a complete message is sent.
+ * @param priv		Private data for transactor
+ * @param m		The message to send.
+ * 			This must be dynamically allocated. The messenger will
+ * 			take ownership of this pointer and free it later.
+ * @param timeo_ms	Timeout in milliseconds
+ */
+extern void mtran_send_ms(struct msgr *msgr, struct mtran *tr,
+		msgr_cb_t cb, void *priv, struct msg *m, int timeo_ms);
+
 /** Queue a message for sending on a currently open connection
  *
  * This must be called from the context of a msgr_cb_t function.
@@ -172,6 +254,21 @@ extern void mtran_send(struct msgr *msgr, struct mtran *tr,
 extern void mtran_send_next(struct mconn *conn, struct mtran *tr,
 			struct msg *m, int timeo);
 
+/** Queue a message for sending on a currently open connection, with a timeout
+ * in milliseconds
+ *
+ * Identical to mtran_send_next, except for the units of the timeout.
+ *
+ * @param conn		the connection that the transactor is associated with
+ * @param tr		the transactor
+ * @param m		The message to send.
+ * 			This must be dynamically allocated. The messenger will
+ * 			take ownership of this pointer and free it later.
+ * @param timeo_ms	Timeout in milliseconds
+ */
+extern void mtran_send_next_ms(struct mconn *conn, struct mtran *tr,
+			struct msg *m, int timeo_ms);
+
 /** Register to receive a message from a currently open connection
  *
  * This must be called from the context of a msgr_cb_t function.
@@ -200,6 +297,39 @@ extern int mconn_cancel(struct msgr *msgr, uint32_t addr, uint16_t port);
  */
 extern struct msgr *mconn_get_msgr(struct mconn *conn);
 
+/** Get the send queue statistics for a messenger.
+ *
+ * The statistics are updated by the messenger thread without any locking, so
+ * if the messenger is running, they are only approximate.
+ *
+ * @param msgr		The messenger
+ * @param stats		(out param) the statistics
+ */
+extern void msgr_get_prio_stats(const struct msgr *msgr,
+		struct msgr_prio_stats *stats);
+
+/** Get the compression statistics for a connection
+ *
+ * This must be called from the context of a msgr_cb_t function.
+ *
+ * @param conn		The connection
+ * @param stats		(out param) the statistics
+ */
+extern void mconn_get_compress_stats(const struct mconn *conn,
+		struct msgr_compress_stats *stats);
+
+/** Get the compression statistics for all the connections a messenger has
+ * ever had.
+ *
+ * Like msgr_get_prio_stats, these are only approximate if the messenger is
+ * running.
+ *
+ * @param msgr		The messenger
+ * @param stats		(out param) the statistics
+ */
+extern void msgr_get_compress_stats(const struct msgr *msgr,
+		struct msgr_compress_stats *stats);
+
 /** Shut down a messenger.
  *
  * Shutdown will close all open connections and join the messenger thread.
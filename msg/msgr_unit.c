@@ -32,9 +32,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define MSGR_UNIT_PORT 9095
 
+/** Number of simultaneous round trips to time in the benchmark */
+#define MSGR_UNIT_BENCH_SENDS 20000
+
+/** Number of connections per endpoint to use in msgr_test_lanes */
+#define MSGR_UNIT_LANES 3
+
+/** Size of the bulk messages to send in msgr_test_lanes */
+#define MSGR_UNIT_BULK_LEN (256 * 1024)
+
+/** Size of the message bodies to send in msgr_test_compress */
+#define MSGR_UNIT_COMPRESS_LEN (128 * 1024)
+
 enum {
 	MMM_TEST1 = 9000,
 	MMM_TEST2,
@@ -56,17 +69,21 @@ static uint32_t g_localhost;
 
 static sem_t g_msgr_test_simple_send_sem;
 
-static struct msgr *msgr_init_helper(int max_conn, int max_tran,
-		int tcp_teardown_timeo, const char *name)
+static struct msgr *msgr_init_pooled_helper(int max_conn, int max_tran,
+		int tcp_teardown_timeo, int conns_per_peer, int compress_thresh,
+		const char *name)
 {
 	struct msgr *msgr;
 	struct msgr_conf mconf;
 	char err[512] = { 0 };
 	size_t err_len = sizeof(err);
 
+	memset(&mconf, 0, sizeof(mconf));
 	mconf.max_conn = max_conn;
 	mconf.max_tran = max_tran;
 	mconf.tcp_teardown_timeo = tcp_teardown_timeo;
+	mconf.conns_per_peer = conns_per_peer;
+	mconf.compress_thresh = compress_thresh;
 	mconf.name = name;
 	mconf.fl_mgr = g_fast_log_mgr;
 	msgr = msgr_init(err, err_len, &mconf);
@@ -77,6 +94,13 @@ static struct msgr *msgr_init_helper(int max_conn, int max_tran,
 	return msgr;
 }
 
+static struct msgr *msgr_init_helper(int max_conn, int max_tran,
+		int tcp_teardown_timeo, const char *name)
+{
+	return msgr_init_pooled_helper(max_conn, max_tran,
+		tcp_teardown_timeo, 0, 0, name);
+}
+
 static void foo_cb(struct mconn *conn, struct mtran *tr)
 {
 	struct mmm_test2 *mm;
@@ -188,28 +212,45 @@ handle_error:
 	return 1;
 }
 
-static int send_foo_tr(struct msgr* msgr, msgr_cb_t cb, uint32_t i)
+static int send_foo_tr_ex(struct msgr* msgr, msgr_cb_t cb, uint32_t i,
+		uint32_t len, int prio)
 {
 	struct mtran *tr;
 	struct mmm_test1 *mout;
 	tr = mtran_alloc(msgr);
 	if (!tr)
 		return -ENOMEM;
-	mout = calloc_msg(MMM_TEST1, sizeof(struct mmm_test1));
+	mout = calloc_msg(MMM_TEST1, len);
 	if (!mout) {
 		mtran_free(tr);
 		return -ENOMEM;
 	}
 	pack_to_be32(&mout->i, i);
+	msg_set_prio((struct msg*)mout, prio);
 	tr->ip = g_localhost;
 	tr->port = MSGR_UNIT_PORT;
 	mtran_send(msgr, tr, cb, (void*)(uintptr_t)i, (struct msg*)mout, 60);
 	return 0;
 }
 
-static int msgr_test_simple_send(int num_sends)
+static int send_foo_tr(struct msgr* msgr, msgr_cb_t cb, uint32_t i)
+{
+	return send_foo_tr_ex(msgr, cb, i, sizeof(struct mmm_test1),
+		MSG_PRIO_NORMAL);
+}
+
+static double timespec_diff_sec(const struct timespec *a,
+		const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) +
+		((b->tv_nsec - a->tv_nsec) / 1000000000.0);
+}
+
+static int msgr_test_simple_send(int num_sends, int bench)
 {
 	int i, res;
+	struct timespec start_ts, end_ts;
+	double elapsed;
 	struct msgr *foo_msgr, *bar_msgr;
 	char err[512] = { 0 };
 	size_t err_len = sizeof(err);
@@ -232,12 +273,23 @@ static int msgr_test_simple_send(int num_sends)
 	msgr_start(bar_msgr, err, err_len);
 	if (err[0])
 		goto handle_error;
+	EXPECT_ZERO(clock_gettime(CLOCK_MONOTONIC, &start_ts));
 	for (i = 0; i < num_sends; ++i) {
 		EXPECT_ZERO(send_foo_tr(foo_msgr, foo_cb, i + 1));
 	}
 	for (i = 0; i < num_sends; ++i) {
 		RETRY_ON_EINTR(res, sem_wait(&g_msgr_test_simple_send_sem));
 	}
+	EXPECT_ZERO(clock_gettime(CLOCK_MONOTONIC, &end_ts));
+	if (bench) {
+		/* With this many transactors in flight at once, both
+		 * messengers spend most of their time looking up active
+		 * transactors. */
+		elapsed = timespec_diff_sec(&start_ts, &end_ts);
+		fprintf(stderr, "msgr_test_simple_send: %d round trips in "
+			"%.3f seconds (%.0f per second)\n", num_sends, elapsed,
+			(elapsed > 0) ? (num_sends / elapsed) : 0.0);
+	}
 	EXPECT_ZERO(sem_destroy(&g_msgr_test_simple_send_sem));
 
 	msgr_shutdown(foo_msgr);
@@ -251,6 +303,312 @@ handle_error:
 	return 1;
 }
 
+static int msgr_test_lanes(int num_sends)
+{
+	int i, res;
+	uint32_t len;
+	struct msgr *foo_msgr, *bar_msgr;
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err);
+	struct listen_info linfo;
+
+	EXPECT_ZERO(sem_init(&g_msgr_test_simple_send_sem, 0, 0));
+	foo_msgr = msgr_init_pooled_helper(10, 100, 360, MSGR_UNIT_LANES,
+			0, "foo_msgr");
+	bar_msgr = msgr_init_helper(10, 100, 360, "bar_msgr");
+	memset(&linfo, 0, sizeof(linfo));
+	linfo.cb = bar_cb;
+	linfo.priv = NULL;
+	linfo.port = MSGR_UNIT_PORT;
+	msgr_listen(bar_msgr, &linfo, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(foo_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(bar_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	/* Interleave small and bulk messages.  The responses come back on
+	 * whichever connection each request went out on. */
+	for (i = 0; i < num_sends; ++i) {
+		len = (i % 3) ? sizeof(struct mmm_test1) : MSGR_UNIT_BULK_LEN;
+		EXPECT_ZERO(send_foo_tr_ex(foo_msgr, foo_cb, i + 1, len,
+			MSG_PRIO_NORMAL));
+	}
+	for (i = 0; i < num_sends; ++i) {
+		RETRY_ON_EINTR(res, sem_wait(&g_msgr_test_simple_send_sem));
+	}
+	EXPECT_ZERO(sem_destroy(&g_msgr_test_simple_send_sem));
+	msgr_shutdown(foo_msgr);
+	msgr_shutdown(bar_msgr);
+	msgr_free(foo_msgr);
+	msgr_free(bar_msgr);
+	return 0;
+
+handle_error:
+	fprintf(stderr, "msgr_test_lanes: got error %s\n", err);
+	return 1;
+}
+
+/** Fill a message body with text that depends on i */
+static void msgr_unit_fill_text(struct msg *m, uint32_t i)
+{
+	char *data = m->data + sizeof(uint32_t);
+	uint32_t len, off;
+
+	len = unpack_from_be32(&m->len) - sizeof(struct mmm_test1);
+	off = 0;
+	while (off < len) {
+		off += snprintf(data + off, len - off,
+			"record %08x: the quick brown fox jumps over the "
+			"lazy dog\n", i);
+	}
+}
+
+/** Check that a message body is what msgr_unit_fill_text would have made */
+static int msgr_unit_check_text(struct msg *m, uint32_t i)
+{
+	struct msg *x;
+	uint32_t len;
+
+	len = unpack_from_be32(&m->len);
+	if (len != sizeof(struct mmm_test1) + MSGR_UNIT_COMPRESS_LEN)
+		return -EINVAL;
+	if (unpack_from_8(&m->flags) & MSG_FLAG_LZ)
+		return -EINVAL;
+	x = calloc_msg(MMM_TEST1, len);
+	if (!x)
+		return -ENOMEM;
+	msgr_unit_fill_text(x, i);
+	if (memcmp(x->data + sizeof(uint32_t), m->data + sizeof(uint32_t),
+			MSGR_UNIT_COMPRESS_LEN)) {
+		free(x);
+		return -EINVAL;
+	}
+	free(x);
+	return 0;
+}
+
+static void compress_foo_cb(struct mconn *conn, struct mtran *tr)
+{
+	struct mmm_test2 *mm;
+	uint32_t i;
+
+	if (tr->state == MTRAN_STATE_SENT) {
+		if (tr->m && IS_ERR(tr->m)) {
+			fprintf(stderr, "compress_foo_cb: send error %d\n",
+				PTR_ERR(tr->m));
+			abort();
+		}
+		mtran_recv_next(conn, tr);
+		return;
+	}
+	if (IS_ERR(tr->m) || (unpack_from_be16(&tr->m->ty) != MMM_TEST2)) {
+		fprintf(stderr, "compress_foo_cb: bad response\n");
+		abort();
+	}
+	mm = (struct mmm_test2*)tr->m;
+	i = unpack_from_be32(&mm->i);
+	if ((i != (uint32_t)(uintptr_t)tr->priv + 1) ||
+			msgr_unit_check_text(tr->m, i)) {
+		fprintf(stderr, "compress_foo_cb: response %d was "
+			"corrupted\n", i);
+		abort();
+	}
+	sem_post(&g_msgr_test_simple_send_sem);
+	mtran_free(tr);
+}
+
+static void compress_bar_cb(struct mconn *conn, struct mtran *tr)
+{
+	struct mmm_test1 *m;
+	struct mmm_test2 *mout;
+	uint32_t i;
+
+	if (tr->state == MTRAN_STATE_SENT) {
+		if (tr->m && IS_ERR(tr->m)) {
+			fprintf(stderr, "compress_bar_cb: send error %d\n",
+				PTR_ERR(tr->m));
+			abort();
+		}
+		mtran_free(tr);
+		return;
+	}
+	m = (struct mmm_test1*)tr->m;
+	i = unpack_from_be32(&m->i);
+	if (msgr_unit_check_text(tr->m, i)) {
+		fprintf(stderr, "compress_bar_cb: request %d was "
+			"corrupted\n", i);
+		abort();
+	}
+	mout = calloc_msg(MMM_TEST2, sizeof(struct mmm_test1) +
+		MSGR_UNIT_COMPRESS_LEN);
+	if (!mout) {
+		fprintf(stderr, "compress_bar_cb: oom\n");
+		abort();
+	}
+	pack_to_be32(&mout->i, i + 1);
+	msgr_unit_fill_text((struct msg*)mout, i + 1);
+	mtran_send_next(conn, tr, (struct msg*)mout, 60);
+	free(m);
+}
+
+static int send_compress_tr(struct msgr *msgr, uint32_t i)
+{
+	struct mtran *tr;
+	struct mmm_test1 *mout;
+
+	tr = mtran_alloc(msgr);
+	if (!tr)
+		return -ENOMEM;
+	mout = calloc_msg(MMM_TEST1, sizeof(struct mmm_test1) +
+		MSGR_UNIT_COMPRESS_LEN);
+	if (!mout) {
+		mtran_free(tr);
+		return -ENOMEM;
+	}
+	pack_to_be32(&mout->i, i);
+	msgr_unit_fill_text((struct msg*)mout, i);
+	tr->ip = g_localhost;
+	tr->port = MSGR_UNIT_PORT;
+	mtran_send(msgr, tr, compress_foo_cb, (void*)(uintptr_t)i,
+		(struct msg*)mout, 60);
+	return 0;
+}
+
+/** Send compressible messages back and forth.
+ *
+ * @param bar_compress	Whether the listening messenger should compress its
+ *			responses.  Either way, it can decompress requests.
+ */
+static int msgr_test_compress(int num_sends, int bar_compress)
+{
+	int i, res;
+	struct msgr *foo_msgr, *bar_msgr;
+	struct msgr_compress_stats foo_stats, bar_stats;
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err);
+	struct listen_info linfo;
+
+	EXPECT_ZERO(sem_init(&g_msgr_test_simple_send_sem, 0, 0));
+	foo_msgr = msgr_init_pooled_helper(10, 100, 360, 0, 1024,
+			"foo_msgr");
+	bar_msgr = msgr_init_pooled_helper(10, 100, 360, 0,
+			bar_compress ? 1024 : 0, "bar_msgr");
+	memset(&linfo, 0, sizeof(linfo));
+	linfo.cb = compress_bar_cb;
+	linfo.priv = NULL;
+	linfo.port = MSGR_UNIT_PORT;
+	msgr_listen(bar_msgr, &linfo, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(foo_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(bar_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	/* The first request opens the connection.  It may go out before the
+	 * hello exchange is finished, so it may not be compressed. */
+	EXPECT_ZERO(send_compress_tr(foo_msgr, 1));
+	RETRY_ON_EINTR(res, sem_wait(&g_msgr_test_simple_send_sem));
+	for (i = 1; i < num_sends; ++i) {
+		EXPECT_ZERO(send_compress_tr(foo_msgr, i + 1));
+	}
+	for (i = 1; i < num_sends; ++i) {
+		RETRY_ON_EINTR(res, sem_wait(&g_msgr_test_simple_send_sem));
+	}
+	EXPECT_ZERO(sem_destroy(&g_msgr_test_simple_send_sem));
+	msgr_shutdown(foo_msgr);
+	msgr_shutdown(bar_msgr);
+	msgr_get_compress_stats(foo_msgr, &foo_stats);
+	msgr_get_compress_stats(bar_msgr, &bar_stats);
+	EXPECT_GE(foo_stats.tx_raw,
+		(uint64_t)(num_sends - 1) * MSGR_UNIT_COMPRESS_LEN);
+	EXPECT_LT(foo_stats.tx_wire * 3, foo_stats.tx_raw);
+	EXPECT_EQ(bar_stats.rx_raw, foo_stats.tx_raw);
+	EXPECT_EQ(bar_stats.rx_wire, foo_stats.tx_wire);
+	EXPECT_EQ(foo_stats.rx_raw, bar_stats.tx_raw);
+	if (bar_compress) {
+		EXPECT_GE(bar_stats.tx_raw,
+			(uint64_t)(num_sends - 1) * MSGR_UNIT_COMPRESS_LEN);
+	}
+	else {
+		EXPECT_ZERO(bar_stats.tx_raw);
+	}
+	msgr_free(foo_msgr);
+	msgr_free(bar_msgr);
+	return 0;
+
+handle_error:
+	fprintf(stderr, "msgr_test_compress: got error %s\n", err);
+	return 1;
+}
+
+static int msgr_test_prio(int num_sends)
+{
+	int i, res, prio;
+	struct msgr *foo_msgr, *bar_msgr;
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err);
+	struct listen_info linfo;
+	struct msgr_prio_stats foo_stats, bar_stats;
+
+	EXPECT_ZERO(sem_init(&g_msgr_test_simple_send_sem, 0, 0));
+	foo_msgr = msgr_init_helper(10, 100, 360, "foo_msgr");
+	bar_msgr = msgr_init_helper(10, 100, 360, "bar_msgr");
+	memset(&linfo, 0, sizeof(linfo));
+	linfo.cb = bar_cb;
+	linfo.priv = NULL;
+	linfo.port = MSGR_UNIT_PORT;
+	msgr_listen(bar_msgr, &linfo, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(foo_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(bar_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	/* Queue up a lot of bulk data, then some high priority messages
+	 * behind it, all on the same connection. */
+	for (i = 0; i < num_sends; ++i) {
+		EXPECT_ZERO(send_foo_tr_ex(foo_msgr, foo_cb, i + 1,
+			MSGR_UNIT_BULK_LEN, MSG_PRIO_BULK));
+	}
+	for (i = num_sends; i < 2 * num_sends; ++i) {
+		EXPECT_ZERO(send_foo_tr_ex(foo_msgr, foo_cb, i + 1,
+			sizeof(struct mmm_test1), MSG_PRIO_HIGH));
+	}
+	for (i = 0; i < 2 * num_sends; ++i) {
+		RETRY_ON_EINTR(res, sem_wait(&g_msgr_test_simple_send_sem));
+	}
+	EXPECT_ZERO(sem_destroy(&g_msgr_test_simple_send_sem));
+	msgr_shutdown(foo_msgr);
+	msgr_shutdown(bar_msgr);
+	/* bar_cb doesn't set a priority on its replies, so they should have
+	 * inherited the priority of the requests. */
+	msgr_get_prio_stats(foo_msgr, &foo_stats);
+	msgr_get_prio_stats(bar_msgr, &bar_stats);
+	for (prio = 0; prio < MSG_PRIO_NUM; ++prio) {
+		EXPECT_EQ(foo_stats.depth[prio], 0);
+		EXPECT_EQ(bar_stats.depth[prio], 0);
+		EXPECT_EQ(foo_stats.sent[prio], bar_stats.sent[prio]);
+	}
+	EXPECT_EQ(foo_stats.sent[MSG_PRIO_BULK], (uint64_t)num_sends);
+	EXPECT_EQ(foo_stats.sent[MSG_PRIO_HIGH], (uint64_t)num_sends);
+	EXPECT_EQ(foo_stats.sent[MSG_PRIO_NORMAL], 0);
+	EXPECT_GE(foo_stats.max_depth[MSG_PRIO_BULK], 1);
+	msgr_free(foo_msgr);
+	msgr_free(bar_msgr);
+	return 0;
+
+handle_error:
+	fprintf(stderr, "msgr_test_prio: got error %s\n", err);
+	return 1;
+}
+
 static sem_t g_msgr_test_baz_sem;
 
 static void baz_cb(struct mconn *conn, struct mtran *tr)
@@ -304,7 +662,9 @@ static int msgr_test_conn_timeout(void)
 	EXPECT_ZERO(sem_init(&g_msgr_test_baz_sem, 0, 0));
 
 	baz1_msgr = msgr_init_helper(10, 10, 1, "baz1_msgr");
-	baz2_msgr = msgr_init_helper(10, 10, 1, "baz2_msgr");
+	/* Only baz1 should time out the connection.  If baz2 got there first,
+	 * baz1 would see the connection reset instead. */
+	baz2_msgr = msgr_init_helper(10, 10, 360, "baz2_msgr");
 	memset(&linfo, 0, sizeof(linfo));
 	linfo.cb = baz_cb;
 	linfo.priv = NULL;
@@ -333,6 +693,61 @@ handle_error:
 	return 1;
 }
 
+static int msgr_test_ms_timeout(void)
+{
+	int res;
+	struct msgr *baz1_msgr, *baz2_msgr;
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err);
+	struct listen_info linfo;
+	struct mtran *tr;
+	struct mmm_test1 *mout;
+	uint64_t start_ms, elapsed_ms;
+
+	EXPECT_ZERO(sem_init(&g_msgr_test_baz_sem, 0, 0));
+
+	baz1_msgr = msgr_init_helper(10, 10, 360, "baz1_msgr");
+	baz2_msgr = msgr_init_helper(10, 10, 360, "baz2_msgr");
+	memset(&linfo, 0, sizeof(linfo));
+	linfo.cb = baz_cb;
+	linfo.priv = NULL;
+	linfo.port = MSGR_UNIT_PORT;
+	msgr_listen(baz2_msgr, &linfo, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(baz1_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	msgr_start(baz2_msgr, err, err_len);
+	if (err[0])
+		goto handle_error;
+	tr = mtran_alloc(baz1_msgr);
+	EXPECT_NOT_EQ(tr, NULL);
+	mout = calloc_msg(MMM_TEST1, sizeof(struct mmm_test1));
+	EXPECT_NOT_EQ(mout, NULL);
+	tr->ip = g_localhost;
+	tr->port = MSGR_UNIT_PORT;
+	/* baz2 never replies, so we should time out after about 100 ms */
+	start_ms = mt_time_ms();
+	mtran_send_ms(baz1_msgr, tr, baz_cb, (void*)(uintptr_t)ETIMEDOUT,
+		(struct msg*)mout, 100);
+	RETRY_ON_EINTR(res, sem_wait(&g_msgr_test_baz_sem));
+	elapsed_ms = mt_time_ms() - start_ms;
+	EXPECT_GE(elapsed_ms, 100);
+	EXPECT_LT(elapsed_ms, 1000);
+	EXPECT_ZERO(sem_destroy(&g_msgr_test_baz_sem));
+
+	msgr_shutdown(baz1_msgr);
+	msgr_shutdown(baz2_msgr);
+	msgr_free(baz1_msgr);
+	msgr_free(baz2_msgr);
+	return 0;
+
+handle_error:
+	fprintf(stderr, "msgr_test_ms_timeout: got error %s\n", err);
+	return 1;
+}
+
 static int msgr_test_conn_shutdown(void)
 {
 	int res;
@@ -386,9 +801,15 @@ int main(POSSIBLY_UNUSED(int argc), char **argv)
 	EXPECT_ZERO(get_localhost_ipv4(&g_localhost));
 	EXPECT_ZERO(msgr_test_init_shutdown(0));
 	EXPECT_ZERO(msgr_test_init_shutdown(1));
-	EXPECT_ZERO(msgr_test_simple_send(1));
-	EXPECT_ZERO(msgr_test_simple_send(100));
+	EXPECT_ZERO(msgr_test_simple_send(1, 0));
+	EXPECT_ZERO(msgr_test_simple_send(100, 0));
+	EXPECT_ZERO(msgr_test_simple_send(MSGR_UNIT_BENCH_SENDS, 1));
+	EXPECT_ZERO(msgr_test_lanes(60));
+	EXPECT_ZERO(msgr_test_compress(30, 1));
+	EXPECT_ZERO(msgr_test_compress(30, 0));
+	EXPECT_ZERO(msgr_test_prio(30));
 	EXPECT_ZERO(msgr_test_conn_timeout());
+	EXPECT_ZERO(msgr_test_ms_timeout());
 	EXPECT_ZERO(msgr_test_conn_shutdown());
 	EXPECT_ZERO(mt_deactivate_alarm(timer));
 	process_ctx_shutdown();
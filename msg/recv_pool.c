@@ -23,10 +23,15 @@
 #include "util/compiler.h"
 #include "util/error.h"
 #include "util/fast_log.h"
+#include "util/hmap.h"
 #include "util/macro.h"
+#include "util/packed.h"
+#include "util/queue.h"
+#include "util/time.h"
 
 #include <errno.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <semaphore.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -34,27 +39,179 @@
 #include <string.h>
 #include <sys/socket.h>
 
+/** Limit on the number of RPCs a handler can make at once.  bsend contexts
+ * grow on demand, so this costs nothing unless it is used. */
 #define RECV_POOL_MAX_BSEND_TR 100000
 
+/** How long to tell a sender to wait when our queues are full, in
+ * milliseconds */
+#define RECV_POOL_FULL_RETRY_MS 100
+
+/** Timeout for sending a busy reply, in milliseconds */
+#define RECV_POOL_BUSY_TIMEO_MS 5000
+
+/** Maximum number of client token buckets to keep.  When we reach this many,
+ * we throw them all away and start again, which gives every client a fresh
+ * burst. */
+#define RECV_POOL_MAX_BUCKETS 65536
+
+/** Number of tokens in the bucket for one request */
+#define RECV_POOL_TOKEN 1000
+
+/** Most transactors a messenger will collect before handing them off to the
+ * worker threads */
+#define RECV_POOL_BATCH_MAX 32
+
 STAILQ_HEAD(pending_tr, mtran);
+STAILQ_HEAD(pending_cont, recv_pool_cont);
 
-struct recv_pool {
-	/** recv_pool lock */
+/** Incoming transactors collected by one messenger thread.
+ *
+ * recv_pool_cb runs on the messenger thread, and puts each request it accepts
+ * here.  When the messenger has nothing more to deliver for now, it calls
+ * recv_pool_flush, which moves the whole batch onto a work queue with one
+ * lock round trip.  Only the messenger thread touches this.
+ */
+struct recv_pool_batch {
+	SLIST_ENTRY(recv_pool_batch) entry;
+	/** The receive pool */
+	struct recv_pool *rpool;
+	/** Transactors waiting to be handed off */
+	struct pending_tr head;
+	/** Number of transactors in head */
+	uint32_t num;
+};
+
+SLIST_HEAD(recv_pool_batches, recv_pool_batch);
+
+/** A token bucket limiting the rate of requests from one client address.
+ *
+ * Tokens are counted in thousandths of a request, so that a rate given in
+ * requests per second adds 'rate' tokens to the bucket every millisecond.
+ */
+struct recv_pool_bucket {
+	/** Tokens currently in the bucket */
+	uint64_t tokens;
+	/** Monotonic time in milliseconds at which we last refilled the
+	 * bucket */
+	uint64_t last_ms;
+};
+
+/** A work queue belonging to one thread of a receive pool.
+ *
+ * The owner takes transactors from the front of its queue.  A thread that has
+ * run out of work of its own steals half of some other thread's queue, also
+ * from the front, so that the oldest requests are handled first.
+ */
+struct recv_pool_wq {
+	/** Protects head, conts, depth, idle, and max_depth */
 	pthread_mutex_t lock;
-	/** Condition variable to wait on */
+	/** The owner waits on this when it has nothing to do */
 	pthread_cond_t cond;
-	/** List of incoming transactors with messages */
-	struct pending_tr pending_head;
+	/** Transactors waiting to be handled */
+	struct pending_tr head;
+	/** Continuations waiting to be run */
+	struct pending_cont conts;
+	/** Number of transactors in head plus continuations in conts.  Other
+	 * threads may read this without the lock, as a hint. */
+	volatile uint32_t depth;
+	/** Nonzero if the owner is waiting for work.  Whoever clears this
+	 * must also signal cond.  Other threads may read this without the
+	 * lock, as a hint. */
+	volatile int idle;
+	/** Highest value depth has reached */
+	uint32_t max_depth;
+	/** Number of transactors the owner has handled */
+	uint64_t handled;
+	/** Number of transactors the owner stole from other threads */
+	uint64_t stolen;
+	/** Number of expired requests the owner dropped */
+	uint64_t expired;
+	/** Total time that transactors handled by the owner spent waiting */
+	uint64_t total_wait_us;
+	/** Longest time that a transactor handled by the owner spent
+	 * waiting */
+	uint64_t max_wait_us;
+};
+
+struct recv_pool {
+	/** Protects thread creation */
+	pthread_mutex_t lock;
 	/** recv_pool has been cancelled */
-	int cancel;
+	volatile int cancel;
 	/** Name of receive pool */
 	char *name;
-	/** Number of threads */
-	int num_threads;
-	/** Array of pointers to threads */
+	/** Number of threads.  This only ever goes up, and a thread's work
+	 * queue is ready before it is counted here. */
+	volatile int num_threads;
+	/** Array of RECV_POOL_MAX_THREADS pointers to threads */
 	struct recv_pool_thread **threads;
+	/** Array of RECV_POOL_MAX_THREADS work queues.  Queue i belongs to
+	 * thread i.  Until the first thread is created, work goes on queue 0,
+	 * which that thread will pick up. */
+	struct recv_pool_wq *wqs;
+	/** Total number of transactors in all of the work queues */
+	volatile int num_queued;
+	/** Number of threads waiting for work */
+	volatile int num_idle;
+	/** Where recv_pool_cb starts looking for a queue to use.  This is just
+	 * a hint, so we don't care about lost updates. */
+	unsigned int next_wq;
+	/** Protects lim and buckets */
+	pthread_mutex_t adm_lock;
+	/** Admission control limits.  recv_pool_cb reads these without the
+	 * lock, as a hint. */
+	struct recv_pool_limits lim;
+	/** Token buckets for clients, keyed by IP address.  slots is NULL if
+	 * we failed to allocate it. */
+	struct hmap buckets;
+	/** Number of requests turned away because the queues were full */
+	uint64_t rejected_full;
+	/** Number of requests turned away by the client rate limit */
+	uint64_t rejected_rate;
+	/** Number of batches of transactors handed off by messengers */
+	uint64_t batches;
+	/** One batch for each messenger we listen on.  Protected by lock. */
+	struct recv_pool_batches batch_head;
 };
 
+static void recv_pool_free_wqs(struct recv_pool_wq *wqs, int num_wqs)
+{
+	int i;
+
+	for (i = 0; i < num_wqs; ++i) {
+		pthread_cond_destroy(&wqs[i].cond);
+		pthread_mutex_destroy(&wqs[i].lock);
+	}
+	free(wqs);
+}
+
+static struct recv_pool_wq *recv_pool_alloc_wqs(void)
+{
+	int i, ret;
+	struct recv_pool_wq *wqs;
+
+	wqs = calloc(RECV_POOL_MAX_THREADS, sizeof(struct recv_pool_wq));
+	if (!wqs)
+		return ERR_PTR(ENOMEM);
+	for (i = 0; i < RECV_POOL_MAX_THREADS; ++i) {
+		ret = pthread_mutex_init(&wqs[i].lock, NULL);
+		if (ret) {
+			recv_pool_free_wqs(wqs, i);
+			return ERR_PTR(ret);
+		}
+		ret = pthread_cond_init_mt(&wqs[i].cond);
+		if (ret) {
+			pthread_mutex_destroy(&wqs[i].lock);
+			recv_pool_free_wqs(wqs, i);
+			return ERR_PTR(ret);
+		}
+		STAILQ_INIT(&wqs[i].head);
+		STAILQ_INIT(&wqs[i].conts);
+	}
+	return wqs;
+}
+
 struct recv_pool *recv_pool_init(const char *name)
 {
 	int ret;
@@ -71,18 +228,37 @@ struct recv_pool *recv_pool_init(const char *name)
 		goto error_free_rp;
 	}
 	rpool->num_threads = 0;
-	rpool->threads = 0;
-	STAILQ_INIT(&rpool->pending_head);
+	SLIST_INIT(&rpool->batch_head);
+	rpool->threads = calloc(RECV_POOL_MAX_THREADS,
+				sizeof(struct recv_pool_thread*));
+	if (!rpool->threads) {
+		ret = -ENOMEM;
+		goto error_free_rp_name;
+	}
+	rpool->wqs = recv_pool_alloc_wqs();
+	if (IS_ERR(rpool->wqs)) {
+		ret = -PTR_ERR(rpool->wqs);
+		goto error_free_threads;
+	}
 	ret = pthread_mutex_init(&rpool->lock, NULL);
 	if (ret)
-		goto error_free_rp_name;
-	ret = pthread_cond_init_mt(&rpool->cond);
+		goto error_free_wqs;
+	ret = pthread_mutex_init(&rpool->adm_lock, NULL);
 	if (ret)
 		goto error_destroy_lock;
+	ret = hmap_init(&rpool->buckets, 0);
+	if (ret)
+		goto error_destroy_adm_lock;
 	return rpool;
 
+error_destroy_adm_lock:
+	pthread_mutex_destroy(&rpool->adm_lock);
 error_destroy_lock:
 	pthread_mutex_destroy(&rpool->lock);
+error_free_wqs:
+	recv_pool_free_wqs(rpool->wqs, RECV_POOL_MAX_THREADS);
+error_free_threads:
+	free(rpool->threads);
 error_free_rp_name:
 	free(rpool->name);
 error_free_rp:
@@ -91,51 +267,541 @@ error:
 	return ERR_PTR(ret);
 }
 
+/** Get the number of work queues that are in use */
+static int recv_pool_num_wqs(const struct recv_pool *rpool)
+{
+	int num_threads = rpool->num_threads;
+
+	return (num_threads == 0) ? 1 : num_threads;
+}
+
+/** Wake up an idle thread, if there is one, so that it can steal some work.
+ *
+ * @param rpool		The receive pool
+ * @param skip		Index of a work queue whose owner we shouldn't bother
+ *			waking
+ */
+static void recv_pool_wake_idle(struct recv_pool *rpool, int skip)
+{
+	int i, num_wqs;
+	struct recv_pool_wq *wq;
+
+	if (rpool->num_idle == 0)
+		return;
+	num_wqs = recv_pool_num_wqs(rpool);
+	for (i = 0; i < num_wqs; ++i) {
+		if (i == skip)
+			continue;
+		wq = &rpool->wqs[i];
+		if (!wq->idle)
+			continue;
+		pthread_mutex_lock(&wq->lock);
+		if (wq->idle) {
+			wq->idle = 0;
+			__sync_fetch_and_sub(&rpool->num_idle, 1);
+			pthread_cond_signal(&wq->cond);
+			pthread_mutex_unlock(&wq->lock);
+			return;
+		}
+		pthread_mutex_unlock(&wq->lock);
+	}
+}
+
+/** Pick a work queue for a new transactor.
+ *
+ * We'd like to hand the transactor straight to an idle thread.  If there
+ * aren't any, we use the shorter of two queues.
+ */
+static int recv_pool_pick_wq(struct recv_pool *rpool)
+{
+	int i, idx, other, num_wqs;
+
+	num_wqs = recv_pool_num_wqs(rpool);
+	idx = rpool->next_wq++ % num_wqs;
+	if (rpool->num_idle > 0) {
+		for (i = 0; i < num_wqs; ++i) {
+			other = (idx + i) % num_wqs;
+			if (rpool->wqs[other].idle)
+				return other;
+		}
+	}
+	other = (idx + 1) % num_wqs;
+	if (rpool->wqs[other].depth < rpool->wqs[idx].depth)
+		return other;
+	return idx;
+}
+
+/** Give a batch of transactors, or a continuation, to one of the threads of
+ * a receive pool.  Exactly one of trs and cont must be non-NULL.
+ *
+ * @param rpool		The receive pool
+ * @param trs		Transactors to hand off.  On success, this list is
+ *			left empty.
+ * @param num		Number of transactors in trs
+ * @param cont		Continuation to hand off
+ *
+ * @return		0 on success; -ECANCELED if the pool has been joined
+ */
+static int recv_pool_enqueue(struct recv_pool *rpool, struct pending_tr *trs,
+		uint32_t num, struct recv_pool_cont *cont)
+{
+	struct recv_pool_wq *wq;
+	int idx, woke;
+	uint32_t i;
+
+	idx = recv_pool_pick_wq(rpool);
+	wq = &rpool->wqs[idx];
+	pthread_mutex_lock(&wq->lock);
+	if (rpool->cancel) {
+		pthread_mutex_unlock(&wq->lock);
+		return -ECANCELED;
+	}
+	if (cont) {
+		STAILQ_INSERT_TAIL(&wq->conts, cont, entry);
+		num = 1;
+	}
+	else {
+		STAILQ_CONCAT(&wq->head, trs);
+	}
+	wq->depth += num;
+	if (wq->depth > wq->max_depth)
+		wq->max_depth = wq->depth;
+	__sync_fetch_and_add(&rpool->num_queued, num);
+	/* Only signal the owner if it's actually waiting.  A busy owner will
+	 * find the work when it's done with what it's doing. */
+	woke = wq->idle;
+	if (woke) {
+		wq->idle = 0;
+		__sync_fetch_and_sub(&rpool->num_idle, 1);
+		pthread_cond_signal(&wq->cond);
+	}
+	pthread_mutex_unlock(&wq->lock);
+	/* Get idle threads to steal whatever the owner can't start on right
+	 * away. */
+	for (i = woke ? 1 : 0; i < num; ++i) {
+		if (rpool->num_idle == 0)
+			break;
+		recv_pool_wake_idle(rpool, idx);
+	}
+	return 0;
+}
+
+/** Free a list of transactors that we never handed off */
+static void recv_pool_free_trs(struct pending_tr *trs)
+{
+	struct mtran *tr;
+
+	while (1) {
+		tr = STAILQ_FIRST(trs);
+		if (!tr)
+			break;
+		STAILQ_REMOVE_HEAD(trs, u.pending_entry);
+		mtran_free(tr);
+	}
+}
+
+/** Hand off the transactors that a messenger has collected.
+ *
+ * Called on the messenger thread, once it has delivered everything it can for
+ * now, or from recv_pool_cb when the batch is full.
+ *
+ * @param priv		The struct recv_pool_batch of that messenger
+ */
+static void recv_pool_flush(void *priv)
+{
+	struct recv_pool_batch *batch = priv;
+	struct recv_pool *rpool = batch->rpool;
+	struct pending_tr trs = STAILQ_HEAD_INITIALIZER(trs);
+	uint32_t num;
+
+	if (batch->num == 0)
+		return;
+	STAILQ_CONCAT(&trs, &batch->head);
+	num = batch->num;
+	batch->num = 0;
+	__sync_fetch_and_add(&rpool->batches, 1);
+	if (recv_pool_enqueue(rpool, &trs, num, NULL))
+		recv_pool_free_trs(&trs);
+}
+
+static void recv_pool_free_buckets(struct hmap *buckets)
+{
+	uint32_t idx;
+	void *v;
+
+	HMAP_FOREACH(buckets, idx, v) {
+		free(v);
+	}
+	hmap_free(buckets);
+}
+
+/** Forget about all clients.  The caller must hold adm_lock.
+ *
+ * If we can't allocate a new table, buckets.slots is left NULL, and
+ * recv_pool_charge will try again later.
+ */
+static void recv_pool_clear_buckets(struct recv_pool *rpool)
+{
+	recv_pool_free_buckets(&rpool->buckets);
+	hmap_init(&rpool->buckets, 0);
+}
+
+/** Take a request's worth of tokens from a client's bucket.
+ *
+ * @param rpool		The receive pool
+ * @param ip		The client's IP address
+ * @param now_ms	The current monotonic time in milliseconds
+ *
+ * @return		0 if the client may go ahead; otherwise, the number of
+ *			milliseconds until it will have enough tokens
+ */
+static uint32_t recv_pool_charge(struct recv_pool *rpool, uint32_t ip,
+		uint64_t now_ms)
+{
+	struct recv_pool_bucket *b;
+	uint64_t rate, cap;
+	uint32_t retry_ms = 0;
+
+	pthread_mutex_lock(&rpool->adm_lock);
+	rate = rpool->lim.client_rate;
+	if (rate == 0)
+		goto done;
+	if ((!rpool->buckets.slots) && hmap_init(&rpool->buckets, 0))
+		goto done;
+	cap = (uint64_t)rpool->lim.client_burst * RECV_POOL_TOKEN;
+	if (cap < RECV_POOL_TOKEN)
+		cap = RECV_POOL_TOKEN;
+	b = hmap_get(&rpool->buckets, ip);
+	if (!b) {
+		if (rpool->buckets.num >= RECV_POOL_MAX_BUCKETS) {
+			recv_pool_clear_buckets(rpool);
+			if (!rpool->buckets.slots)
+				goto done;
+		}
+		/* If we run out of memory here, it's better to let the
+		 * request in than to turn everyone away. */
+		b = malloc(sizeof(struct recv_pool_bucket));
+		if (!b)
+			goto done;
+		if (hmap_put(&rpool->buckets, ip, b)) {
+			free(b);
+			goto done;
+		}
+		b->tokens = cap;
+		b->last_ms = now_ms;
+	}
+	if (now_ms > b->last_ms) {
+		b->tokens += (now_ms - b->last_ms) * rate;
+		if (b->tokens > cap)
+			b->tokens = cap;
+		b->last_ms = now_ms;
+	}
+	if (b->tokens >= RECV_POOL_TOKEN)
+		b->tokens -= RECV_POOL_TOKEN;
+	else
+		retry_ms = (RECV_POOL_TOKEN - b->tokens + rate - 1) / rate;
+done:
+	pthread_mutex_unlock(&rpool->adm_lock);
+	return retry_ms;
+}
+
+/** Decide whether to accept a newly arrived request.
+ *
+ * @param rpool		The receive pool
+ * @param tr		The transactor holding the request
+ *
+ * @return		0 if the request should be queued; otherwise, the
+ *			number of milliseconds the sender should wait before
+ *			trying again
+ */
+static uint32_t recv_pool_admit(struct recv_pool *rpool,
+		const struct mtran *tr)
+{
+	uint32_t max_queued, retry_ms;
+
+	if (unpack_from_8(&tr->m->flags) & MSG_FLAG_MUSTDO)
+		return 0;
+	max_queued = rpool->lim.max_queued;
+	if ((max_queued != 0) &&
+			((uint32_t)rpool->num_queued >= max_queued)) {
+		__sync_fetch_and_add(&rpool->rejected_full, 1);
+		return RECV_POOL_FULL_RETRY_MS;
+	}
+	if (rpool->lim.client_rate == 0)
+		return 0;
+	retry_ms = recv_pool_charge(rpool, tr->ip, mt_time_ms());
+	if (retry_ms)
+		__sync_fetch_and_add(&rpool->rejected_rate, 1);
+	return retry_ms;
+}
+
+/** Turn a request away with a busy reply.
+ *
+ * recv_pool_cb will be called again once the reply has been sent.
+ */
+static void recv_pool_send_busy(struct mconn *conn, struct mtran *tr,
+		uint32_t retry_ms)
+{
+	struct msg *r;
+
+	msg_release(tr->m);
+	tr->m = NULL;
+	r = busy_resp_alloc(retry_ms);
+	if (IS_ERR(r)) {
+		mtran_free(tr);
+		return;
+	}
+	mtran_send_next_ms(conn, tr, r, RECV_POOL_BUSY_TIMEO_MS);
+}
+
 static void recv_pool_cb(struct mconn *conn, struct mtran *tr)
 {
-	struct recv_pool *rpool = tr->priv;
+	struct recv_pool_batch *batch = tr->priv;
+	struct recv_pool *rpool = batch->rpool;
+	uint32_t retry_ms;
 
+	if (tr->state == MTRAN_STATE_SENT) {
+		/* We have finished sending a busy reply, successfully or
+		 * otherwise. */
+		mtran_free(tr);
+		return;
+	}
 	if (IS_ERR(tr->m)) {
 		/* The incoming message could not be completely received for
 		 * some reason.  Nothing we can do here. */
 		mtran_free(tr);
 		return;
 	}
-	/* We don't need to keep the receive pool pointer in tr->priv any more.
+	retry_ms = recv_pool_admit(rpool, tr);
+	if (retry_ms) {
+		recv_pool_send_busy(conn, tr, retry_ms);
+		return;
+	}
+	/* We don't need to keep the batch pointer in tr->priv any more.
 	 * Instead, store a pointer to the messenger that sent this message, in
 	 * case we want to send a reply later.  */
 	tr->priv = mconn_get_msgr(conn);
-	pthread_mutex_lock(&rpool->lock);
-	if (rpool->cancel) {
-		pthread_mutex_unlock(&rpool->lock);
-		mtran_free(tr);
-		return;
-	}
-	STAILQ_INSERT_TAIL(&rpool->pending_head, tr, u.pending_entry);
-	pthread_cond_signal(&rpool->cond);
-	pthread_mutex_unlock(&rpool->lock);
+	tr->queued_us = mt_time_us();
+	/* The messenger will call recv_pool_flush once it has nothing else to
+	 * deliver.  Requests waiting in the batch are not counted against
+	 * max_queued, but there are never more than RECV_POOL_BATCH_MAX of
+	 * them per messenger. */
+	STAILQ_INSERT_TAIL(&batch->head, tr, u.pending_entry);
+	if (++batch->num >= RECV_POOL_BATCH_MAX)
+		recv_pool_flush(batch);
+}
+
+int recv_pool_post(struct recv_pool *rpool, struct recv_pool_cont *cont)
+{
+	cont->err = 0;
+	cont->queued_us = mt_time_us();
+	return recv_pool_enqueue(rpool, NULL, 0, cont);
+}
+
+void recv_pool_set_limits(struct recv_pool *rpool,
+		const struct recv_pool_limits *lim)
+{
+	pthread_mutex_lock(&rpool->adm_lock);
+	if ((lim->client_rate != rpool->lim.client_rate) ||
+			(lim->client_burst != rpool->lim.client_burst))
+		recv_pool_clear_buckets(rpool);
+	memcpy(&rpool->lim, lim, sizeof(struct recv_pool_limits));
+	pthread_mutex_unlock(&rpool->adm_lock);
 }
 
 void recv_pool_msgr_listen(struct recv_pool *rpool, struct msgr *msgr,
 		uint16_t port, char *err, size_t err_len)
 {
 	struct listen_info linfo;
+	struct recv_pool_batch *batch;
 
+	batch = calloc(1, sizeof(struct recv_pool_batch));
+	if (!batch) {
+		snprintf(err, err_len, "recv_pool_msgr_listen: out of memory");
+		return;
+	}
+	batch->rpool = rpool;
+	STAILQ_INIT(&batch->head);
 	memset(&linfo, 0, sizeof(linfo));
 	linfo.cb = recv_pool_cb;
-	linfo.priv = rpool;
+	linfo.flush = recv_pool_flush;
+	linfo.priv = batch;
 	linfo.port = port;
 	msgr_listen(msgr, &linfo, err, err_len);
+	if (err[0]) {
+		free(batch);
+		return;
+	}
+	pthread_mutex_lock(&rpool->lock);
+	SLIST_INSERT_HEAD(&rpool->batch_head, batch, entry);
+	pthread_mutex_unlock(&rpool->lock);
+}
+
+/** Take the first continuation from a work queue.  The queue must be locked.
+ *
+ * @return		The continuation, or NULL if there were none
+ */
+static struct recv_pool_cont *recv_pool_wq_take_cont(struct recv_pool *rpool,
+		struct recv_pool_wq *wq)
+{
+	struct recv_pool_cont *cont;
+
+	cont = STAILQ_FIRST(&wq->conts);
+	if (cont) {
+		STAILQ_REMOVE_HEAD(&wq->conts, entry);
+		wq->depth--;
+		__sync_fetch_and_sub(&rpool->num_queued, 1);
+	}
+	return cont;
+}
+
+/** Take the next piece of work from a thread's own work queue.
+ * Continuations go first.
+ *
+ * @param rpool		The receive pool
+ * @param wq		The work queue
+ * @param cont		(out param) the continuation to run, if any
+ *
+ * @return		The transactor to handle, if any
+ */
+static struct mtran *recv_pool_wq_pop(struct recv_pool *rpool,
+		struct recv_pool_wq *wq, struct recv_pool_cont **cont)
+{
+	struct mtran *tr = NULL;
+
+	pthread_mutex_lock(&wq->lock);
+	*cont = recv_pool_wq_take_cont(rpool, wq);
+	if (!*cont) {
+		tr = STAILQ_FIRST(&wq->head);
+		if (tr) {
+			STAILQ_REMOVE_HEAD(&wq->head, u.pending_entry);
+			wq->depth--;
+			__sync_fetch_and_sub(&rpool->num_queued, 1);
+		}
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return tr;
+}
+
+/** Steal half of the first non-empty work queue we can find.
+ *
+ * We return the oldest of the transactors we stole, and put the rest on the
+ * end of our own queue.  Taking several at once means that we don't have to
+ * come back to the victim's lock every time we finish a request.  If the
+ * victim has continuations waiting, we just take the first of those.
+ *
+ * @param rpool		The receive pool
+ * @param self		Index of our own work queue
+ * @param cont		(out param) the continuation to run, if any
+ *
+ * @return		A transactor to handle, or NULL if there was no
+ *			transactor to steal
+ */
+static struct mtran *recv_pool_steal(struct recv_pool *rpool, int self,
+		struct recv_pool_cont **cont)
+{
+	struct pending_tr loot = STAILQ_HEAD_INITIALIZER(loot);
+	struct recv_pool_wq *wq, *victim;
+	struct mtran *tr;
+	int i, num_wqs;
+	uint32_t j, num;
+
+	wq = &rpool->wqs[self];
+	num_wqs = recv_pool_num_wqs(rpool);
+	for (i = 1; i < num_wqs; ++i) {
+		victim = &rpool->wqs[(self + i) % num_wqs];
+		if ((victim == wq) || (victim->depth == 0))
+			continue;
+		pthread_mutex_lock(&victim->lock);
+		*cont = recv_pool_wq_take_cont(rpool, victim);
+		if (*cont) {
+			pthread_mutex_unlock(&victim->lock);
+			wq->stolen++;
+			return NULL;
+		}
+		num = (victim->depth + 1) / 2;
+		for (j = 0; j < num; ++j) {
+			tr = STAILQ_FIRST(&victim->head);
+			STAILQ_REMOVE_HEAD(&victim->head, u.pending_entry);
+			STAILQ_INSERT_TAIL(&loot, tr, u.pending_entry);
+		}
+		victim->depth -= num;
+		pthread_mutex_unlock(&victim->lock);
+		if (num == 0)
+			continue;
+		wq->stolen += num;
+		tr = STAILQ_FIRST(&loot);
+		STAILQ_REMOVE_HEAD(&loot, u.pending_entry);
+		__sync_fetch_and_sub(&rpool->num_queued, 1);
+		if (num > 1) {
+			pthread_mutex_lock(&wq->lock);
+			STAILQ_CONCAT(&wq->head, &loot);
+			wq->depth += num - 1;
+			if (wq->depth > wq->max_depth)
+				wq->max_depth = wq->depth;
+			pthread_mutex_unlock(&wq->lock);
+		}
+		return tr;
+	}
+	return NULL;
+}
+
+/** Wait until there might be some work for us to do.
+ *
+ * @param rpool		The receive pool
+ * @param wq		Our own work queue
+ */
+static void recv_pool_wait(struct recv_pool *rpool, struct recv_pool_wq *wq)
+{
+	pthread_mutex_lock(&wq->lock);
+	if ((wq->depth != 0) || rpool->cancel) {
+		pthread_mutex_unlock(&wq->lock);
+		return;
+	}
+	wq->idle = 1;
+	__sync_fetch_and_add(&rpool->num_idle, 1);
+	/* recv_pool_cb bumps num_queued before looking for idle threads, and
+	 * we have bumped num_idle before looking at num_queued.  So either it
+	 * will see that we're idle and wake us, or we will see the transactor
+	 * it queued, and go and steal it. */
+	if (rpool->num_queued > 0) {
+		wq->idle = 0;
+		__sync_fetch_and_sub(&rpool->num_idle, 1);
+		pthread_mutex_unlock(&wq->lock);
+		return;
+	}
+	while (wq->idle && (!rpool->cancel))
+		pthread_cond_wait(&wq->cond, &wq->lock);
+	if (wq->idle) {
+		wq->idle = 0;
+		__sync_fetch_and_sub(&rpool->num_idle, 1);
+	}
+	pthread_mutex_unlock(&wq->lock);
+}
+
+/** Get the deadline for handling a request.
+ *
+ * Messages flagged MSG_FLAG_MUSTDO have no deadline: they must be carried out
+ * whether or not anyone is still waiting for the answer.
+ */
+static uint64_t recv_pool_tr_deadline(const struct mtran *tr)
+{
+	if (unpack_from_8(&tr->m->flags) & MSG_FLAG_MUSTDO)
+		return 0;
+	return tr->deadline_ms;
 }
 
 static int recv_pool_thread_trampoline(struct redfish_thread *rt)
 {
 	int ret;
 	struct mtran *tr;
+	struct recv_pool_cont *cont;
 	struct recv_pool_thread *rrt  = (struct recv_pool_thread *)rt;
 	struct recv_pool *rpool = rrt->rpool;
+	struct recv_pool_wq *wq = &rpool->wqs[rrt->idx];
 	recv_pool_handler_fn_t handler = rrt->handler;
 	struct bsend *ctx;
+	uint64_t wait_us, deadline_ms;
 	char fb_name[FAST_LOG_BUF_NAME_MAX];
 
 	snprintf(fb_name, sizeof(fb_name), "%s%d", rpool->name, rt->thread_id);
@@ -145,24 +811,47 @@ static int recv_pool_thread_trampoline(struct redfish_thread *rt)
 		return PTR_ERR(ctx);
 	}
 	rrt->ctx = ctx;
-	pthread_mutex_lock(&rpool->lock);
 	while (1) {
 		if (rpool->cancel) {
-			pthread_mutex_unlock(&rpool->lock);
 			ret = 0;
 			break;
 		}
-		tr = STAILQ_FIRST(&rpool->pending_head);
-		if (!tr) {
-			pthread_cond_wait(&rpool->cond, &rpool->lock);
+		tr = recv_pool_wq_pop(rpool, wq, &cont);
+		if ((!tr) && (!cont))
+			tr = recv_pool_steal(rpool, rrt->idx, &cont);
+		if ((!tr) && (!cont)) {
+			recv_pool_wait(rpool, wq);
 			continue;
 		}
-		STAILQ_REMOVE_HEAD(&rpool->pending_head, u.pending_entry);
-		pthread_mutex_unlock(&rpool->lock);
-		ret = handler(rrt, tr);
+		if (tr) {
+			deadline_ms = recv_pool_tr_deadline(tr);
+			if (deadline_ms && (mt_time_ms() >= deadline_ms)) {
+				/* The sender has given up on this request
+				 * already.  Doing it anyway would only make
+				 * things worse for the requests behind it. */
+				wq->expired++;
+				mtran_free(tr);
+				continue;
+			}
+		}
+		wait_us = mt_time_us() - (cont ? cont->queued_us :
+				tr->queued_us);
+		wq->handled++;
+		wq->total_wait_us += wait_us;
+		if (wait_us > wq->max_wait_us)
+			wq->max_wait_us = wait_us;
+		if (cont) {
+			ret = cont->fn(rrt, cont);
+		}
+		else {
+			/* Sub-RPCs made on behalf of this request shouldn't
+			 * outlive it. */
+			bsend_set_deadline(ctx, deadline_ms);
+			ret = handler(rrt, tr);
+			bsend_set_deadline(ctx, 0);
+		}
 		if (ret)
 			break;
-		pthread_mutex_lock(&rpool->lock);
 	}
 	bsend_free(ctx);
 	return ret;
@@ -172,7 +861,6 @@ int recv_pool_thread_create(struct recv_pool *rpool, struct fast_log_mgr *mgr,
 		recv_pool_handler_fn_t handler, void *priv)
 {
 	int ret;
-	struct recv_pool_thread **threads;
 	struct recv_pool_thread *rt;
 
 	/* create the Redfish thread */
@@ -181,22 +869,18 @@ int recv_pool_thread_create(struct recv_pool *rpool, struct fast_log_mgr *mgr,
 		pthread_mutex_unlock(&rpool->lock);
 		return -ECANCELED;
 	}
-	threads = realloc(rpool->threads,
-		sizeof (struct recv_pool_thread*) * rpool->num_threads + 1);
-	if (!threads) {
+	if (rpool->num_threads >= RECV_POOL_MAX_THREADS) {
 		pthread_mutex_unlock(&rpool->lock);
-		return -ENOMEM;
+		return -ENOSPC;
 	}
-	rpool->threads = threads;
 	rt = calloc(1, sizeof(struct recv_pool_thread));
 	if (!rt) {
 		pthread_mutex_unlock(&rpool->lock);
 		return -ENOMEM;
 	}
-	threads[rpool->num_threads] = rt;
-	memset(rt, 0, sizeof(struct recv_pool_thread));
 	rt->rpool = rpool;
 	rt->handler = handler;
+	rt->idx = rpool->num_threads;
 	ret = redfish_thread_create(mgr, (struct redfish_thread*)rt,
 			recv_pool_thread_trampoline, priv);
 	if (ret) {
@@ -204,30 +888,109 @@ int recv_pool_thread_create(struct recv_pool *rpool, struct fast_log_mgr *mgr,
 		pthread_mutex_unlock(&rpool->lock);
 		return ret;
 	}
+	rpool->threads[rt->idx] = rt;
+	/* Make sure that anyone who sees the new thread count also sees the
+	 * new thread. */
+	__sync_synchronize();
 	rpool->num_threads++;
 	pthread_mutex_unlock(&rpool->lock);
 	return 0;
 }
 
+void recv_pool_get_stats(struct recv_pool *rpool,
+		struct recv_pool_stats *stats)
+{
+	int i, num_wqs;
+	const struct recv_pool_wq *wq;
+
+	memset(stats, 0, sizeof(struct recv_pool_stats));
+	num_wqs = recv_pool_num_wqs(rpool);
+	for (i = 0; i < num_wqs; ++i) {
+		wq = &rpool->wqs[i];
+		stats->depth += wq->depth;
+		if (wq->max_depth > stats->max_depth)
+			stats->max_depth = wq->max_depth;
+		stats->handled += wq->handled;
+		stats->stolen += wq->stolen;
+		stats->expired += wq->expired;
+		stats->total_wait_us += wq->total_wait_us;
+		if (wq->max_wait_us > stats->max_wait_us)
+			stats->max_wait_us = wq->max_wait_us;
+	}
+	stats->rejected_full = rpool->rejected_full;
+	stats->rejected_rate = rpool->rejected_rate;
+	stats->batches = rpool->batches;
+}
+
 void recv_pool_join(struct recv_pool *rpool)
 {
-	int i, POSSIBLY_UNUSED(ret);
+	int i, num_wqs, POSSIBLY_UNUSED(ret);
+	struct recv_pool_wq *wq;
+	struct recv_pool_cont *cont;
+	struct mtran *tr;
 
 	pthread_mutex_lock(&rpool->lock);
 	rpool->cancel = 1;
-	pthread_cond_broadcast(&rpool->cond);
 	pthread_mutex_unlock(&rpool->lock);
-
+	/* Anyone who takes a work queue lock after this will see the cancel
+	 * flag. */
+	num_wqs = recv_pool_num_wqs(rpool);
+	for (i = 0; i < num_wqs; ++i) {
+		wq = &rpool->wqs[i];
+		pthread_mutex_lock(&wq->lock);
+		pthread_cond_broadcast(&wq->cond);
+		pthread_mutex_unlock(&wq->lock);
+	}
 	for (i = 0; i < rpool->num_threads; ++i) {
 		ret = redfish_thread_join((struct redfish_thread*)
 			rpool->threads[i]);
 	}
+	for (i = 0; i < num_wqs; ++i) {
+		wq = &rpool->wqs[i];
+		while (1) {
+			tr = STAILQ_FIRST(&wq->head);
+			if (!tr)
+				break;
+			STAILQ_REMOVE_HEAD(&wq->head, u.pending_entry);
+			wq->depth--;
+			mtran_free(tr);
+		}
+		/* Continuations usually own a request that is in progress,
+		 * and whatever else goes with it.  Give them a chance to free
+		 * it all. */
+		while (1) {
+			cont = STAILQ_FIRST(&wq->conts);
+			if (!cont)
+				break;
+			STAILQ_REMOVE_HEAD(&wq->conts, entry);
+			wq->depth--;
+			cont->err = -ECANCELED;
+			ret = cont->fn(NULL, cont);
+		}
+		wq->depth = 0;
+	}
+	rpool->num_queued = 0;
 }
 
 void recv_pool_free(struct recv_pool *rp)
 {
-	pthread_cond_destroy(&rp->cond);
+	int i;
+	struct recv_pool_batch *batch;
+
+	while (1) {
+		batch = SLIST_FIRST(&rp->batch_head);
+		if (!batch)
+			break;
+		SLIST_REMOVE_HEAD(&rp->batch_head, entry);
+		recv_pool_free_trs(&batch->head);
+		free(batch);
+	}
+	recv_pool_free_buckets(&rp->buckets);
+	pthread_mutex_destroy(&rp->adm_lock);
 	pthread_mutex_destroy(&rp->lock);
+	recv_pool_free_wqs(rp->wqs, RECV_POOL_MAX_THREADS);
+	for (i = 0; i < rp->num_threads; ++i)
+		free(rp->threads[i]);
 	free(rp->threads);
 	free(rp->name);
 	free(rp);
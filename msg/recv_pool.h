@@ -23,22 +23,110 @@
  * Redfish blocking RPC implementation
  */
 
+#include "util/queue.h"
 #include "util/thread.h" /* for struct redfish_thread */
 
+#include <stdint.h> /* for uint64_t, etc. */
+
+/** Maximum number of threads in a receive pool */
+#define RECV_POOL_MAX_THREADS 256
+
 struct fast_log_buf;
 struct msgr;
 struct mtran;
 struct recv_pool;
+struct recv_pool_cont;
 struct recv_pool_thread;
 
 typedef int (*recv_pool_handler_fn_t)(struct recv_pool_thread *rt,
 			struct mtran *tr);
 
+typedef int (*recv_pool_cont_fn_t)(struct recv_pool_thread *rt,
+			struct recv_pool_cont *cont);
+
+/** A continuation: a piece of work to be run by some thread of a receive pool
+ * once whatever it was waiting for has happened.
+ *
+ * Handlers that would otherwise block (waiting for replies to sub-RPCs, for
+ * example) can instead register a continuation and return, so that the thread
+ * can go on to handle other messages.  Embed this in a larger structure and
+ * use GET_OUTER to get at it in the continuation function.
+ *
+ * If the pool is joined while the continuation is still waiting, the
+ * continuation is run anyway by recv_pool_join, with rt set to NULL and err set
+ * to -ECANCELED.  It should then just free whatever it owns.
+ */
+struct recv_pool_cont {
+	STAILQ_ENTRY(recv_pool_cont) entry;
+	/** Function to run.  The return value is treated the same way as the
+	 * return value of a recv_pool_handler_fn_t. */
+	recv_pool_cont_fn_t fn;
+	/** 0, or -ECANCELED if the continuation is being run only so that it
+	 * can clean up */
+	int err;
+	/** Monotonic time in microseconds at which this continuation was
+	 * posted */
+	uint64_t queued_us;
+};
+
 struct recv_pool_thread {
 	struct redfish_thread base;
 	struct recv_pool *rpool;
 	recv_pool_handler_fn_t handler;
 	struct bsend *ctx;
+	/** Index of this thread's work queue in the receive pool */
+	int idx;
+};
+
+/** Admission control settings for a receive pool.
+ *
+ * Requests that are turned away get an EBUSY reply telling the sender how long
+ * to wait before trying again, rather than sitting in a queue until they time
+ * out.  Messages flagged MSG_FLAG_MUSTDO are always admitted.
+ */
+struct recv_pool_limits {
+	/** Maximum number of transactors waiting to be handled, or 0 for no
+	 * limit */
+	uint32_t max_queued;
+	/** Number of requests per second that each client address may make
+	 * over the long run, or 0 for no limit */
+	uint32_t client_rate;
+	/** Number of requests that a client address may make in a burst.  If
+	 * this is less than 1, 1 is used. */
+	uint32_t client_burst;
+};
+
+/** Receive pool statistics */
+struct recv_pool_stats {
+	/** Number of transactors and continuations currently waiting to be
+	 * handled */
+	uint32_t depth;
+	/** Highest number of transactors ever waiting in any one thread's
+	 * queue */
+	uint32_t max_depth;
+	/** Number of transactors and continuations handled */
+	uint64_t handled;
+	/** Number of transactors that were taken from another thread's
+	 * queue */
+	uint64_t stolen;
+	/** Number of requests dropped without being handled, because their
+	 * sender had already given up on them */
+	uint64_t expired;
+	/** Number of requests turned away because the pool's queues were
+	 * full */
+	uint64_t rejected_full;
+	/** Number of requests turned away because their sender was over its
+	 * rate limit */
+	uint64_t rejected_rate;
+	/** Total time transactors spent waiting to be handled, in
+	 * microseconds */
+	uint64_t total_wait_us;
+	/** Longest time any transactor spent waiting to be handled, in
+	 * microseconds */
+	uint64_t max_wait_us;
+	/** Number of batches of incoming transactors that messengers have
+	 * handed to the pool */
+	uint64_t batches;
 };
 
 /** Create an RPC receive thread pool
@@ -50,6 +138,9 @@ struct recv_pool_thread {
 extern struct recv_pool *recv_pool_init(const char *name);
 
 /** Hook up a messenger to a receive pool
+ *
+ * The messenger thread collects the requests it receives, and hands them to
+ * the pool's threads in batches.
  *
  * @param rpool		The receive pool
  * @param msgr		The messenger to hook up
@@ -72,7 +163,51 @@ extern void recv_pool_msgr_listen(struct recv_pool *rpool, struct msgr *msgr,
 extern int recv_pool_thread_create(struct recv_pool *rpool,
 	struct fast_log_mgr *mgr, recv_pool_handler_fn_t handler, void *priv);
 
+/** Set the admission control limits for a receive pool
+ *
+ * By default, a receive pool admits everything.  This can be called at any
+ * time, but changing the client rate or burst forgets what each client has
+ * done so far.
+ *
+ * @param rpool		The receive pool
+ * @param lim		The new limits.  This will be deep-copied.
+ */
+extern void recv_pool_set_limits(struct recv_pool *rpool,
+		const struct recv_pool_limits *lim);
+
+/** Post a continuation to a receive pool
+ *
+ * The continuation will be run by one of the pool's threads.  Continuations
+ * are run ahead of newly arrived messages, since they usually finish off
+ * requests that are already in progress.
+ *
+ * This can be called from any context, including a messenger callback.
+ *
+ * @param rpool		The receive pool
+ * @param cont		The continuation.  cont->fn must be set.
+ *
+ * @return		0 on success; -ECANCELED if the pool has been joined,
+ *			in which case the continuation will never run
+ */
+extern int recv_pool_post(struct recv_pool *rpool,
+		struct recv_pool_cont *cont);
+
+/** Get statistics for a receive pool.
+ *
+ * The statistics are gathered without stopping the worker threads, so they are
+ * only approximate while the pool is running.
+ *
+ * @param rpool		The receive pool
+ * @param stats		(out param) the statistics
+ */
+extern void recv_pool_get_stats(struct recv_pool *rpool,
+		struct recv_pool_stats *stats);
+
 /** Join all threads in a receive pool
+ *
+ * Transactors which were still waiting to be handled are freed.  Continuations
+ * which were still waiting are run on the calling thread with err set to
+ * -ECANCELED, so that they can clean up.
  *
  * @rpool		The receive pool
  */
@@ -17,9 +17,11 @@
  */
 
 #include "core/process_ctx.h"
+#include "msg/asend.h"
 #include "msg/recv_pool.h"
 #include "msg/msg.h"
 #include "msg/msgr.h"
+#include "msg/xdr.h"
 #include "util/compiler.h"
 #include "util/fast_log.h"
 #include "util/macro.h"
@@ -62,7 +64,97 @@ static int recv_pool_test_init_shutdown(void)
 	return 0;
 }
 
-static int send_foo_tr(struct msgr* msgr, msgr_cb_t cb, uint32_t q)
+struct test_cont {
+	struct recv_pool_cont cont;
+	int ran;
+	int err;
+};
+
+static int test_cont_fn(struct recv_pool_thread *rt,
+		struct recv_pool_cont *cont)
+{
+	struct test_cont *tc = GET_OUTER(cont, struct test_cont, cont);
+
+	if (rt)
+		abort();
+	tc->ran++;
+	tc->err = cont->err;
+	return 0;
+}
+
+static int test_asend_cont(struct recv_pool_thread *rt, struct asend *as)
+{
+	int *err = asend_get_priv(as);
+
+	if (rt)
+		abort();
+	*err = asend_get_err(as);
+	asend_free(as);
+	return 0;
+}
+
+static int recv_pool_test_cancel_conts(void)
+{
+	int i, as_err = 0;
+	char err[512] = { 0 };
+	struct recv_pool *rpool;
+	struct test_cont tc[3], late;
+	struct msgr_conf conf;
+	struct msgr *msgr;
+	struct mtran *tr;
+	struct asend *as;
+	struct msg *m;
+
+	memset(tc, 0, sizeof(tc));
+	memset(&late, 0, sizeof(late));
+	rpool = recv_pool_init("my_tpool");
+	EXPECT_NOT_ERRPTR(rpool);
+	/* There are no threads, so these wait until the pool is joined */
+	for (i = 0; i < 3; ++i) {
+		tc[i].cont.fn = test_cont_fn;
+		EXPECT_ZERO(recv_pool_post(rpool, &tc[i].cont));
+	}
+	recv_pool_join(rpool);
+	for (i = 0; i < 3; ++i) {
+		EXPECT_EQ(tc[i].ran, 1);
+		EXPECT_EQ(tc[i].err, -ECANCELED);
+	}
+	late.cont.fn = test_cont_fn;
+	EXPECT_EQ(recv_pool_post(rpool, &late.cont), -ECANCELED);
+	EXPECT_ZERO(late.ran);
+
+	/* An asend continuation still gets to clean up */
+	as = asend_init(rpool, 0, &as_err);
+	EXPECT_NOT_ERRPTR(as);
+	asend_join(as, test_asend_cont);
+	EXPECT_EQ(as_err, -ECANCELED);
+
+	/* If there's no room for another RPC, the message is still ours */
+	memset(&conf, 0, sizeof(conf));
+	conf.max_conn = 1;
+	conf.max_tran = 1;
+	conf.tcp_teardown_timeo = 10;
+	conf.name = "cancel_msgr";
+	conf.fl_mgr = g_fast_log_mgr;
+	msgr = msgr_init(err, sizeof(err), &conf);
+	EXPECT_ZERO(err[0]);
+	as = asend_init(rpool, 0, NULL);
+	EXPECT_NOT_ERRPTR(as);
+	tr = mtran_alloc(msgr);
+	EXPECT_NOT_EQ(tr, NULL);
+	m = resp_alloc(0);
+	EXPECT_NOT_ERRPTR(m);
+	EXPECT_EQ(asend_add_tr_or_free(as, msgr, 0, m, tr, 1, NULL), -EMFILE);
+	msg_release(m);
+	asend_free(as);
+	msgr_shutdown(msgr);
+	msgr_free(msgr);
+	recv_pool_free(rpool);
+	return 0;
+}
+
+static int send_foo_tr_ms(struct msgr* msgr, msgr_cb_t cb, uint32_t q,
+		int timeo_ms)
 {
 	struct mtran *tr;
 	struct mmm_test40 *mout;
@@ -77,10 +169,16 @@ static int send_foo_tr(struct msgr* msgr, msgr_cb_t cb, uint32_t q)
 	pack_to_be32(&mout->q, q);
 	tr->ip = g_localhost;
 	tr->port = MSGR_UNIT_PORT;
-	mtran_send(msgr, tr, cb, (void*)(uintptr_t)q, (struct msg*)mout, 60);
+	mtran_send_ms(msgr, tr, cb, (void*)(uintptr_t)q, (struct msg*)mout,
+		timeo_ms);
 	return 0;
 }
 
+static int send_foo_tr(struct msgr* msgr, msgr_cb_t cb, uint32_t q)
+{
+	return send_foo_tr_ms(msgr, cb, q, 60000);
+}
+
 static void foo_cb(POSSIBLY_UNUSED(struct mconn *conn), struct mtran *tr)
 {
 	if (tr->state != MTRAN_STATE_SENT)
@@ -128,6 +226,7 @@ static int recv_pool_test_recv(int nthreads, int niter)
 	int i, iter;
 	struct msgr *foo_msgr, *bar_msgr;
 	struct recv_pool *rpool;
+	struct recv_pool_stats stats;
 	char err[512] = { 0 };
 	size_t err_len = sizeof(err);
 	struct msgr_conf foo_msgr_conf = {
@@ -184,6 +283,12 @@ static int recv_pool_test_recv(int nthreads, int niter)
 		pthread_mutex_unlock(&g_full_set_lock);
 	}
 	recv_pool_join(rpool);
+	recv_pool_get_stats(rpool, &stats);
+	EXPECT_EQ(stats.handled, (uint64_t)(nthreads * niter));
+	EXPECT_EQ(stats.depth, 0);
+	EXPECT_GE(stats.total_wait_us, stats.max_wait_us);
+	EXPECT_GE(stats.batches, 1);
+	EXPECT_GE(stats.handled, stats.batches);
 	recv_pool_free(rpool);
 
 	msgr_shutdown(foo_msgr);
@@ -196,14 +301,239 @@ static int recv_pool_test_recv(int nthreads, int niter)
 	return 0;
 }
 
+static sem_t g_expire_block_sem;
+static sem_t g_expire_start_sem;
+static sem_t g_expire_done_sem;
+
+/** Message 0 holds up the only thread in the pool until we let it go */
+static int recv_pool_expire_handler(
+		POSSIBLY_UNUSED(struct recv_pool_thread *rt), struct mtran *tr)
+{
+	struct mmm_test40 *m = (struct mmm_test40 *)tr->m;
+	uint32_t q;
+
+	q = unpack_from_be32(&m->q);
+	if (q == 0) {
+		sem_post(&g_expire_start_sem);
+		sem_wait(&g_expire_block_sem);
+	}
+	mtran_free(tr);
+	sem_post(&g_expire_done_sem);
+	return 0;
+}
+
+static int recv_pool_test_expire(void)
+{
+	struct msgr *foo_msgr, *bar_msgr;
+	struct recv_pool *rpool;
+	struct recv_pool_stats stats;
+	char err[512] = { 0 };
+	struct msgr_conf conf;
+
+	EXPECT_ZERO(sem_init(&g_expire_block_sem, 0, 0));
+	EXPECT_ZERO(sem_init(&g_expire_start_sem, 0, 0));
+	EXPECT_ZERO(sem_init(&g_expire_done_sem, 0, 0));
+	memset(&conf, 0, sizeof(conf));
+	conf.max_conn = 10;
+	conf.max_tran = 10;
+	conf.tcp_teardown_timeo = 10;
+	conf.fl_mgr = g_fast_log_mgr;
+	conf.name = "foo_msgr";
+	foo_msgr = msgr_init(err, sizeof(err), &conf);
+	EXPECT_ZERO(err[0]);
+	conf.name = "bar_msgr";
+	bar_msgr = msgr_init(err, sizeof(err), &conf);
+	EXPECT_ZERO(err[0]);
+	rpool = recv_pool_init("my_tpool");
+	EXPECT_NOT_ERRPTR(rpool);
+	EXPECT_ZERO(recv_pool_thread_create(rpool, g_fast_log_mgr,
+		recv_pool_expire_handler, NULL));
+	recv_pool_msgr_listen(rpool, bar_msgr, MSGR_UNIT_PORT,
+			err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(foo_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(bar_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+
+	EXPECT_ZERO(send_foo_tr(foo_msgr, foo_cb, 0));
+	/* Timeouts only go out once the hello exchange is over.  bar answered
+	 * our hello before it read message 0, so give the answer a moment to
+	 * get back to foo. */
+	sem_wait(&g_expire_start_sem);
+	usleep(100000);
+	/* The sender of message 1 only waits 100 ms for it.  By the time the
+	 * pool gets to it, it should be dropped. */
+	EXPECT_ZERO(send_foo_tr_ms(foo_msgr, foo_cb, 1, 100));
+	usleep(500000);
+	EXPECT_ZERO(send_foo_tr(foo_msgr, foo_cb, 2));
+	sem_post(&g_expire_block_sem);
+	sem_wait(&g_expire_done_sem);
+	sem_wait(&g_expire_done_sem);
+	recv_pool_join(rpool);
+	recv_pool_get_stats(rpool, &stats);
+	EXPECT_EQ(stats.handled, 2);
+	EXPECT_EQ(stats.expired, 1);
+	recv_pool_free(rpool);
+	msgr_shutdown(foo_msgr);
+	msgr_shutdown(bar_msgr);
+	msgr_free(foo_msgr);
+	msgr_free(bar_msgr);
+	sem_destroy(&g_expire_block_sem);
+	sem_destroy(&g_expire_start_sem);
+	sem_destroy(&g_expire_done_sem);
+	return 0;
+}
+
+static sem_t g_admit_block_sem;
+static sem_t g_admit_start_sem;
+static sem_t g_admit_done_sem;
+static int g_admit_num_ok;
+static int g_admit_num_busy;
+static uint32_t g_admit_max_retry_ms;
+
+/** Message 0 holds up the only thread in the pool until we let it go.
+ * Everything gets a reply. */
+static int recv_pool_admit_handler(
+		POSSIBLY_UNUSED(struct recv_pool_thread *rt), struct mtran *tr)
+{
+	struct msg *m = tr->m;
+	uint32_t q;
+
+	q = unpack_from_be32(&((struct mmm_test40 *)m)->q);
+	if (q == 0) {
+		sem_post(&g_admit_start_sem);
+		sem_wait(&g_admit_block_sem);
+	}
+	asend_std_reply(tr, 0);
+	msg_release(m);
+	return 0;
+}
+
+static void admit_cb(struct mconn *conn, struct mtran *tr)
+{
+	uint32_t retry_ms;
+
+	if (tr->state == MTRAN_STATE_SENT) {
+		if (tr->m)
+			abort();
+		mtran_recv_next(conn, tr);
+		return;
+	}
+	if (IS_ERR(tr->m))
+		abort();
+	retry_ms = msg_xdr_busy_retry_ms(tr->m);
+	if (retry_ms) {
+		if (msg_xdr_decode_as_generic(tr->m) != EBUSY)
+			abort();
+		__sync_fetch_and_add(&g_admit_num_busy, 1);
+		if (retry_ms > g_admit_max_retry_ms)
+			g_admit_max_retry_ms = retry_ms;
+	}
+	else {
+		__sync_fetch_and_add(&g_admit_num_ok, 1);
+	}
+	mtran_free(tr);
+	sem_post(&g_admit_done_sem);
+}
+
+static int recv_pool_test_admit(void)
+{
+	int i;
+	struct msgr *foo_msgr, *bar_msgr;
+	struct recv_pool *rpool;
+	struct recv_pool_stats stats;
+	struct recv_pool_limits lim;
+	char err[512] = { 0 };
+	struct msgr_conf conf;
+
+	EXPECT_ZERO(sem_init(&g_admit_block_sem, 0, 0));
+	EXPECT_ZERO(sem_init(&g_admit_start_sem, 0, 0));
+	EXPECT_ZERO(sem_init(&g_admit_done_sem, 0, 0));
+	memset(&conf, 0, sizeof(conf));
+	conf.max_conn = 10;
+	conf.max_tran = 10;
+	conf.tcp_teardown_timeo = 10;
+	conf.fl_mgr = g_fast_log_mgr;
+	conf.name = "foo_msgr";
+	foo_msgr = msgr_init(err, sizeof(err), &conf);
+	EXPECT_ZERO(err[0]);
+	conf.name = "bar_msgr";
+	bar_msgr = msgr_init(err, sizeof(err), &conf);
+	EXPECT_ZERO(err[0]);
+	rpool = recv_pool_init("my_tpool");
+	EXPECT_NOT_ERRPTR(rpool);
+	memset(&lim, 0, sizeof(lim));
+	lim.max_queued = 2;
+	recv_pool_set_limits(rpool, &lim);
+	EXPECT_ZERO(recv_pool_thread_create(rpool, g_fast_log_mgr,
+		recv_pool_admit_handler, NULL));
+	recv_pool_msgr_listen(rpool, bar_msgr, MSGR_UNIT_PORT,
+			err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(foo_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+	msgr_start(bar_msgr, err, sizeof(err));
+	EXPECT_ZERO(err[0]);
+
+	/* With the only thread stuck on message 0, two more requests fit in
+	 * the queue, and the rest are turned away. */
+	EXPECT_ZERO(send_foo_tr(foo_msgr, admit_cb, 0));
+	sem_wait(&g_admit_start_sem);
+	for (i = 1; i < 6; ++i)
+		EXPECT_ZERO(send_foo_tr(foo_msgr, admit_cb, i));
+	for (i = 0; i < 3; ++i)
+		sem_wait(&g_admit_done_sem);
+	EXPECT_EQ(g_admit_num_busy, 3);
+	EXPECT_EQ(g_admit_max_retry_ms, 100);
+	sem_post(&g_admit_block_sem);
+	for (i = 0; i < 3; ++i)
+		sem_wait(&g_admit_done_sem);
+	EXPECT_EQ(g_admit_num_ok, 3);
+
+	/* One request per second, with a burst of two */
+	lim.max_queued = 0;
+	lim.client_rate = 1;
+	lim.client_burst = 2;
+	recv_pool_set_limits(rpool, &lim);
+	g_admit_num_ok = g_admit_num_busy = 0;
+	g_admit_max_retry_ms = 0;
+	for (i = 1; i < 5; ++i)
+		EXPECT_ZERO(send_foo_tr(foo_msgr, admit_cb, i));
+	for (i = 1; i < 5; ++i)
+		sem_wait(&g_admit_done_sem);
+	EXPECT_EQ(g_admit_num_ok, 2);
+	EXPECT_EQ(g_admit_num_busy, 2);
+	EXPECT_GT(g_admit_max_retry_ms, 0);
+	EXPECT_LT(g_admit_max_retry_ms, 1001);
+
+	recv_pool_join(rpool);
+	recv_pool_get_stats(rpool, &stats);
+	EXPECT_EQ(stats.handled, 5);
+	EXPECT_EQ(stats.rejected_full, 3);
+	EXPECT_EQ(stats.rejected_rate, 2);
+	recv_pool_free(rpool);
+	msgr_shutdown(foo_msgr);
+	msgr_shutdown(bar_msgr);
+	msgr_free(foo_msgr);
+	msgr_free(bar_msgr);
+	sem_destroy(&g_admit_block_sem);
+	sem_destroy(&g_admit_start_sem);
+	sem_destroy(&g_admit_done_sem);
+	return 0;
+}
+
 int main(POSSIBLY_UNUSED(int argc), char **argv)
 {
 	EXPECT_ZERO(utility_ctx_init(argv[0]));
 	EXPECT_ZERO(get_localhost_ipv4(&g_localhost));
 	EXPECT_ZERO(recv_pool_test_init_shutdown());
+	EXPECT_ZERO(recv_pool_test_cancel_conts());
 	EXPECT_ZERO(recv_pool_test_recv(1, 1));
 	EXPECT_ZERO(recv_pool_test_recv(3, 1));
 	EXPECT_ZERO(recv_pool_test_recv(10, 5));
+	EXPECT_ZERO(recv_pool_test_expire());
+	EXPECT_ZERO(recv_pool_test_admit());
 	process_ctx_shutdown();
 
 	return EXIT_SUCCESS;
@@ -65,6 +65,18 @@ struct rf_lentry {
 	struct rf_stat stat;
 };
 
+/** Identifies a request which modifies the metadata, so that the MDS can
+ * recognize retransmissions of it.  This is the first thing in every such
+ * request. */
+struct rf_req_id {
+	/** Client ID.  Clients pick this at random when they start up.
+	 * 0 means that the request should not be tracked. */
+	unsigned hyper clid;
+	/** Sequence number.  Each client numbers its requests starting at
+	 * 1. */
+	unsigned hyper seq;
+};
+
 enum fish_msg_ty {
 	/* ============== Common ============== */
 	/** Generic response */
@@ -107,6 +119,12 @@ enum fish_msg_ty {
 	mmm_rename_req_ty,
 	/** Locate blocks in a file */
 	mmm_locate_req_ty,
+	/** Change the OSDs which a chunk is stored on */
+	mmm_chunk_osds_req_ty,
+	/** OSD report that one of its chunks is corrupt */
+	mmm_osd_bad_chunk_ty,
+	/** OSD heartbeat, with its current load */
+	mmm_osd_heartbeat_ty,
 
 	/* ============== mds messages ============== */
 	/** current mds status */
@@ -138,7 +156,14 @@ enum fish_msg_ty {
 	/** osd response to chunk report request */
 	mmm_osd_chunkrep_resp_ty,
 	/** mds request to unlink a chunk */
-	mmm_osd_unlink_req_ty
+	mmm_osd_unlink_req_ty,
+	/** mds request to copy a chunk to other osds */
+	mmm_osd_copy_req_ty,
+
+	/* ============== flow control ============== */
+	/** The receiver is overloaded and did not handle the request.  Try
+	 * again later. */
+	mmm_busy_resp_ty = 5000
 };
 
 /* ============== Common ============== */
@@ -146,6 +171,14 @@ struct mmm_resp {
 	unsigned int error;
 };
 
+/** The error field comes first, so that a busy response can be decoded as a
+ * generic response by anyone who doesn't care about the rest. */
+struct mmm_busy_resp {
+	unsigned int error;
+	/** How long to wait before trying again, in milliseconds */
+	unsigned int retry_after_ms;
+};
+
 struct mmm_heartbeat {
 	unsigned int ty;
 	unsigned int id;
@@ -180,6 +213,7 @@ struct mmm_get_user_info_req {
 };
 
 struct mmm_create_file_req {
+	struct rf_req_id rid;
 	unsigned int block_sz;
 	unsigned int mode;
 	unsigned int repl;
@@ -196,6 +230,7 @@ struct mmm_open_file_req {
 };
 
 struct mmm_mkdirs_req {
+	struct rf_req_id rid;
 	unsigned hyper ctime;
 	int mode;
 	string path<RF_PATH_MAX>;
@@ -218,12 +253,14 @@ struct mmm_nid_stat_req {
 };
 
 struct mmm_chmod_req {
+	struct rf_req_id rid;
 	int mode;
 	string user<RF_USER_MAX>;
 	string path<RF_PATH_MAX>;
 };
 
 struct mmm_chown_req {
+	struct rf_req_id rid;
 	string path<RF_PATH_MAX>;
 	string user<RF_USER_MAX>;
 	string new_user<RF_USER_MAX>;
@@ -231,6 +268,7 @@ struct mmm_chown_req {
 };
 
 struct mmm_utimes_req {
+	struct rf_req_id rid;
 	unsigned hyper new_atime;
 	unsigned hyper new_mtime;
 	string path<RF_PATH_MAX>;
@@ -247,12 +285,14 @@ enum mmm_unlink_op {
 };
 
 struct mmm_unlink_req {
+	struct rf_req_id rid;
 	enum mmm_unlink_op uop;
 	string path<RF_PATH_MAX>;
 	string user<RF_USER_MAX>;
 };
 
 struct mmm_rename_req {
+	struct rf_req_id rid;
 	string src<RF_PATH_MAX>;
 	string dst<RF_PATH_MAX>;
 	string user<RF_USER_MAX>;
@@ -265,6 +305,43 @@ struct mmm_locate_req {
 	unsigned hyper len;
 };
 
+/** The MDS sends this to itself once it has copied a chunk to new OSDs, so
+ * that the change reaches the replicas like any other.  If the chunk isn't
+ * stored on old_oid any more, nothing is changed. */
+struct mmm_chunk_osds_req {
+	struct rf_req_id rid;
+	unsigned hyper cid;
+	unsigned int old_oid<RF_MAX_OID>;
+	unsigned int new_oid<RF_MAX_OID>;
+};
+
+/** An OSD sends this when its scrubber finds that one of its copies of a
+ * chunk is corrupt.  The primary MDS copies the chunk again from a good
+ * replica, and unlinks the bad copy. */
+struct mmm_osd_bad_chunk {
+	unsigned int oid;
+	unsigned hyper cid;
+};
+
+/** Each OSD sends this to every MDS every few seconds, so that the MDSes can
+ * tell how full and how busy it is.  Latencies cover the reads and writes
+ * since the previous heartbeat, and are upper bounds, in microseconds. */
+struct mmm_osd_heartbeat {
+	unsigned int oid;
+	/** Bytes free on the OSD's filesystem */
+	unsigned hyper free_bytes;
+	/** Bytes used on the OSD's filesystem */
+	unsigned hyper used_bytes;
+	/** Number of chunks stored */
+	unsigned hyper num_chunks;
+	/** Number of requests waiting to be handled */
+	unsigned int queue_depth;
+	unsigned int read_p50_us;
+	unsigned int read_p99_us;
+	unsigned int write_p50_us;
+	unsigned int write_p99_us;
+};
+
 /* ============== MDS messages ============== */
 struct mmm_mds_status_resp {
 	int mid;
@@ -313,8 +390,13 @@ struct mmm_osd_read_req {
 	int len;
 };
 
+/** Set in the flags of an OSD message if its crc field holds the CRC32C of
+ * the data that follows */
+const MMM_OSD_FLAG_CRC32C = 0x1;
+
 struct mmm_osd_read_resp {
 	int flags;
+	unsigned int crc;
 	/* next: data */
 };
 
@@ -322,7 +404,13 @@ const MMM_OSD_HFLUSH_DATA_MAX = 2147483648;
 
 struct mmm_osd_hflush_req {
 	unsigned hyper cid;
+	unsigned hyper off;
 	int flags;
+	unsigned int crc;
+	/* The OSDs to pass the write on to, in order.  Each OSD forwards the
+	 * write to the first one, with the rest of the chain, and only answers
+	 * once everything after it in the chain has answered. */
+	struct endpoint chain<RF_MAX_OID>;
 	/* next: data */
 };
 
@@ -340,6 +428,13 @@ struct mmm_osd_unlink_req {
 	unsigned hyper cid;
 };
 
+/** Copy a chunk to other OSDs.  The data is sent to the first OSD in dst, with
+ * the rest of dst as its replication chain. */
+struct mmm_osd_copy_req {
+	unsigned hyper cid;
+	struct endpoint dst<RF_MAX_OID>;
+};
+
 struct mmm_create_file_resp {
 	uint64_t nid;
 };
@@ -82,7 +82,7 @@ int32_t msg_xdr_extdecode(xdrproc_t xdrproc, const struct msg *m,
 	}
 	cl = xdr_getpos(&xdrs);
 	xdr_destroy(&xdrs);
-	*extra = ((char*)out) + cl;
+	*extra = m->data + cl;
 	return xl - cl;
 }
 
@@ -103,3 +103,14 @@ int32_t msg_xdr_decode_as_generic(const struct msg *m)
 		return ret;
 	return resp.error;
 }
+
+uint32_t msg_xdr_busy_retry_ms(const struct msg *m)
+{
+	struct mmm_busy_resp resp;
+
+	if (unpack_from_be16(&m->ty) != mmm_busy_resp_ty)
+		return 0;
+	if (MSG_XDR_DECODE(mmm_busy_resp, m, &resp) < 0)
+		return 0;
+	return (resp.retry_after_ms == 0) ? 1 : resp.retry_after_ms;
+}
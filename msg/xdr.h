@@ -131,4 +131,14 @@ extern int32_t msg_xdr_decode(xdrproc_t xdrproc,
  */
 extern int32_t msg_xdr_decode_as_generic(const struct msg *m);
 
+/** Determine whether a message is a busy response
+ *
+ * @param m		The message
+ *
+ * @return		0 if the message is not a busy response.
+ *			Otherwise, the number of milliseconds the receiver
+ *			asked us to wait before trying again (at least 1).
+ */
+extern uint32_t msg_xdr_busy_retry_ms(const struct msg *m);
+
 #endif
@@ -88,8 +88,9 @@ void fast_log_ostor_dump(struct fast_log_entry *f, char *buf)
 		break;
 	case FLOS_OCHUNK_WRITE:
 		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
-			"[chunk 0x%"PRIx64"] %swriting %"PRId32 " bytes\n",
-			fe->cid, flos_err(fe->error, b, b_len), fe->data);
+			"[chunk 0x%"PRIx64"] %swriting %"PRId32 " bytes at offset "
+			"%" PRIx64 "\n", fe->cid,
+			flos_err(fe->error, b, b_len), fe->data, fe->off);
 		break;
 	case FLOS_OCHUNK_READ:
 		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
@@ -133,6 +134,44 @@ void fast_log_ostor_dump(struct fast_log_entry *f, char *buf)
 		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
 			"ostor lru thread waking.  need_lru=%d\n", fe->data);
 		break;
+	case FLOS_OCHUNK_CORRUPT:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"[chunk 0x%"PRIx64"] checksum mismatch in the segment "
+			"at offset 0x%"PRIx64".  stored checksum = 0x%08x\n",
+			fe->cid, fe->off, fe->data);
+		break;
+	case FLOS_OCHUNK_BAD_CSUM:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"[chunk 0x%"PRIx64"] refusing to write data that "
+			"doesn't match its checksum 0x%08x\n",
+			fe->cid, fe->data);
+		break;
+	case FLOS_PACK_INDEX:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"opack index has %d records\n", fe->data);
+		break;
+	case FLOS_PACK_COMPACT:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"[container 0x%"PRIx64"] compacted.  moved %d "
+			"extents\n", fe->cid, fe->data);
+		break;
+	case FLOS_OCACHE_HIT:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"[chunk 0x%"PRIx64"] read at offset 0x%"PRIx64" found "
+			"%d segments in the cache\n", fe->cid, fe->off,
+			fe->data);
+		break;
+	case FLOS_OCACHE_FILL:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"[chunk 0x%"PRIx64"] %sreading %d segments into the "
+			"cache from offset 0x%"PRIx64"\n", fe->cid,
+			flos_err(fe->error, b, b_len), fe->data, fe->off);
+		break;
+	case FLOS_SCRUB_CHUNK:
+		snprintf(buf, FAST_LOG_PRETTY_PRINTED_MAX,
+			"[chunk 0x%"PRIx64"] %sscrubbed %d bytes\n", fe->cid,
+			flos_err(fe->error, b, b_len), fe->data);
+		break;
 	default:
 		snappend(buf, FAST_LOG_PRETTY_PRINTED_MAX,
 			 "(unknown ostor event %d)\n", fe->event);
@@ -32,6 +32,13 @@ enum fast_log_osd_event {
 	FLOS_OCHUNK_ALLOC,
 	FLOS_LRU_SLEEP,
 	FLOS_LRU_WAKE,
+	FLOS_OCHUNK_CORRUPT,
+	FLOS_OCHUNK_BAD_CSUM,
+	FLOS_PACK_INDEX,
+	FLOS_PACK_COMPACT,
+	FLOS_OCACHE_HIT,
+	FLOS_OCACHE_FILL,
+	FLOS_SCRUB_CHUNK,
 	FLOS_MAX,
 };
 
@@ -18,29 +18,37 @@
 
 #include "common/cluster_map.h"
 #include "common/config/mdsc.h"
+#include "common/config/ostorc.h"
 #include "common/config/unitaryc.h"
 #include "core/glitch_log.h"
 #include "core/process_ctx.h"
 #include "jorm/jorm_const.h"
 #include "mds/const.h"
+#include "msg/asend.h"
 #include "msg/bsend.h"
+#include "msg/cenc.h"
 #include "msg/msg.h"
 #include "msg/msgr.h"
 #include "msg/recv_pool.h"
 #include "msg/types.h"
 #include "msg/xdr.h"
 #include "osd/net.h"
+#include "osd/oscrub.h"
 #include "osd/ostor.h"
 #include "util/compiler.h"
+#include "util/crc32c.h"
 #include "util/error.h"
 #include "util/fast_log.h"
 #include "util/fast_log_types.h"
+#include "util/macro.h"
+#include "util/net.h"
 #include "util/packed.h"
 #include "util/string.h"
 #include "util/thread.h"
 #include "util/time.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <rpc/xdr.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -51,16 +59,27 @@
 
 #define OSD_NET_IO_THREADS 16
 
+/** Number of threads doing chunk copies.  The MDS keeps no more than this
+ * many copies from one OSD going at a time. */
+#define OSD_NET_COPY_THREADS 2
+
 #define OSD_REPLY_TIMEO 30
 
 #define OSD_HB_SEND_IVAL 3
 
+/** Size of the pieces we send chunks to other OSDs in when copying them */
+#define OSD_COPY_PIECE_SZ (1024 * 1024)
+
 /** recv_pool for doing I/O operations for clients and other OSDs */
 static struct recv_pool *g_io_rpool;
 
 /** recv_pool for talking to metadata servers */
 static struct recv_pool *g_mds_rpool;
 
+/** recv_pool for copying chunks to other OSDs.  It doesn't listen on any
+ * messenger; handle_mmm_osd_copy_req posts copies to it. */
+static struct recv_pool *g_copy_rpool;
+
 /** This OSD's ID */
 static uint32_t g_oid;
 
@@ -73,40 +92,90 @@ static struct ostor *g_ostor;
 /** OSD messengers */
 static struct msgr *g_msgr[RF_ENTITY_TY_NUM];
 
+/** The scrubber, or NULL if scrubbing is disabled */
+static struct oscrub *g_oscrub;
+
 /** Thread which sends heartbeat messages */
 static struct redfish_thread g_osd_send_hb_thread;
 
+/** Decode an OSD read request in either encoding */
+static int decode_osd_read_req(const struct msg *m,
+		struct cenc_mmm_osd_read_req *req)
+{
+	int32_t ret;
+	struct mmm_osd_read_req xreq;
+
+	if (cenc_is_compact(m)) {
+		ret = CENC_DECODE_mmm_osd_read_req(m, req, NULL);
+		return (ret < 0) ? ret : 0;
+	}
+	ret = MSG_XDR_DECODE(mmm_osd_read_req, m, &xreq);
+	if (ret < 0)
+		return ret;
+	req->cid = xreq.cid;
+	req->start = xreq.start;
+	req->len = xreq.len;
+	XDR_REQ_FREE(mmm_osd_read_req, &xreq);
+	return 0;
+}
+
+/** Fill in the checksum of an OSD read response once the data is in place.
+ *
+ * The response has to be allocated before we read the data into it, so the
+ * checksum can't be known when it is encoded.  In both encodings, the message
+ * starts with the 32-bit flags field followed by the 32-bit crc field, in
+ * big-endian byte order. */
+static void osd_read_resp_set_crc(struct msg *r, uint32_t crc)
+{
+	pack_to_be32(r->data, MMM_OSD_FLAG_CRC32C);
+	pack_to_be32(r->data + sizeof(uint32_t), crc);
+}
+
 static int handle_mmm_get_osd_read_req(struct recv_pool_thread *rt,
 		struct mtran *tr, const struct msg *m)
 {
 	int32_t ret;
-	struct mmm_osd_read_req req;
+	uint32_t crc;
+	struct cenc_mmm_osd_read_req req;
+	struct cenc_mmm_osd_read_resp cresp;
 	struct mmm_osd_read_resp resp;
 	struct msg *r;
 	char *footer;
 
-	ret = MSG_XDR_DECODE(mmm_osd_read_req, m, &req);
+	ret = decode_osd_read_req(m, &req);
 	if (ret < 0)
 		return ret;
 	if (req.len < 0) {
 		ret = -EINVAL;
 		goto send_resp;
 	}
-	resp.flags = 0;
-	r = msg_xdr_extalloc(mmm_osd_read_resp_ty,
-		(xdrproc_t)xdr_mmm_osd_read_resp, &resp, req.len,
-		(void**)&footer);
+	/* Answer in the same encoding that the request used */
+	if (cenc_is_compact(m)) {
+		cresp.flags = 0;
+		cresp.crc = 0;
+		r = CENC_ALLOC_mmm_osd_read_resp(&cresp, req.len,
+			(void**)&footer);
+	}
+	else {
+		resp.flags = 0;
+		resp.crc = 0;
+		r = msg_xdr_extalloc(mmm_osd_read_resp_ty,
+			(xdrproc_t)xdr_mmm_osd_read_resp, &resp, req.len,
+			(void**)&footer);
+	}
 	if (IS_ERR(r)) {
 		ret = PTR_ERR(r);
 		goto send_resp;
 	}
 	ret = ostor_read(g_ostor, rt->base.fb, req.cid, req.start,
-		footer, req.len);
+		footer, req.len, &crc);
 	if (ret < 0) {
 		msg_release(r);
 		goto send_resp;
 	}
+	osd_read_resp_set_crc(r, crc);
 	r = msg_shrink(r, req.len - ret);
+	msg_set_prio(r, MSG_PRIO_BULK);
 	ret = 0;
 
 send_resp:
@@ -114,7 +183,225 @@ send_resp:
 		ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
 	else
 		ret = bsend_reply(rt->base.fb, rt->ctx, tr, r);
-	XDR_REQ_FREE(mmm_osd_read_req, &req);
+	return ret;
+}
+
+/** Decode an OSD hflush request in either encoding
+ *
+ * @param m		The message
+ * @param req		(out param) the request
+ * @param chain		(out param) room for RF_MAX_OID endpoints.  The
+ *			replication chain of an XDR request is copied here.
+ * @param data		(out param) the data to write
+ *
+ * @return		The length of the data, or a negative error code
+ */
+static int32_t decode_osd_hflush_req(const struct msg *m,
+		struct cenc_mmm_osd_hflush_req *req, struct cenc_ep *chain,
+		const char **data)
+{
+	int32_t dlen;
+	uint32_t i;
+	struct mmm_osd_hflush_req xreq;
+
+	if (cenc_is_compact(m)) {
+		return CENC_DECODE_mmm_osd_hflush_req(m, req,
+			(const void**)data);
+	}
+	dlen = msg_xdr_extdecode((xdrproc_t)xdr_mmm_osd_hflush_req,
+		m, &xreq, (const void**)data);
+	if (dlen < 0)
+		return dlen;
+	req->cid = xreq.cid;
+	req->off = xreq.off;
+	req->flags = xreq.flags;
+	req->crc = xreq.crc;
+	for (i = 0; i < xreq.chain.chain_len; ++i) {
+		cenc_ep_set(&chain[i], xreq.chain.chain_val[i].ip,
+			xreq.chain.chain_val[i].port);
+	}
+	req->chain = chain;
+	req->num_chain = xreq.chain.chain_len;
+	XDR_REQ_FREE(mmm_osd_hflush_req, &xreq);
+	return dlen;
+}
+
+/** An hflush request which we have passed on to the next OSD in its
+ * replication chain */
+struct osd_chain_op {
+	/** Transactor to answer the request on */
+	struct mtran *tr;
+	/** The chunk being written */
+	uint64_t cid;
+	/** IP address of the next OSD in the chain */
+	uint32_t next_ip;
+	/** Port of the next OSD in the chain */
+	uint16_t next_port;
+	/** 0 if we passed the write on; a negative error code otherwise */
+	int32_t fwd_ret;
+	/** Result of writing the data here */
+	int32_t ret;
+};
+
+/** Check a replication chain before passing a write on along it.
+ *
+ * A chain that leads back to this OSD, or names some OSD twice, would have
+ * the write go round in circles.
+ *
+ * @param chain		The chain
+ * @param num_chain	Number of endpoints in the chain
+ *
+ * @return		0 if the chain is fine; -EINVAL otherwise
+ */
+static int osd_chain_check(const struct cenc_ep *chain, uint32_t num_chain)
+{
+	const struct daemon_info *me = &g_cmap->oinfo[g_oid];
+	uint32_t i, j, ip;
+	uint16_t port;
+
+	if (num_chain > RF_MAX_OID)
+		return -EINVAL;
+	for (i = 0; i < num_chain; ++i) {
+		ip = cenc_ep_ip(&chain[i]);
+		port = cenc_ep_port(&chain[i]);
+		if ((ip == me->ip) && (port == me->port[RF_ENTITY_TY_OSD]))
+			return -EINVAL;
+		for (j = 0; j < i; ++j) {
+			if ((ip == cenc_ep_ip(&chain[j])) &&
+					(port == cenc_ep_port(&chain[j])))
+				return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/** Allocate the message that passes a write on to the next OSD in its
+ * replication chain.  The next OSD gets the rest of the chain, and passes the
+ * write on in turn.
+ *
+ * @param req		The request, which must have a non-empty chain
+ * @param data		The data to write
+ * @param dlen		Length of data
+ *
+ * @return		The message, or an error pointer
+ */
+static struct msg *osd_chain_alloc_fwd(
+		const struct cenc_mmm_osd_hflush_req *req, const char *data,
+		int32_t dlen)
+{
+	struct cenc_mmm_osd_hflush_req fwd;
+	struct msg *m;
+	char *extra;
+
+	fwd = *req;
+	fwd.chain = req->chain + 1;
+	fwd.num_chain = req->num_chain - 1;
+	m = CENC_ALLOC_mmm_osd_hflush_req(&fwd, dlen, (void**)&extra);
+	if (IS_ERR(m))
+		return m;
+	memcpy(extra, data, dlen);
+	msg_set_prio(m, MSG_PRIO_BULK);
+	return m;
+}
+
+/** Find out how a write that we passed on to the next OSD in its replication
+ * chain went.
+ *
+ * @param tr		The transactor we passed the write on with
+ *
+ * @return		0 if the write succeeded all the way down the chain;
+ *			a negative error code otherwise
+ */
+static int32_t osd_chain_get_result(const struct mtran *tr)
+{
+	int32_t ret;
+
+	if (IS_ERR(tr->m))
+		return FORCE_NEGATIVE(PTR_ERR(tr->m));
+	ret = msg_xdr_decode_as_generic(tr->m);
+	/* A negative return means that we couldn't understand the reply,
+	 * rather than that the write failed. */
+	return (ret < 0) ? -EIO : FORCE_NEGATIVE(ret);
+}
+
+/** Start passing a write on to the next OSD in its replication chain, using
+ * the thread's bsend context.
+ *
+ * We don't wait for its answer here: the caller reads the next piece in the
+ * meantime, and then collects the answer with osd_chain_finish.
+ *
+ * @param rt		The recv_pool thread
+ * @param req		The request, which must have a non-empty chain
+ * @param data		The data to write
+ * @param dlen		Length of data
+ *
+ * @return		0 on success; a negative error code otherwise
+ */
+static int osd_chain_start(struct recv_pool_thread *rt,
+		const struct cenc_mmm_osd_hflush_req *req, const char *data,
+		int32_t dlen)
+{
+	int ret;
+	struct msg *m;
+
+	m = osd_chain_alloc_fwd(req, data, dlen);
+	if (IS_ERR(m))
+		return FORCE_NEGATIVE(PTR_ERR(m));
+	ret = bsend_add(rt->ctx, g_msgr[RF_ENTITY_TY_OSD], BSF_RESP, m,
+		cenc_ep_ip(&req->chain[0]), cenc_ep_port(&req->chain[0]),
+		OSD_REPLY_TIMEO, NULL);
+	if (ret)
+		msg_release(m);
+	return ret;
+}
+
+/** Wait for the next OSD in a replication chain to answer.
+ *
+ * @param rt		The recv_pool thread
+ *
+ * @return		0 if the write succeeded all the way down the chain;
+ *			a negative error code otherwise
+ */
+static int osd_chain_finish(struct recv_pool_thread *rt)
+{
+	int32_t ret;
+
+	bsend_join(rt->ctx);
+	ret = osd_chain_get_result(bsend_get_mtran(rt->ctx, 0));
+	bsend_reset(rt->ctx);
+	return ret;
+}
+
+/** Runs once the next OSD in the chain has answered (or failed to answer) an
+ * hflush request which we passed on to it.  Now we can reply. */
+static int osd_chain_done(POSSIBLY_UNUSED(struct recv_pool_thread *rt),
+		struct asend *as)
+{
+	struct osd_chain_op *op;
+	int32_t ret, cret;
+	char ep_buf[128];
+
+	op = asend_get_priv(as);
+	if (asend_get_err(as)) {
+		/* We're shutting down.  Nobody is going to hear the reply. */
+		asend_free(as);
+		mtran_free(op->tr);
+		free(op);
+		return 0;
+	}
+	cret = op->fwd_ret;
+	if (asend_get_num_sent(as) > 0)
+		cret = osd_chain_get_result(asend_get_mtran(as, 0));
+	asend_free(as);
+	if (cret) {
+		ipv4_to_str(op->next_ip, ep_buf, sizeof(ep_buf));
+		glitch_log("handle_mmm_osd_hflush_req: failed to "
+			"replicate chunk 0x%"PRIx64" to %s:%d: "
+			"error %d\n", op->cid, ep_buf, op->next_port, cret);
+	}
+	ret = op->ret ? op->ret : cret;
+	ret = asend_std_reply(op->tr, ret);
+	free(op);
 	return ret;
 }
 
@@ -122,23 +409,59 @@ static int handle_mmm_osd_hflush_req(struct recv_pool_thread *rt,
 		struct mtran *tr, const struct msg *m)
 {
 	int32_t dlen, ret;
-	struct mmm_osd_hflush_req req;
+	struct cenc_mmm_osd_hflush_req req;
+	struct cenc_ep chain[RF_MAX_OID];
+	struct osd_chain_op *op;
+	struct asend *as;
+	struct msg *fm;
 	const char *footer;
 
-	dlen = msg_xdr_extdecode((xdrproc_t)xdr_mmm_osd_hflush_req,
-		m, &req, (const void**)&footer);
-	if (dlen < 0) {
+	dlen = decode_osd_hflush_req(m, &req, chain, &footer);
+	if (dlen < 0)
 		return dlen;
+	ret = osd_chain_check(req.chain, req.num_chain);
+	if (ret)
+		return bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	if (req.num_chain == 0) {
+		ret = ostor_write(g_ostor, rt->base.fb, req.cid, req.off,
+			footer, dlen, (req.flags & MMM_OSD_FLAG_CRC32C) ?
+				&req.crc : NULL);
+		return bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
 	}
-	// TODO: check flags
-	ret = ostor_write(g_ostor, rt->base.fb, req.cid, footer, dlen);
-	if (ret) {
-		goto send_resp;
+	op = calloc(1, sizeof(struct osd_chain_op));
+	if (!op)
+		return bsend_std_reply(rt->base.fb, rt->ctx, tr, -ENOMEM);
+	as = asend_init(rt->rpool, 1, op);
+	if (IS_ERR(as)) {
+		free(op);
+		return bsend_std_reply(rt->base.fb, rt->ctx, tr,
+			FORCE_NEGATIVE(PTR_ERR(as)));
 	}
-send_resp:
-	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
-	XDR_REQ_FREE(mmm_osd_hflush_req, &req);
-	return ret;
+	op->tr = tr;
+	op->cid = req.cid;
+	op->next_ip = cenc_ep_ip(&req.chain[0]);
+	op->next_port = cenc_ep_port(&req.chain[0]);
+	/* Send the data on to the next replica before writing it here, so
+	 * that the two happen at once.  The client only has to send it to
+	 * the first OSD in the chain.  We don't wait for the next replica on
+	 * this thread: where chains cross, OSDs would end up with all their
+	 * threads waiting on each other.  osd_chain_done sends the reply once
+	 * the next replica has answered. */
+	fm = osd_chain_alloc_fwd(&req, footer, dlen);
+	if (IS_ERR(fm)) {
+		op->fwd_ret = FORCE_NEGATIVE(PTR_ERR(fm));
+	}
+	else {
+		op->fwd_ret = asend_add(as, g_msgr[RF_ENTITY_TY_OSD],
+			BSF_RESP, fm, op->next_ip, op->next_port,
+			OSD_REPLY_TIMEO, NULL);
+		if (op->fwd_ret)
+			msg_release(fm);
+	}
+	op->ret = ostor_write(g_ostor, rt->base.fb, req.cid, req.off, footer,
+		dlen, (req.flags & MMM_OSD_FLAG_CRC32C) ? &req.crc : NULL);
+	asend_join(as, osd_chain_done);
+	return 0;
 }
 
 static int handle_mmm_osd_chunkrep_req(struct recv_pool_thread *rt,
@@ -198,6 +521,153 @@ static int handle_mmm_osd_unlink_req(struct recv_pool_thread *rt,
 	return ret;
 }
 
+/** A chunk copy waiting for, or running on, a thread of g_copy_rpool */
+struct osd_copy_op {
+	struct recv_pool_cont cont;
+	/** Transactor to reply on */
+	struct mtran *tr;
+	/** The decoded request */
+	struct mmm_osd_copy_req req;
+};
+
+static void osd_copy_op_free(struct osd_copy_op *op)
+{
+	XDR_REQ_FREE(mmm_osd_copy_req, &op->req);
+	free(op);
+}
+
+/** Copy a chunk to other OSDs, one piece at a time.
+ *
+ * While one piece is on its way, we read the next one.  The first OSD passes
+ * each piece on to the rest, just as it would for a client.
+ *
+ * This runs on g_copy_rpool, since a copy can keep its thread busy for a long
+ * time.
+ */
+static int osd_copy_run(struct recv_pool_thread *rt,
+		struct recv_pool_cont *cont)
+{
+	struct osd_copy_op *op = GET_OUTER(cont, struct osd_copy_op, cont);
+	struct mmm_osd_copy_req *req = &op->req;
+	int32_t ret, dlen, next_dlen, cret;
+	uint32_t i, crc, next_crc;
+	uint64_t off;
+	struct cenc_mmm_osd_hflush_req fwd;
+	struct cenc_ep chain[RF_MAX_OID];
+	char *buf[2] = { NULL, NULL };
+	int cur = 0;
+
+	if (cont->err) {
+		mtran_free(op->tr);
+		osd_copy_op_free(op);
+		return 0;
+	}
+	for (i = 0; i < req->dst.dst_len; ++i) {
+		cenc_ep_set(&chain[i], req->dst.dst_val[i].ip,
+			req->dst.dst_val[i].port);
+	}
+	ret = osd_chain_check(chain, req->dst.dst_len);
+	if (ret)
+		goto done;
+	buf[0] = malloc(OSD_COPY_PIECE_SZ);
+	buf[1] = malloc(OSD_COPY_PIECE_SZ);
+	if ((!buf[0]) || (!buf[1])) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	memset(&fwd, 0, sizeof(fwd));
+	fwd.cid = req->cid;
+	fwd.flags = MMM_OSD_FLAG_CRC32C;
+	fwd.chain = chain;
+	fwd.num_chain = req->dst.dst_len;
+	off = 0;
+	dlen = ostor_read(g_ostor, rt->base.fb, req->cid, off, buf[cur],
+		OSD_COPY_PIECE_SZ, &crc);
+	while (1) {
+		if (dlen < 0) {
+			ret = dlen;
+			goto done;
+		}
+		/* An empty chunk still has to be created on the other
+		 * side. */
+		if ((dlen == 0) && (off != 0))
+			break;
+		fwd.off = off;
+		fwd.crc = crc;
+		ret = osd_chain_start(rt, &fwd, buf[cur], dlen);
+		if (ret)
+			goto done;
+		next_dlen = 0;
+		next_crc = 0;
+		if (dlen == OSD_COPY_PIECE_SZ) {
+			next_dlen = ostor_read(g_ostor, rt->base.fb, req->cid,
+				off + dlen, buf[!cur], OSD_COPY_PIECE_SZ,
+				&next_crc);
+		}
+		cret = osd_chain_finish(rt);
+		if (cret) {
+			ret = cret;
+			goto done;
+		}
+		if (dlen < OSD_COPY_PIECE_SZ)
+			break;
+		off += dlen;
+		dlen = next_dlen;
+		crc = next_crc;
+		cur = !cur;
+	}
+	ret = 0;
+done:
+	if (ret) {
+		glitch_log("osd_copy_run: failed to copy chunk "
+			"0x%"PRIx64": error %d\n", req->cid, ret);
+	}
+	free(buf[0]);
+	free(buf[1]);
+	ret = bsend_std_reply(rt->base.fb, rt->ctx, op->tr, ret);
+	osd_copy_op_free(op);
+	return ret;
+}
+
+/** Queue a chunk copy on g_copy_rpool.
+ *
+ * We don't do the copy here, so that a few long copies can't hold up the
+ * unlink, chunkrep, and other requests that the MDS sends us.
+ */
+static int handle_mmm_osd_copy_req(struct recv_pool_thread *rt,
+		struct mtran *tr, const struct msg *m)
+{
+	struct osd_copy_op *op;
+	int ret;
+
+	op = calloc(1, sizeof(struct osd_copy_op));
+	if (!op) {
+		mtran_free(tr);
+		return -ENOMEM;
+	}
+	ret = MSG_XDR_DECODE(mmm_osd_copy_req, m, &op->req);
+	if (ret < 0) {
+		free(op);
+		mtran_free(tr);
+		return ret;
+	}
+	if (op->req.dst.dst_len == 0) {
+		ret = -EINVAL;
+		goto error;
+	}
+	op->tr = tr;
+	op->cont.fn = osd_copy_run;
+	ret = recv_pool_post(g_copy_rpool, &op->cont);
+	if (ret)
+		goto error;
+	return 0;
+
+error:
+	ret = bsend_std_reply(rt->base.fb, rt->ctx, tr, ret);
+	osd_copy_op_free(op);
+	return ret;
+}
+
 /** Handle an incoming message.
  *
  * Notes:
@@ -231,6 +701,9 @@ static int osd_net_handle_tr(struct recv_pool_thread *rt, struct mtran *tr)
 	case mmm_osd_unlink_req_ty:
 		ret = handle_mmm_osd_unlink_req(rt, tr, m);
 		break;
+	case mmm_osd_copy_req_ty:
+		ret = handle_mmm_osd_copy_req(rt, tr, m);
+		break;
 	default:
 		glitch_log("osd_net_handle_mds_tr: unhandled message "
 			   "type %d from %s\n", ty, ep_buf);
@@ -246,9 +719,105 @@ static int osd_net_handle_tr(struct recv_pool_thread *rt, struct mtran *tr)
 	return 0;
 }
 
+/** Tell the metadata servers that our copy of a chunk is corrupt.
+ *
+ * This is the scrubber's report function.  The report goes to every MDS that
+ * is in, since only the primary accepts it.
+ */
+static int osd_report_bad_chunk(POSSIBLY_UNUSED(void *priv),
+		struct fast_log_buf *fb, uint64_t cid)
+{
+	int i, ret, num_sent;
+	int32_t res;
+	struct mmm_osd_bad_chunk req;
+	struct daemon_info *di;
+	struct bsend *ctx;
+	struct mtran *tr;
+	struct msg *m;
+
+	ctx = bsend_init(fb, RF_MAX_MDS);
+	if (IS_ERR(ctx))
+		return FORCE_NEGATIVE(PTR_ERR(ctx));
+	req.oid = g_oid;
+	req.cid = cid;
+	m = MSG_XDR_ALLOC(mmm_osd_bad_chunk, &req);
+	if (IS_ERR(m)) {
+		ret = FORCE_NEGATIVE(PTR_ERR(m));
+		goto done;
+	}
+	for (i = 0; i < g_cmap->num_mds; ++i) {
+		di = &g_cmap->minfo[i];
+		if (!di->in)
+			continue;
+		msg_addref(m);
+		if (bsend_add(ctx, g_msgr[RF_ENTITY_TY_MDS], BSF_RESP, m,
+				di->ip, di->port[RF_ENTITY_TY_OSD],
+				OSD_REPLY_TIMEO, NULL))
+			msg_release(m);
+	}
+	msg_release(m);
+	ret = -EHOSTUNREACH;
+	num_sent = bsend_join(ctx);
+	for (i = 0; i < num_sent; ++i) {
+		tr = bsend_get_mtran(ctx, i);
+		if (IS_ERR(tr->m))
+			continue;
+		res = msg_xdr_decode_as_generic(tr->m);
+		if (res == 0) {
+			ret = 0;
+			break;
+		}
+	}
+	bsend_reset(ctx);
+done:
+	bsend_free(ctx);
+	return ret;
+}
+
+/** Fill in a heartbeat with our current load
+ *
+ * @param hb		(out param) the heartbeat
+ * @param prev		The ostor statistics as of the previous heartbeat.
+ *			These are replaced with the current ones, so that
+ *			the latencies only cover what happened in between.
+ */
+static void osd_get_load(struct mmm_osd_heartbeat *hb,
+		struct ostor_stats *prev)
+{
+	int ret;
+	struct ostor_space space;
+	struct ostor_stats cur;
+	struct ostor_wait_hist hist;
+	struct recv_pool_stats rstats;
+
+	memset(hb, 0, sizeof(struct mmm_osd_heartbeat));
+	hb->oid = g_oid;
+	ret = ostor_get_space(g_ostor, &space);
+	if (ret) {
+		glitch_log("osd_get_load: failed to find out how much "
+			"space we have: error %d\n", ret);
+	}
+	hb->free_bytes = space.free_bytes;
+	hb->used_bytes = space.used_bytes;
+	hb->num_chunks = space.num_chunks;
+	recv_pool_get_stats(g_io_rpool, &rstats);
+	hb->queue_depth = rstats.depth;
+	ostor_get_stats(g_ostor, &cur);
+	memcpy(&hist, &cur.read_time, sizeof(hist));
+	ostor_wait_hist_sub(&hist, &prev->read_time);
+	hb->read_p50_us = ostor_wait_hist_pct(&hist, 50);
+	hb->read_p99_us = ostor_wait_hist_pct(&hist, 99);
+	memcpy(&hist, &cur.write_time, sizeof(hist));
+	ostor_wait_hist_sub(&hist, &prev->write_time);
+	hb->write_p50_us = ostor_wait_hist_pct(&hist, 50);
+	hb->write_p99_us = ostor_wait_hist_pct(&hist, 99);
+	memcpy(prev, &cur, sizeof(struct ostor_stats));
+}
+
 static int osd_send_hb_thread(struct redfish_thread *rt)
 {
-	struct mmm_heartbeat resp;
+	struct mmm_osd_heartbeat hb;
+	struct ostor_stats prev;
 	struct msg *r;
 	struct daemon_info *di;
 	struct bsend *ctx;
@@ -262,28 +831,34 @@ static int osd_send_hb_thread(struct redfish_thread *rt)
 			"error %d\n", PTR_ERR(ctx));
 		abort();
 	}
-	resp.ty = RF_ENTITY_TY_OSD;
-	resp.id = g_oid;
-	r = MSG_XDR_ALLOC(mmm_resp, &resp);
-	if (IS_ERR(r)) {
-		abort();
-	}
+	memset(&prev, 0, sizeof(prev));
 	while (1) {
 		glitch_log("osd_send_hb_thread: sending...\n");
 		until = mt_time() + OSD_HB_SEND_IVAL;
+		osd_get_load(&hb, &prev);
+		r = MSG_XDR_ALLOC(mmm_osd_heartbeat, &hb);
+		if (IS_ERR(r)) {
+			glitch_log("osd_send_hb_thread: failed to allocate "
+				"a heartbeat: error %d\n", PTR_ERR(r));
+			mt_sleep_until(until);
+			continue;
+		}
+		msg_set_prio(r, MSG_PRIO_HIGH);
 		for (i = 0; i < g_cmap->num_mds; ++i) {
 			di = &g_cmap->minfo[i];
 			if (!di->in)
 				continue;
 			msg_addref(r);
-			bsend_add(ctx, g_msgr[RF_ENTITY_TY_MDS], 0, r,
-				di->ip, di->port[RF_ENTITY_TY_OSD], 2, NULL);
+			if (bsend_add(ctx, g_msgr[RF_ENTITY_TY_MDS], 0, r,
+					di->ip, di->port[RF_ENTITY_TY_OSD], 2,
+					NULL))
+				msg_release(r);
 		}
+		msg_release(r);
 		bsend_join(ctx);
 		bsend_reset(ctx);
 		mt_sleep_until(until);
 	}
-	msg_release(r);
 	bsend_free(ctx);
 	return 0;
 }
@@ -304,6 +879,7 @@ void osd_net_init(struct unitaryc *conf, uint16_t oid,
 			.max_conn = 65535,
 			.max_tran = 65535,
 			.tcp_teardown_timeo = 900,
+			.conns_per_peer = 4,
 			.name = "osd_msgr",
 			.fl_mgr = g_fast_log_mgr,
 		},
@@ -330,7 +906,19 @@ void osd_net_init(struct unitaryc *conf, uint16_t oid,
 			"error %d.\n", PTR_ERR(g_ostor));
 		abort();
 	}
+	if (osdc->oc->ostor_scrub_mb > 0) {
+		g_oscrub = oscrub_init(g_ostor,
+			((uint64_t)osdc->oc->ostor_scrub_mb) << 20,
+			osdc->oc->ostor_scrub_ival, osd_report_bad_chunk,
+			NULL);
+		if (IS_ERR(g_oscrub)) {
+			glitch_log("osd_net_init: failed to create the "
+				"scrubber: error %d.\n", PTR_ERR(g_oscrub));
+			abort();
+		}
+	}
 	for (i = 0; i < RF_ENTITY_TY_NUM; ++i) {
+		oconf[i].compress_thresh = unitaryc_compress_thresh(conf);
 		g_msgr[i] = msgr_init(err, err_len, &oconf[i]);
 		if (err[0]) {
 			glitch_log("osd_net_init: failed to create %s "
@@ -350,6 +938,12 @@ void osd_net_init(struct unitaryc *conf, uint16_t oid,
 			   "error %d\n", PTR_ERR(g_io_rpool));
 		abort();
 	}
+	g_copy_rpool = recv_pool_init("copy_rpool");
+	if (IS_ERR(g_copy_rpool)) {
+		glitch_log("osd_net_init: failed to create copy_rpool: "
+			   "error %d\n", PTR_ERR(g_copy_rpool));
+		abort();
+	}
 	for (i = 0; i < OSD_NET_MDS_THREADS; ++i) {
 		ret = recv_pool_thread_create(g_mds_rpool, g_fast_log_mgr,
 			osd_net_handle_tr, NULL);
@@ -368,6 +962,15 @@ void osd_net_init(struct unitaryc *conf, uint16_t oid,
 			abort();
 		}
 	}
+	for (i = 0; i < OSD_NET_COPY_THREADS; ++i) {
+		ret = recv_pool_thread_create(g_copy_rpool, g_fast_log_mgr,
+			osd_net_handle_tr, NULL);
+		if (ret) {
+			glitch_log("osd_net_init: failed to create copy "
+				   "thread: error %d\n", ret);
+			abort();
+		}
+	}
 	recv_pool_msgr_listen(g_mds_rpool, g_msgr[RF_ENTITY_TY_MDS],
 		osdc->mds_port, err, err_len);
 	if (err[0]) {
@@ -0,0 +1,686 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/glitch_log.h"
+#include "core/process_ctx.h"
+#include "mds/const.h"
+#include "osd/fast_log.h"
+#include "osd/ocache.h"
+#include "osd/ostor.h"
+#include "util/compiler.h"
+#include "util/crc32c.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/queue.h"
+#include "util/thread.h"
+#include "util/tree.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** log2 of the number of shards.  Each shard has its own lock and LRU list,
+ * and gets an equal share of the cache. */
+#define OCACHE_SHARD_BITS 6
+
+#define OCACHE_NUM_SHARDS (1 << OCACHE_SHARD_BITS)
+
+/** Maximum number of segments to read from the store at once */
+#define OCACHE_MAX_FILL_SEGS 16
+
+/** log2 of the number of sequential readers we can keep track of */
+#define OCACHE_STREAM_BITS 8
+
+#define OCACHE_NUM_STREAMS (1 << OCACHE_STREAM_BITS)
+
+/** Maximum number of readahead requests waiting for the readahead thread.
+ * Requests which don't fit are dropped. */
+#define OCACHE_MAX_PREFETCH 64
+
+/** A cached segment */
+struct oseg {
+	RB_ENTRY(oseg) by_key_entry;
+	TAILQ_ENTRY(oseg) lru_entry;
+	/** chunk id */
+	uint64_t cid;
+	/** segment number in the chunk */
+	uint64_t seg;
+	/** The cache holds one reference while the segment is in it, and each
+	 * thread copying data out of it holds another.  Changed atomically. */
+	volatile int32_t refcnt;
+	/** Length of the data.  Only the last segment of a chunk can be
+	 * shorter than OSTOR_CSUM_SEG.  It may be empty, if the chunk ends on
+	 * a segment boundary. */
+	uint32_t len;
+	/** CRC32C of the data */
+	uint32_t crc;
+	/** The data */
+	char data[0];
+};
+
+RB_HEAD(osegs_by_key, oseg);
+TAILQ_HEAD(oseg_lru, oseg);
+
+struct ocache_shard {
+	/** Protects everything in the shard */
+	pthread_mutex_t lock;
+	/** Cached segments sorted by chunk id and segment number */
+	struct osegs_by_key key_head;
+	/** Cached segments, most recently used first */
+	struct oseg_lru lru;
+	/** Bytes of data cached in this shard */
+	uint64_t bytes;
+	/** Incremented whenever segments in this shard are invalidated.  Data
+	 * read from the store is only cached if this didn't change while it
+	 * was being read, since it may be out of date otherwise. */
+	uint64_t gen;
+	/** If nonzero, the cache is shutting down.  Each shard has its own
+	 * copy, so that it can be checked under the shard lock. */
+	int shutdown;
+};
+
+/** A reader which may be reading a chunk sequentially */
+struct ostream {
+	/** chunk id */
+	uint64_t cid;
+	/** Where the next read will start, if it is sequential */
+	uint64_t next;
+	/** The segment after the last one that has been read ahead */
+	uint64_t ra_end;
+};
+
+/** A request for the readahead thread */
+struct oprefetch {
+	/** chunk id */
+	uint64_t cid;
+	/** First segment to read */
+	uint64_t seg;
+	/** Number of segments to read */
+	int nseg;
+};
+
+struct ocache {
+	/** Maximum number of bytes to cache in each shard */
+	uint64_t shard_max;
+	/** Number of segments to read ahead of a sequential reader */
+	int readahead;
+	/** Reads data from the store */
+	ocache_fill_fn_t fill;
+	/** Private pointer to pass to fill */
+	void *priv;
+	/** Statistics.  Changed atomically. */
+	volatile uint64_t hits;
+	volatile uint64_t misses;
+	volatile uint64_t prefetched;
+	volatile uint64_t evicted;
+	/** The shards */
+	struct ocache_shard shards[OCACHE_NUM_SHARDS];
+	/** Protects everything below */
+	pthread_mutex_t lock;
+	/** Signalled when there is work for the readahead thread */
+	pthread_cond_t cond;
+	/** If nonzero, we are shutting down */
+	int shutdown;
+	/** Readers which may be sequential, indexed by a hash of the chunk
+	 * id */
+	struct ostream streams[OCACHE_NUM_STREAMS];
+	/** Ring of requests for the readahead thread */
+	struct oprefetch queue[OCACHE_MAX_PREFETCH];
+	/** Index of the first request in the ring */
+	int queue_start;
+	/** Number of requests in the ring */
+	int queue_len;
+	/** The readahead thread.  Only started if readahead is nonzero. */
+	struct redfish_thread ra_thread;
+};
+
+static int compare_oseg_by_key(struct oseg *a, struct oseg *b) PURE;
+static int ocache_ra_thread(struct redfish_thread *rt);
+
+RB_GENERATE(osegs_by_key, oseg, by_key_entry, compare_oseg_by_key);
+
+static int compare_oseg_by_key(struct oseg *a, struct oseg *b)
+{
+	if (a->cid < b->cid)
+		return -1;
+	else if (a->cid > b->cid)
+		return 1;
+	else if (a->seg < b->seg)
+		return -1;
+	else if (a->seg > b->seg)
+		return 1;
+	return 0;
+}
+
+static uint64_t ocache_hash(uint64_t cid)
+{
+	return cid * 0x9e3779b97f4a7c15ULL;
+}
+
+static struct ocache_shard *ocache_cid_to_shard(struct ocache *cache,
+		uint64_t cid)
+{
+	return &cache->shards[ocache_hash(cid) >> (64 - OCACHE_SHARD_BITS)];
+}
+
+static void oseg_release(struct oseg *s)
+{
+	if (__sync_sub_and_fetch(&s->refcnt, 1) == 0)
+		free(s);
+}
+
+/** Remove a segment from the cache.
+ *
+ * Should be called with the shard lock held.
+ */
+static void ocache_remove(struct ocache_shard *shard, struct oseg *s)
+{
+	RB_REMOVE(osegs_by_key, &shard->key_head, s);
+	TAILQ_REMOVE(&shard->lru, s, lru_entry);
+	shard->bytes -= s->len;
+	oseg_release(s);
+}
+
+/** Look up a segment in the cache, and mark it as recently used.
+ *
+ * @param cache		The cache
+ * @param cid		The chunk id
+ * @param seg		The segment number
+ * @param out		(out param) the segment, which the caller must release
+ *			with oseg_release; or NULL if it isn't cached
+ *
+ * @return		0 on success; -ESHUTDOWN if the cache is shutting down
+ */
+static int ocache_lookup(struct ocache *cache, uint64_t cid, uint64_t seg,
+		struct oseg **out)
+{
+	struct ocache_shard *shard;
+	struct oseg exemplar, *s;
+
+	shard = ocache_cid_to_shard(cache, cid);
+	exemplar.cid = cid;
+	exemplar.seg = seg;
+	pthread_mutex_lock(&shard->lock);
+	if (shard->shutdown) {
+		pthread_mutex_unlock(&shard->lock);
+		return -ESHUTDOWN;
+	}
+	s = RB_FIND(osegs_by_key, &shard->key_head, &exemplar);
+	if (s) {
+		TAILQ_REMOVE(&shard->lru, s, lru_entry);
+		TAILQ_INSERT_HEAD(&shard->lru, s, lru_entry);
+		__sync_fetch_and_add(&s->refcnt, 1);
+	}
+	pthread_mutex_unlock(&shard->lock);
+	*out = s;
+	return 0;
+}
+
+/** Count how many segments in a row are missing from the cache
+ *
+ * @return		The number of segments, starting at seg, which are not
+ *			cached, up to a maximum of max
+ */
+static int ocache_count_missing(struct ocache *cache, uint64_t cid,
+		uint64_t seg, int max)
+{
+	int n;
+	struct ocache_shard *shard;
+	struct oseg exemplar;
+
+	shard = ocache_cid_to_shard(cache, cid);
+	exemplar.cid = cid;
+	pthread_mutex_lock(&shard->lock);
+	for (n = 0; n < max; ++n) {
+		exemplar.seg = seg + n;
+		if (RB_FIND(osegs_by_key, &shard->key_head, &exemplar))
+			break;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return n;
+}
+
+/** Add a segment to the cache, evicting old segments if necessary.
+ *
+ * Caching is best-effort, so nothing is returned.  The segment isn't added if
+ * it is already cached, or if the shard has been invalidated since gen was
+ * sampled.
+ */
+static void ocache_insert(struct ocache *cache, uint64_t cid, uint64_t seg,
+		const char *data, uint32_t len, uint32_t crc, uint64_t gen)
+{
+	struct ocache_shard *shard;
+	struct oseg *s, *victim;
+
+	s = malloc(sizeof(struct oseg) + len);
+	if (!s)
+		return;
+	s->cid = cid;
+	s->seg = seg;
+	s->refcnt = 1;
+	s->len = len;
+	s->crc = crc;
+	memcpy(s->data, data, len);
+	shard = ocache_cid_to_shard(cache, cid);
+	pthread_mutex_lock(&shard->lock);
+	if ((shard->gen != gen) ||
+			RB_INSERT(osegs_by_key, &shard->key_head, s)) {
+		pthread_mutex_unlock(&shard->lock);
+		free(s);
+		return;
+	}
+	TAILQ_INSERT_HEAD(&shard->lru, s, lru_entry);
+	shard->bytes += len;
+	while (shard->bytes > cache->shard_max) {
+		victim = TAILQ_LAST(&shard->lru, oseg_lru);
+		ocache_remove(shard, victim);
+		__sync_fetch_and_add(&cache->evicted, 1);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/** Read some segments from the store, and add them to the cache.
+ *
+ * @param cache		The cache
+ * @param fb		The fast log buffer
+ * @param cid		The chunk id
+ * @param seg		The first segment to read
+ * @param nseg		Number of segments to read
+ * @param buf		(out param) buffer of at least nseg segments to read
+ *			the data into
+ * @param crcs		(out param) the CRC32C of each segment that was read
+ *
+ * @return		The number of bytes read, which is less than nseg
+ *			segments at the end of the chunk; or a negative error
+ *			code
+ */
+static int32_t ocache_fill(struct ocache *cache, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t seg, int nseg, char *buf,
+		uint32_t *crcs)
+{
+	int32_t ret, pos, len;
+	int i;
+	uint64_t gen;
+	struct ocache_shard *shard;
+
+	shard = ocache_cid_to_shard(cache, cid);
+	pthread_mutex_lock(&shard->lock);
+	gen = shard->gen;
+	pthread_mutex_unlock(&shard->lock);
+	ret = cache->fill(cache->priv, fb, cid, seg << OSTOR_CSUM_SEG_SHIFT,
+		buf, nseg << OSTOR_CSUM_SEG_SHIFT, NULL);
+	fast_log_ostor(fb, FLOS_OCACHE_FILL, cid, seg << OSTOR_CSUM_SEG_SHIFT,
+		(ret < 0) ? ret : 0, nseg);
+	if (ret < 0)
+		return ret;
+	for (pos = 0, i = 0; pos < ret; pos += len, ++i) {
+		len = ret - pos;
+		if (len > OSTOR_CSUM_SEG)
+			len = OSTOR_CSUM_SEG;
+		crcs[i] = crc32c(CRC32C_INIT, buf + pos, len);
+		ocache_insert(cache, cid, seg + i, buf + pos, len, crcs[i],
+			gen);
+	}
+	/* If the chunk ends on a segment boundary, remember that with an empty
+	 * segment.  Otherwise readers that ask for more than there is would
+	 * always have to go to the store to find out. */
+	if ((ret < (nseg << OSTOR_CSUM_SEG_SHIFT)) &&
+			((ret & (OSTOR_CSUM_SEG - 1)) == 0)) {
+		ocache_insert(cache, cid, seg + i, buf + ret, 0, CRC32C_INIT,
+			gen);
+	}
+	return ret;
+}
+
+/** Note that a chunk has been read, and queue readahead if the reader seems
+ * to be reading it sequentially.
+ *
+ * @param cache		The cache
+ * @param cid		The chunk id
+ * @param off		Offset of the start of the read
+ * @param end		Offset of the end of the read
+ */
+static void ocache_note_read(struct ocache *cache, uint64_t cid,
+		uint64_t off, uint64_t end)
+{
+	uint64_t first, last;
+	struct ostream *st;
+	struct oprefetch *pf;
+
+	if (cache->readahead <= 0)
+		return;
+	st = &cache->streams[ocache_hash(cid) >> (64 - OCACHE_STREAM_BITS)];
+	pthread_mutex_lock(&cache->lock);
+	if ((st->cid == cid) && (st->next == off)) {
+		first = (end + OSTOR_CSUM_SEG - 1) >> OSTOR_CSUM_SEG_SHIFT;
+		last = first + cache->readahead;
+		if (first < st->ra_end)
+			first = st->ra_end;
+		if ((last > first) && (!cache->shutdown) &&
+				(cache->queue_len < OCACHE_MAX_PREFETCH)) {
+			pf = &cache->queue[(cache->queue_start +
+				cache->queue_len) % OCACHE_MAX_PREFETCH];
+			pf->cid = cid;
+			pf->seg = first;
+			pf->nseg = last - first;
+			cache->queue_len++;
+			st->ra_end = last;
+			pthread_cond_signal(&cache->cond);
+		}
+	}
+	else {
+		st->cid = cid;
+		st->ra_end = 0;
+	}
+	st->next = end;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+struct ocache *ocache_init(uint64_t max_bytes, int readahead,
+		ocache_fill_fn_t fill, void *priv)
+{
+	int i, ret;
+	struct ocache *cache;
+
+	cache = calloc(1, sizeof(struct ocache));
+	if (!cache) {
+		ret = ENOMEM;
+		goto error;
+	}
+	/* Each shard has room for at least one segment, however small the
+	 * cache is. */
+	cache->shard_max = max_bytes / OCACHE_NUM_SHARDS;
+	if (cache->shard_max < OSTOR_CSUM_SEG)
+		cache->shard_max = OSTOR_CSUM_SEG;
+	cache->readahead = readahead;
+	cache->fill = fill;
+	cache->priv = priv;
+	for (i = 0; i < OCACHE_NUM_STREAMS; ++i)
+		cache->streams[i].cid = RF_INVAL_CID;
+	ret = pthread_mutex_init(&cache->lock, NULL);
+	if (ret)
+		goto error_free_cache;
+	ret = pthread_cond_init(&cache->cond, NULL);
+	if (ret)
+		goto error_free_lock;
+	for (i = 0; i < OCACHE_NUM_SHARDS; ++i) {
+		ret = pthread_mutex_init(&cache->shards[i].lock, NULL);
+		if (ret)
+			goto error_free_shards;
+		RB_INIT(&cache->shards[i].key_head);
+		TAILQ_INIT(&cache->shards[i].lru);
+	}
+	if (readahead > 0) {
+		ret = redfish_thread_create(g_fast_log_mgr, &cache->ra_thread,
+			ocache_ra_thread, cache);
+		if (ret)
+			goto error_free_shards;
+	}
+	return cache;
+
+error_free_shards:
+	while (--i >= 0)
+		pthread_mutex_destroy(&cache->shards[i].lock);
+	pthread_cond_destroy(&cache->cond);
+error_free_lock:
+	pthread_mutex_destroy(&cache->lock);
+error_free_cache:
+	free(cache);
+error:
+	return ERR_PTR(FORCE_POSITIVE(ret));
+}
+
+void ocache_shutdown(struct ocache *cache)
+{
+	int i;
+
+	for (i = 0; i < OCACHE_NUM_SHARDS; ++i) {
+		pthread_mutex_lock(&cache->shards[i].lock);
+		cache->shards[i].shutdown = 1;
+		pthread_mutex_unlock(&cache->shards[i].lock);
+	}
+	pthread_mutex_lock(&cache->lock);
+	cache->shutdown = 1;
+	pthread_cond_broadcast(&cache->cond);
+	pthread_mutex_unlock(&cache->lock);
+	if (cache->readahead > 0)
+		redfish_thread_join(&cache->ra_thread);
+}
+
+void ocache_free(struct ocache *cache)
+{
+	int i;
+	struct ocache_shard *shard;
+	struct oseg *s;
+
+	for (i = 0; i < OCACHE_NUM_SHARDS; ++i) {
+		shard = &cache->shards[i];
+		while (1) {
+			s = RB_MIN(osegs_by_key, &shard->key_head);
+			if (!s)
+				break;
+			ocache_remove(shard, s);
+		}
+		pthread_mutex_destroy(&shard->lock);
+	}
+	pthread_cond_destroy(&cache->cond);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+int32_t ocache_read(struct ocache *cache, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc)
+{
+	int i, n, hits = 0, misses = 0;
+	int32_t ret;
+	uint64_t pos, end, seg, sstart, send, stop, pstart, pend, copy;
+	uint32_t whole, c, crcs[OCACHE_MAX_FILL_SEGS];
+	struct oseg *s;
+	char *buf = NULL;
+
+	if (dlen <= 0)
+		return cache->fill(cache->priv, fb, cid, off, data, dlen, crc);
+	whole = CRC32C_INIT;
+	end = off + dlen;
+	pos = off;
+	while (pos < end) {
+		seg = pos >> OSTOR_CSUM_SEG_SHIFT;
+		sstart = seg << OSTOR_CSUM_SEG_SHIFT;
+		ret = ocache_lookup(cache, cid, seg, &s);
+		if (ret)
+			goto done;
+		if (s) {
+			hits++;
+			send = sstart + s->len;
+			stop = (send < end) ? send : end;
+			if (stop > pos) {
+				memcpy(data + (pos - off),
+					s->data + (pos - sstart), stop - pos);
+				c = ((pos == sstart) && (stop == send)) ?
+					s->crc : crc32c(CRC32C_INIT,
+					data + (pos - off), stop - pos);
+				whole = crc32c_combine(whole, c, stop - pos);
+				pos = stop;
+			}
+			oseg_release(s);
+			/* A short segment is the last one in the chunk. */
+			if (send < sstart + OSTOR_CSUM_SEG)
+				break;
+			continue;
+		}
+		if (!buf) {
+			buf = malloc(OCACHE_MAX_FILL_SEGS * OSTOR_CSUM_SEG);
+			if (!buf) {
+				ret = -ENOMEM;
+				goto done;
+			}
+		}
+		n = ((end - 1) >> OSTOR_CSUM_SEG_SHIFT) - seg + 1;
+		if (n > OCACHE_MAX_FILL_SEGS)
+			n = OCACHE_MAX_FILL_SEGS;
+		/* Somebody else may have cached the segment since we
+		 * looked. */
+		n = ocache_count_missing(cache, cid, seg, n);
+		if (n == 0)
+			continue;
+		misses += n;
+		ret = ocache_fill(cache, fb, cid, seg, n, buf, crcs);
+		if (ret < 0)
+			goto done;
+		send = sstart + ret;
+		stop = (send < end) ? send : end;
+		for (i = 0; pos < stop; ++i) {
+			pstart = sstart +
+				((uint64_t)i << OSTOR_CSUM_SEG_SHIFT);
+			pend = pstart + OSTOR_CSUM_SEG;
+			if (pend > send)
+				pend = send;
+			if (pend <= pos)
+				continue;
+			copy = (pend < stop) ? pend : stop;
+			memcpy(data + (pos - off), buf + (pos - sstart),
+				copy - pos);
+			if ((pos == pstart) && (copy == pend)) {
+				c = crcs[i];
+			}
+			else {
+				c = crc32c(CRC32C_INIT, data + (pos - off),
+					copy - pos);
+			}
+			whole = crc32c_combine(whole, c, copy - pos);
+			pos = copy;
+		}
+		if (send < sstart + ((uint64_t)n << OSTOR_CSUM_SEG_SHIFT))
+			break;
+	}
+	ret = pos - off;
+	if (crc)
+		*crc = whole;
+	if (ret == dlen)
+		ocache_note_read(cache, cid, off, end);
+done:
+	if (hits) {
+		fast_log_ostor(fb, FLOS_OCACHE_HIT, cid, off, 0, hits);
+		__sync_fetch_and_add(&cache->hits, hits);
+	}
+	if (misses)
+		__sync_fetch_and_add(&cache->misses, misses);
+	free(buf);
+	return ret;
+}
+
+/** Read ahead of a sequential reader.
+ *
+ * Segments which are already cached are skipped.  We stop early if we reach
+ * the end of the chunk, or if there is an error; readahead is only a hint.
+ */
+static void ocache_prefetch(struct ocache *cache, struct fast_log_buf *fb,
+		const struct oprefetch *pf, char *buf, uint32_t *crcs)
+{
+	int n;
+	int32_t ret;
+	uint64_t seg, last;
+
+	last = pf->seg + pf->nseg;
+	for (seg = pf->seg; seg < last; seg += n) {
+		n = last - seg;
+		if (n > OCACHE_MAX_FILL_SEGS)
+			n = OCACHE_MAX_FILL_SEGS;
+		n = ocache_count_missing(cache, pf->cid, seg, n);
+		if (n == 0) {
+			n = 1;
+			continue;
+		}
+		ret = ocache_fill(cache, fb, pf->cid, seg, n, buf, crcs);
+		if (ret <= 0)
+			return;
+		__sync_fetch_and_add(&cache->prefetched,
+			(ret + OSTOR_CSUM_SEG - 1) >> OSTOR_CSUM_SEG_SHIFT);
+		if (ret < (n << OSTOR_CSUM_SEG_SHIFT))
+			return;
+	}
+}
+
+static int ocache_ra_thread(struct redfish_thread *rt)
+{
+	struct ocache *cache = rt->priv;
+	struct oprefetch pf;
+	uint32_t crcs[OCACHE_MAX_FILL_SEGS];
+	char *buf;
+
+	buf = malloc(OCACHE_MAX_FILL_SEGS * OSTOR_CSUM_SEG);
+	if (!buf) {
+		glitch_log("ocache: failed to allocate the readahead "
+			"buffer.  Readahead is disabled.\n");
+		return -ENOMEM;
+	}
+	while (1) {
+		pthread_mutex_lock(&cache->lock);
+		while ((!cache->shutdown) && (cache->queue_len == 0))
+			pthread_cond_wait(&cache->cond, &cache->lock);
+		if (cache->shutdown) {
+			pthread_mutex_unlock(&cache->lock);
+			break;
+		}
+		pf = cache->queue[cache->queue_start];
+		cache->queue_start = (cache->queue_start + 1) %
+			OCACHE_MAX_PREFETCH;
+		cache->queue_len--;
+		pthread_mutex_unlock(&cache->lock);
+		ocache_prefetch(cache, rt->fb, &pf, buf, crcs);
+	}
+	free(buf);
+	return 0;
+}
+
+void ocache_invalidate(struct ocache *cache, uint64_t cid, uint64_t off)
+{
+	struct ocache_shard *shard;
+	struct oseg exemplar, *s, *next;
+
+	shard = ocache_cid_to_shard(cache, cid);
+	exemplar.cid = cid;
+	exemplar.seg = off >> OSTOR_CSUM_SEG_SHIFT;
+	pthread_mutex_lock(&shard->lock);
+	shard->gen++;
+	for (s = RB_NFIND(osegs_by_key, &shard->key_head, &exemplar);
+			s && (s->cid == cid); s = next) {
+		next = RB_NEXT(osegs_by_key, &shard->key_head, s);
+		ocache_remove(shard, s);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void ocache_get_stats(struct ocache *cache, struct ocache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->prefetched = cache->prefetched;
+	stats->evicted = cache->evicted;
+	for (i = 0; i < OCACHE_NUM_SHARDS; ++i) {
+		pthread_mutex_lock(&cache->shards[i].lock);
+		stats->bytes += cache->shards[i].bytes;
+		pthread_mutex_unlock(&cache->shards[i].lock);
+	}
+}
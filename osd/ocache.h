@@ -0,0 +1,117 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_OSD_OCACHE_DOT_H
+#define REDFISH_OSD_OCACHE_DOT_H
+
+#include <stdint.h> /* for uint64_t, etc. */
+
+struct fast_log_buf;
+struct ocache;
+
+/* The segment cache
+ *
+ * The segment cache keeps recently read chunk data in memory, so that chunks
+ * which many clients read at once are read from the disk only once.  Data is
+ * cached in segments of OSTOR_CSUM_SEG bytes, keyed by chunk ID and segment
+ * number.  When the cache is full, the least recently used segments are
+ * dropped.
+ *
+ * The cache notices when a chunk is being read sequentially, and reads the
+ * next few segments into the cache in the background, before they are asked
+ * for.
+ *
+ * Chunk data doesn't change once it has been written, except at the end of
+ * the chunk.  Anything that writes to or unlinks a chunk must call
+ * ocache_invalidate afterwards.
+ */
+
+/** Reads data from the store into the cache.  This has the same semantics as
+ * ostor_read.
+ *
+ * @param priv		The private pointer given to ocache_init
+ */
+typedef int32_t (*ocache_fill_fn_t)(void *priv, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc);
+
+/** Segment cache statistics */
+struct ocache_stats {
+	/** Number of segments that were found in the cache */
+	uint64_t hits;
+	/** Number of segments that had to be read from the store */
+	uint64_t misses;
+	/** Number of segments read ahead of a sequential reader */
+	uint64_t prefetched;
+	/** Number of segments dropped because the cache was full */
+	uint64_t evicted;
+	/** Bytes of data in the cache */
+	uint64_t bytes;
+};
+
+/** Create a segment cache
+ *
+ * @param max_bytes	Maximum amount of data to cache
+ * @param readahead	Number of segments to read ahead of a sequential
+ *			reader.  0 disables readahead.
+ * @param fill		The function to read data from the store with
+ * @param priv		Private pointer to pass to fill
+ *
+ * @return		An error pointer on error; the cache otherwise
+ */
+extern struct ocache *ocache_init(uint64_t max_bytes, int readahead,
+		ocache_fill_fn_t fill, void *priv);
+
+/** Shut down a segment cache
+ *
+ * This stops the readahead thread.  After this function has been called, all
+ * further reads through the cache will return ESHUTDOWN.
+ *
+ * @param cache		The cache
+ */
+extern void ocache_shutdown(struct ocache *cache);
+
+/** Free a segment cache
+ *
+ * @param cache		The cache
+ */
+extern void ocache_free(struct ocache *cache);
+
+/** Read from a chunk through the cache.  See ostor_read. */
+extern int32_t ocache_read(struct ocache *cache, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc);
+
+/** Forget about cached data which may have changed
+ *
+ * @param cache		The cache
+ * @param cid		The chunk ID
+ * @param off		Forget about everything in the chunk from the segment
+ *			holding this offset onwards
+ */
+extern void ocache_invalidate(struct ocache *cache, uint64_t cid,
+		uint64_t off);
+
+/** Get segment cache statistics
+ *
+ * @param cache		The cache
+ * @param stats		(out param) the statistics
+ */
+extern void ocache_get_stats(struct ocache *cache, struct ocache_stats *stats);
+
+#endif
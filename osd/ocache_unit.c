@@ -0,0 +1,375 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/alarm.h"
+#include "core/process_ctx.h"
+#include "osd/ocache.h"
+#include "osd/ostor.h"
+#include "util/crc32c.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/test.h"
+#include "util/thread.h"
+#include "util/time.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Number of chunks in the fake store */
+#define OCACHEU_NUM_CHUNKS 8
+
+/** Largest chunk in the fake store */
+#define OCACHEU_MAX_LEN (16 * OSTOR_CSUM_SEG)
+
+/** A chunk ID which the fake store doesn't have */
+#define OCACHEU_MISSING_CID 1000
+
+#define OCACHEU_NUM_THREADS 4
+
+#define OCACHEU_THREAD_READS 300
+
+/** The fake store.  Chunk cid holds the first size[cid] bytes of
+ * g_data + cid. */
+struct ocacheu_store {
+	/** Size of each chunk */
+	volatile int32_t size[OCACHEU_NUM_CHUNKS];
+	/** Number of calls to ocacheu_fill */
+	volatile int fills;
+};
+
+static char *g_data;
+
+static int32_t ocacheu_fill(void *priv,
+		POSSIBLY_UNUSED(struct fast_log_buf *fb), uint64_t cid,
+		uint64_t off, char *data, int32_t dlen, uint32_t *crc)
+{
+	struct ocacheu_store *store = priv;
+	int32_t ret;
+
+	__sync_fetch_and_add(&store->fills, 1);
+	if (cid >= OCACHEU_NUM_CHUNKS)
+		return -ENOENT;
+	if (off >= (uint64_t)store->size[cid]) {
+		ret = 0;
+	}
+	else {
+		ret = store->size[cid] - off;
+		if (ret > dlen)
+			ret = dlen;
+	}
+	memcpy(data, g_data + cid + off, ret);
+	if (crc)
+		*crc = crc32c(CRC32C_INIT, data, ret);
+	return ret;
+}
+
+/** Read through the cache and check what we get against the fake store */
+static int ocacheu_check(struct ocache *cache, struct ocacheu_store *store,
+		struct fast_log_buf *fb, uint64_t cid, uint64_t off,
+		int32_t len)
+{
+	char *buf;
+	uint32_t crc;
+	int32_t ret, expect;
+
+	expect = ((int64_t)off >= store->size[cid]) ? 0 :
+		store->size[cid] - (int32_t)off;
+	if (expect > len)
+		expect = len;
+	buf = malloc(len + 1);
+	EXPECT_NOT_EQ(buf, NULL);
+	ret = ocache_read(cache, fb, cid, off, buf, len, &crc);
+	EXPECT_EQ(ret, expect);
+	EXPECT_ZERO(memcmp(buf, g_data + cid + off, ret));
+	EXPECT_EQ(crc, crc32c(CRC32C_INIT, buf, ret));
+	free(buf);
+	return 0;
+}
+
+static int ocacheu_simple_test(struct fast_log_buf *fb)
+{
+	int fills;
+	char buf[100];
+	struct ocacheu_store store;
+	struct ocache *cache;
+	struct ocache_stats stats;
+
+	memset(&store, 0, sizeof(store));
+	store.size[1] = 5 * OSTOR_CSUM_SEG + 1000;
+	cache = ocache_init(64 << 20, 0, ocacheu_fill, &store);
+	EXPECT_NOT_ERRPTR(cache);
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1, 0, store.size[1]));
+	EXPECT_EQ(store.fills, 1);
+	ocache_get_stats(cache, &stats);
+	EXPECT_EQ(stats.misses, 6);
+	EXPECT_EQ(stats.hits, 0);
+	EXPECT_EQ(stats.bytes, (uint64_t)store.size[1]);
+
+	/* Everything from here on should come from the cache. */
+	fills = store.fills;
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1, 0, store.size[1]));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1,
+		OSTOR_CSUM_SEG / 2 + 3, 2 * OSTOR_CSUM_SEG));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1, 5 * OSTOR_CSUM_SEG,
+		OSTOR_CSUM_SEG));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1,
+		5 * OSTOR_CSUM_SEG + 999, 100));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1,
+		5 * OSTOR_CSUM_SEG + 1000, 100));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1,
+		4 * OSTOR_CSUM_SEG + 10, 100));
+	EXPECT_EQ(store.fills, fills);
+	ocache_get_stats(cache, &stats);
+	EXPECT_EQ(stats.misses, 6);
+	EXPECT_GT(stats.hits, 6);
+
+	/* Reading past the end of the chunk goes to the store, since the
+	 * cache doesn't know where the end is unless it has the last
+	 * segment. */
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 1,
+		7 * OSTOR_CSUM_SEG, 100));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 2, 0, 100));
+	EXPECT_EQ(ocache_read(cache, fb, OCACHEU_MISSING_CID, 0, buf,
+		sizeof(buf), NULL), -ENOENT);
+	EXPECT_EQ(ocache_read(cache, fb, 1, 0, buf, 0, NULL), 0);
+	ocache_shutdown(cache);
+	EXPECT_EQ(ocache_read(cache, fb, 1, 0, buf, sizeof(buf), NULL),
+		-ESHUTDOWN);
+	ocache_free(cache);
+	return 0;
+}
+
+static int ocacheu_invalidate_test(struct fast_log_buf *fb)
+{
+	int fills;
+	char *buf;
+	struct ocacheu_store store;
+	struct ocache *cache;
+	struct ocache_stats stats;
+
+	memset(&store, 0, sizeof(store));
+	store.size[3] = OSTOR_CSUM_SEG + 10;
+	store.size[4] = 3 * OSTOR_CSUM_SEG;
+	cache = ocache_init(64 << 20, 0, ocacheu_fill, &store);
+	EXPECT_NOT_ERRPTR(cache);
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 3, 0, OCACHEU_MAX_LEN));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 4, 0, OCACHEU_MAX_LEN));
+
+	/* Until the cache is told, it keeps returning the old end of the
+	 * chunk. */
+	store.size[3] = 4 * OSTOR_CSUM_SEG + 10;
+	buf = malloc(OCACHEU_MAX_LEN);
+	EXPECT_NOT_EQ(buf, NULL);
+	EXPECT_EQ(ocache_read(cache, fb, 3, 0, buf, OCACHEU_MAX_LEN, NULL),
+		OSTOR_CSUM_SEG + 10);
+	free(buf);
+	ocache_invalidate(cache, 3, OSTOR_CSUM_SEG + 10);
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 3, 0, OCACHEU_MAX_LEN));
+
+	/* Invalidating one chunk leaves the others alone. */
+	fills = store.fills;
+	ocache_invalidate(cache, 3, 0);
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 4, 0, OCACHEU_MAX_LEN));
+	EXPECT_EQ(store.fills, fills);
+	ocache_get_stats(cache, &stats);
+	EXPECT_EQ(stats.bytes, (uint64_t)store.size[4]);
+	ocache_shutdown(cache);
+	ocache_free(cache);
+	return 0;
+}
+
+static int ocacheu_evict_test(struct fast_log_buf *fb)
+{
+	int i;
+	struct ocacheu_store store;
+	struct ocache *cache;
+	struct ocache_stats stats;
+
+	memset(&store, 0, sizeof(store));
+	for (i = 0; i < OCACHEU_NUM_CHUNKS; ++i)
+		store.size[i] = OCACHEU_MAX_LEN;
+	/* This is small enough that each shard only holds one segment. */
+	cache = ocache_init(4 * OSTOR_CSUM_SEG, 0, ocacheu_fill, &store);
+	EXPECT_NOT_ERRPTR(cache);
+	for (i = 0; i < OCACHEU_NUM_CHUNKS; ++i) {
+		EXPECT_ZERO(ocacheu_check(cache, &store, fb, i, 0,
+			OCACHEU_MAX_LEN));
+	}
+	ocache_get_stats(cache, &stats);
+	EXPECT_EQ(stats.misses, OCACHEU_NUM_CHUNKS * 16);
+	EXPECT_GT(stats.evicted, 0);
+	EXPECT_LT(stats.bytes, OCACHEU_NUM_CHUNKS * OSTOR_CSUM_SEG + 1);
+	for (i = 0; i < OCACHEU_NUM_CHUNKS; ++i) {
+		EXPECT_ZERO(ocacheu_check(cache, &store, fb, i,
+			OSTOR_CSUM_SEG - 5, 10));
+	}
+	ocache_shutdown(cache);
+	ocache_free(cache);
+	return 0;
+}
+
+/** Wait for the readahead thread to read ahead a given number of segments
+ * in all */
+static int ocacheu_wait_prefetched(struct ocache *cache, uint64_t nseg)
+{
+	int i;
+	struct ocache_stats stats;
+
+	for (i = 0; i < 5000; ++i) {
+		ocache_get_stats(cache, &stats);
+		if (stats.prefetched >= nseg)
+			break;
+		usleep(1000);
+	}
+	EXPECT_EQ(stats.prefetched, nseg);
+	return 0;
+}
+
+static int ocacheu_readahead_test(struct fast_log_buf *fb)
+{
+	uint64_t misses;
+	struct ocacheu_store store;
+	struct ocache *cache;
+	struct ocache_stats stats;
+
+	memset(&store, 0, sizeof(store));
+	store.size[5] = OCACHEU_MAX_LEN;
+	store.size[6] = OCACHEU_MAX_LEN;
+	cache = ocache_init(64 << 20, 4, ocacheu_fill, &store);
+	EXPECT_NOT_ERRPTR(cache);
+
+	/* The second read in a row tells the cache that the chunk is being
+	 * read sequentially. */
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 5, 0, OSTOR_CSUM_SEG));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 5, OSTOR_CSUM_SEG,
+		OSTOR_CSUM_SEG));
+	EXPECT_ZERO(ocacheu_wait_prefetched(cache, 4));
+	ocache_get_stats(cache, &stats);
+	misses = stats.misses;
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 5, 2 * OSTOR_CSUM_SEG,
+		4 * OSTOR_CSUM_SEG));
+	ocache_get_stats(cache, &stats);
+	EXPECT_EQ(stats.misses, misses);
+	/* That read was sequential too, so we keep going. */
+	EXPECT_ZERO(ocacheu_wait_prefetched(cache, 8));
+
+	/* Random reads don't trigger readahead. */
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 6,
+		8 * OSTOR_CSUM_SEG, 100));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 6,
+		2 * OSTOR_CSUM_SEG, 100));
+	EXPECT_ZERO(ocacheu_check(cache, &store, fb, 6,
+		12 * OSTOR_CSUM_SEG, 100));
+	ocache_shutdown(cache);
+	ocache_get_stats(cache, &stats);
+	EXPECT_EQ(stats.prefetched, 8);
+	ocache_free(cache);
+	return 0;
+}
+
+struct ocacheu_thread_ctx {
+	struct ocache *cache;
+	struct ocacheu_store *store;
+	unsigned int seed;
+};
+
+static int ocacheu_thread(struct redfish_thread *rt)
+{
+	int i;
+	uint64_t cid, off;
+	int32_t len;
+	struct ocacheu_thread_ctx *ctx = rt->priv;
+
+	for (i = 0; i < OCACHEU_THREAD_READS; ++i) {
+		cid = rand_r(&ctx->seed) % OCACHEU_NUM_CHUNKS;
+		off = rand_r(&ctx->seed) % OCACHEU_MAX_LEN;
+		len = 1 + rand_r(&ctx->seed) % (3 * OSTOR_CSUM_SEG);
+		/* Sometimes read the next part of the chunk, so that there is
+		 * readahead going on as well. */
+		if (i % 3 == 0)
+			off = 0;
+		EXPECT_ZERO(ocacheu_check(ctx->cache, ctx->store, rt->fb,
+			cid, off, len));
+		if (i % 3 == 0) {
+			EXPECT_ZERO(ocacheu_check(ctx->cache, ctx->store,
+				rt->fb, cid, len, len));
+		}
+	}
+	return 0;
+}
+
+static int ocacheu_threaded_test(void)
+{
+	int i;
+	struct ocacheu_store store;
+	struct ocache *cache;
+	struct ocacheu_thread_ctx ctx[OCACHEU_NUM_THREADS];
+	struct redfish_thread thr[OCACHEU_NUM_THREADS];
+
+	memset(&store, 0, sizeof(store));
+	for (i = 0; i < OCACHEU_NUM_CHUNKS; ++i)
+		store.size[i] = OCACHEU_MAX_LEN - i * 1000;
+	/* Small enough that there is eviction going on. */
+	cache = ocache_init(8 << 20, 4, ocacheu_fill, &store);
+	EXPECT_NOT_ERRPTR(cache);
+	for (i = 0; i < OCACHEU_NUM_THREADS; ++i) {
+		ctx[i].cache = cache;
+		ctx[i].store = &store;
+		ctx[i].seed = i;
+		EXPECT_ZERO(redfish_thread_create(g_fast_log_mgr, &thr[i],
+			ocacheu_thread, &ctx[i]));
+	}
+	for (i = 0; i < OCACHEU_NUM_THREADS; ++i)
+		EXPECT_ZERO(redfish_thread_join(&thr[i]));
+	ocache_shutdown(cache);
+	ocache_free(cache);
+	return 0;
+}
+
+int main(POSSIBLY_UNUSED(int argc), char **argv)
+{
+	int i;
+	struct fast_log_buf *fb;
+	timer_t timer;
+	time_t t;
+
+	EXPECT_ZERO(utility_ctx_init(argv[0])); /* for g_fast_log_mgr */
+	t = mt_time() + 600;
+	EXPECT_ZERO(mt_set_alarm(t, "ocache_unit timed out", &timer));
+	fb = fast_log_create(g_fast_log_mgr, "main");
+	EXPECT_NOT_ERRPTR(fb);
+	g_data = malloc(OCACHEU_MAX_LEN + OCACHEU_NUM_CHUNKS);
+	EXPECT_NOT_EQ(g_data, NULL);
+	for (i = 0; i < OCACHEU_MAX_LEN + OCACHEU_NUM_CHUNKS; ++i)
+		g_data[i] = random();
+
+	EXPECT_ZERO(ocacheu_simple_test(fb));
+	EXPECT_ZERO(ocacheu_invalidate_test(fb));
+	EXPECT_ZERO(ocacheu_evict_test(fb));
+	EXPECT_ZERO(ocacheu_readahead_test(fb));
+	EXPECT_ZERO(ocacheu_threaded_test());
+
+	EXPECT_ZERO(mt_deactivate_alarm(timer));
+	fast_log_free(fb);
+	free(g_data);
+	process_ctx_shutdown();
+
+	return EXIT_SUCCESS;
+}
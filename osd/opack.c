@@ -0,0 +1,1634 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/glitch_log.h"
+#include "core/process_ctx.h"
+#include "osd/fast_log.h"
+#include "osd/opack.h"
+#include "osd/ostor.h"
+#include "util/compiler.h"
+#include "util/crc32c.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/macro.h"
+#include "util/packed.h"
+#include "util/safe_io.h"
+#include "util/string.h"
+#include "util/terror.h"
+#include "util/thread.h"
+#include "util/time.h"
+#include "util/tree.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define OPACK_INDEX_NAME "index"
+
+#define OPACK_INDEX_TMP_NAME "index.tmp"
+
+/** Number of seconds between looks for containers to compact */
+#define OPACK_COMPACT_PERIOD_SEC 30
+
+/** The index is rewritten once it has more than this many records for each
+ * one that is still needed... */
+#define OPACK_INDEX_SLACK 2
+
+/** ...and at least this many records in total */
+#define OPACK_INDEX_MIN_REWRITE 1024
+
+/** Number of index records to read at once when replaying the index */
+#define OPACK_REPLAY_BATCH 1024
+
+enum opack_rec_ty {
+	/** Append an extent to a chunk, creating the chunk if it doesn't
+	 * exist.  A zero-length extent just creates the chunk. */
+	OPACK_REC_ADD = 1,
+	/** Unlink a chunk */
+	OPACK_REC_DEL = 2,
+	/** Move one of a chunk's extents somewhere else */
+	OPACK_REC_MOVE = 3,
+};
+
+/** A record in the index file.  All fields are big-endian. */
+PACKED(
+struct opack_rec {
+	/** enum opack_rec_ty */
+	uint16_t ty;
+	uint16_t pad;
+	/** The container that the extent is in */
+	uint32_t cont;
+	/** The chunk ID */
+	uint64_t cid;
+	/** Offset of the extent in the container */
+	uint64_t off;
+	/** Length of the extent */
+	uint32_t len;
+	/** CRC32C of the extent data */
+	uint32_t crc;
+	/** For OPACK_REC_MOVE, the index of the extent in the chunk */
+	uint32_t ext;
+	/** CRC32C of all of the preceding fields */
+	uint32_t rcrc;
+});
+
+BUILD_BUG_ON(sizeof(struct opack_rec) != 40);
+
+/** A piece of a chunk, stored in a container */
+struct pext {
+	/** Offset of the extent in the chunk */
+	uint64_t pos;
+	/** Offset of the extent in the container */
+	uint64_t off;
+	/** The container that the extent is in */
+	uint32_t cont;
+	/** Length of the extent */
+	uint32_t len;
+	/** CRC32C of the extent data */
+	uint32_t crc;
+};
+
+struct pchunk {
+	RB_ENTRY(pchunk) by_cid_entry;
+	/** chunk id */
+	uint64_t cid;
+	/** Length of the chunk data */
+	uint64_t size;
+	/** The extents, in the order they appear in the chunk.  This array
+	 * is only changed with both io_lock held for writing and the pack
+	 * lock held. */
+	struct pext *ext;
+	/** Number of extents */
+	int num_ext;
+	/** Number of extents there is room for in ext */
+	int max_ext;
+	/** Number of threads using the chunk.  Protected by the pack lock. */
+	int refcnt;
+	/** Nonzero once the chunk is in the index.  Until then, it is being
+	 * created, and doesn't exist as far as readers are concerned.  Only
+	 * set with io_lock held for writing and the pack lock held. */
+	int indexed;
+	/** Nonzero once the chunk has been unlinked.  It is no longer in the
+	 * tree, and will be freed when refcnt drops to 0.  Protected by the
+	 * pack lock. */
+	int dead;
+	/** Held for writing while appending to the chunk, unlinking it, or
+	 * moving its extents, and for reading while reading from it. */
+	pthread_rwlock_t io_lock;
+};
+
+/** A container file */
+struct pcont {
+	/** Container ID */
+	uint32_t id;
+	/** Open file descriptor */
+	int fd;
+	/** Number of bytes which have been handed out */
+	uint64_t tail;
+	/** Number of bytes in extents which are in the index */
+	uint64_t live;
+	/** Number of bytes which have been handed out, but aren't in the index
+	 * yet.  We won't compact a container while this is nonzero. */
+	uint64_t pending;
+	/** Nonzero if no more space will be handed out in this container */
+	int sealed;
+};
+
+static int compare_pchunk_by_cid(struct pchunk *ch_a,
+		struct pchunk *ch_b) PURE;
+static int opack_compact_thread(struct redfish_thread *rt);
+
+RB_HEAD(pchunks_by_cid, pchunk);
+RB_GENERATE(pchunks_by_cid, pchunk, by_cid_entry, compare_pchunk_by_cid);
+
+struct opack {
+	/** Path to the directory holding the containers and the index */
+	char *dir_path;
+	/** Size of each container */
+	uint64_t cont_size;
+	/** Compact containers which have less than this percentage of live
+	 * data */
+	int compact_pct;
+	/** Serializes appends to the index file and rewrites of it.  If the
+	 * pack lock is also held, this must be taken first. */
+	pthread_mutex_t index_lock;
+	/** The index file.  Protected by index_lock. */
+	int index_fd;
+	/** Number of records in the index file.  Protected by index_lock. */
+	uint64_t index_recs;
+	/** Only one thread compacts at a time.  Only compaction removes
+	 * containers, so while this is held, no container goes away. */
+	pthread_mutex_t compact_lock;
+	/** Protects everything below */
+	pthread_mutex_t lock;
+	/** If nonzero, we are shutting down */
+	int shutdown;
+	/** Tree of chunks sorted by chunk id */
+	struct pchunks_by_cid cid_head;
+	/** The containers, indexed by container ID.  Containers which have
+	 * been deleted are NULL. */
+	struct pcont **conts;
+	/** Length of the conts array */
+	uint32_t num_conts;
+	/** The container that new extents go into, or NULL if we haven't
+	 * created it yet */
+	struct pcont *active;
+	/** Number of chunks */
+	uint64_t num_chunks;
+	/** Number of extents */
+	uint64_t num_extents;
+	/** Number of containers that have been compacted */
+	uint64_t num_compacted;
+	/** Incremented whenever a container may have become ready to be
+	 * compacted */
+	uint64_t compact_gen;
+	/** Signalled when the compaction thread should look for work */
+	pthread_cond_t compact_cond;
+	/** The compaction thread */
+	struct redfish_thread compact_thread;
+};
+
+/************************** helpers *******************************/
+static int compare_pchunk_by_cid(struct pchunk *ch_a, struct pchunk *ch_b)
+{
+	if (ch_a->cid < ch_b->cid)
+		return -1;
+	if (ch_a->cid > ch_b->cid)
+		return 1;
+	return 0;
+}
+
+static void opack_get_cont_path(const struct opack *pack, char *path,
+		size_t path_len, uint32_t id)
+{
+	snprintf(path, path_len, "%s/c%08" PRIx32, pack->dir_path, id);
+}
+
+static void opack_rec_pack(struct opack_rec *rec, int ty, uint64_t cid,
+		const struct pext *e, uint32_t ext)
+{
+	memset(rec, 0, sizeof(*rec));
+	pack_to_be16(&rec->ty, ty);
+	pack_to_be64(&rec->cid, cid);
+	if (e) {
+		pack_to_be32(&rec->cont, e->cont);
+		pack_to_be64(&rec->off, e->off);
+		pack_to_be32(&rec->len, e->len);
+		pack_to_be32(&rec->crc, e->crc);
+	}
+	pack_to_be32(&rec->ext, ext);
+	pack_to_be32(&rec->rcrc, crc32c(CRC32C_INIT, rec,
+		offsetof(struct opack_rec, rcrc)));
+}
+
+/** Make sure that a chunk has room for more extents.
+ *
+ * Should be called with the pack lock held.
+ */
+static int pchunk_reserve_ext(struct pchunk *ch, int n)
+{
+	int max_ext;
+	struct pext *ext;
+
+	if (ch->num_ext + n <= ch->max_ext)
+		return 0;
+	max_ext = ch->max_ext ? (ch->max_ext * 2) : 4;
+	if (max_ext < ch->num_ext + n)
+		max_ext = ch->num_ext + n;
+	ext = realloc(ch->ext, max_ext * sizeof(struct pext));
+	if (!ext)
+		return -ENOMEM;
+	ch->ext = ext;
+	ch->max_ext = max_ext;
+	return 0;
+}
+
+static struct pchunk *pchunk_alloc(struct opack *pack, uint64_t cid)
+{
+	struct pchunk *ch;
+
+	ch = calloc(1, sizeof(struct pchunk));
+	if (!ch)
+		return ERR_PTR(ENOMEM);
+	if (pthread_rwlock_init(&ch->io_lock, NULL)) {
+		free(ch);
+		return ERR_PTR(ENOMEM);
+	}
+	ch->cid = cid;
+	RB_INSERT(pchunks_by_cid, &pack->cid_head, ch);
+	pack->num_chunks++;
+	return ch;
+}
+
+static void pchunk_free(struct pchunk *ch)
+{
+	pthread_rwlock_destroy(&ch->io_lock);
+	free(ch->ext);
+	free(ch);
+}
+
+/** Check whether a container should be compacted.
+ *
+ * Should be called with the pack lock held.
+ */
+static int opack_cont_compactable(const struct opack *pack,
+		const struct pcont *cont)
+{
+	if ((!cont->sealed) || (cont->pending))
+		return 0;
+	return cont->live * 100 < pack->cont_size * pack->compact_pct;
+}
+
+/** Take a chunk out of the tree, and stop counting its extents as live.
+ *
+ * If that leaves a container ready to be compacted, wake the compaction
+ * thread.
+ *
+ * Should be called with the pack lock held.
+ */
+static void pchunk_kill(struct opack *pack, struct pchunk *ch)
+{
+	int i, was;
+	struct pcont *cont;
+
+	for (i = 0; i < ch->num_ext; ++i) {
+		if (ch->ext[i].cont >= pack->num_conts)
+			continue;
+		cont = pack->conts[ch->ext[i].cont];
+		if (!cont)
+			continue;
+		was = opack_cont_compactable(pack, cont);
+		cont->live -= ch->ext[i].len;
+		if ((!was) && opack_cont_compactable(pack, cont)) {
+			pack->compact_gen++;
+			pthread_cond_signal(&pack->compact_cond);
+		}
+	}
+	pack->num_extents -= ch->num_ext;
+	pack->num_chunks--;
+	RB_REMOVE(pchunks_by_cid, &pack->cid_head, ch);
+	ch->dead = 1;
+}
+
+static struct pchunk *opack_find_chunk(struct opack *pack, uint64_t cid)
+{
+	struct pchunk exemplar;
+
+	memset(&exemplar, 0, sizeof(exemplar));
+	exemplar.cid = cid;
+	return RB_FIND(pchunks_by_cid, &pack->cid_head, &exemplar);
+}
+
+/** Find a chunk, and take a reference to it.
+ *
+ * @param pack		The packed store
+ * @param cid		The chunk ID
+ * @param create	If nonzero, create the chunk if it doesn't exist
+ *
+ * @return		The chunk, or an error pointer
+ */
+static struct pchunk *opack_hold_chunk(struct opack *pack, uint64_t cid,
+		int create)
+{
+	struct pchunk *ch;
+
+	pthread_mutex_lock(&pack->lock);
+	if (pack->shutdown) {
+		ch = ERR_PTR(ESHUTDOWN);
+		goto done;
+	}
+	ch = opack_find_chunk(pack, cid);
+	if (!ch) {
+		if (!create) {
+			ch = ERR_PTR(ENOENT);
+			goto done;
+		}
+		ch = pchunk_alloc(pack, cid);
+		if (IS_ERR(ch))
+			goto done;
+	}
+	ch->refcnt++;
+done:
+	pthread_mutex_unlock(&pack->lock);
+	return ch;
+}
+
+/** Drop a reference taken by opack_hold_chunk */
+static void opack_release_chunk(struct opack *pack, struct pchunk *ch)
+{
+	pthread_mutex_lock(&pack->lock);
+	ch->refcnt--;
+	if (ch->refcnt == 0) {
+		/* A chunk that we started to create, but never managed to
+		 * write to, doesn't exist. */
+		if ((!ch->dead) && (!ch->indexed))
+			pchunk_kill(pack, ch);
+		if (ch->dead)
+			pchunk_free(ch);
+	}
+	pthread_mutex_unlock(&pack->lock);
+}
+
+/** Get the file descriptor of a container.
+ *
+ * @return		The file descriptor, or -1 if there is no such
+ *			container
+ */
+static int opack_cont_fd(struct opack *pack, uint32_t id)
+{
+	int fd = -1;
+
+	pthread_mutex_lock(&pack->lock);
+	if ((id < pack->num_conts) && pack->conts[id])
+		fd = pack->conts[id]->fd;
+	pthread_mutex_unlock(&pack->lock);
+	return fd;
+}
+
+/************************** containers *******************************/
+/** Add a container to the container table.
+ *
+ * Should be called with the pack lock held, or during initialization.
+ */
+static struct pcont *opack_cont_add(struct opack *pack, uint32_t id, int fd)
+{
+	uint32_t num_conts;
+	struct pcont *cont, **conts;
+
+	if (id >= pack->num_conts) {
+		num_conts = pack->num_conts ? pack->num_conts : 16;
+		while (num_conts <= id)
+			num_conts *= 2;
+		conts = realloc(pack->conts,
+			num_conts * sizeof(struct pcont*));
+		if (!conts)
+			return ERR_PTR(ENOMEM);
+		memset(conts + pack->num_conts, 0,
+			(num_conts - pack->num_conts) * sizeof(struct pcont*));
+		pack->conts = conts;
+		pack->num_conts = num_conts;
+	}
+	cont = calloc(1, sizeof(struct pcont));
+	if (!cont)
+		return ERR_PTR(ENOMEM);
+	cont->id = id;
+	cont->fd = fd;
+	pack->conts[id] = cont;
+	return cont;
+}
+
+/** Create a new container, and make it the active container.
+ *
+ * Should be called with the pack lock held.  This does blocking I/O with the
+ * lock held, but it only happens once every cont_size bytes.
+ */
+static int opack_cont_create(struct opack *pack)
+{
+	int ret, fd;
+	uint32_t id;
+	struct pcont *cont;
+	char path[PATH_MAX];
+
+	id = pack->active ? (pack->active->id + 1) : pack->num_conts;
+	opack_get_cont_path(pack, path, sizeof(path), id);
+	RETRY_ON_EINTR(fd, open(path, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC,
+		0660));
+	if (fd < 0) {
+		ret = errno;
+		glitch_log("opack: failed to create container '%s': "
+			"error %d (%s)\n", path, ret, terror(ret));
+		return -ret;
+	}
+	ret = posix_fallocate(fd, 0, pack->cont_size);
+	if (ret) {
+		glitch_log("opack: failed to allocate %" PRId64 " bytes for "
+			"container '%s': error %d (%s)\n", pack->cont_size,
+			path, ret, terror(ret));
+		goto error_unlink;
+	}
+	cont = opack_cont_add(pack, id, fd);
+	if (IS_ERR(cont)) {
+		ret = PTR_ERR(cont);
+		goto error_unlink;
+	}
+	if (pack->active) {
+		pack->active->sealed = 1;
+		pack->compact_gen++;
+		pthread_cond_signal(&pack->compact_cond);
+	}
+	pack->active = cont;
+	return 0;
+
+error_unlink:
+	close(fd);
+	unlink(path);
+	return -ret;
+}
+
+/** Hand out space for some extents.
+ *
+ * As many of the extents as will fit are given space in the active container,
+ * one after another.  If none of them fit, we start a new container.
+ *
+ * @param pack		The packed store
+ * @param ext		The extents.  The len fields must be filled in.  We
+ *			fill in the cont and off fields.
+ * @param num_ext	Number of extents
+ * @param fd		(out param) the file descriptor of the container
+ *
+ * @return		The number of extents that were given space, or a
+ *			negative error code
+ */
+static int opack_alloc(struct opack *pack, struct pext *ext, int num_ext,
+		int *fd)
+{
+	int i, ret;
+	uint64_t len;
+	struct pcont *cont;
+
+	pthread_mutex_lock(&pack->lock);
+	cont = pack->active;
+	if ((!cont) || (cont->tail + ext[0].len > pack->cont_size)) {
+		ret = opack_cont_create(pack);
+		if (ret)
+			goto done;
+		cont = pack->active;
+	}
+	len = 0;
+	for (i = 0; i < num_ext; ++i) {
+		if (cont->tail + len + ext[i].len > pack->cont_size)
+			break;
+		ext[i].cont = cont->id;
+		ext[i].off = cont->tail + len;
+		len += ext[i].len;
+	}
+	cont->tail += len;
+	cont->pending += len;
+	*fd = cont->fd;
+	ret = i;
+done:
+	pthread_mutex_unlock(&pack->lock);
+	return ret;
+}
+
+/** Give back the pending space handed out by opack_alloc, once the extents
+ * have either been put in the index, or abandoned.
+ *
+ * Should be called with the pack lock held.
+ */
+static void opack_unpend(struct opack *pack, const struct pext *ext,
+		int num_ext, int live)
+{
+	int i;
+	struct pcont *cont;
+
+	for (i = 0; i < num_ext; ++i) {
+		cont = pack->conts[ext[i].cont];
+		cont->pending -= ext[i].len;
+		if (live)
+			cont->live += ext[i].len;
+	}
+}
+
+/************************** index *******************************/
+/** Append records to the index file.
+ *
+ * Should be called with the index lock held.
+ */
+static int opack_index_append(struct opack *pack,
+		const struct opack_rec *recs, int nrecs)
+{
+	int ret;
+
+	ret = safe_write(pack->index_fd, recs,
+		nrecs * sizeof(struct opack_rec));
+	if (ret) {
+		/* Don't leave part of a record behind. */
+		if (ftruncate(pack->index_fd,
+				pack->index_recs * sizeof(struct opack_rec))) {
+			glitch_log("opack: failed to truncate the index "
+				"after a failed write: error %d\n", errno);
+		}
+		return ret;
+	}
+	pack->index_recs += nrecs;
+	return 0;
+}
+
+/** Rewrite the index file from what we have in memory.
+ *
+ * The new index is written to a temporary file, which is then renamed over the
+ * old one, so there is always a complete index on disk.
+ *
+ * Should be called with the index lock held.
+ */
+static int opack_index_rewrite(struct opack *pack, struct fast_log_buf *fb)
+{
+	int i, ret, fd, nrecs;
+	struct opack_rec *recs;
+	struct pchunk *ch;
+	char path[PATH_MAX], tpath[PATH_MAX];
+
+	pthread_mutex_lock(&pack->lock);
+	nrecs = 0;
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head)
+		nrecs += ch->num_ext ? ch->num_ext : 1;
+	recs = malloc((nrecs ? nrecs : 1) * sizeof(struct opack_rec));
+	if (!recs) {
+		pthread_mutex_unlock(&pack->lock);
+		return -ENOMEM;
+	}
+	nrecs = 0;
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head) {
+		if (ch->num_ext == 0)
+			opack_rec_pack(&recs[nrecs++], OPACK_REC_ADD, ch->cid,
+				NULL, 0);
+		for (i = 0; i < ch->num_ext; ++i)
+			opack_rec_pack(&recs[nrecs++], OPACK_REC_ADD, ch->cid,
+				&ch->ext[i], 0);
+	}
+	pthread_mutex_unlock(&pack->lock);
+	snprintf(path, sizeof(path), "%s/%s", pack->dir_path,
+		OPACK_INDEX_NAME);
+	snprintf(tpath, sizeof(tpath), "%s/%s", pack->dir_path,
+		OPACK_INDEX_TMP_NAME);
+	RETRY_ON_EINTR(fd, open(tpath, O_CREAT | O_TRUNC | O_WRONLY |
+		O_APPEND | O_CLOEXEC, 0660));
+	if (fd < 0) {
+		ret = -errno;
+		goto done;
+	}
+	ret = safe_write(fd, recs, nrecs * sizeof(struct opack_rec));
+	if (ret)
+		goto error_close;
+	if (fsync(fd)) {
+		ret = -errno;
+		goto error_close;
+	}
+	if (rename(tpath, path)) {
+		ret = -errno;
+		goto error_close;
+	}
+	close(pack->index_fd);
+	pack->index_fd = fd;
+	pack->index_recs = nrecs;
+	fast_log_ostor(fb, FLOS_PACK_INDEX, 0, 0, 0, nrecs);
+	ret = 0;
+	goto done;
+
+error_close:
+	close(fd);
+	unlink(tpath);
+done:
+	if (ret) {
+		glitch_log("opack: failed to rewrite the index: error %d "
+			"(%s)\n", ret, terror(ret));
+	}
+	free(recs);
+	return ret;
+}
+
+/** Rewrite the index if most of its records are obsolete.
+ *
+ * Should be called with the index lock held.
+ */
+static int opack_index_maybe_rewrite(struct opack *pack,
+		struct fast_log_buf *fb)
+{
+	uint64_t needed;
+
+	pthread_mutex_lock(&pack->lock);
+	needed = pack->num_extents + pack->num_chunks;
+	pthread_mutex_unlock(&pack->lock);
+	if ((pack->index_recs < OPACK_INDEX_MIN_REWRITE) ||
+			(pack->index_recs <= needed * OPACK_INDEX_SLACK))
+		return 0;
+	return opack_index_rewrite(pack, fb);
+}
+
+/** Apply an index record to the in-memory state.
+ *
+ * This is only used while replaying the index, so no locks are needed.
+ * Container accounting is done afterwards.
+ */
+static int opack_replay_rec(struct opack *pack, const struct opack_rec *rec)
+{
+	int ret;
+	uint32_t ext;
+	struct pchunk *ch;
+	struct pext e;
+
+	memset(&e, 0, sizeof(e));
+	e.cont = unpack_from_be32(&rec->cont);
+	e.off = unpack_from_be64(&rec->off);
+	e.len = unpack_from_be32(&rec->len);
+	e.crc = unpack_from_be32(&rec->crc);
+	ch = opack_find_chunk(pack, unpack_from_be64(&rec->cid));
+	switch (unpack_from_be16(&rec->ty)) {
+	case OPACK_REC_ADD:
+		if (!ch) {
+			ch = pchunk_alloc(pack, unpack_from_be64(&rec->cid));
+			if (IS_ERR(ch))
+				return FORCE_NEGATIVE(PTR_ERR(ch));
+			ch->indexed = 1;
+		}
+		if (e.len == 0)
+			return 0;
+		ret = pchunk_reserve_ext(ch, 1);
+		if (ret)
+			return ret;
+		e.pos = ch->size;
+		ch->ext[ch->num_ext++] = e;
+		ch->size += e.len;
+		pack->num_extents++;
+		return 0;
+	case OPACK_REC_DEL:
+		if (ch) {
+			pack->num_extents -= ch->num_ext;
+			pack->num_chunks--;
+			RB_REMOVE(pchunks_by_cid, &pack->cid_head, ch);
+			pchunk_free(ch);
+		}
+		return 0;
+	case OPACK_REC_MOVE:
+		ext = unpack_from_be32(&rec->ext);
+		if ((!ch) || (ext >= (uint32_t)ch->num_ext) ||
+				(ch->ext[ext].len != e.len))
+			return -EINVAL;
+		ch->ext[ext].cont = e.cont;
+		ch->ext[ext].off = e.off;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/** Replay the index file.
+ *
+ * If the last records were only partly written when we went down, they are
+ * cut off.
+ */
+static int opack_replay(struct opack *pack, struct fast_log_buf *fb)
+{
+	int i, ret, n;
+	ssize_t res;
+	uint64_t good = 0;
+	struct opack_rec *recs;
+
+	recs = malloc(OPACK_REPLAY_BATCH * sizeof(struct opack_rec));
+	if (!recs)
+		return -ENOMEM;
+	while (1) {
+		res = safe_pread(pack->index_fd, recs,
+			OPACK_REPLAY_BATCH * sizeof(struct opack_rec),
+			good * sizeof(struct opack_rec));
+		if (res < 0) {
+			ret = res;
+			goto done;
+		}
+		n = res / sizeof(struct opack_rec);
+		for (i = 0; i < n; ++i) {
+			if (crc32c(CRC32C_INIT, &recs[i], offsetof(struct
+					opack_rec, rcrc)) !=
+					unpack_from_be32(&recs[i].rcrc))
+				goto torn;
+			ret = opack_replay_rec(pack, &recs[i]);
+			if (ret == -EINVAL) {
+				glitch_log("opack: ignoring bad index record "
+					"%" PRId64 "\n", good);
+			}
+			else if (ret) {
+				goto done;
+			}
+			good++;
+		}
+		if (res < OPACK_REPLAY_BATCH *
+				(ssize_t)sizeof(struct opack_rec))
+			break;
+	}
+torn:
+	pack->index_recs = good;
+	if (ftruncate(pack->index_fd, good * sizeof(struct opack_rec))) {
+		ret = -errno;
+		goto done;
+	}
+	fast_log_ostor(fb, FLOS_PACK_INDEX, 0, 0, 0, good);
+	ret = 0;
+done:
+	free(recs);
+	return ret;
+}
+
+/** Open the containers in the pack directory */
+static int opack_load_conts(struct opack *pack)
+{
+	int ret, fd;
+	unsigned int id;
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct pcont *cont;
+	DIR *dp;
+
+	dp = opendir(pack->dir_path);
+	if (!dp)
+		return -errno;
+	while (1) {
+		errno = 0;
+		de = readdir(dp);
+		if (!de) {
+			ret = -errno;
+			break;
+		}
+		if ((strlen(de->d_name) != 9) ||
+				(sscanf(de->d_name, "c%08x", &id) != 1))
+			continue;
+		opack_get_cont_path(pack, path, sizeof(path), id);
+		RETRY_ON_EINTR(fd, open(path, O_RDWR | O_CLOEXEC));
+		if (fd < 0) {
+			ret = -errno;
+			break;
+		}
+		cont = opack_cont_add(pack, id, fd);
+		if (IS_ERR(cont)) {
+			close(fd);
+			ret = FORCE_NEGATIVE(PTR_ERR(cont));
+			break;
+		}
+	}
+	closedir(dp);
+	return ret;
+}
+
+/** Work out how much of each container is in use, once the index has been
+ * replayed.
+ *
+ * The newest container becomes the active container.  Extents that were
+ * written after its last indexed extent were never acknowledged, so we can
+ * reuse that space.  Other containers are sealed.  Containers with nothing
+ * in them are deleted.
+ */
+static void opack_account_conts(struct opack *pack)
+{
+	int i;
+	uint32_t id;
+	uint64_t end;
+	struct pchunk *ch;
+	struct pcont *cont;
+	char path[PATH_MAX];
+
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head) {
+		for (i = 0; i < ch->num_ext; ++i) {
+			id = ch->ext[i].cont;
+			if ((id >= pack->num_conts) || (!pack->conts[id])) {
+				glitch_log("opack: chunk 0x%" PRIx64 " has "
+					"an extent in container %" PRId32
+					", which is missing\n", ch->cid, id);
+				continue;
+			}
+			cont = pack->conts[id];
+			cont->live += ch->ext[i].len;
+			end = ch->ext[i].off + ch->ext[i].len;
+			if (cont->tail < end)
+				cont->tail = end;
+		}
+	}
+	pack->active = NULL;
+	for (id = pack->num_conts; id-- > 0; ) {
+		cont = pack->conts[id];
+		if (!cont)
+			continue;
+		if (!pack->active) {
+			pack->active = cont;
+			continue;
+		}
+		cont->sealed = 1;
+		if (cont->live == 0) {
+			close(cont->fd);
+			opack_get_cont_path(pack, path, sizeof(path), id);
+			unlink(path);
+			free(cont);
+			pack->conts[id] = NULL;
+		}
+	}
+}
+
+/************************** opack *******************************/
+struct opack *opack_init(const char *path, uint64_t cont_size,
+		int compact_pct)
+{
+	int ret;
+	struct opack *pack;
+	struct fast_log_buf *fb;
+	char ipath[PATH_MAX];
+
+	if (cont_size < OSTOR_CSUM_SEG) {
+		glitch_log("opack_init: containers must be at least %d "
+			"bytes\n", OSTOR_CSUM_SEG);
+		ret = EINVAL;
+		goto error;
+	}
+	if ((mkdir(path, 0770) < 0) && (errno != EEXIST)) {
+		ret = errno;
+		glitch_log("opack_init: failed to create directory '%s': "
+			"error %d (%s)\n", path, ret, terror(ret));
+		goto error;
+	}
+	ret = zsnprintf(ipath, sizeof(ipath), "%s/%s", path,
+		OPACK_INDEX_NAME);
+	if (ret) {
+		ret = ENAMETOOLONG;
+		goto error;
+	}
+	pack = calloc(1, sizeof(struct opack));
+	if (!pack) {
+		ret = ENOMEM;
+		goto error;
+	}
+	pack->dir_path = strdup(path);
+	if (!pack->dir_path) {
+		ret = ENOMEM;
+		goto error_free_pack;
+	}
+	pack->cont_size = cont_size;
+	pack->compact_pct = compact_pct;
+	RB_INIT(&pack->cid_head);
+	ret = pthread_mutex_init(&pack->index_lock, NULL);
+	if (ret)
+		goto error_free_dir_path;
+	ret = pthread_mutex_init(&pack->compact_lock, NULL);
+	if (ret)
+		goto error_free_index_lock;
+	ret = pthread_mutex_init(&pack->lock, NULL);
+	if (ret)
+		goto error_free_compact_lock;
+	ret = pthread_cond_init_mt(&pack->compact_cond);
+	if (ret)
+		goto error_free_lock;
+	RETRY_ON_EINTR(pack->index_fd, open(ipath,
+		O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0660));
+	if (pack->index_fd < 0) {
+		ret = errno;
+		glitch_log("opack_init: failed to open '%s': error %d (%s)\n",
+			ipath, ret, terror(ret));
+		goto error_free_compact_cond;
+	}
+	fb = fast_log_create(g_fast_log_mgr, "opack_init");
+	if (IS_ERR(fb)) {
+		ret = PTR_ERR(fb);
+		goto error_free_state;
+	}
+	ret = opack_load_conts(pack);
+	if (!ret)
+		ret = opack_replay(pack, fb);
+	if (!ret) {
+		opack_account_conts(pack);
+		ret = opack_index_maybe_rewrite(pack, fb);
+	}
+	fast_log_free(fb);
+	if (ret) {
+		glitch_log("opack_init: failed to load '%s': error %d (%s)\n",
+			path, ret, terror(ret));
+		ret = FORCE_POSITIVE(ret);
+		goto error_free_state;
+	}
+	ret = redfish_thread_create(g_fast_log_mgr, &pack->compact_thread,
+		opack_compact_thread, pack);
+	if (ret)
+		goto error_free_state;
+	return pack;
+
+error_free_state:
+	opack_free(pack);
+	return ERR_PTR(FORCE_POSITIVE(ret));
+error_free_compact_cond:
+	pthread_cond_destroy(&pack->compact_cond);
+error_free_lock:
+	pthread_mutex_destroy(&pack->lock);
+error_free_compact_lock:
+	pthread_mutex_destroy(&pack->compact_lock);
+error_free_index_lock:
+	pthread_mutex_destroy(&pack->index_lock);
+error_free_dir_path:
+	free(pack->dir_path);
+error_free_pack:
+	free(pack);
+error:
+	return ERR_PTR(ret);
+}
+
+void opack_shutdown(struct opack *pack)
+{
+	pthread_mutex_lock(&pack->lock);
+	pack->shutdown = 1;
+	pthread_cond_broadcast(&pack->compact_cond);
+	pthread_mutex_unlock(&pack->lock);
+	redfish_thread_join(&pack->compact_thread);
+}
+
+void opack_free(struct opack *pack)
+{
+	uint32_t id;
+	struct pchunk *ch;
+
+	while (1) {
+		ch = RB_MIN(pchunks_by_cid, &pack->cid_head);
+		if (!ch)
+			break;
+		RB_REMOVE(pchunks_by_cid, &pack->cid_head, ch);
+		pchunk_free(ch);
+	}
+	for (id = 0; id < pack->num_conts; ++id) {
+		if (!pack->conts[id])
+			continue;
+		close(pack->conts[id]->fd);
+		free(pack->conts[id]);
+	}
+	free(pack->conts);
+	close(pack->index_fd);
+	pthread_cond_destroy(&pack->compact_cond);
+	pthread_mutex_destroy(&pack->lock);
+	pthread_mutex_destroy(&pack->compact_lock);
+	pthread_mutex_destroy(&pack->index_lock);
+	free(pack->dir_path);
+	free(pack);
+}
+
+/** Append to a chunk which we hold for writing.
+ *
+ * The data is split into extents at segment boundaries, written to the
+ * containers, and only then added to the index.
+ */
+static int opack_append(struct opack *pack, struct fast_log_buf *fb,
+		struct pchunk *ch, const char *data, int32_t dlen,
+		const uint32_t *crc)
+{
+	int i, n, ret, fd, num_ext;
+	int32_t pos, plen;
+	uint32_t whole;
+	struct pext *ext;
+	struct opack_rec *recs;
+
+	num_ext = 0;
+	for (pos = 0; pos < dlen; pos += plen) {
+		plen = OSTOR_CSUM_SEG -
+			((ch->size + pos) & (OSTOR_CSUM_SEG - 1));
+		if (plen > dlen - pos)
+			plen = dlen - pos;
+		num_ext++;
+	}
+	ext = calloc(num_ext ? num_ext : 1, sizeof(struct pext));
+	recs = calloc(num_ext ? num_ext : 1, sizeof(struct opack_rec));
+	if ((!ext) || (!recs)) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	whole = CRC32C_INIT;
+	for (pos = 0, i = 0; pos < dlen; pos += plen, ++i) {
+		plen = OSTOR_CSUM_SEG -
+			((ch->size + pos) & (OSTOR_CSUM_SEG - 1));
+		if (plen > dlen - pos)
+			plen = dlen - pos;
+		ext[i].pos = ch->size + pos;
+		ext[i].len = plen;
+		ext[i].crc = crc32c(CRC32C_INIT, data + pos, plen);
+		whole = crc32c_combine(whole, ext[i].crc, plen);
+	}
+	if (crc && (whole != *crc)) {
+		fast_log_ostor(fb, FLOS_OCHUNK_BAD_CSUM, ch->cid, 0,
+			-EBADMSG, *crc);
+		ret = -EBADMSG;
+		goto done;
+	}
+	pthread_mutex_lock(&pack->lock);
+	ret = pchunk_reserve_ext(ch, num_ext);
+	pthread_mutex_unlock(&pack->lock);
+	if (ret)
+		goto done;
+	for (i = 0, pos = 0; i < num_ext; i += n) {
+		n = opack_alloc(pack, ext + i, num_ext - i, &fd);
+		if (n < 0) {
+			ret = n;
+			break;
+		}
+		plen = ext[i + n - 1].pos + ext[i + n - 1].len - ext[i].pos;
+		ret = safe_pwrite(fd, data + pos, plen, ext[i].off);
+		pos += plen;
+		if (ret) {
+			i += n;
+			break;
+		}
+	}
+	if (ret) {
+		pthread_mutex_lock(&pack->lock);
+		opack_unpend(pack, ext, i, 0);
+		pthread_mutex_unlock(&pack->lock);
+		goto done;
+	}
+	if (num_ext == 0) {
+		/* Writing nothing still creates the chunk. */
+		opack_rec_pack(&recs[0], OPACK_REC_ADD, ch->cid, NULL, 0);
+	}
+	for (i = 0; i < num_ext; ++i)
+		opack_rec_pack(&recs[i], OPACK_REC_ADD, ch->cid, &ext[i], 0);
+	pthread_mutex_lock(&pack->index_lock);
+	ret = opack_index_append(pack, recs, num_ext ? num_ext : 1);
+	pthread_mutex_lock(&pack->lock);
+	opack_unpend(pack, ext, num_ext, !ret);
+	if (!ret) {
+		if (num_ext > 0)
+			memcpy(ch->ext + ch->num_ext, ext,
+				num_ext * sizeof(struct pext));
+		ch->num_ext += num_ext;
+		ch->size += dlen;
+		pack->num_extents += num_ext;
+		ch->indexed = 1;
+	}
+	pthread_mutex_unlock(&pack->lock);
+	pthread_mutex_unlock(&pack->index_lock);
+done:
+	free(recs);
+	free(ext);
+	return ret;
+}
+
+/** Find the first extent which ends after an offset */
+static int pchunk_find_ext(const struct pchunk *ch, uint64_t off)
+{
+	int lo = 0, hi = ch->num_ext, mid;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) / 2);
+		if (ch->ext[mid].pos + ch->ext[mid].len <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/** Read an extent and check its checksum.
+ *
+ * @return		0 on success; -EIO if the extent is missing or corrupt;
+ *			another error code on I/O error
+ */
+static int opack_read_ext(struct opack *pack, struct fast_log_buf *fb,
+		const struct pchunk *ch, const struct pext *e, char *buf)
+{
+	int ret, fd;
+	uint32_t c;
+
+	fd = opack_cont_fd(pack, e->cont);
+	if (fd < 0) {
+		fast_log_ostor(fb, FLOS_OCHUNK_CORRUPT, ch->cid, e->pos,
+			-EIO, e->crc);
+		return -EIO;
+	}
+	ret = safe_pread_exact(fd, buf, e->len, e->off);
+	if (ret)
+		return (ret == -EDOM) ? -EIO : ret;
+	c = crc32c(CRC32C_INIT, buf, e->len);
+	if (c != e->crc) {
+		fast_log_ostor(fb, FLOS_OCHUNK_CORRUPT, ch->cid, e->pos,
+			-EIO, e->crc);
+		return -EIO;
+	}
+	return 0;
+}
+
+/** Read from a chunk which we hold for reading or writing.  See ostor_read.
+ */
+static int32_t pchunk_read(struct opack *pack, struct fast_log_buf *fb,
+		const struct pchunk *ch, uint64_t off, char *data,
+		int32_t dlen, uint32_t *crc)
+{
+	int i;
+	int32_t ret;
+	uint64_t end, start, stop;
+	uint32_t whole, c;
+	const struct pext *e;
+	char *bounce = NULL;
+
+	whole = CRC32C_INIT;
+	end = off + dlen;
+	if (end > ch->size)
+		end = ch->size;
+	for (i = pchunk_find_ext(ch, off); i < ch->num_ext; ++i) {
+		e = &ch->ext[i];
+		if (e->pos >= end)
+			break;
+		start = (e->pos > off) ? e->pos : off;
+		stop = (e->pos + e->len < end) ? (e->pos + e->len) : end;
+		if ((start == e->pos) && (stop == e->pos + e->len)) {
+			/* We want the whole extent, so read it in place. */
+			ret = opack_read_ext(pack, fb, ch, e,
+				data + (e->pos - off));
+			if (ret)
+				goto done;
+			whole = crc32c_combine(whole, e->crc, e->len);
+			continue;
+		}
+		if (!bounce) {
+			bounce = malloc(OSTOR_CSUM_SEG);
+			if (!bounce) {
+				ret = -ENOMEM;
+				goto done;
+			}
+		}
+		ret = opack_read_ext(pack, fb, ch, e, bounce);
+		if (ret)
+			goto done;
+		memcpy(data + (start - off), bounce + (start - e->pos),
+			stop - start);
+		c = crc32c(CRC32C_INIT, data + (start - off), stop - start);
+		whole = crc32c_combine(whole, c, stop - start);
+	}
+	ret = (end > off) ? (end - off) : 0;
+	if (crc)
+		*crc = whole;
+done:
+	free(bounce);
+	return ret;
+}
+
+int32_t opack_read(struct opack *pack, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc)
+{
+	int32_t ret;
+	struct pchunk *ch;
+
+	ch = opack_hold_chunk(pack, cid, 0);
+	if (IS_ERR(ch))
+		return FORCE_NEGATIVE(PTR_ERR(ch));
+	pthread_rwlock_rdlock(&ch->io_lock);
+	if (ch->dead || (!ch->indexed))
+		ret = -ENOENT;
+	else
+		ret = pchunk_read(pack, fb, ch, off, data, dlen, crc);
+	pthread_rwlock_unlock(&ch->io_lock);
+	opack_release_chunk(pack, ch);
+	return ret;
+}
+
+/** Find out how much of a write is already in a chunk which we hold for
+ * writing.  See ochunk_overlap in osd/ostor.c.
+ */
+static int32_t pchunk_overlap(struct opack *pack, struct fast_log_buf *fb,
+		const struct pchunk *ch, uint64_t off, const char *data,
+		int32_t dlen, const uint32_t *crc)
+{
+	int32_t ret, olen;
+	char *buf;
+
+	if (off > ch->size)
+		return -ERANGE;
+	olen = dlen;
+	if (off + olen > ch->size)
+		olen = ch->size - off;
+	if (olen == 0)
+		return 0;
+	if (crc && (crc32c(CRC32C_INIT, data, dlen) != *crc)) {
+		fast_log_ostor(fb, FLOS_OCHUNK_BAD_CSUM, ch->cid, off,
+			-EBADMSG, *crc);
+		return -EBADMSG;
+	}
+	buf = malloc(olen);
+	if (!buf)
+		return -ENOMEM;
+	ret = pchunk_read(pack, fb, ch, off, buf, olen, NULL);
+	if (ret >= 0)
+		ret = ((ret == olen) && (!memcmp(buf, data, olen))) ?
+			olen : -EEXIST;
+	free(buf);
+	return ret;
+}
+
+int opack_write(struct opack *pack, struct fast_log_buf *fb, uint64_t cid,
+		uint64_t off, const char *data, int32_t dlen,
+		const uint32_t *crc)
+{
+	int ret;
+	struct pchunk *ch;
+
+	while (1) {
+		ch = opack_hold_chunk(pack, cid, 1);
+		if (IS_ERR(ch))
+			return FORCE_NEGATIVE(PTR_ERR(ch));
+		pthread_rwlock_wrlock(&ch->io_lock);
+		/* If the chunk was unlinked while we were waiting for it, the
+		 * write goes to a new, empty chunk. */
+		if (!ch->dead)
+			break;
+		pthread_rwlock_unlock(&ch->io_lock);
+		opack_release_chunk(pack, ch);
+	}
+	ret = pchunk_overlap(pack, fb, ch, off, data, dlen, crc);
+	if (ret == 0) {
+		ret = opack_append(pack, fb, ch, data, dlen, crc);
+	}
+	else if (ret > 0) {
+		ret = (ret < dlen) ? opack_append(pack, fb, ch, data + ret,
+			dlen - ret, NULL) : 0;
+	}
+	pthread_rwlock_unlock(&ch->io_lock);
+	opack_release_chunk(pack, ch);
+	return ret;
+}
+
+int opack_unlink(struct opack *pack, POSSIBLY_UNUSED(struct fast_log_buf *fb),
+		uint64_t cid)
+{
+	int ret;
+	struct pchunk *ch;
+	struct opack_rec rec;
+
+	ch = opack_hold_chunk(pack, cid, 0);
+	if (IS_ERR(ch))
+		return FORCE_NEGATIVE(PTR_ERR(ch));
+	pthread_rwlock_wrlock(&ch->io_lock);
+	if (ch->dead || (!ch->indexed)) {
+		ret = -ENOENT;
+		goto done;
+	}
+	opack_rec_pack(&rec, OPACK_REC_DEL, cid, NULL, 0);
+	pthread_mutex_lock(&pack->index_lock);
+	ret = opack_index_append(pack, &rec, 1);
+	if (!ret) {
+		pthread_mutex_lock(&pack->lock);
+		pchunk_kill(pack, ch);
+		pthread_mutex_unlock(&pack->lock);
+	}
+	pthread_mutex_unlock(&pack->index_lock);
+done:
+	pthread_rwlock_unlock(&ch->io_lock);
+	opack_release_chunk(pack, ch);
+	return ret;
+}
+
+int opack_verify(struct opack *pack, POSSIBLY_UNUSED(struct fast_log_buf *fb),
+		uint64_t cid)
+{
+	int i, ret = 0;
+	const struct pext *e;
+	struct pchunk *ch;
+
+	ch = opack_hold_chunk(pack, cid, 0);
+	if (IS_ERR(ch))
+		return FORCE_NEGATIVE(PTR_ERR(ch));
+	pthread_rwlock_rdlock(&ch->io_lock);
+	pthread_mutex_lock(&pack->lock);
+	if (ch->dead || (!ch->indexed))
+		ret = -ENOENT;
+	for (i = 0; (ret == 0) && (i < ch->num_ext); ++i) {
+		e = &ch->ext[i];
+		if ((e->cont >= pack->num_conts) || (!pack->conts[e->cont]) ||
+				(e->off + e->len > pack->cont_size))
+			ret = -EIO;
+	}
+	pthread_mutex_unlock(&pack->lock);
+	pthread_rwlock_unlock(&ch->io_lock);
+	opack_release_chunk(pack, ch);
+	return ret;
+}
+
+int opack_list(struct opack *pack, uint64_t mask, uint64_t val,
+		uint64_t **cids)
+{
+	int num = 0, max = 0;
+	struct pchunk *ch;
+
+	pthread_mutex_lock(&pack->lock);
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head) {
+		if (ch->indexed && ((ch->cid & mask) == val))
+			max++;
+	}
+	pthread_mutex_unlock(&pack->lock);
+	*cids = NULL;
+	if (max == 0)
+		return 0;
+	*cids = malloc(max * sizeof(uint64_t));
+	if (!*cids)
+		return -ENOMEM;
+	/* Chunks created since we counted will be seen next time. */
+	pthread_mutex_lock(&pack->lock);
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head) {
+		if (num >= max)
+			break;
+		if (ch->indexed && ((ch->cid & mask) == val))
+			(*cids)[num++] = ch->cid;
+	}
+	pthread_mutex_unlock(&pack->lock);
+	return num;
+}
+
+/************************** compaction *******************************/
+/** Move a chunk's extents out of a container.
+ *
+ * Should be called with the compaction lock held.
+ *
+ * @return		Number of extents moved, or a negative error code
+ */
+static int opack_move_chunk(struct opack *pack, struct fast_log_buf *fb,
+		struct pchunk *ch, uint32_t victim, char *buf)
+{
+	int i, ret = 0, fd, moved = 0;
+	struct pext e;
+	struct opack_rec rec;
+
+	pthread_rwlock_wrlock(&ch->io_lock);
+	for (i = 0; (!ch->dead) && (i < ch->num_ext); ++i) {
+		if (ch->ext[i].cont != victim)
+			continue;
+		e = ch->ext[i];
+		ret = opack_read_ext(pack, fb, ch, &e, buf);
+		/* Carry corrupt data over as it is, so that reads of it keep
+		 * failing. */
+		if (ret && (ret != -EIO))
+			break;
+		ret = opack_alloc(pack, &e, 1, &fd);
+		if (ret < 0)
+			break;
+		ret = safe_pwrite(fd, buf, e.len, e.off);
+		pthread_mutex_lock(&pack->index_lock);
+		if (!ret) {
+			opack_rec_pack(&rec, OPACK_REC_MOVE, ch->cid, &e, i);
+			ret = opack_index_append(pack, &rec, 1);
+		}
+		pthread_mutex_lock(&pack->lock);
+		opack_unpend(pack, &e, 1, !ret);
+		if (!ret) {
+			pack->conts[victim]->live -= e.len;
+			ch->ext[i] = e;
+			moved++;
+		}
+		pthread_mutex_unlock(&pack->lock);
+		pthread_mutex_unlock(&pack->index_lock);
+		if (ret)
+			break;
+	}
+	pthread_rwlock_unlock(&ch->io_lock);
+	return ret ? ret : moved;
+}
+
+/** Make everything we have written so far durable */
+static int opack_sync(struct opack *pack, uint32_t victim)
+{
+	int ret = 0, *fds;
+	uint32_t id, n = 0;
+
+	pthread_mutex_lock(&pack->lock);
+	fds = malloc(pack->num_conts * sizeof(int));
+	if (fds) {
+		for (id = 0; id < pack->num_conts; ++id) {
+			if ((id != victim) && pack->conts[id])
+				fds[n++] = pack->conts[id]->fd;
+		}
+	}
+	pthread_mutex_unlock(&pack->lock);
+	if (!fds)
+		return -ENOMEM;
+	/* Containers only go away while the compaction lock is held, so
+	 * these file descriptors stay open. */
+	for (id = 0; id < n; ++id) {
+		if (fdatasync(fds[id]))
+			ret = -errno;
+	}
+	free(fds);
+	return ret;
+}
+
+int opack_compact(struct opack *pack, struct fast_log_buf *fb)
+{
+	int i, ret, num_ch = 0, moved = 0;
+	uint32_t id;
+	struct pcont *cont, *victim = NULL;
+	struct pchunk *ch, **chs = NULL;
+	char *buf = NULL, path[PATH_MAX];
+
+	pthread_mutex_lock(&pack->compact_lock);
+	pthread_mutex_lock(&pack->lock);
+	if (pack->shutdown) {
+		pthread_mutex_unlock(&pack->lock);
+		ret = -ESHUTDOWN;
+		goto done;
+	}
+	for (id = 0; id < pack->num_conts; ++id) {
+		cont = pack->conts[id];
+		if ((!cont) || (!opack_cont_compactable(pack, cont)))
+			continue;
+		if ((!victim) || (cont->live < victim->live))
+			victim = cont;
+	}
+	if (!victim) {
+		pthread_mutex_unlock(&pack->lock);
+		ret = 0;
+		goto done;
+	}
+	/* Find the chunks with extents in the victim.  Nothing new can be put
+	 * there, since it is sealed. */
+	chs = calloc(pack->num_chunks ? pack->num_chunks : 1,
+		sizeof(struct pchunk*));
+	if (!chs) {
+		pthread_mutex_unlock(&pack->lock);
+		ret = -ENOMEM;
+		goto done;
+	}
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head) {
+		for (i = 0; i < ch->num_ext; ++i) {
+			if (ch->ext[i].cont == victim->id) {
+				ch->refcnt++;
+				chs[num_ch++] = ch;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&pack->lock);
+	ret = 0;
+	buf = malloc(OSTOR_CSUM_SEG);
+	if (!buf)
+		ret = -ENOMEM;
+	for (i = 0; i < num_ch; ++i) {
+		if (ret >= 0) {
+			ret = opack_move_chunk(pack, fb, chs[i], victim->id,
+				buf);
+			if (ret > 0)
+				moved += ret;
+		}
+		opack_release_chunk(pack, chs[i]);
+	}
+	if (ret < 0)
+		goto done;
+	/* The copies must be on disk before the originals go away. */
+	ret = opack_sync(pack, victim->id);
+	if (ret)
+		goto done;
+	pthread_mutex_lock(&pack->index_lock);
+	if (fdatasync(pack->index_fd))
+		ret = -errno;
+	else
+		ret = opack_index_maybe_rewrite(pack, fb);
+	pthread_mutex_unlock(&pack->index_lock);
+	if (ret)
+		goto done;
+	pthread_mutex_lock(&pack->lock);
+	if (victim->live != 0) {
+		/* Someone must have failed to read an extent. */
+		pthread_mutex_unlock(&pack->lock);
+		ret = -EIO;
+		goto done;
+	}
+	pack->conts[victim->id] = NULL;
+	pack->num_compacted++;
+	pthread_mutex_unlock(&pack->lock);
+	close(victim->fd);
+	opack_get_cont_path(pack, path, sizeof(path), victim->id);
+	if (unlink(path)) {
+		ret = errno;
+		glitch_log("opack: failed to unlink %s: error %d (%s)\n",
+			path, ret, terror(ret));
+	}
+	fast_log_ostor(fb, FLOS_PACK_COMPACT, victim->id, 0, 0, moved);
+	free(victim);
+	ret = 1;
+done:
+	pthread_mutex_unlock(&pack->compact_lock);
+	free(buf);
+	free(chs);
+	return ret;
+}
+
+static int opack_compact_thread(struct redfish_thread *rt)
+{
+	int ret;
+	uint64_t gen;
+	struct timespec ts;
+	struct opack *pack = rt->priv;
+
+	while (1) {
+		pthread_mutex_lock(&pack->lock);
+		gen = pack->compact_gen;
+		pthread_mutex_unlock(&pack->lock);
+		ret = 0;
+		if (pack->compact_pct > 0)
+			ret = opack_compact(pack, rt->fb);
+		if (ret > 0)
+			continue;
+		if ((ret < 0) && (ret != -ESHUTDOWN)) {
+			glitch_log("opack: compaction failed: error %d (%s)\n",
+				ret, terror(ret));
+		}
+		if (clock_gettime(CLOCK_MONOTONIC, &ts))
+			abort();
+		timespec_add_sec(&ts, OPACK_COMPACT_PERIOD_SEC);
+		pthread_mutex_lock(&pack->lock);
+		if (pack->shutdown) {
+			pthread_mutex_unlock(&pack->lock);
+			return 0;
+		}
+		/* If a container was sealed while we were looking, go around
+		 * again right away. */
+		if ((pack->compact_gen == gen) || (ret < 0))
+			pthread_cond_timedwait(&pack->compact_cond,
+				&pack->lock, &ts);
+		pthread_mutex_unlock(&pack->lock);
+	}
+}
+
+void opack_get_stats(struct opack *pack, struct opack_stats *stats)
+{
+	uint32_t id;
+	struct pcont *cont;
+	struct pchunk *ch;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&pack->lock);
+	stats->num_chunks = pack->num_chunks;
+	stats->num_extents = pack->num_extents;
+	stats->num_compacted = pack->num_compacted;
+	RB_FOREACH(ch, pchunks_by_cid, &pack->cid_head)
+		stats->live_bytes += ch->size;
+	for (id = 0; id < pack->num_conts; ++id) {
+		cont = pack->conts[id];
+		if (!cont)
+			continue;
+		stats->num_containers++;
+		stats->used_bytes += cont->tail;
+	}
+	pthread_mutex_unlock(&pack->lock);
+}
+
+uint64_t opack_num_chunks(struct opack *pack)
+{
+	uint64_t num;
+
+	pthread_mutex_lock(&pack->lock);
+	num = pack->num_chunks;
+	pthread_mutex_unlock(&pack->lock);
+	return num;
+}
@@ -0,0 +1,157 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_OSD_OPACK_DOT_H
+#define REDFISH_OSD_OPACK_DOT_H
+
+#include <stdint.h> /* for uint64_t, etc. */
+
+struct fast_log_buf;
+struct opack;
+
+/* The packed object store
+ *
+ * Rather than giving each chunk a file of its own, the packed store appends
+ * chunk data to a few large container files, which are preallocated when they
+ * are created.  Each write becomes one or more extents in the current
+ * container.  No extent crosses an OSTOR_CSUM_SEG boundary in the chunk, and
+ * each carries the CRC32C of its data, which is checked on every read.
+ *
+ * Where each extent lives is recorded in an index file, which is an
+ * append-only log of fixed-size records.  It is replayed into memory when the
+ * store is opened.  Unlinking a chunk appends a record saying so.
+ *
+ * Unlinked chunks leave dead space behind in the containers.  When a full
+ * container is mostly dead, the live extents in it are copied to the current
+ * container, and it is deleted.  The index is rewritten from memory when most
+ * of its records are obsolete.
+ */
+
+/** Packed object store statistics */
+struct opack_stats {
+	/** Number of chunks */
+	uint64_t num_chunks;
+	/** Number of extents */
+	uint64_t num_extents;
+	/** Number of container files */
+	uint64_t num_containers;
+	/** Bytes of chunk data */
+	uint64_t live_bytes;
+	/** Bytes used in the containers, including dead space */
+	uint64_t used_bytes;
+	/** Number of containers that have been compacted */
+	uint64_t num_compacted;
+};
+
+/** Open the packed object store, creating it if necessary
+ *
+ * @param path		The directory to keep the containers and index in
+ * @param cont_size	Size of each container file, in bytes
+ * @param compact_pct	A full container is compacted once less than this
+ *			percentage of it holds live data.  0 disables
+ *			compaction.
+ *
+ * @return		An error pointer on error; the packed store otherwise
+ */
+extern struct opack *opack_init(const char *path, uint64_t cont_size,
+		int compact_pct);
+
+/** Shut down the packed object store
+ *
+ * After this function has been called, all further calls to the store will
+ * return ESHUTDOWN.
+ *
+ * @param pack		The packed store
+ */
+extern void opack_shutdown(struct opack *pack);
+
+/** Free the packed object store
+ *
+ * @param pack		The packed store
+ */
+extern void opack_free(struct opack *pack);
+
+/** Write to a chunk.  See ostor_write. */
+extern int opack_write(struct opack *pack, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, const char *data, int32_t dlen,
+		const uint32_t *crc);
+
+/** Read from a chunk.  See ostor_read. */
+extern int32_t opack_read(struct opack *pack, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc);
+
+/** Unlink a chunk.  See ostor_unlink. */
+extern int opack_unlink(struct opack *pack, struct fast_log_buf *fb,
+		uint64_t cid);
+
+/** Validate a chunk
+ *
+ * This checks that the chunk exists, and that each of its extents lies inside
+ * a container.  It doesn't read the data.
+ *
+ * @return		0 if the chunk exists; -ENOENT if it does not; -EIO if
+ *			an extent is missing
+ */
+extern int opack_verify(struct opack *pack, struct fast_log_buf *fb,
+		uint64_t cid);
+
+/** List the chunks in the store
+ *
+ * @param pack		The packed store
+ * @param mask		Only list chunks whose IDs, ANDed with mask...
+ * @param val		...are equal to val
+ * @param cids		(out param) a malloced array of the chunk IDs, in
+ *			ascending order, or NULL if there are none
+ *
+ * @return		The number of chunks listed; a negative error code
+ *			otherwise
+ */
+extern int opack_list(struct opack *pack, uint64_t mask, uint64_t val,
+		uint64_t **cids);
+
+/** Compact the emptiest container, if any container needs it
+ *
+ * This is normally done by a background thread.
+ *
+ * @param pack		The packed store
+ * @param fb		The fast log buffer
+ *
+ * @return		1 if a container was compacted; 0 if there was nothing
+ *			to do; a negative error code otherwise
+ */
+extern int opack_compact(struct opack *pack, struct fast_log_buf *fb);
+
+/** Get packed object store statistics
+ *
+ * @param pack		The packed store
+ * @param stats		(out param) the statistics
+ */
+extern void opack_get_stats(struct opack *pack, struct opack_stats *stats);
+
+/** Count the chunks in the store
+ *
+ * This is much cheaper than opack_get_stats.
+ *
+ * @param pack		The packed store
+ *
+ * @return		The number of chunks
+ */
+extern uint64_t opack_num_chunks(struct opack *pack);
+
+#endif
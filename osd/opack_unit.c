@@ -0,0 +1,426 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/alarm.h"
+#include "core/process_ctx.h"
+#include "osd/opack.h"
+#include "osd/ostor.h"
+#include "util/crc32c.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/string.h"
+#include "util/tempfile.h"
+#include "util/test.h"
+#include "util/thread.h"
+#include "util/time.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Container size for most of the tests.  This is small, so that we go
+ * through plenty of containers. */
+#define OPACKU_CONT_SIZE (4 * OSTOR_CSUM_SEG)
+
+/** Length of the chunks written by opacku_compact_test */
+#define OPACKU_CHUNK_LEN 20000
+
+/** Number of chunks written by opacku_compact_test */
+#define OPACKU_NUM_CHUNKS 40
+
+#define OPACKU_NUM_THREADS 4
+
+#define OPACKU_THREAD_CHUNKS 30
+
+#define OPACKU_THREAD_ROUNDS 3
+
+/** Length of each write made by opacku_thread */
+#define OPACKU_THREAD_LEN 3000
+
+static char *g_data;
+
+/** Fill in the test data.  Chunk cid is g_data + cid, so that each chunk
+ * has different contents. */
+static int opacku_init_data(void)
+{
+	int i, len;
+
+	len = 8 * OSTOR_CSUM_SEG;
+	g_data = malloc(len);
+	EXPECT_NOT_EQ(g_data, NULL);
+	for (i = 0; i < len; ++i)
+		g_data[i] = random();
+	return 0;
+}
+
+/** Check the contents of a chunk written with g_data */
+static int opacku_check(struct opack *pack, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, int32_t len, int32_t size)
+{
+	char *buf;
+	uint32_t crc;
+	int32_t expect;
+
+	buf = calloc(1, len + 1);
+	EXPECT_NOT_EQ(buf, NULL);
+	expect = ((int32_t)off >= size) ? 0 : (size - (int32_t)off);
+	if (expect > len)
+		expect = len;
+	EXPECT_EQ(opack_read(pack, fb, cid, off, buf, len, &crc), expect);
+	EXPECT_ZERO(memcmp(buf, g_data + cid + off, expect));
+	EXPECT_EQ(crc, crc32c(CRC32C_INIT, g_data + cid + off, expect));
+	free(buf);
+	return 0;
+}
+
+static int opacku_simple_test(const char *tdir, struct fast_log_buf *fb)
+{
+	struct opack *pack;
+	uint32_t crc;
+	char buf[10];
+
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 50);
+	EXPECT_NOT_ERRPTR(pack);
+	/* Appends that start and end in the middle of segments, some of them
+	 * bigger than a container */
+	EXPECT_ZERO(opack_write(pack, fb, 1, 0, g_data + 1, 1000, NULL));
+	crc = crc32c(CRC32C_INIT, g_data + 1 + 1000, 2 * OSTOR_CSUM_SEG);
+	EXPECT_ZERO(opack_write(pack, fb, 1, 1000, g_data + 1 + 1000,
+		2 * OSTOR_CSUM_SEG, &crc));
+	crc ^= 1;
+	EXPECT_EQ(opack_write(pack, fb, 1, 1000 + (2 * OSTOR_CSUM_SEG),
+		g_data + 1 + 1000 + (2 * OSTOR_CSUM_SEG), 10, &crc),
+		-EBADMSG);
+	EXPECT_ZERO(opack_write(pack, fb, 1, 1000 + (2 * OSTOR_CSUM_SEG),
+		g_data + 1 + 1000 + (2 * OSTOR_CSUM_SEG),
+		3 * OSTOR_CSUM_SEG, NULL));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 0, 5 * OSTOR_CSUM_SEG + 1000,
+		5 * OSTOR_CSUM_SEG + 1000));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 10, 20,
+		5 * OSTOR_CSUM_SEG + 1000));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 900, OSTOR_CSUM_SEG,
+		5 * OSTOR_CSUM_SEG + 1000));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, OSTOR_CSUM_SEG - 10,
+		OSTOR_CSUM_SEG + 20, 5 * OSTOR_CSUM_SEG + 1000));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 5 * OSTOR_CSUM_SEG, 2000,
+		5 * OSTOR_CSUM_SEG + 1000));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 6 * OSTOR_CSUM_SEG, 10,
+		5 * OSTOR_CSUM_SEG + 1000));
+	EXPECT_ZERO(opack_verify(pack, fb, 1));
+
+	/* An empty write creates an empty chunk */
+	EXPECT_EQ(opack_read(pack, fb, 2, 0, buf, sizeof(buf), NULL),
+		-ENOENT);
+	EXPECT_ZERO(opack_write(pack, fb, 2, 0, g_data, 0, NULL));
+	EXPECT_ZERO(opacku_check(pack, fb, 2, 0, 10, 0));
+	EXPECT_ZERO(opack_verify(pack, fb, 2));
+
+	/* Unlinked chunks are gone, and start out empty if they are written
+	 * again */
+	EXPECT_ZERO(opack_unlink(pack, fb, 1));
+	EXPECT_EQ(opack_unlink(pack, fb, 1), -ENOENT);
+	EXPECT_EQ(opack_verify(pack, fb, 1), -ENOENT);
+	EXPECT_EQ(opack_read(pack, fb, 1, 0, buf, sizeof(buf), NULL),
+		-ENOENT);
+	EXPECT_EQ(opack_write(pack, fb, 1, 100, g_data + 1, 100, NULL),
+		-ERANGE);
+	EXPECT_ZERO(opack_write(pack, fb, 1, 0, g_data + 1, 100, NULL));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 0, 200, 100));
+
+	/* Writes which are sent again are only done once.  The part that was
+	 * already written has to match. */
+	EXPECT_ZERO(opack_write(pack, fb, 1, 0, g_data + 1, 100, NULL));
+	EXPECT_ZERO(opack_write(pack, fb, 1, 50, g_data + 51, 10, NULL));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 0, 200, 100));
+	EXPECT_ZERO(opack_write(pack, fb, 1, 50, g_data + 51, 100, NULL));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 0, 200, 150));
+	EXPECT_EQ(opack_write(pack, fb, 1, 50, g_data + 52, 100, NULL),
+		-EEXIST);
+	EXPECT_EQ(opack_write(pack, fb, 1, 151, g_data + 152, 10, NULL),
+		-ERANGE);
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 0, 200, 150));
+	opack_shutdown(pack);
+	EXPECT_EQ(opack_write(pack, fb, 1, 150, g_data + 151, 100, NULL),
+		-ESHUTDOWN);
+	opack_free(pack);
+	return 0;
+}
+
+/** Write some chunks, reopen the store, and check that they survived.  Then
+ * damage the end of the index as though we crashed while writing it. */
+static int opacku_reopen_test(const char *tdir, struct fast_log_buf *fb)
+{
+	int fd;
+	uint64_t cid;
+	struct opack *pack;
+	struct opack_stats stats;
+	char path[PATH_MAX];
+
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 50);
+	EXPECT_NOT_ERRPTR(pack);
+	for (cid = 1; cid < 10; ++cid) {
+		EXPECT_ZERO(opack_write(pack, fb, cid, 0, g_data + cid,
+			cid * 5000, NULL));
+		EXPECT_ZERO(opack_write(pack, fb, cid, cid * 5000,
+			g_data + cid + (cid * 5000), 1000, NULL));
+	}
+	EXPECT_ZERO(opack_unlink(pack, fb, 3));
+	EXPECT_ZERO(opack_unlink(pack, fb, 4));
+	EXPECT_ZERO(opack_write(pack, fb, 4, 0, g_data + 4, 10, NULL));
+	opack_shutdown(pack);
+	opack_free(pack);
+
+	EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/index", tdir));
+	fd = open(path, O_WRONLY | O_APPEND);
+	EXPECT_GT(fd, -1);
+	EXPECT_EQ(write(fd, g_data, 17), 17);
+	EXPECT_ZERO(close(fd));
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 50);
+	EXPECT_NOT_ERRPTR(pack);
+	for (cid = 1; cid < 10; ++cid) {
+		if (cid == 3) {
+			EXPECT_EQ(opack_verify(pack, fb, cid), -ENOENT);
+			continue;
+		}
+		EXPECT_ZERO(opack_verify(pack, fb, cid));
+		EXPECT_ZERO(opacku_check(pack, fb, cid, 0, 100000,
+			(cid == 4) ? 10 : (cid * 5000) + 1000));
+	}
+	opack_get_stats(pack, &stats);
+	EXPECT_EQ(stats.num_chunks, 8);
+	/* New data goes after the old data in the newest container. */
+	EXPECT_ZERO(opack_write(pack, fb, 1, 6000, g_data + 1 + 6000, 100,
+		NULL));
+	EXPECT_ZERO(opacku_check(pack, fb, 1, 0, 100000, 6100));
+	opack_shutdown(pack);
+	opack_free(pack);
+	return 0;
+}
+
+static int opacku_compact_test(const char *tdir, struct fast_log_buf *fb)
+{
+	uint64_t cid;
+	struct opack *pack;
+	struct opack_stats before, after;
+	char path[PATH_MAX];
+
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 50);
+	EXPECT_NOT_ERRPTR(pack);
+	for (cid = 1; cid <= OPACKU_NUM_CHUNKS; ++cid) {
+		EXPECT_ZERO(opack_write(pack, fb, cid, 0, g_data + cid,
+			OPACKU_CHUNK_LEN, NULL));
+	}
+	/* Unlink three chunks out of every four */
+	for (cid = 1; cid <= OPACKU_NUM_CHUNKS; ++cid) {
+		if (cid & 3)
+			EXPECT_ZERO(opack_unlink(pack, fb, cid));
+	}
+	opack_get_stats(pack, &before);
+	EXPECT_EQ(before.live_bytes,
+		(OPACKU_NUM_CHUNKS / 4) * OPACKU_CHUNK_LEN);
+	while (1) {
+		int ret = opack_compact(pack, fb);
+		EXPECT_GE(ret, 0);
+		if (ret == 0)
+			break;
+	}
+	opack_get_stats(pack, &after);
+	EXPECT_GT(after.num_compacted, 0);
+	EXPECT_LT(after.num_containers, before.num_containers);
+	EXPECT_EQ(after.live_bytes, before.live_bytes);
+	for (cid = 1; cid <= OPACKU_NUM_CHUNKS; ++cid) {
+		if (cid & 3)
+			continue;
+		EXPECT_ZERO(opacku_check(pack, fb, cid, 0, OPACKU_CHUNK_LEN,
+			OPACKU_CHUNK_LEN));
+	}
+	opack_shutdown(pack);
+	opack_free(pack);
+
+	/* The moves were recorded in the index */
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 50);
+	EXPECT_NOT_ERRPTR(pack);
+	opack_get_stats(pack, &after);
+	EXPECT_EQ(after.live_bytes, before.live_bytes);
+	for (cid = 1; cid <= OPACKU_NUM_CHUNKS; ++cid) {
+		if (cid & 3) {
+			EXPECT_EQ(opack_verify(pack, fb, cid), -ENOENT);
+			continue;
+		}
+		EXPECT_ZERO(opacku_check(pack, fb, cid, 0, OPACKU_CHUNK_LEN,
+			OPACKU_CHUNK_LEN));
+	}
+
+	/* The first container was mostly dead, so it should be gone. */
+	EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/c%08x", tdir, 0));
+	EXPECT_EQ(access(path, F_OK), -1);
+	opack_shutdown(pack);
+	opack_free(pack);
+	return 0;
+}
+
+/** Flip a bit in the first extent of the first container, which holds the
+ * start of the first chunk written to a fresh store. */
+static int opacku_corrupt_test(const char *tdir, struct fast_log_buf *fb)
+{
+	int fd;
+	struct opack *pack;
+	char path[PATH_MAX], b, buf[100];
+
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 50);
+	EXPECT_NOT_ERRPTR(pack);
+	EXPECT_ZERO(opack_write(pack, fb, 5, 0, g_data + 5, 1000, NULL));
+	EXPECT_ZERO(opack_write(pack, fb, 5, 1000, g_data + 5 + 1000,
+		1000, NULL));
+	EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/c%08x", tdir, 0));
+	fd = open(path, O_RDWR);
+	EXPECT_GT(fd, -1);
+	EXPECT_EQ(pread(fd, &b, 1, 500), 1);
+	b ^= 0x10;
+	EXPECT_EQ(pwrite(fd, &b, 1, 500), 1);
+	EXPECT_ZERO(close(fd));
+	EXPECT_EQ(opack_read(pack, fb, 5, 0, buf, sizeof(buf), NULL), -EIO);
+	EXPECT_EQ(opack_read(pack, fb, 5, 990, buf, sizeof(buf), NULL), -EIO);
+	EXPECT_ZERO(opacku_check(pack, fb, 5, 1000, 1000, 2000));
+	opack_shutdown(pack);
+	opack_free(pack);
+	return 0;
+}
+
+static int g_next_thread;
+
+static int opacku_thread(struct redfish_thread *rt)
+{
+	int i, round;
+	uint64_t cid, base;
+	struct opack *pack = rt->priv;
+
+	base = (uint64_t)(__sync_fetch_and_add(&g_next_thread, 1) + 1) * 100;
+	for (round = 0; round < OPACKU_THREAD_ROUNDS; ++round) {
+		for (i = 0; i < OPACKU_THREAD_CHUNKS; ++i) {
+			cid = base + i;
+			EXPECT_ZERO(opack_write(pack, rt->fb, cid,
+				round * OPACKU_THREAD_LEN,
+				g_data + cid + (round * OPACKU_THREAD_LEN),
+				OPACKU_THREAD_LEN, NULL));
+		}
+	}
+	for (i = 0; i < OPACKU_THREAD_CHUNKS; ++i) {
+		cid = base + i;
+		EXPECT_ZERO(opacku_check(pack, rt->fb, cid, 0,
+			OPACKU_THREAD_ROUNDS * OPACKU_THREAD_LEN,
+			OPACKU_THREAD_ROUNDS * OPACKU_THREAD_LEN));
+		if (i & 1)
+			EXPECT_ZERO(opack_unlink(pack, rt->fb, cid));
+	}
+	/* Keep reading while the compaction thread moves things around */
+	for (round = 0; round < OPACKU_THREAD_ROUNDS; ++round) {
+		for (i = 0; i < OPACKU_THREAD_CHUNKS; ++i) {
+			cid = base + i;
+			if (i & 1) {
+				EXPECT_EQ(opack_verify(pack, rt->fb, cid),
+					-ENOENT);
+				continue;
+			}
+			EXPECT_ZERO(opacku_check(pack, rt->fb, cid,
+				round * 1000, OPACKU_THREAD_LEN,
+				OPACKU_THREAD_ROUNDS * OPACKU_THREAD_LEN));
+		}
+	}
+	return 0;
+}
+
+/** Several threads write, read, and unlink chunks, while containers are
+ * compacted underneath them. */
+static int opacku_threaded_test(const char *tdir, struct fast_log_buf *fb)
+{
+	int i, ret;
+	struct opack *pack;
+	struct opack_stats stats;
+	struct redfish_thread threads[OPACKU_NUM_THREADS];
+
+	pack = opack_init(tdir, OPACKU_CONT_SIZE, 90);
+	EXPECT_NOT_ERRPTR(pack);
+	for (i = 0; i < OPACKU_NUM_THREADS; ++i) {
+		EXPECT_ZERO(redfish_thread_create(g_fast_log_mgr,
+			&threads[i], opacku_thread, pack));
+	}
+	for (i = 0; i < OPACKU_NUM_THREADS; ++i) {
+		EXPECT_ZERO(redfish_thread_join(&threads[i]));
+	}
+	/* Whatever the compaction thread hasn't got to yet, do now. */
+	do {
+		ret = opack_compact(pack, fb);
+		EXPECT_GE(ret, 0);
+	} while (ret == 1);
+	opack_get_stats(pack, &stats);
+	EXPECT_EQ(stats.num_chunks,
+		OPACKU_NUM_THREADS * OPACKU_THREAD_CHUNKS / 2);
+	EXPECT_EQ(stats.live_bytes, stats.num_chunks *
+		OPACKU_THREAD_ROUNDS * OPACKU_THREAD_LEN);
+	EXPECT_GT(stats.num_compacted, 0);
+	opack_shutdown(pack);
+	opack_free(pack);
+	return 0;
+}
+
+int main(POSSIBLY_UNUSED(int argc), char **argv)
+{
+	char tdir[PATH_MAX];
+	struct fast_log_buf *fb;
+	timer_t timer;
+	time_t t;
+
+	EXPECT_ZERO(utility_ctx_init(argv[0])); /* for g_fast_log_mgr */
+	t = mt_time() + 600;
+	EXPECT_ZERO(mt_set_alarm(t, "opack_unit timed out", &timer));
+	fb = fast_log_create(g_fast_log_mgr, "main");
+	EXPECT_NOT_ERRPTR(fb);
+	EXPECT_ZERO(opacku_init_data());
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(opacku_simple_test(tdir, fb));
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(opacku_reopen_test(tdir, fb));
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(opacku_compact_test(tdir, fb));
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(opacku_corrupt_test(tdir, fb));
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(opacku_threaded_test(tdir, fb));
+
+	EXPECT_ZERO(mt_deactivate_alarm(timer));
+	fast_log_free(fb);
+	free(g_data);
+	process_ctx_shutdown();
+
+	return EXIT_SUCCESS;
+}
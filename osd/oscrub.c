@@ -0,0 +1,330 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/glitch_log.h"
+#include "core/process_ctx.h"
+#include "osd/fast_log.h"
+#include "osd/oscrub.h"
+#include "osd/ostor.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/platform/ioprio.h"
+#include "util/terror.h"
+#include "util/thread.h"
+#include "util/time.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Size of the pieces that we read chunks in */
+#define OSCRUB_PIECE_SZ (1024 * 1024)
+
+struct oscrub {
+	/** The ostor we are scrubbing */
+	struct ostor *ostor;
+	/** Maximum number of bytes to read per second, or 0 for no limit */
+	uint64_t rate;
+	/** Seconds to wait between passes */
+	int ival;
+	/** Function to call for corrupt chunks */
+	oscrub_report_fn_t report;
+	/** Private data for report */
+	void *priv;
+	/** Buffer to read chunks into */
+	char *buf;
+	/** Monotonic time in milliseconds by which we expect to have
+	 * finished reading what we have read so far, at our rate */
+	uint64_t due_ms;
+	/** Protects everything below */
+	pthread_mutex_t lock;
+	/** Signalled when we are shutting down */
+	pthread_cond_t cond;
+	/** If nonzero, we are shutting down */
+	int shutdown;
+	/** Statistics */
+	struct oscrub_stats stats;
+	/** The scrubber thread */
+	struct redfish_thread thread;
+};
+
+static int oscrub_thread(struct redfish_thread *rt);
+
+struct oscrub *oscrub_init(struct ostor *ostor, uint64_t rate, int ival,
+		oscrub_report_fn_t report, void *priv)
+{
+	int ret;
+	struct oscrub *scrub;
+
+	scrub = calloc(1, sizeof(struct oscrub));
+	if (!scrub)
+		return ERR_PTR(ENOMEM);
+	scrub->ostor = ostor;
+	scrub->rate = rate;
+	scrub->ival = ival;
+	scrub->report = report;
+	scrub->priv = priv;
+	scrub->stats.cur_bucket = -1;
+	scrub->buf = malloc(OSCRUB_PIECE_SZ);
+	if (!scrub->buf) {
+		ret = ENOMEM;
+		goto error_free_scrub;
+	}
+	ret = pthread_mutex_init(&scrub->lock, NULL);
+	if (ret)
+		goto error_free_buf;
+	ret = pthread_cond_init_mt(&scrub->cond);
+	if (ret)
+		goto error_destroy_lock;
+	ret = redfish_thread_create(g_fast_log_mgr, &scrub->thread,
+		oscrub_thread, scrub);
+	if (ret)
+		goto error_destroy_cond;
+	return scrub;
+
+error_destroy_cond:
+	pthread_cond_destroy(&scrub->cond);
+error_destroy_lock:
+	pthread_mutex_destroy(&scrub->lock);
+error_free_buf:
+	free(scrub->buf);
+error_free_scrub:
+	free(scrub);
+	return ERR_PTR(FORCE_POSITIVE(ret));
+}
+
+void oscrub_shutdown(struct oscrub *scrub)
+{
+	pthread_mutex_lock(&scrub->lock);
+	scrub->shutdown = 1;
+	pthread_cond_broadcast(&scrub->cond);
+	pthread_mutex_unlock(&scrub->lock);
+	redfish_thread_join(&scrub->thread);
+}
+
+void oscrub_free(struct oscrub *scrub)
+{
+	pthread_cond_destroy(&scrub->cond);
+	pthread_mutex_destroy(&scrub->lock);
+	free(scrub->buf);
+	free(scrub);
+}
+
+/** Wait until a given monotonic time, or until we are shut down.
+ *
+ * Should be called with the scrubber lock held.
+ *
+ * @return		0 on success; -ESHUTDOWN if we are shutting down
+ */
+static int oscrub_wait_until(struct oscrub *scrub, uint64_t until_ms)
+{
+	struct timespec ts;
+
+	memset(&ts, 0, sizeof(ts));
+	ts.tv_sec = until_ms / 1000;
+	ts.tv_nsec = (until_ms % 1000) * 1000000;
+	while ((!scrub->shutdown) && (mt_time_ms() < until_ms))
+		pthread_cond_timedwait(&scrub->cond, &scrub->lock, &ts);
+	return scrub->shutdown ? -ESHUTDOWN : 0;
+}
+
+/** Account for some data that we have read, and wait until our rate allows us
+ * to read more.
+ *
+ * We never save up time while the disk is slow, so that there is no burst of
+ * reads once it catches up.
+ *
+ * @param scrub		The scrubber
+ * @param len		Number of bytes we have read
+ *
+ * @return		0 on success; -ESHUTDOWN if we are shutting down
+ */
+static int oscrub_throttle(struct oscrub *scrub, uint64_t len)
+{
+	int ret;
+	uint64_t now;
+
+	pthread_mutex_lock(&scrub->lock);
+	scrub->stats.bytes += len;
+	scrub->stats.pass_bytes += len;
+	if (scrub->rate == 0) {
+		ret = scrub->shutdown ? -ESHUTDOWN : 0;
+		goto done;
+	}
+	now = mt_time_ms();
+	if (scrub->due_ms < now)
+		scrub->due_ms = now;
+	scrub->due_ms += (len * 1000) / scrub->rate;
+	ret = oscrub_wait_until(scrub, scrub->due_ms);
+done:
+	pthread_mutex_unlock(&scrub->lock);
+	return ret;
+}
+
+/** Read a chunk from start to end
+ *
+ * @param scrub		The scrubber
+ * @param fb		The fast log buffer
+ * @param cid		The chunk ID
+ *
+ * @return		0 if the chunk is fine, or was unlinked while we were
+ *			reading it; -EIO if it is corrupt; -ESHUTDOWN if we
+ *			are shutting down; another negative error code if
+ *			the chunk couldn't be read
+ */
+static int oscrub_chunk(struct oscrub *scrub, struct fast_log_buf *fb,
+		uint64_t cid)
+{
+	int ret;
+	int32_t res;
+	uint64_t off = 0;
+
+	while (1) {
+		res = ostor_scrub_read(scrub->ostor, fb, cid, off,
+			scrub->buf, OSCRUB_PIECE_SZ);
+		if (res < 0) {
+			ret = (res == -ENOENT) ? 0 : res;
+			break;
+		}
+		off += res;
+		ret = oscrub_throttle(scrub, res);
+		if (ret)
+			break;
+		if (res < OSCRUB_PIECE_SZ)
+			break;
+	}
+	fast_log_ostor(fb, FLOS_SCRUB_CHUNK, cid, 0, ret, off);
+	return ret;
+}
+
+/** Deal with a chunk which turned out to be corrupt
+ *
+ * @param scrub		The scrubber
+ * @param fb		The fast log buffer
+ * @param cid		The chunk ID
+ */
+static void oscrub_found_corrupt(struct oscrub *scrub,
+		struct fast_log_buf *fb, uint64_t cid)
+{
+	int ret;
+
+	glitch_log("oscrub: chunk 0x%"PRIx64" is corrupt\n", cid);
+	ret = scrub->report(scrub->priv, fb, cid);
+	pthread_mutex_lock(&scrub->lock);
+	scrub->stats.corrupt++;
+	if (ret)
+		scrub->stats.report_failures++;
+	pthread_mutex_unlock(&scrub->lock);
+	if (ret) {
+		glitch_log("oscrub: failed to report corrupt chunk "
+			"0x%"PRIx64": error %d (%s)\n", cid, ret,
+			terror(ret));
+	}
+}
+
+int oscrub_pass(struct oscrub *scrub, struct fast_log_buf *fb)
+{
+	int i, b, ret, num;
+	uint64_t *cids;
+
+	pthread_mutex_lock(&scrub->lock);
+	scrub->stats.pass_chunks = 0;
+	scrub->stats.pass_bytes = 0;
+	scrub->due_ms = 0;
+	pthread_mutex_unlock(&scrub->lock);
+	ret = 0;
+	for (b = 0; (b < OSTOR_NUM_BUCKETS) && (ret == 0); ++b) {
+		pthread_mutex_lock(&scrub->lock);
+		scrub->stats.cur_bucket = b;
+		pthread_mutex_unlock(&scrub->lock);
+		num = ostor_list(scrub->ostor, b, &cids);
+		if (num < 0) {
+			glitch_log("oscrub_pass: failed to list bucket %d: "
+				"error %d (%s)\n", b, num, terror(num));
+			continue;
+		}
+		for (i = 0; i < num; ++i) {
+			ret = oscrub_chunk(scrub, fb, cids[i]);
+			if (ret == -ESHUTDOWN)
+				break;
+			if (ret == -EIO)
+				oscrub_found_corrupt(scrub, fb, cids[i]);
+			pthread_mutex_lock(&scrub->lock);
+			scrub->stats.chunks++;
+			scrub->stats.pass_chunks++;
+			if ((ret != 0) && (ret != -EIO))
+				scrub->stats.errors++;
+			pthread_mutex_unlock(&scrub->lock);
+			ret = 0;
+		}
+		free(cids);
+	}
+	pthread_mutex_lock(&scrub->lock);
+	scrub->stats.cur_bucket = -1;
+	if (ret == 0) {
+		scrub->stats.passes++;
+		scrub->stats.last_pass_end = mt_time();
+	}
+	pthread_mutex_unlock(&scrub->lock);
+	return ret;
+}
+
+void oscrub_get_stats(struct oscrub *scrub, struct oscrub_stats *stats)
+{
+	pthread_mutex_lock(&scrub->lock);
+	memcpy(stats, &scrub->stats, sizeof(struct oscrub_stats));
+	pthread_mutex_unlock(&scrub->lock);
+}
+
+static int oscrub_thread(struct redfish_thread *rt)
+{
+	int ret;
+	uint64_t ival_ms;
+	struct oscrub *scrub = rt->priv;
+	struct oscrub_stats stats;
+
+	ret = set_idle_io_prio();
+	if (ret) {
+		glitch_log("oscrub_thread: failed to lower our I/O priority: "
+			"error %d (%s).  Scrubbing anyway.\n", ret,
+			terror(ret));
+	}
+	/* Even with no interval, don't spin on an empty ostor. */
+	ival_ms = (scrub->ival > 0) ? (scrub->ival * 1000ULL) : 1000;
+	while (1) {
+		pthread_mutex_lock(&scrub->lock);
+		ret = oscrub_wait_until(scrub, mt_time_ms() + ival_ms);
+		pthread_mutex_unlock(&scrub->lock);
+		if (ret)
+			break;
+		if (oscrub_pass(scrub, rt->fb))
+			break;
+		oscrub_get_stats(scrub, &stats);
+		glitch_log("oscrub_thread: finished pass %"PRIu64".  Read "
+			"%"PRIu64" chunks, %"PRIu64" bytes.  So far, found "
+			"%"PRIu64" corrupt chunks, and failed to read "
+			"%"PRIu64".\n", stats.passes, stats.pass_chunks,
+			stats.pass_bytes, stats.corrupt, stats.errors);
+	}
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_OSD_OSCRUB_DOT_H
+#define REDFISH_OSD_OSCRUB_DOT_H
+
+#include <stdint.h> /* for uint64_t, etc. */
+#include <time.h> /* for time_t */
+
+struct fast_log_buf;
+struct oscrub;
+struct ostor;
+
+/* The scrubber
+ *
+ * The scrubber reads every chunk in the ostor, from start to end, so that the
+ * checksums of data which nobody has read in a long time still get checked.
+ * It goes through the ostor one bucket at a time, reading the chunks in each
+ * bucket in the order that ostor_list gives.
+ *
+ * Scrubbing is meant to run all the time, so it is careful not to get in the
+ * way.  It reads no faster than a given rate, it reads around the segment
+ * cache, and on platforms which have I/O priorities, its thread only uses the
+ * disk when nothing else wants it.
+ *
+ * When a chunk turns out to be corrupt, the scrubber hands it to a report
+ * function, which is expected to let the metadata server know, so that the
+ * chunk can be copied again from a good replica.
+ */
+
+/** Function which is called for each corrupt chunk
+ *
+ * @param priv		The private data given to oscrub_init
+ * @param fb		The fast log buffer
+ * @param cid		The corrupt chunk
+ *
+ * @return		0 on success; error code otherwise
+ */
+typedef int (*oscrub_report_fn_t)(void *priv, struct fast_log_buf *fb,
+		uint64_t cid);
+
+/** Scrubber progress */
+struct oscrub_stats {
+	/** Number of passes which have finished */
+	uint64_t passes;
+	/** Number of chunks read in all passes */
+	uint64_t chunks;
+	/** Number of bytes read in all passes */
+	uint64_t bytes;
+	/** Number of corrupt chunks found in all passes */
+	uint64_t corrupt;
+	/** Number of chunks which couldn't be read for reasons other than
+	 * corruption, in all passes */
+	uint64_t errors;
+	/** Number of corrupt chunks which the report function failed to
+	 * report */
+	uint64_t report_failures;
+	/** The bucket which the current pass is in, or -1 if no pass is in
+	 * progress */
+	int cur_bucket;
+	/** Number of chunks read so far in the current pass */
+	uint64_t pass_chunks;
+	/** Number of bytes read so far in the current pass */
+	uint64_t pass_bytes;
+	/** Monotonic time at which the most recent pass finished, or 0 if
+	 * none has */
+	time_t last_pass_end;
+};
+
+/** Create the scrubber, and start its thread
+ *
+ * The thread waits ival seconds before starting its first pass.
+ *
+ * @param ostor		The ostor to scrub
+ * @param rate		Maximum number of bytes to read per second, or 0 for
+ *			no limit
+ * @param ival		Seconds to wait between passes
+ * @param report	Function to call for corrupt chunks
+ * @param priv		Private data to pass to report
+ *
+ * @return		An error pointer on error; the scrubber otherwise
+ */
+extern struct oscrub *oscrub_init(struct ostor *ostor, uint64_t rate,
+		int ival, oscrub_report_fn_t report, void *priv);
+
+/** Stop the scrubber
+ *
+ * Any pass in progress is abandoned.  After this function has been called,
+ * oscrub_pass returns -ESHUTDOWN.
+ *
+ * @param scrub		The scrubber
+ */
+extern void oscrub_shutdown(struct oscrub *scrub);
+
+/** Free the scrubber
+ *
+ * @param scrub		The scrubber.  It must have been shut down.
+ */
+extern void oscrub_free(struct oscrub *scrub);
+
+/** Scrub the whole ostor once
+ *
+ * This is normally done by the scrubber thread.  Only one pass may be in
+ * progress at a time.
+ *
+ * @param scrub		The scrubber
+ * @param fb		The fast log buffer
+ *
+ * @return		0 on success; -ESHUTDOWN if the scrubber was shut down
+ */
+extern int oscrub_pass(struct oscrub *scrub, struct fast_log_buf *fb);
+
+/** Get scrubber statistics
+ *
+ * @param scrub		The scrubber
+ * @param stats		(out param) the statistics
+ */
+extern void oscrub_get_stats(struct oscrub *scrub,
+		struct oscrub_stats *stats);
+
+#endif
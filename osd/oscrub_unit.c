@@ -0,0 +1,251 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/config/ostorc.h"
+#include "core/alarm.h"
+#include "core/process_ctx.h"
+#include "osd/oscrub.h"
+#include "osd/ostor.h"
+#include "util/error.h"
+#include "util/fast_log.h"
+#include "util/string.h"
+#include "util/tempfile.h"
+#include "util/test.h"
+#include "util/time.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Length of each chunk we write */
+#define OSCRUBU_CHUNK_LEN ((2 * OSTOR_CSUM_SEG) + 123)
+
+/** Number of chunks we write */
+#define OSCRUBU_NUM_CHUNKS 4
+
+/** Container size, in megabytes, to use when testing the packed store */
+#define OSCRUBU_PACK_MB 1
+
+/** The chunks we write.  Two of them are in the same bucket. */
+static const uint64_t OSCRUBU_CIDS[OSCRUBU_NUM_CHUNKS] = {
+	0x1, 0x20001, 0x2, 0xff
+};
+
+/** Chunks which the scrubber has reported as corrupt */
+static uint64_t g_reported[OSCRUBU_NUM_CHUNKS];
+
+/** Number of entries in g_reported */
+static int g_num_reported;
+
+static int oscrubu_report(POSSIBLY_UNUSED(void *priv),
+		POSSIBLY_UNUSED(struct fast_log_buf *fb), uint64_t cid)
+{
+	if (g_num_reported >= OSCRUBU_NUM_CHUNKS)
+		return -ENOBUFS;
+	g_reported[g_num_reported++] = cid;
+	return 0;
+}
+
+static struct ostor *oscrubu_init_ostor(const char *ostor_path,
+		struct fast_log_buf *fb, int pack_mb, struct ostorc **oconf)
+{
+	int i;
+	char *data;
+	struct ostor *ostor;
+
+	*oconf = JORM_INIT_ostorc();
+	if (IS_ERR(*oconf))
+		return ERR_PTR(ENOMEM);
+	(*oconf)->ostor_max_open = 10;
+	(*oconf)->ostor_timeo = 10;
+	(*oconf)->ostor_aio_depth = 0;
+	(*oconf)->ostor_pack_mb = pack_mb;
+	(*oconf)->ostor_pack_compact_pct = 50;
+	(*oconf)->ostor_cache_mb = 0;
+	(*oconf)->ostor_path = strdup(ostor_path);
+	if (!(*oconf)->ostor_path)
+		return ERR_PTR(ENOMEM);
+	ostor = ostor_init(*oconf);
+	if (IS_ERR(ostor))
+		return ostor;
+	data = malloc(OSCRUBU_CHUNK_LEN);
+	if (!data)
+		return ERR_PTR(ENOMEM);
+	for (i = 0; i < OSCRUBU_CHUNK_LEN; ++i)
+		data[i] = random();
+	for (i = 0; i < OSCRUBU_NUM_CHUNKS; ++i) {
+		if (ostor_write(ostor, fb, OSCRUBU_CIDS[i], 0, data,
+				OSCRUBU_CHUNK_LEN, NULL))
+			return ERR_PTR(EIO);
+	}
+	free(data);
+	return ostor;
+}
+
+static int oscrubu_test_list(const char *ostor_path, struct fast_log_buf *fb,
+		int pack_mb)
+{
+	struct ostorc *oconf;
+	struct ostor *ostor;
+	uint64_t *cids;
+
+	ostor = oscrubu_init_ostor(ostor_path, fb, pack_mb, &oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+	EXPECT_EQ(ostor_list(ostor, 1, &cids), 2);
+	EXPECT_EQ(cids[0], 0x1);
+	EXPECT_EQ(cids[1], 0x20001);
+	free(cids);
+	EXPECT_EQ(ostor_list(ostor, 0xff, &cids), 1);
+	EXPECT_EQ(cids[0], 0xff);
+	free(cids);
+	EXPECT_EQ(ostor_list(ostor, 3, &cids), 0);
+	EXPECT_EQ(cids, NULL);
+	EXPECT_EQ(ostor_list(ostor, OSTOR_NUM_BUCKETS, &cids), -EINVAL);
+	EXPECT_ZERO(ostor_unlink(ostor, fb, 0x1));
+	EXPECT_EQ(ostor_list(ostor, 1, &cids), 1);
+	EXPECT_EQ(cids[0], 0x20001);
+	free(cids);
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+	JORM_FREE_ostorc(oconf);
+	return 0;
+}
+
+static int oscrubu_test_scrub(const char *ostor_path, struct fast_log_buf *fb,
+		int pack_mb)
+{
+	int fd, POSSIBLY_UNUSED(res);
+	char b, path[PATH_MAX];
+	struct ostorc *oconf;
+	struct ostor *ostor;
+	struct oscrub *scrub;
+	struct oscrub_stats stats;
+
+	ostor = oscrubu_init_ostor(ostor_path, fb, pack_mb, &oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+	g_num_reported = 0;
+	/* The thread won't get around to scrubbing before we're done */
+	scrub = oscrub_init(ostor, 0, 3600, oscrubu_report, NULL);
+	EXPECT_NOT_ERRPTR(scrub);
+	oscrub_get_stats(scrub, &stats);
+	EXPECT_EQ(stats.cur_bucket, -1);
+	EXPECT_ZERO(stats.passes);
+	EXPECT_ZERO(oscrub_pass(scrub, fb));
+	oscrub_get_stats(scrub, &stats);
+	EXPECT_EQ(stats.passes, 1);
+	EXPECT_EQ(stats.cur_bucket, -1);
+	EXPECT_EQ(stats.pass_chunks, OSCRUBU_NUM_CHUNKS);
+	EXPECT_EQ(stats.pass_bytes, OSCRUBU_NUM_CHUNKS * OSCRUBU_CHUNK_LEN);
+	EXPECT_ZERO(stats.corrupt);
+	EXPECT_ZERO(stats.errors);
+	EXPECT_ZERO(g_num_reported);
+
+	if (pack_mb == 0) {
+		/* Flip a bit in the last segment of chunk 0x2 behind the
+		 * ostor's back */
+		EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/%02x/%014x",
+			ostor_path, 0x2, 0));
+		fd = open(path, O_RDWR);
+		EXPECT_GT(fd, -1);
+		EXPECT_EQ(pread(fd, &b, 1, OSCRUBU_CHUNK_LEN - 1), 1);
+		b ^= 0x01;
+		EXPECT_EQ(pwrite(fd, &b, 1, OSCRUBU_CHUNK_LEN - 1), 1);
+		RETRY_ON_EINTR(res, close(fd));
+		EXPECT_ZERO(oscrub_pass(scrub, fb));
+		oscrub_get_stats(scrub, &stats);
+		EXPECT_EQ(stats.passes, 2);
+		EXPECT_EQ(stats.pass_chunks, OSCRUBU_NUM_CHUNKS);
+		EXPECT_EQ(stats.chunks, 2 * OSCRUBU_NUM_CHUNKS);
+		EXPECT_EQ(stats.corrupt, 1);
+		EXPECT_ZERO(stats.errors);
+		EXPECT_ZERO(stats.report_failures);
+		EXPECT_EQ(g_num_reported, 1);
+		EXPECT_EQ(g_reported[0], 0x2);
+	}
+	oscrub_shutdown(scrub);
+	EXPECT_EQ(oscrub_pass(scrub, fb), -ESHUTDOWN);
+	oscrub_free(scrub);
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+	JORM_FREE_ostorc(oconf);
+	return 0;
+}
+
+static int oscrubu_test_rate(const char *ostor_path, struct fast_log_buf *fb)
+{
+	uint64_t start;
+	struct ostorc *oconf;
+	struct ostor *ostor;
+	struct oscrub *scrub;
+
+	ostor = oscrubu_init_ostor(ostor_path, fb, 0, &oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+	/* Allow a second's worth of reading for all of the chunks */
+	scrub = oscrub_init(ostor, OSCRUBU_NUM_CHUNKS * OSCRUBU_CHUNK_LEN,
+		3600, oscrubu_report, NULL);
+	EXPECT_NOT_ERRPTR(scrub);
+	start = mt_time_ms();
+	EXPECT_ZERO(oscrub_pass(scrub, fb));
+	EXPECT_GE(mt_time_ms() - start, 900);
+	oscrub_shutdown(scrub);
+	oscrub_free(scrub);
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+	JORM_FREE_ostorc(oconf);
+	return 0;
+}
+
+int main(POSSIBLY_UNUSED(int argc), char **argv)
+{
+	int i, pack_mb;
+	char tdir[PATH_MAX];
+	struct fast_log_buf *fb;
+	timer_t timer;
+	time_t t;
+
+	EXPECT_ZERO(utility_ctx_init(argv[0])); /* for g_fast_log_mgr */
+	t = mt_time() + 600;
+	EXPECT_ZERO(mt_set_alarm(t, "oscrub_unit timed out", &timer));
+	fb = fast_log_create(g_fast_log_mgr, "main");
+	EXPECT_NOT_ERRPTR(fb);
+
+	/* Run everything with a file per chunk, and then again with the
+	 * packed store. */
+	for (i = 0; i < 2; ++i) {
+		pack_mb = i ? OSCRUBU_PACK_MB : 0;
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(oscrubu_test_list(tdir, fb, pack_mb));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(oscrubu_test_scrub(tdir, fb, pack_mb));
+	}
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(oscrubu_test_rate(tdir, fb));
+
+	EXPECT_ZERO(mt_deactivate_alarm(timer));
+	fast_log_free(fb);
+	process_ctx_shutdown();
+
+	return EXIT_SUCCESS;
+}
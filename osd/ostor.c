@@ -24,11 +24,18 @@
 #include "jorm/jorm_const.h"
 #include "mds/const.h"
 #include "osd/fast_log.h"
+#include "osd/ocache.h"
+#include "osd/opack.h"
 #include "osd/ostor.h"
 #include "util/compiler.h"
+#include "util/crc32c.h"
 #include "util/error.h"
 #include "util/fast_log.h"
 #include "util/fast_log_types.h"
+#include "util/packed.h"
+#include "util/platform/aio.h"
+#include "util/platform/readdir.h"
+#include "util/queue.h"
 #include "util/safe_io.h"
 #include "util/string.h"
 #include "util/terror.h"
@@ -36,6 +43,7 @@
 #include "util/time.h"
 #include "util/tree.h"
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -45,40 +53,141 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
 
 #define OSTOR_LRU_LONG_PERIOD_SEC 60
 
-#define OSTOR_LRU_SHORT_PERIOD_NSEC 1000
-
 #define OSTOR_TEST_DIR "test.tmp"
 
+/** Subdirectory holding the packed object store */
+#define OSTOR_PACK_DIR "pack"
+
+/** log2 of the number of shards in the open chunk table */
+#define OSTOR_SHARD_BITS 4
+
+/** Number of shards in the open chunk table */
+#define OSTOR_NUM_SHARDS (1 << OSTOR_SHARD_BITS)
+
+/** Maximum number of file descriptors to register with the asynchronous I/O
+ * ring */
+#define OSTOR_AIO_MAX_SLOTS 4096
+
+/** Maximum number of operations that we submit at once */
+#define OSTOR_MAX_OPS 4
+
+/** Alignment of the offsets, lengths, and buffers of O_DIRECT writes */
+#define OSTOR_DIRECT_ALIGN 4096
+
+/** Size of the buffers in the O_DIRECT buffer pool */
+#define OSTOR_DIRECT_BUF_SIZE (1024 * 1024)
+
+/** Maximum number of idle buffers to keep in the O_DIRECT buffer pool */
+#define OSTOR_DIRECT_POOL_MAX 16
+
+/** Length of the name of a chunk data file */
+#define OSTOR_CHUNK_NAME_LEN 14
+
 struct ochunk {
 	RB_ENTRY(ochunk) by_cid_entry;
-	RB_ENTRY(ochunk) by_atime_entry;
+	/** Entry in the shard's clock ring */
+	TAILQ_ENTRY(ochunk) clock_entry;
 	/** chunk id */
 	uint64_t cid;
-	/** last access time */
-	time_t atime;
+	/** last access time.  This is written without holding any lock. */
+	volatile time_t atime;
+	/** Set whenever the chunk is used, and cleared when the clock hand
+	 * passes it.  This is written without holding any lock. */
+	volatile int referenced;
 	/** open file descriptor */
 	int fd;
+	/** open file descriptor for the checksum file, or -1 if this chunk
+	 * has no checksums */
+	int csum_fd;
+	/** Slot that fd is registered in with the asynchronous I/O ring, or -1
+	 * if it isn't registered */
+	int fd_slot;
+	/** Slot that csum_fd is registered in, or -1 */
+	int csum_slot;
+	/** File descriptor for writing the chunk data with O_DIRECT, or -1 if
+	 * it hasn't been opened yet.  It is opened by the first write which
+	 * is big enough to use it. */
+	int direct_fd;
 	/** Reference count.  If this is -1, the chunk is in the process of
-	 * being created or being destroyed.  */
-	int32_t refcnt;
+	 * being created or being destroyed.
+	 *
+	 * This is only incremented, or changed to or from -1, with the shard
+	 * lock held.  ochunk_release decrements it without the lock.  So all
+	 * changes must be atomic. */
+	volatile int32_t refcnt;
+	/** Checksum of the last segment, if it is only partly filled */
+	uint32_t tail_crc;
+	/** Length of the chunk data */
+	uint64_t size;
+	/** Held for writing while appending to the chunk, and for reading
+	 * while reading from it, so that readers always see data and
+	 * checksums that match. */
+	pthread_rwlock_t io_lock;
 };
 
+struct ostor_shard;
+
 static int compare_ochunk_by_cid(struct ochunk *ch_a,
 		struct ochunk *ch_b) PURE;
-static int compare_ochunk_by_atime(struct ochunk *ch_a,
-		struct ochunk *ch_b) PURE;
 static struct ochunk *ostor_get_ochunk(struct ostor *ostor,
+		struct ostor_shard *shard, struct fast_log_buf *fb,
+		uint64_t cid, int create);
+static struct ostor_shard *ostor_cid_to_shard(struct ostor *ostor,
+		uint64_t cid);
+static struct ochunk *ostor_hold_ochunk(struct ostor *ostor,
 		struct fast_log_buf *fb, uint64_t cid, int create);
+static void ostor_unreserve_fd(struct ostor *ostor);
+static void ostor_wake_lru(struct ostor *ostor);
+static void ostor_wait_hist_add(struct ostor_wait_hist *hist, uint64_t us);
+static void ostor_wait_hist_add_atomic(struct ostor_wait_hist *hist,
+		uint64_t us);
 static int ostor_lru_thread(struct redfish_thread *rt);
+static int ostor_count_chunks(struct ostor *ostor);
+static int32_t ostor_read_store(void *priv, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc);
 
 RB_HEAD(ochunks_by_cid, ochunk);
 RB_GENERATE(ochunks_by_cid, ochunk, by_cid_entry, compare_ochunk_by_cid);
-RB_HEAD(ochunks_by_atime, ochunk);
-RB_GENERATE(ochunks_by_atime, ochunk, by_atime_entry, compare_ochunk_by_atime);
+TAILQ_HEAD(ochunk_ring, ochunk);
+
+/** One shard of the open chunk table.  Chunks are assigned to shards by a hash
+ * of the chunk ID. */
+struct ostor_shard {
+	/** lock which protects everything in the shard */
+	pthread_mutex_t lock;
+	/** tree of open chunks sorted by chunk id */
+	struct ochunks_by_cid cid_head;
+	/** Open chunks which are ready to use, in the order that the clock
+	 * hand visits them */
+	struct ochunk_ring ring;
+	/** Number of chunks in ring */
+	int ring_len;
+	/** The next chunk in ring that the clock hand will look at, or NULL
+	 * if it will start over at the beginning */
+	struct ochunk *hand;
+	/** Broadcast when a chunk in this shard finishes being created or
+	 * destroyed, and when a chunk becomes idle while someone is waiting */
+	pthread_cond_t cond;
+	/** Number of threads waiting on cond.  This is read by ochunk_release
+	 * without holding the lock, so it must be changed atomically. */
+	volatile int waiters;
+	/** Time spent waiting for chunks to be created or destroyed */
+	struct ostor_wait_hist busy_wait;
+	/** Time spent in ostor_unlink waiting for chunks to become idle */
+	struct ostor_wait_hist unlink_wait;
+	/** Time taken by reads of chunks in this shard.  Changed atomically,
+	 * without holding the lock. */
+	struct ostor_wait_hist read_time;
+	/** Time taken by writes to chunks in this shard.  Changed atomically,
+	 * without holding the lock. */
+	struct ostor_wait_hist write_time;
+};
 
 /** The backend store for the osd's data.  Basically, this is where we put chunk
  * data.
@@ -89,7 +198,7 @@ RB_GENERATE(ochunks_by_atime, ochunk, by_atime_entry, compare_ochunk_by_atime);
  * (least-recently-used) cache of open file descriptors.
  *
  * 2. We don't want to perform blocking system calls, like
- * read/write/open/close/unlink, while holding ostor->lock.
+ * read/write/open/close/unlink, while holding any locks.
  *
  * 3. We also want to limit the number of open file descriptors.  Using too many
  * file descriptors could cause problems for other processes on this machine.
@@ -98,39 +207,77 @@ RB_GENERATE(ochunks_by_atime, ochunk, by_atime_entry, compare_ochunk_by_atime);
  * This design accomplishes all three of those things.  See ostorc.jorm for
  * tunables.
  *
- * The busy-waiting could be eliminated by using per-chunk condition variables
- * and locks, but I doubt that that would be worth it.  We only really have to
- * busy-wait when block creations and deletions are racing-- NOT a common
- * scenario.  If we had per-chunk condition variables and mutexes, we'd have to
- * pay the cost of using them all the time.
+ * The open chunks are split into OSTOR_NUM_SHARDS shards, each with its own
+ * lock, so that I/O on different chunks doesn't contend on one mutex.  A chunk
+ * is looked up under its shard lock, but released without taking any lock.
+ * Rather than keeping the chunks sorted by access time, we use the CLOCK
+ * algorithm: each access sets a reference bit, and the lru thread sweeps
+ * around each shard, evicting chunks that have been idle for too long, or,
+ * when someone is waiting for a file descriptor, chunks whose bit has been
+ * clear since the last sweep.  ostor->lock is only taken when files are
+ * opened or closed.
+ *
+ * Threads which have to wait for a chunk to be created, destroyed, or left
+ * idle sleep on the shard's condition variable.  Creating and destroying
+ * chunks always happens with the shard lock held, so those transitions can
+ * simply broadcast.  ochunk_release only takes the shard lock if it dropped
+ * the last reference and the shard has waiters.  Similarly, it only wakes the
+ * lru thread if someone is waiting for a file descriptor.
  */
 struct ostor {
 	/** Path to the ostor directory */
 	char *dir_path;
 	/** If nonzero, we are shutting down */
 	int shutdown;
-	/** current number of files that are open */
+	/** current number of chunks that are open, or being opened */
 	int num_open;
-	/** maximum number of files to open */
+	/** maximum number of chunks to open */
 	int max_open;
 	/** maximum number of seconds to leave a file open once it's unused */
 	time_t atime_timeo;
-	/** lock which protects num_open, chunk_head */
+	/** lock which protects shutdown, num_open, and need_lru.  If a shard
+	 * lock is also held, it must be taken first. */
 	pthread_mutex_t lock;
 	/** condition variable used to signal that the garbage collector thread
 	 * should wake up */
 	pthread_cond_t lru_cond;
-	/** minimum number of files we need to close to make way for new ones */
-	int need_lru;
+	/** minimum number of files we need to close to make way for new ones.
+	 * ochunk_release reads this without holding the lock. */
+	volatile int need_lru;
+	/** Incremented whenever there may be new work for the lru thread */
+	uint64_t lru_gen;
+	/** Time spent waiting for file descriptors */
+	struct ostor_wait_hist fd_wait;
 	/** condition variable used to signal that more ochunks are allowed to
 	 * be opened */
 	pthread_cond_t alloc_cond;
-	/** tree of open chunks sorted by chunk id */
-	struct ochunks_by_cid cid_head;
-	/** tree of open chunks sorted by last access time */
-	struct ochunks_by_atime atime_head;
+	/** The shard that the lru thread will look at first when someone is
+	 * waiting for a file descriptor.  Only used by the lru thread. */
+	int clock_shard;
 	/** the lru thread */
 	struct redfish_thread lru_thread;
+	/** The asynchronous I/O ring, or NULL if we do synchronous I/O */
+	struct aio_ring *aio;
+	/** The packed object store, or NULL if each chunk has a file of its
+	 * own.  If this is set, it handles all chunk operations. */
+	struct opack *pack;
+	/** The segment cache, or NULL if reads aren't cached */
+	struct ocache *cache;
+	/** Writes of at least this many bytes go partly through O_DIRECT, or
+	 * 0 if we never use O_DIRECT.  This is cleared without holding any
+	 * lock if the filesystem turns out not to support O_DIRECT. */
+	volatile int32_t direct_min;
+	/** lock which protects the O_DIRECT buffer pool */
+	pthread_mutex_t dbuf_lock;
+	/** Idle aligned buffers for O_DIRECT writes */
+	void *dbufs[OSTOR_DIRECT_POOL_MAX];
+	/** Number of buffers in dbufs */
+	int num_dbufs;
+	/** Number of chunks, if there is no packed store.  This is changed
+	 * atomically, without holding any lock. */
+	volatile uint64_t num_chunks;
+	/** The open chunk table */
+	struct ostor_shard shards[OSTOR_NUM_SHARDS];
 };
 
 /************************** ochunk *******************************/
@@ -148,34 +295,101 @@ static void ochunk_get_path(const struct ostor *ostor, char *path,
 		 (int)(cid & 0xff), cid >> 16);
 }
 
+static void ochunk_get_csum_path(const struct ostor *ostor, char *path,
+		size_t path_len, uint64_t cid)
+{
+	snprintf(path, path_len, "%s/%02x/%014" PRIx64 ".crc",
+		 ostor->dir_path, (int)(cid & 0xff), cid >> 16);
+}
+
 /** Allocate an ostor chunk.
  *
- * Create the data structure in memory for a chunk.
+ * Create the data structure in memory for a chunk.  The caller must already
+ * have reserved a file descriptor with ostor_reserve_fd.
  *
- * Should be called with the ostor lock held.
+ * Should be called with the shard lock held.
  *
- * @param ostor		The ostor
+ * @param shard		The shard
  * @param cid		The chunk ID
  */
-static struct ochunk *ochunk_alloc(struct ostor *ostor, uint64_t cid)
+static struct ochunk *ochunk_alloc(struct ostor_shard *shard, uint64_t cid)
 {
 	struct ochunk *ch;
 
 	ch = calloc(1, sizeof(struct ochunk));
 	if (!ch)
 		return ERR_PTR(ENOMEM);
+	if (pthread_rwlock_init(&ch->io_lock, NULL)) {
+		free(ch);
+		return ERR_PTR(ENOMEM);
+	}
 	ch->cid = cid;
 	ch->fd = -1;
+	ch->csum_fd = -1;
+	ch->fd_slot = -1;
+	ch->csum_slot = -1;
+	ch->direct_fd = -1;
 	ch->atime = 0;
 	ch->refcnt = -1;
-	ostor->num_open++;
-	RB_INSERT(ochunks_by_cid, &ostor->cid_head, ch);
+	RB_INSERT(ochunks_by_cid, &shard->cid_head, ch);
 	return ch;
 }
 
+/** Open the checksum file for an ostor chunk, and find out how much data the
+ * chunk has.
+ *
+ * Should be called with the shard lock __released__, after the chunk's data
+ * file has been opened.
+ *
+ * @param ostor		The ostor
+ * @param ch		The chunk
+ * @param create	If nonzero, we may create the checksum file.
+ */
+static int ochunk_open_csum(struct ostor *ostor, struct ochunk *ch,
+		int create)
+{
+	int ret;
+	struct stat st;
+	char cpath[PATH_MAX];
+	uint32_t be;
+
+	if (fstat(ch->fd, &st) < 0)
+		return errno;
+	ch->size = st.st_size;
+	ochunk_get_csum_path(ostor, cpath, sizeof(cpath), ch->cid);
+	RETRY_ON_EINTR(ch->csum_fd, open(cpath,
+		O_RDWR | O_CLOEXEC | O_NOATIME));
+	if (ch->csum_fd < 0) {
+		ret = errno;
+		if (ret != ENOENT)
+			return ret;
+		/* A chunk that has data but no checksum file was written
+		 * before we kept checksums.  An empty one can start keeping
+		 * them now. */
+		if ((ch->size != 0) || (!create))
+			return 0;
+		RETRY_ON_EINTR(ch->csum_fd, open(cpath,
+			O_CREAT | O_RDWR | O_CLOEXEC | O_NOATIME, 0660));
+		if (ch->csum_fd < 0)
+			return errno;
+		return 0;
+	}
+	if ((ch->size & (OSTOR_CSUM_SEG - 1)) == 0)
+		return 0;
+	ret = safe_pread(ch->csum_fd, &be, sizeof(be),
+		(ch->size >> OSTOR_CSUM_SEG_SHIFT) * sizeof(uint32_t));
+	if (ret < 0)
+		return FORCE_POSITIVE(ret);
+	/* If the checksum of the last segment is missing, reads of that
+	 * segment will fail verification.  We still want to be able to open
+	 * the chunk, so that it can be unlinked. */
+	ch->tail_crc = (ret == sizeof(be)) ? unpack_from_be32(&be) : 0;
+	return 0;
+}
+
 /** Open the file backing an ostor chunk.
  *
- * Should be called with the ostor lock __released__.
+ * Should be called with the shard lock __released__.
  *
  * @param ostor		The current monotonic time
  * @param cur_time	The current monotonic time
@@ -187,73 +401,157 @@ static int ochunk_open(struct ostor *ostor, struct ochunk *ch, int create)
 	char path[PATH_MAX], dpath[PATH_MAX];
 
 	ochunk_get_path(ostor, path, sizeof(path), ch->cid);
-	open_flags = create ? O_CREAT : 0;
-	open_flags |= O_APPEND | O_RDWR | O_CLOEXEC | O_NOATIME;
-	RETRY_ON_EINTR(ch->fd, open(path, open_flags, 0660));
+	open_flags = O_RDWR | O_CLOEXEC | O_NOATIME;
+	RETRY_ON_EINTR(ch->fd, open(path, open_flags));
 	if (ch->fd >= 0)
-		return 0;
+		return ochunk_open_csum(ostor, ch, create);
 	ret = errno;
 	if ((ret != ENOENT) || (!create)) {
 		return ret;
 	}
-	ochunk_get_dpath(ostor, dpath, sizeof(dpath), ch->cid);
-	if (mkdir(dpath, 0770) < 0) {
+	/* Nobody else can create the chunk while our ochunk is in the table,
+	 * so O_EXCL tells us whether the chunk is new. */
+	open_flags |= O_CREAT | O_EXCL;
+	RETRY_ON_EINTR(ch->fd, open(path, open_flags, 0660));
+	if ((ch->fd < 0) && (errno == ENOENT)) {
+		ochunk_get_dpath(ostor, dpath, sizeof(dpath), ch->cid);
+		if (mkdir(dpath, 0770) < 0) {
+			ret = -errno;
+			return ret;
+		}
+		RETRY_ON_EINTR(ch->fd, open(path, open_flags, 0660));
+	}
+	if (ch->fd < 0) {
 		ret = -errno;
 		return ret;
 	}
-	RETRY_ON_EINTR(ch->fd, open(path, open_flags, 0660));
-	if (ch->fd >= 0)
-		return 0;
-	ret = -errno;
-	return ret;
+	__sync_fetch_and_add(&ostor->num_chunks, 1);
+	return ochunk_open_csum(ostor, ch, create);
 }
 
+/** Drop a reference to a chunk taken by ostor_hold_ochunk.
+ *
+ * This doesn't take any locks unless we drop the last reference while someone
+ * is waiting.  Once the reference count has been decremented, the chunk may be
+ * evicted at any time, so we must not touch it after that.
+ *
+ * @param ostor		The ostor
+ * @param ch		The chunk
+ */
 static void ochunk_release(struct ostor *ostor, struct ochunk *ch)
 {
-	time_t t;
+	struct ostor_shard *shard;
+	int32_t old;
 
-	t = mt_time();
-	pthread_mutex_lock(&ostor->lock);
-	ch->atime = t;
-	if (ch->refcnt == -1)
+	shard = ostor_cid_to_shard(ostor, ch->cid);
+	ch->atime = mt_time();
+	ch->referenced = 1;
+	old = __sync_fetch_and_sub(&ch->refcnt, 1);
+	if (old <= 0)
 		abort();
-	ch->refcnt--;
-	RB_INSERT(ochunks_by_atime, &ostor->atime_head, ch);
-	pthread_mutex_unlock(&ostor->lock);
+	if (old != 1)
+		return;
+	/* Waiters increment shard->waiters before they check the reference
+	 * count.  Since both are changed with full barriers, either they saw
+	 * our decrement, or we see their increment. */
+	if (shard->waiters > 0) {
+		pthread_mutex_lock(&shard->lock);
+		pthread_cond_broadcast(&shard->cond);
+		pthread_mutex_unlock(&shard->lock);
+	}
+	if (ostor->need_lru > 0)
+		ostor_wake_lru(ostor);
+}
+
+/** Add a chunk which has just become ready to use to the clock ring.
+ *
+ * Should be called with the shard lock held.
+ */
+static void ochunk_ring_insert(struct ostor_shard *shard, struct ochunk *ch)
+{
+	/* Insert the chunk just behind the hand, so that it will be the last
+	 * one looked at. */
+	if (shard->hand)
+		TAILQ_INSERT_BEFORE(shard->hand, ch, clock_entry);
+	else
+		TAILQ_INSERT_TAIL(&shard->ring, ch, clock_entry);
+	shard->ring_len++;
+}
+
+/** Remove a chunk from the clock ring.
+ *
+ * Should be called with the shard lock held.
+ */
+static void ochunk_ring_remove(struct ostor_shard *shard, struct ochunk *ch)
+{
+	if (shard->hand == ch)
+		shard->hand = TAILQ_NEXT(ch, clock_entry);
+	TAILQ_REMOVE(&shard->ring, ch, clock_entry);
+	shard->ring_len--;
 }
 
 /** Close the file associated with an ochunk, and flush the ochunk data
  * structure from memory.
  *
- * Should be called with the ostor lock held.
+ * Should be called with the shard lock held.  The chunk's reference count must
+ * be -1, and it must not be in the clock ring.
  *
  * @param ostor		The ostor
- * @param cid		The chunk ID
+ * @param shard		The shard that the chunk belongs to
+ * @param fb		The fast log buffer
+ * @param ch		The chunk
  */
-static void ochunk_evict(struct ostor *ostor, struct fast_log_buf *fb,
-		struct ochunk *ch)
+static void ochunk_evict(struct ostor *ostor, struct ostor_shard *shard,
+		struct fast_log_buf *fb, struct ochunk *ch)
 {
 	int res = 0, fd = ch->fd;
 	uint64_t cid = ch->cid;
 
 	if (ch->refcnt != -1)
 		abort();
-	if (fd > 0) {
-		pthread_mutex_unlock(&ostor->lock);
-		RETRY_ON_EINTR(res, close(fd));
-		if (res) {
-			glitch_log("ostor error: failed to close fd %d: error "
-				"%d (%s)\n", fd, res, terror(res));
+	if ((fd > 0) || (ch->csum_fd >= 0)) {
+		pthread_mutex_unlock(&shard->lock);
+		if (ostor->aio) {
+			aio_ring_unregister(ostor->aio, ch->fd_slot);
+			aio_ring_unregister(ostor->aio, ch->csum_slot);
+			ch->fd_slot = -1;
+			ch->csum_slot = -1;
 		}
-		ch->fd = -1;
-		pthread_mutex_lock(&ostor->lock);
+		if (fd > 0) {
+			RETRY_ON_EINTR(res, close(fd));
+			if (res) {
+				glitch_log("ostor error: failed to close fd "
+					"%d: error %d (%s)\n", fd, res,
+					terror(res));
+			}
+			ch->fd = -1;
+		}
+		if (ch->csum_fd >= 0) {
+			RETRY_ON_EINTR(res, close(ch->csum_fd));
+			if (res) {
+				glitch_log("ostor error: failed to close "
+					"checksum fd %d: error %d (%s)\n",
+					ch->csum_fd, res, terror(res));
+			}
+			ch->csum_fd = -1;
+		}
+		if (ch->direct_fd >= 0) {
+			RETRY_ON_EINTR(res, close(ch->direct_fd));
+			if (res) {
+				glitch_log("ostor error: failed to close "
+					"O_DIRECT fd %d: error %d (%s)\n",
+					ch->direct_fd, res, terror(res));
+			}
+			ch->direct_fd = -1;
+		}
+		pthread_mutex_lock(&shard->lock);
 	}
-	RB_REMOVE(ochunks_by_cid, &ostor->cid_head, ch);
+	RB_REMOVE(ochunks_by_cid, &shard->cid_head, ch);
+	pthread_rwlock_destroy(&ch->io_lock);
 	free(ch);
-	if (ostor->need_lru > 0)
-		ostor->need_lru--;
-	ostor->num_open--;
-	pthread_cond_signal(&ostor->alloc_cond);
+	if (shard->waiters > 0)
+		pthread_cond_broadcast(&shard->cond);
+	ostor_unreserve_fd(ostor);
 	fast_log_ostor(fb, FLOS_OCHUNK_EVICT, cid, 0, res, fd);
 }
 
@@ -266,19 +564,10 @@ static int compare_ochunk_by_cid(struct ochunk *ch_a, struct ochunk *ch_b)
 	return 0;
 }
 
-static int compare_ochunk_by_atime(struct ochunk *ch_a, struct ochunk *ch_b)
-{
-	if (ch_a->atime < ch_b->atime)
-		return -1;
-	if (ch_a->atime > ch_b->atime)
-		return 1;
-	return compare_ochunk_by_cid(ch_a, ch_b);
-}
-
 /************************** ostor *******************************/
 struct ostor *ostor_init(const struct ostorc *oconf)
 {
-	int ret;
+	int i, ret, num_slots;
 	struct ostor *ostor;
 	char tpath[PATH_MAX];
 
@@ -326,32 +615,117 @@ struct ostor *ostor_init(const struct ostorc *oconf)
 	ostor->num_open = 0;
 	ostor->max_open = oconf->ostor_max_open;
 	ostor->atime_timeo = oconf->ostor_timeo;
+	ostor->direct_min = 0;
+	if (oconf->ostor_direct_kb > INT32_MAX / 1024)
+		ostor->direct_min = INT32_MAX;
+	else if (oconf->ostor_direct_kb > 0)
+		ostor->direct_min = oconf->ostor_direct_kb * 1024;
 	ret = pthread_mutex_init(&ostor->lock, NULL);
 	if (ret) {
 		goto error_free_dir_path;
 	}
-	ret = pthread_cond_init_mt(&ostor->lru_cond);
+	ret = pthread_mutex_init(&ostor->dbuf_lock, NULL);
 	if (ret) {
 		goto error_free_lock;
 	}
+	ret = pthread_cond_init_mt(&ostor->lru_cond);
+	if (ret) {
+		goto error_free_dbuf_lock;
+	}
 	ostor->need_lru = 0;
 	ret = pthread_cond_init_mt(&ostor->alloc_cond);
 	if (ret) {
 		goto error_free_lru_cond;
 	}
-	RB_INIT(&ostor->cid_head);
-	RB_INIT(&ostor->atime_head);
+	for (i = 0; i < OSTOR_NUM_SHARDS; ++i) {
+		ret = pthread_mutex_init(&ostor->shards[i].lock, NULL);
+		if (ret) {
+			goto error_free_shards;
+		}
+		ret = pthread_cond_init(&ostor->shards[i].cond, NULL);
+		if (ret) {
+			pthread_mutex_destroy(&ostor->shards[i].lock);
+			goto error_free_shards;
+		}
+		RB_INIT(&ostor->shards[i].cid_head);
+		TAILQ_INIT(&ostor->shards[i].ring);
+	}
+	ostor->aio = NULL;
+	ostor->pack = NULL;
+	if (oconf->ostor_pack_mb > 0) {
+		snprintf(tpath, sizeof(tpath), "%s/%s", oconf->ostor_path,
+			OSTOR_PACK_DIR);
+		ostor->pack = opack_init(tpath,
+			((uint64_t)oconf->ostor_pack_mb) << 20,
+			oconf->ostor_pack_compact_pct);
+		if (IS_ERR(ostor->pack)) {
+			ret = PTR_ERR(ostor->pack);
+			goto error_free_shards;
+		}
+	}
+	else if (oconf->ostor_aio_depth > 0) {
+		/* Each open chunk may have a checksum file as well. */
+		num_slots = OSTOR_AIO_MAX_SLOTS;
+		if (ostor->max_open < num_slots / 2)
+			num_slots = ostor->max_open * 2;
+		ostor->aio = aio_ring_init(oconf->ostor_aio_depth, num_slots);
+		if (IS_ERR(ostor->aio)) {
+			ret = PTR_ERR(ostor->aio);
+			glitch_log("ostor_init: failed to set up asynchronous "
+				"I/O: error %d (%s).  Falling back to "
+				"synchronous I/O.\n", ret, terror(ret));
+			ostor->aio = NULL;
+		}
+	}
+	ostor->cache = NULL;
+	if (oconf->ostor_cache_mb > 0) {
+		ostor->cache = ocache_init(
+			((uint64_t)oconf->ostor_cache_mb) << 20,
+			oconf->ostor_cache_readahead, ostor_read_store, ostor);
+		if (IS_ERR(ostor->cache)) {
+			ret = PTR_ERR(ostor->cache);
+			ostor->cache = NULL;
+			goto error_free_aio;
+		}
+	}
+	if (!ostor->pack) {
+		ret = ostor_count_chunks(ostor);
+		if (ret) {
+			glitch_log("ostor_init: failed to count the chunks in "
+				"'%s': error %d (%s)\n", ostor->dir_path, ret,
+				terror(ret));
+			ret = FORCE_POSITIVE(ret);
+			goto error_free_aio;
+		}
+	}
 	ret = redfish_thread_create(g_fast_log_mgr, &ostor->lru_thread,
 		ostor_lru_thread, ostor);
 	if (ret) {
-		goto error_free_alloc_cond;
+		goto error_free_aio;
 	}
 	return ostor;
 
-error_free_alloc_cond:
+error_free_aio:
+	if (ostor->cache) {
+		ocache_shutdown(ostor->cache);
+		ocache_free(ostor->cache);
+	}
+	if (ostor->aio)
+		aio_ring_free(ostor->aio);
+	if (ostor->pack) {
+		opack_shutdown(ostor->pack);
+		opack_free(ostor->pack);
+	}
+error_free_shards:
+	while (--i >= 0) {
+		pthread_cond_destroy(&ostor->shards[i].cond);
+		pthread_mutex_destroy(&ostor->shards[i].lock);
+	}
 	pthread_cond_destroy(&ostor->alloc_cond);
 error_free_lru_cond:
 	pthread_cond_destroy(&ostor->lru_cond);
+error_free_dbuf_lock:
+	pthread_mutex_destroy(&ostor->dbuf_lock);
 error_free_lock:
 	pthread_mutex_destroy(&ostor->lock);
 error_free_dir_path:
@@ -370,10 +744,46 @@ void ostor_shutdown(struct ostor *ostor)
 	pthread_cond_broadcast(&ostor->alloc_cond);
 	pthread_mutex_unlock(&ostor->lock);
 	redfish_thread_join(&ostor->lru_thread);
+	if (ostor->cache)
+		ocache_shutdown(ostor->cache);
+	if (ostor->pack)
+		opack_shutdown(ostor->pack);
 }
 
 void ostor_free(struct ostor *ostor)
 {
+	int i;
+	struct ostor_shard *shard;
+	struct ochunk *ch;
+
+	if (ostor->cache)
+		ocache_free(ostor->cache);
+	for (i = 0; i < OSTOR_NUM_SHARDS; ++i) {
+		shard = &ostor->shards[i];
+		while (1) {
+			ch = RB_MIN(ochunks_by_cid, &shard->cid_head);
+			if (!ch)
+				break;
+			RB_REMOVE(ochunks_by_cid, &shard->cid_head, ch);
+			if (ch->fd >= 0)
+				close(ch->fd);
+			if (ch->csum_fd >= 0)
+				close(ch->csum_fd);
+			if (ch->direct_fd >= 0)
+				close(ch->direct_fd);
+			pthread_rwlock_destroy(&ch->io_lock);
+			free(ch);
+		}
+		pthread_cond_destroy(&shard->cond);
+		pthread_mutex_destroy(&shard->lock);
+	}
+	for (i = 0; i < ostor->num_dbufs; ++i)
+		free(ostor->dbufs[i]);
+	pthread_mutex_destroy(&ostor->dbuf_lock);
+	if (ostor->aio)
+		aio_ring_free(ostor->aio);
+	if (ostor->pack)
+		opack_free(ostor->pack);
 	pthread_cond_destroy(&ostor->alloc_cond);
 	pthread_cond_destroy(&ostor->lru_cond);
 	pthread_mutex_destroy(&ostor->lock);
@@ -381,10 +791,535 @@ void ostor_free(struct ostor *ostor)
 	free(ostor);
 }
 
+static void ostor_set_op(struct aio_op *op, int ty, int fd, int slot,
+		void *buf, uint32_t len, uint64_t off)
+{
+	memset(op, 0, sizeof(*op));
+	op->ty = ty;
+	op->fd = fd;
+	op->slot = slot;
+	op->buf = buf;
+	op->len = len;
+	op->off = off;
+}
+
+/** Carry out a batch of positional reads and writes.
+ *
+ * If we have an asynchronous I/O ring, the whole batch goes to the kernel with
+ * one system call.  Otherwise, or if the ring can't take the batch, the
+ * operations are done one after another.  Either way, the results are left in
+ * ops[i].res, as described in util/platform/aio.h.
+ *
+ * @param ostor		The ostor
+ * @param ops		The operations
+ * @param nops		Number of operations
+ */
+static void ostor_do_io(struct ostor *ostor, struct aio_op *ops, int nops)
+{
+	int i, cancel = 0;
+	ssize_t res;
+
+	if (ostor->aio && (aio_ring_run(ostor->aio, ops, nops) == 0))
+		return;
+	for (i = 0; i < nops; ++i) {
+		if (cancel) {
+			ops[i].res = -ECANCELED;
+		}
+		else if (ops[i].ty == AIO_OP_PREAD) {
+			ops[i].res = safe_pread(ops[i].fd, ops[i].buf,
+				ops[i].len, ops[i].off);
+		}
+		else {
+			res = safe_pwrite(ops[i].fd, ops[i].buf, ops[i].len,
+				ops[i].off);
+			ops[i].res = res ? res : (int32_t)ops[i].len;
+		}
+		cancel = ops[i].link && (ops[i].res != (int32_t)ops[i].len);
+	}
+}
+
+/** Get the result of an operation that had to transfer everything.
+ *
+ * @return		0 on success; -EIO if we hit the end of the file; the
+ *			error code otherwise
+ */
+static int ostor_op_result(const struct aio_op *op)
+{
+	if (op->res < 0)
+		return op->res;
+	if ((uint32_t)op->res != op->len)
+		return -EIO;
+	return 0;
+}
+
+/** Get an aligned buffer of OSTOR_DIRECT_BUF_SIZE bytes from the O_DIRECT
+ * buffer pool.
+ *
+ * @param ostor		The ostor
+ *
+ * @return		The buffer, or NULL if we ran out of memory
+ */
+static void *ostor_get_dbuf(struct ostor *ostor)
+{
+	void *buf = NULL;
+
+	pthread_mutex_lock(&ostor->dbuf_lock);
+	if (ostor->num_dbufs > 0)
+		buf = ostor->dbufs[--ostor->num_dbufs];
+	pthread_mutex_unlock(&ostor->dbuf_lock);
+	if (buf)
+		return buf;
+	if (posix_memalign(&buf, OSTOR_DIRECT_ALIGN, OSTOR_DIRECT_BUF_SIZE))
+		return NULL;
+	return buf;
+}
+
+/** Give a buffer back to the O_DIRECT buffer pool.
+ *
+ * @param ostor		The ostor
+ * @param buf		The buffer
+ */
+static void ostor_put_dbuf(struct ostor *ostor, void *buf)
+{
+	pthread_mutex_lock(&ostor->dbuf_lock);
+	if (ostor->num_dbufs < OSTOR_DIRECT_POOL_MAX) {
+		ostor->dbufs[ostor->num_dbufs++] = buf;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&ostor->dbuf_lock);
+	free(buf);
+}
+
+/** Decide whether part of a write should go through O_DIRECT, and open the
+ * chunk's O_DIRECT file descriptor if so.
+ *
+ * Should be called with ch->io_lock held for writing.
+ *
+ * @return		1 if the write should use O_DIRECT; 0 otherwise
+ */
+static int ochunk_use_direct(struct ostor *ostor, struct ochunk *ch,
+		int32_t dlen)
+{
+	int ret;
+	char path[PATH_MAX];
+
+	if ((ostor->direct_min == 0) || (dlen < ostor->direct_min))
+		return 0;
+	if (ch->direct_fd >= 0)
+		return 1;
+	ochunk_get_path(ostor, path, sizeof(path), ch->cid);
+	RETRY_ON_EINTR(ch->direct_fd, open(path,
+		O_WRONLY | O_DIRECT | O_CLOEXEC | O_NOATIME));
+	if (ch->direct_fd >= 0)
+		return 1;
+	ret = errno;
+	if (ret == EINVAL) {
+		glitch_log("ostor: the filesystem under %s doesn't support "
+			"O_DIRECT.  Falling back to buffered I/O.\n",
+			ostor->dir_path);
+		ostor->direct_min = 0;
+	}
+	return 0;
+}
+
+/** Write to a chunk through its O_DIRECT file descriptor.
+ *
+ * The caller's buffer usually isn't aligned, so the data is copied into
+ * aligned buffers from the pool first.
+ *
+ * Should be called with ch->io_lock held for writing.
+ *
+ * @param ostor		The ostor
+ * @param ch		The chunk
+ * @param data		The data to write
+ * @param off		Offset in the chunk.  Must be a multiple of
+ *			OSTOR_DIRECT_ALIGN.
+ * @param len		Length of the data.  Must be a multiple of
+ *			OSTOR_DIRECT_ALIGN.
+ *
+ * @return		0 on success; a negative error code otherwise
+ */
+static int ochunk_write_direct(struct ostor *ostor, struct ochunk *ch,
+		const char *data, uint64_t off, uint64_t len)
+{
+	int ret = 0;
+	uint64_t pos, plen;
+	struct aio_op op;
+	void *buf;
+
+	buf = ostor_get_dbuf(ostor);
+	if (!buf)
+		return -ENOMEM;
+	for (pos = 0; pos < len; pos += plen) {
+		plen = len - pos;
+		if (plen > OSTOR_DIRECT_BUF_SIZE)
+			plen = OSTOR_DIRECT_BUF_SIZE;
+		memcpy(buf, data + pos, plen);
+		ostor_set_op(&op, AIO_OP_PWRITE, ch->direct_fd, -1, buf,
+			plen, off + pos);
+		ostor_do_io(ostor, &op, 1);
+		ret = ostor_op_result(&op);
+		if (ret)
+			break;
+	}
+	ostor_put_dbuf(ostor, buf);
+	return ret;
+}
+
+/** Append to a chunk, updating its checksums.
+ *
+ * The data and the checksums are written with one batch.  The checksums are
+ * only written once all of the data has been.
+ *
+ * If the write is big enough, the aligned part in the middle of it is written
+ * through O_DIRECT first, after anything in front of it, so that large
+ * sequential writes don't fill up the page cache.  The rest of the data goes
+ * in the batch with the checksums.
+ *
+ * Should be called with ch->io_lock held for writing.
+ */
+static int ochunk_append(struct ostor *ostor, struct fast_log_buf *fb,
+		struct ochunk *ch, const char *data, int32_t dlen,
+		const uint32_t *crc)
+{
+	int ret, nops;
+	int32_t pos, plen;
+	uint32_t whole, pc, c, *crcs;
+	uint64_t off, first, nseg, i, dstart, dend;
+	struct aio_op ops[2];
+	struct stat st;
+
+	off = ch->size;
+	if (ch->csum_fd < 0) {
+		ostor_set_op(&ops[0], AIO_OP_PWRITE, ch->fd, ch->fd_slot,
+			(void*)data, dlen, off);
+		if (crc && (crc32c(CRC32C_INIT, data, dlen) != *crc)) {
+			fast_log_ostor(fb, FLOS_OCHUNK_BAD_CSUM, ch->cid, 0,
+				-EBADMSG, *crc);
+			return -EBADMSG;
+		}
+		ostor_do_io(ostor, ops, 1);
+		ret = ostor_op_result(&ops[0]);
+		if (ret) {
+			if (fstat(ch->fd, &st) == 0)
+				ch->size = st.st_size;
+			return ret;
+		}
+		ch->size = off + dlen;
+		return 0;
+	}
+	first = off >> OSTOR_CSUM_SEG_SHIFT;
+	nseg = ((off + dlen + OSTOR_CSUM_SEG - 1) >> OSTOR_CSUM_SEG_SHIFT) -
+		first;
+	crcs = malloc((nseg + 1) * sizeof(uint32_t));
+	if (!crcs)
+		return -ENOMEM;
+	/* Checksum each piece of the data once.  The checksums of the
+	 * segments, and of the data as a whole, are made from those. */
+	whole = CRC32C_INIT;
+	c = (off & (OSTOR_CSUM_SEG - 1)) ? ch->tail_crc : CRC32C_INIT;
+	for (pos = 0, i = 0; pos < dlen; pos += plen, ++i) {
+		plen = OSTOR_CSUM_SEG - ((off + pos) & (OSTOR_CSUM_SEG - 1));
+		if (plen > dlen - pos)
+			plen = dlen - pos;
+		pc = crc32c(CRC32C_INIT, data + pos, plen);
+		whole = crc32c_combine(whole, pc, plen);
+		c = crc32c_combine(c, pc, plen);
+		pack_to_be32(&crcs[i], c);
+		if (((off + pos + plen) & (OSTOR_CSUM_SEG - 1)) == 0)
+			c = CRC32C_INIT;
+	}
+	if (crc && (whole != *crc)) {
+		fast_log_ostor(fb, FLOS_OCHUNK_BAD_CSUM, ch->cid, 0,
+			-EBADMSG, *crc);
+		ret = -EBADMSG;
+		goto done;
+	}
+	dstart = dend = off;
+	if (ochunk_use_direct(ostor, ch, dlen)) {
+		dstart = (off + OSTOR_DIRECT_ALIGN - 1) &
+			~((uint64_t)OSTOR_DIRECT_ALIGN - 1);
+		dend = (off + dlen) & ~((uint64_t)OSTOR_DIRECT_ALIGN - 1);
+		if (dend <= dstart)
+			dstart = dend = off;
+	}
+	if (dend > dstart) {
+		if (dstart > off) {
+			ostor_set_op(&ops[0], AIO_OP_PWRITE, ch->fd,
+				ch->fd_slot, (void*)data, dstart - off, off);
+			ostor_do_io(ostor, ops, 1);
+			ret = ostor_op_result(&ops[0]);
+			if (ret)
+				goto error_size;
+		}
+		ret = ochunk_write_direct(ostor, ch, data + (dstart - off),
+			dstart, dend - dstart);
+		if (ret)
+			goto error_size;
+	}
+	nops = 0;
+	if (off + dlen > dend) {
+		ostor_set_op(&ops[nops], AIO_OP_PWRITE, ch->fd, ch->fd_slot,
+			(void*)(data + (dend - off)), off + dlen - dend, dend);
+		ops[nops++].link = 1;
+	}
+	ostor_set_op(&ops[nops++], AIO_OP_PWRITE, ch->csum_fd, ch->csum_slot,
+		crcs, nseg * sizeof(uint32_t), first * sizeof(uint32_t));
+	ostor_do_io(ostor, ops, nops);
+	if (nops > 1) {
+		ret = ostor_op_result(&ops[0]);
+		if (ret)
+			goto error_size;
+	}
+	ch->size = off + dlen;
+	ch->tail_crc = c;
+	ret = ostor_op_result(&ops[nops - 1]);
+	goto done;
+
+error_size:
+	/* Some of the data may have been written. */
+	if (fstat(ch->fd, &st) == 0)
+		ch->size = st.st_size;
+done:
+	free(crcs);
+	return ret;
+}
+
+/** Verify a segment which was read into a bounce buffer, and copy out the
+ * part of it that the caller wanted.
+ *
+ * @param fb		The fast log buffer
+ * @param ch		The chunk
+ * @param sstart	Offset of the segment in the chunk
+ * @param send		Offset of the end of the segment
+ * @param bounce	The segment data
+ * @param stored	The stored checksum of the segment
+ * @param start		Offset of the first byte the caller wants
+ * @param end		Offset of the end of the part the caller wants
+ * @param data		(out param) where to copy the part the caller wants
+ *
+ * @return		The checksum of the part that was copied, or an error
+ *			code as a negative number.  Note that this means that
+ *			the caller has to check the sign of a 64-bit result.
+ */
+static int64_t ochunk_check_partial(struct fast_log_buf *fb,
+		const struct ochunk *ch, uint64_t sstart, uint64_t send,
+		const char *bounce, const uint32_t *stored, uint64_t start,
+		uint64_t end, char *data)
+{
+	uint32_t c;
+
+	c = crc32c(CRC32C_INIT, bounce, send - sstart);
+	if (c != unpack_from_be32(stored)) {
+		fast_log_ostor(fb, FLOS_OCHUNK_CORRUPT, ch->cid, sstart,
+			-EIO, unpack_from_be32(stored));
+		return -EIO;
+	}
+	memcpy(data, bounce + (start - sstart), end - start);
+	return crc32c(CRC32C_INIT, data, end - start);
+}
+
+/** Read from a chunk, verifying its checksums.
+ *
+ * Should be called with ch->io_lock held for reading.
+ *
+ * Segments which are entirely inside the range being read are read directly
+ * into the caller's buffer.  The segments at the ends, if they are only partly
+ * wanted, go through bounce buffers, since we have to check the whole thing.
+ * The checksums, the segments at the ends, and the segments in between are
+ * all read with one batch.
+ */
+static int32_t ochunk_read(struct ostor *ostor, struct fast_log_buf *fb,
+		struct ochunk *ch, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc)
+{
+	int32_t ret;
+	int64_t res;
+	int i, nops, head, tail;
+	uint64_t end, first, nseg, pos, len;
+	uint64_t hstart, hend, mstart, mend, tstart, tend;
+	uint32_t whole, c, sc, *stored = NULL;
+	char *bounce = NULL;
+	struct aio_op ops[OSTOR_MAX_OPS];
+
+	if (ch->csum_fd < 0) {
+		ostor_set_op(&ops[0], AIO_OP_PREAD, ch->fd, ch->fd_slot,
+			data, dlen, off);
+		ostor_do_io(ostor, ops, 1);
+		ret = ops[0].res;
+		if ((ret >= 0) && crc)
+			*crc = crc32c(CRC32C_INIT, data, ret);
+		return ret;
+	}
+	whole = CRC32C_INIT;
+	if ((off >= ch->size) || (dlen == 0)) {
+		ret = 0;
+		goto done;
+	}
+	end = off + dlen;
+	if (end > ch->size)
+		end = ch->size;
+	first = off >> OSTOR_CSUM_SEG_SHIFT;
+	nseg = ((end - 1) >> OSTOR_CSUM_SEG_SHIFT) - first + 1;
+	stored = malloc(nseg * sizeof(uint32_t));
+	if (!stored) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	/* Work out which segments are only partly wanted.  A partial segment
+	 * at the end of the chunk is read as far as the end of the chunk. */
+	hstart = off & ~((uint64_t)OSTOR_CSUM_SEG - 1);
+	hend = hstart + OSTOR_CSUM_SEG;
+	if (hend > ch->size)
+		hend = ch->size;
+	head = (off != hstart) || (hend > end);
+	mstart = head ? hend : off;
+	tstart = (end - 1) & ~((uint64_t)OSTOR_CSUM_SEG - 1);
+	tend = tstart + OSTOR_CSUM_SEG;
+	if (tend > ch->size)
+		tend = ch->size;
+	tail = (tstart >= mstart) && (tend > end);
+	mend = tail ? tstart : end;
+	if (head || tail) {
+		bounce = malloc(2 * OSTOR_CSUM_SEG);
+		if (!bounce) {
+			ret = -ENOMEM;
+			goto done;
+		}
+	}
+	nops = 0;
+	ostor_set_op(&ops[nops++], AIO_OP_PREAD, ch->csum_fd, ch->csum_slot,
+		stored, nseg * sizeof(uint32_t), first * sizeof(uint32_t));
+	if (head) {
+		ostor_set_op(&ops[nops++], AIO_OP_PREAD, ch->fd, ch->fd_slot,
+			bounce, hend - hstart, hstart);
+	}
+	if (mend > mstart) {
+		ostor_set_op(&ops[nops++], AIO_OP_PREAD, ch->fd, ch->fd_slot,
+			data + (mstart - off), mend - mstart, mstart);
+	}
+	if (tail) {
+		ostor_set_op(&ops[nops++], AIO_OP_PREAD, ch->fd, ch->fd_slot,
+			bounce + OSTOR_CSUM_SEG, tend - tstart, tstart);
+	}
+	ostor_do_io(ostor, ops, nops);
+	for (i = 0; i < nops; ++i) {
+		ret = ostor_op_result(&ops[i]);
+		if (ret)
+			goto done;
+	}
+	if (head) {
+		len = ((hend < end) ? hend : end) - off;
+		res = ochunk_check_partial(fb, ch, hstart, hend, bounce,
+			&stored[0], off, off + len, data);
+		if (res < 0) {
+			ret = res;
+			goto done;
+		}
+		whole = crc32c_combine(whole, res, len);
+	}
+	for (pos = mstart; pos < mend; pos += len) {
+		len = OSTOR_CSUM_SEG - (pos & (OSTOR_CSUM_SEG - 1));
+		if (len > mend - pos)
+			len = mend - pos;
+		c = crc32c(CRC32C_INIT, data + (pos - off), len);
+		sc = unpack_from_be32(&stored[(pos >> OSTOR_CSUM_SEG_SHIFT) -
+			first]);
+		if (c != sc) {
+			fast_log_ostor(fb, FLOS_OCHUNK_CORRUPT, ch->cid, pos,
+				-EIO, sc);
+			ret = -EIO;
+			goto done;
+		}
+		whole = crc32c_combine(whole, c, len);
+	}
+	if (tail) {
+		res = ochunk_check_partial(fb, ch, tstart, tend,
+			bounce + OSTOR_CSUM_SEG, &stored[nseg - 1], tstart,
+			end, data + (tstart - off));
+		if (res < 0) {
+			ret = res;
+			goto done;
+		}
+		whole = crc32c_combine(whole, res, end - tstart);
+	}
+	ret = end - off;
+done:
+	if ((ret >= 0) && crc)
+		*crc = whole;
+	free(bounce);
+	free(stored);
+	return ret;
+}
+
+/** Find out how much of a write is already in a chunk.
+ *
+ * A client which doesn't hear back about a write sends it again, so some or
+ * all of it may have been written already.  That part must match what the
+ * chunk holds.
+ *
+ * Should be called with ch->io_lock held for writing.
+ *
+ * @return		The number of bytes at the start of the write which are
+ *			already in the chunk.  If this is nonzero, the
+ *			checksum of the whole write has been checked.
+ *			-ERANGE if the write starts past the end of the chunk;
+ *			-EEXIST if the chunk holds different data there;
+ *			another negative error code otherwise.
+ */
+static int32_t ochunk_overlap(struct ostor *ostor, struct fast_log_buf *fb,
+		struct ochunk *ch, uint64_t off, const char *data,
+		int32_t dlen, const uint32_t *crc)
+{
+	int32_t ret, olen;
+	char *buf;
+
+	if (off > ch->size)
+		return -ERANGE;
+	olen = dlen;
+	if (off + olen > ch->size)
+		olen = ch->size - off;
+	if (olen == 0)
+		return 0;
+	if (crc && (crc32c(CRC32C_INIT, data, dlen) != *crc)) {
+		fast_log_ostor(fb, FLOS_OCHUNK_BAD_CSUM, ch->cid, off,
+			-EBADMSG, *crc);
+		return -EBADMSG;
+	}
+	buf = malloc(olen);
+	if (!buf)
+		return -ENOMEM;
+	ret = ochunk_read(ostor, fb, ch, off, buf, olen, NULL);
+	if (ret >= 0)
+		ret = ((ret == olen) && (!memcmp(buf, data, olen))) ?
+			olen : -EEXIST;
+	free(buf);
+	return ret;
+}
+
+/** Record how long an operation on a chunk took
+ *
+ * @param ostor		The ostor
+ * @param cid		The chunk ID
+ * @param write		Nonzero for a write; zero for a read
+ * @param start_us	Monotonic time at which the operation started
+ */
+static void ostor_add_op_time(struct ostor *ostor, uint64_t cid, int write,
+		uint64_t start_us)
+{
+	uint64_t us = mt_time_us() - start_us;
+	struct ostor_shard *shard = ostor_cid_to_shard(ostor, cid);
+
+	ostor_wait_hist_add_atomic(write ? &shard->write_time :
+		&shard->read_time, us);
+}
+
 int ostor_write(struct ostor *ostor, struct fast_log_buf *fb, uint64_t cid,
-		const char *data, int32_t dlen)
+		uint64_t off, const char *data, int32_t dlen,
+		const uint32_t *crc)
 {
 	int ret;
+	uint64_t start_us = mt_time_us();
 	struct ochunk *ch;
 
 	if (dlen < 0) {
@@ -395,28 +1330,69 @@ int ostor_write(struct ostor *ostor, struct fast_log_buf *fb, uint64_t cid,
 		ret = -EINVAL;
 		goto done;
 	}
-	pthread_mutex_lock(&ostor->lock);
-	ch = ostor_get_ochunk(ostor, fb, cid, 1);
+	if (ostor->pack) {
+		ret = opack_write(ostor->pack, fb, cid, off, data, dlen,
+			crc);
+		goto done;
+	}
+	ch = ostor_hold_ochunk(ostor, fb, cid, (off == 0));
 	if (IS_ERR(ch)) {
-		pthread_mutex_unlock(&ostor->lock);
 		ret = FORCE_NEGATIVE(PTR_ERR(ch));
+		/* A chunk that doesn't exist yet is empty. */
+		if ((ret == -ENOENT) && (off != 0))
+			ret = -ERANGE;
 		goto done;
 	}
-	RB_REMOVE(ochunks_by_atime, &ostor->atime_head, ch);
-	ch->refcnt++;
-	pthread_mutex_unlock(&ostor->lock);
-	ret = safe_write(ch->fd, data, dlen);
+	pthread_rwlock_wrlock(&ch->io_lock);
+	ret = ochunk_overlap(ostor, fb, ch, off, data, dlen, crc);
+	if (ret == 0) {
+		ret = ochunk_append(ostor, fb, ch, data, dlen, crc);
+	}
+	else if (ret > 0) {
+		ret = (ret < dlen) ? ochunk_append(ostor, fb, ch, data + ret,
+			dlen - ret, NULL) : 0;
+	}
+	pthread_rwlock_unlock(&ch->io_lock);
 	ochunk_release(ostor, ch);
 done:
-	fast_log_ostor(fb, FLOS_OCHUNK_WRITE, cid, 0, ret, dlen);
+	/* Even a failed write may have changed the end of the chunk. */
+	if (ostor->cache && (cid != RF_INVAL_CID))
+		ocache_invalidate(ostor->cache, cid, off);
+	if (cid != RF_INVAL_CID)
+		ostor_add_op_time(ostor, cid, 1, start_us);
+	fast_log_ostor(fb, FLOS_OCHUNK_WRITE, cid, off, ret, dlen);
+	return ret;
+}
+
+/** Read from a chunk, without going through the segment cache.
+ *
+ * This is also how the segment cache reads from the store.  priv is the ostor.
+ */
+static int32_t ostor_read_store(void *priv, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc)
+{
+	int32_t ret;
+	struct ostor *ostor = priv;
+	struct ochunk *ch;
+
+	if (ostor->pack)
+		return opack_read(ostor->pack, fb, cid, off, data, dlen, crc);
+	ch = ostor_hold_ochunk(ostor, fb, cid, 0);
+	if (IS_ERR(ch))
+		return FORCE_NEGATIVE(PTR_ERR(ch));
+	pthread_rwlock_rdlock(&ch->io_lock);
+	ret = ochunk_read(ostor, fb, ch, off, data, dlen, crc);
+	pthread_rwlock_unlock(&ch->io_lock);
+	ochunk_release(ostor, ch);
 	return ret;
 }
 
 int32_t ostor_read(struct ostor *ostor, struct fast_log_buf *fb, uint64_t cid,
-		uint64_t off, char *data, int32_t dlen)
+		uint64_t off, char *data, int32_t dlen, uint32_t *crc)
 {
 	int ret;
-	struct ochunk *ch;
+	uint64_t start_us = mt_time_us();
 
 	if (dlen < 0) {
 		ret = -EINVAL;
@@ -426,18 +1402,11 @@ int32_t ostor_read(struct ostor *ostor, struct fast_log_buf *fb, uint64_t cid,
 		ret = -EINVAL;
 		goto done;
 	}
-	pthread_mutex_lock(&ostor->lock);
-	ch = ostor_get_ochunk(ostor, fb, cid, 0);
-	if (IS_ERR(ch)) {
-		pthread_mutex_unlock(&ostor->lock);
-		ret = FORCE_NEGATIVE(PTR_ERR(ch));
-		goto done;
-	}
-	RB_REMOVE(ochunks_by_atime, &ostor->atime_head, ch);
-	ch->refcnt++;
-	pthread_mutex_unlock(&ostor->lock);
-	ret = safe_pread(ch->fd, data, dlen, off);
-	ochunk_release(ostor, ch);
+	if (ostor->cache)
+		ret = ocache_read(ostor->cache, fb, cid, off, data, dlen, crc);
+	else
+		ret = ostor_read_store(ostor, fb, cid, off, data, dlen, crc);
+	ostor_add_op_time(ostor, cid, 0, start_us);
 done:
 	if (ret < 0)
 		fast_log_ostor(fb, FLOS_OCHUNK_READ, cid, off, ret, dlen);
@@ -449,6 +1418,8 @@ done:
 int ostor_unlink(struct ostor *ostor, struct fast_log_buf *fb, uint64_t cid)
 {
 	int ret, res;
+	uint64_t wait_start = 0;
+	struct ostor_shard *shard;
 	struct ochunk *ch;
 	char path[PATH_MAX];
 
@@ -456,45 +1427,70 @@ int ostor_unlink(struct ostor *ostor, struct fast_log_buf *fb, uint64_t cid)
 		ret = -EINVAL;
 		goto done;
 	}
+	if (ostor->pack) {
+		ret = opack_unlink(ostor->pack, fb, cid);
+		goto done;
+	}
 	/* Wait for the reference count to go to 0 before unlinking and freeing
-	 * the chunk.  The lock/unlock calls invoke memory barriers, making the
-	 * other threads' changes to ch->refcnt visible to us. */
+	 * the chunk.  Since ochunk_release doesn't take the shard lock, we
+	 * have to use compare-and-swap to claim the chunk. */
+	shard = ostor_cid_to_shard(ostor, cid);
+	pthread_mutex_lock(&shard->lock);
 	while (1) {
-		pthread_mutex_lock(&ostor->lock);
-		ch = ostor_get_ochunk(ostor, fb, cid, 0);
+		ch = ostor_get_ochunk(ostor, shard, fb, cid, 0);
 		if (IS_ERR(ch)) {
-			pthread_mutex_unlock(&ostor->lock);
+			pthread_mutex_unlock(&shard->lock);
 			ret = FORCE_NEGATIVE(PTR_ERR(ch));
 			goto done;
 		}
-		if (ch->refcnt == -1) {
-			pthread_mutex_unlock(&ostor->lock);
-			ret = -ENOENT;
-			goto done;
-		}
-		if (ch->refcnt == 0)
+		/* Let ochunk_release know that we're waiting before we look at
+		 * the reference count.  See ochunk_release. */
+		__sync_fetch_and_add(&shard->waiters, 1);
+		if (__sync_bool_compare_and_swap(&ch->refcnt, 0, -1)) {
+			__sync_fetch_and_sub(&shard->waiters, 1);
 			break;
-		pthread_mutex_unlock(&ostor->lock);
-		mt_msleep(1);
+		}
+		if (wait_start == 0)
+			wait_start = mt_time_us();
+		fast_log_ostor(fb, FLOS_OCHUNK_WAIT, cid, 0, -EBUSY,
+			ch->refcnt);
+		pthread_cond_wait(&shard->cond, &shard->lock);
+		__sync_fetch_and_sub(&shard->waiters, 1);
 	}
-	ch->refcnt = -1;
-	RB_REMOVE(ochunks_by_atime, &ostor->atime_head, ch);
-	pthread_mutex_unlock(&ostor->lock);
+	if (wait_start != 0)
+		ostor_wait_hist_add(&shard->unlink_wait,
+			mt_time_us() - wait_start);
+	ochunk_ring_remove(shard, ch);
+	pthread_mutex_unlock(&shard->lock);
 	ochunk_get_path(ostor, path, sizeof(path), ch->cid);
 	RETRY_ON_EINTR(res, unlink(path));
 	if (res) {
 		glitch_log("ostor error: failed to unlink %s: error %d\n",
 			path, res);
 	}
-	pthread_mutex_lock(&ostor->lock);
+	else
+		__sync_fetch_and_sub(&ostor->num_chunks, 1);
+	/* A checksum file left behind without its chunk is harmless.  If the
+	 * chunk is created again, the old checksums are overwritten. */
+	if (ch->csum_fd >= 0) {
+		ochunk_get_csum_path(ostor, path, sizeof(path), ch->cid);
+		RETRY_ON_EINTR(res, unlink(path));
+		if (res) {
+			glitch_log("ostor error: failed to unlink %s: "
+				"error %d\n", path, res);
+		}
+	}
+	pthread_mutex_lock(&shard->lock);
 	/* Now that the backing file has been deleted, we can evict the chunk
 	 * from memory.  We couldn't do this earlier because then someone else
 	 * might re-create the chunk.  His open() would then race with our
 	 * unlink() operation. */
-	ochunk_evict(ostor, fb, ch);
-	pthread_mutex_unlock(&ostor->lock);
+	ochunk_evict(ostor, shard, fb, ch);
+	pthread_mutex_unlock(&shard->lock);
 	ret = 0;
 done:
+	if (ostor->cache && (ret == 0))
+		ocache_invalidate(ostor->cache, cid, 0);
 	fast_log_ostor(fb, FLOS_OCHUNK_UNLINK, cid, 0, ret, 0);
 	return ret;
 }
@@ -502,15 +1498,255 @@ done:
 int ostor_verify(struct ostor *ostor, struct fast_log_buf *fb,
 		uint64_t cid)
 {
-	/* TODO: fancier things, like verifying checksums */
-	char data[1] = { 0 };
-	return ostor_read(ostor, fb, cid, 0, data, 0);
+	int ret;
+	uint64_t nseg;
+	struct ochunk *ch;
+	struct stat st;
+
+	if (cid == RF_INVAL_CID)
+		return -EINVAL;
+	if (ostor->pack)
+		return opack_verify(ostor->pack, fb, cid);
+	ch = ostor_hold_ochunk(ostor, fb, cid, 0);
+	if (IS_ERR(ch))
+		return FORCE_NEGATIVE(PTR_ERR(ch));
+	ret = 0;
+	pthread_rwlock_rdlock(&ch->io_lock);
+	if (ch->csum_fd >= 0) {
+		nseg = (ch->size + OSTOR_CSUM_SEG - 1) >> OSTOR_CSUM_SEG_SHIFT;
+		if (fstat(ch->csum_fd, &st) < 0)
+			ret = -errno;
+		else if ((uint64_t)st.st_size < nseg * sizeof(uint32_t))
+			ret = -EIO;
+	}
+	pthread_rwlock_unlock(&ch->io_lock);
+	ochunk_release(ostor, ch);
+	return ret;
 }
 
-static struct ochunk *ostor_get_ochunk(struct ostor *ostor,
+int32_t ostor_scrub_read(struct ostor *ostor, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen)
+{
+	if ((dlen < 0) || (cid == RF_INVAL_CID))
+		return -EINVAL;
+	return ostor_read_store(ostor, fb, cid, off, data, dlen, NULL);
+}
+
+static int compare_cid(const void *a, const void *b)
+{
+	uint64_t ca = *(const uint64_t*)a, cb = *(const uint64_t*)b;
+
+	if (ca < cb)
+		return -1;
+	if (ca > cb)
+		return 1;
+	return 0;
+}
+
+/** Get the chunk ID that a file in a chunk directory holds the data for.
+ *
+ * @return		The chunk ID, or RF_INVAL_CID if the file isn't a chunk
+ *			data file.  Checksum files are not.
+ */
+static uint64_t ostor_name_to_cid(const char *name, int bucket)
+{
+	int i;
+	uint64_t v = 0;
+	char c;
+
+	for (i = 0; name[i]; ++i) {
+		c = name[i];
+		if ((c >= '0') && (c <= '9'))
+			v = (v << 4) | (c - '0');
+		else if ((c >= 'a') && (c <= 'f'))
+			v = (v << 4) | (c - 'a' + 10);
+		else
+			return RF_INVAL_CID;
+	}
+	if (i != OSTOR_CHUNK_NAME_LEN)
+		return RF_INVAL_CID;
+	return (v << 16) | bucket;
+}
+
+int ostor_list(struct ostor *ostor, int bucket, uint64_t **cids)
+{
+	int ret, num = 0, max = 0;
+	uint64_t cid, *c, *arr = NULL;
+	char dpath[PATH_MAX];
+	struct redfish_dirp *dp;
+	struct dirent *de;
+
+	*cids = NULL;
+	if ((bucket < 0) || (bucket >= OSTOR_NUM_BUCKETS))
+		return -EINVAL;
+	if (ostor->pack) {
+		return opack_list(ostor->pack, OSTOR_NUM_BUCKETS - 1, bucket,
+			cids);
+	}
+	ochunk_get_dpath(ostor, dpath, sizeof(dpath), bucket);
+	ret = do_opendir(dpath, &dp);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret)
+		return ret;
+	while ((de = do_readdir(dp))) {
+		cid = ostor_name_to_cid(de->d_name, bucket);
+		if (cid == RF_INVAL_CID)
+			continue;
+		if (num == max) {
+			max = max ? (max * 2) : 64;
+			c = realloc(arr, max * sizeof(uint64_t));
+			if (!c) {
+				do_closedir(dp);
+				free(arr);
+				return -ENOMEM;
+			}
+			arr = c;
+		}
+		arr[num++] = cid;
+	}
+	do_closedir(dp);
+	if (num > 1)
+		qsort(arr, num, sizeof(uint64_t), compare_cid);
+	*cids = arr;
+	return num;
+}
+
+/** Count the chunks in an ostor which has no packed store
+ *
+ * @param ostor		The ostor
+ *
+ * @return		0 on success; error code otherwise
+ */
+static int ostor_count_chunks(struct ostor *ostor)
+{
+	int b, num;
+	uint64_t *cids;
+
+	ostor->num_chunks = 0;
+	for (b = 0; b < OSTOR_NUM_BUCKETS; ++b) {
+		num = ostor_list(ostor, b, &cids);
+		if (num < 0)
+			return num;
+		free(cids);
+		ostor->num_chunks += num;
+	}
+	return 0;
+}
+
+/** Find the shard that a chunk belongs to.
+ *
+ * Chunk IDs are handed out sequentially, so we mix the bits with a
+ * multiplicative hash rather than just using the low bits.
+ */
+static struct ostor_shard *ostor_cid_to_shard(struct ostor *ostor,
+		uint64_t cid)
+{
+	uint64_t h = cid * 0x9e3779b97f4a7c15ULL;
+
+	return &ostor->shards[h >> (64 - OSTOR_SHARD_BITS)];
+}
+
+/** Reserve a file descriptor for a chunk we're about to open, waiting for the
+ * lru thread to close some files if we already have too many open.
+ *
+ * Should be called with the shard lock __released__.
+ *
+ * @return		0 on success; ESHUTDOWN if we're shutting down
+ */
+static int ostor_reserve_fd(struct ostor *ostor, struct fast_log_buf *fb,
+		uint64_t cid)
+{
+	int ret;
+	uint64_t wait_start = 0;
+
+	pthread_mutex_lock(&ostor->lock);
+	while (1) {
+		if (ostor->shutdown) {
+			ret = ESHUTDOWN;
+			break;
+		}
+		if (ostor->num_open < ostor->max_open) {
+			ostor->num_open++;
+			ret = 0;
+			break;
+		}
+		if (wait_start == 0)
+			wait_start = mt_time_us();
+		fast_log_ostor(fb, FLOS_OCHUNK_WAIT, cid, 0, -EMFILE,
+			ostor->num_open);
+		ostor->need_lru++;
+		ostor->lru_gen++;
+		pthread_cond_signal(&ostor->lru_cond);
+		pthread_cond_wait(&ostor->alloc_cond, &ostor->lock);
+	}
+	if (wait_start != 0)
+		ostor_wait_hist_add(&ostor->fd_wait, mt_time_us() - wait_start);
+	pthread_mutex_unlock(&ostor->lock);
+	return ret;
+}
+
+/** Tell the lru thread that a chunk may have become evictable.
+ *
+ * Should be called with the ostor lock __released__.
+ */
+static void ostor_wake_lru(struct ostor *ostor)
+{
+	pthread_mutex_lock(&ostor->lock);
+	ostor->lru_gen++;
+	pthread_cond_signal(&ostor->lru_cond);
+	pthread_mutex_unlock(&ostor->lock);
+}
+
+/** Give back a file descriptor reserved by ostor_reserve_fd.
+ *
+ * May be called with a shard lock held.
+ */
+static void ostor_unreserve_fd(struct ostor *ostor)
+{
+	pthread_mutex_lock(&ostor->lock);
+	if (ostor->need_lru > 0)
+		ostor->need_lru--;
+	ostor->num_open--;
+	pthread_cond_signal(&ostor->alloc_cond);
+	pthread_mutex_unlock(&ostor->lock);
+}
+
+/** Find a chunk and take a reference to it, so that it won't be evicted.
+ * Drop the reference with ochunk_release.
+ *
+ * Should be called with the shard lock __released__.
+ */
+static struct ochunk *ostor_hold_ochunk(struct ostor *ostor,
 		struct fast_log_buf *fb, uint64_t cid, int create)
+{
+	struct ostor_shard *shard;
+	struct ochunk *ch;
+
+	shard = ostor_cid_to_shard(ostor, cid);
+	pthread_mutex_lock(&shard->lock);
+	ch = ostor_get_ochunk(ostor, shard, fb, cid, create);
+	if (IS_ERR(ch)) {
+		pthread_mutex_unlock(&shard->lock);
+		return ch;
+	}
+	__sync_fetch_and_add(&ch->refcnt, 1);
+	ch->referenced = 1;
+	pthread_mutex_unlock(&shard->lock);
+	return ch;
+}
+
+/** Find a chunk, opening it if necessary.
+ *
+ * Should be called with the shard lock held.  The lock may be dropped and
+ * re-taken while we wait.
+ */
+static struct ochunk *ostor_get_ochunk(struct ostor *ostor,
+		struct ostor_shard *shard, struct fast_log_buf *fb,
+		uint64_t cid, int create)
 {
 	int ret;
+	uint64_t wait_start = 0;
 	struct ochunk exemplar, *ch;
 
 	memset(&exemplar, 0, sizeof(exemplar));
@@ -520,7 +1756,7 @@ static struct ochunk *ostor_get_ochunk(struct ostor *ostor,
 			ch = ERR_PTR(ESHUTDOWN);
 			break;
 		}
-		ch = RB_FIND(ochunks_by_cid, &ostor->cid_head, &exemplar);
+		ch = RB_FIND(ochunks_by_cid, &shard->cid_head, &exemplar);
 		if (ch) {
 			if (ch->refcnt != -1) {
 				/* The chunk exists in memory and is ready to use */
@@ -534,99 +1770,315 @@ static struct ochunk *ostor_get_ochunk(struct ostor *ostor,
 				ch = ERR_PTR(ENOENT);
 				break;
 			}
-			/* Busy-wait until the chunk is either fully
-			 * created or fully destroyed.  Busy-waiting
-			 * sucks, but we should not hit this case very
-			 * often. */
-			pthread_mutex_unlock(&ostor->lock);
+			/* Wait until the chunk is either fully created
+			 * or fully destroyed. */
+			if (wait_start == 0)
+				wait_start = mt_time_us();
 			fast_log_ostor(fb, FLOS_OCHUNK_WAIT, cid,
 				0, -EBUSY, 0);
-			mt_msleep(1);
-			pthread_mutex_lock(&ostor->lock);
+			__sync_fetch_and_add(&shard->waiters, 1);
+			pthread_cond_wait(&shard->cond, &shard->lock);
+			__sync_fetch_and_sub(&shard->waiters, 1);
 			continue;
 		}
-		if (ostor->num_open < ostor->max_open) {
-			ch = ochunk_alloc(ostor, cid);
-			if (IS_ERR(ch))
-				break;
-			pthread_mutex_unlock(&ostor->lock);
-			ret = ochunk_open(ostor, ch, create);
-			fast_log_ostor(fb, FLOS_OCHUNK_ALLOC, cid,
-				0, ret, ch->fd);
-			pthread_mutex_lock(&ostor->lock);
-			if (ret) {
-				ochunk_evict(ostor, fb, ch);
-				ch = ERR_PTR(ret);
-				break;
-			}
-			/* The ochunk is now ready to use. */
-			ch->refcnt = 0;
+		pthread_mutex_unlock(&shard->lock);
+		ret = ostor_reserve_fd(ostor, fb, cid);
+		pthread_mutex_lock(&shard->lock);
+		if (ret) {
+			ch = ERR_PTR(ret);
 			break;
 		}
-		fast_log_ostor(fb, FLOS_OCHUNK_WAIT, cid, 0, -EMFILE,
-			ostor->num_open);
-		ostor->need_lru++;
-		pthread_cond_signal(&ostor->lru_cond);
-		pthread_cond_wait(&ostor->alloc_cond, &ostor->lock);
+		/* Someone else may have started opening the chunk while we
+		 * were waiting. */
+		if (RB_FIND(ochunks_by_cid, &shard->cid_head, &exemplar)) {
+			ostor_unreserve_fd(ostor);
+			continue;
+		}
+		ch = ochunk_alloc(shard, cid);
+		if (IS_ERR(ch)) {
+			ostor_unreserve_fd(ostor);
+			break;
+		}
+		pthread_mutex_unlock(&shard->lock);
+		ret = ochunk_open(ostor, ch, create);
+		fast_log_ostor(fb, FLOS_OCHUNK_ALLOC, cid,
+			0, ret, ch->fd);
+		if ((ret == 0) && ostor->aio) {
+			ch->fd_slot = aio_ring_register(ostor->aio, ch->fd);
+			if (ch->csum_fd >= 0)
+				ch->csum_slot = aio_ring_register(ostor->aio,
+					ch->csum_fd);
+		}
+		pthread_mutex_lock(&shard->lock);
+		if (ret) {
+			ochunk_evict(ostor, shard, fb, ch);
+			ch = ERR_PTR(ret);
+			break;
+		}
+		/* The ochunk is now ready to use. */
+		ch->refcnt = 0;
+		ochunk_ring_insert(shard, ch);
+		if (shard->waiters > 0)
+			pthread_cond_broadcast(&shard->cond);
+		break;
 	}
+	if (wait_start != 0)
+		ostor_wait_hist_add(&shard->busy_wait,
+			mt_time_us() - wait_start);
 	return ch;
 }
 
 /************************** lru *******************************/
-static struct ochunk *ostor_find_dispoable_chunk(struct ostor *ostor,
-			time_t cur_time)
+/** Sweep the clock hand around one shard.
+ *
+ * Should be called with the shard lock held.
+ *
+ * @param ostor		The ostor
+ * @param shard		The shard
+ * @param fb		The fast log buffer
+ * @param cur_time	The current monotonic time
+ * @param need		(in/out param) The number of chunks we need to evict
+ *			to make room for new ones.  Decremented for each chunk
+ *			we evict.
+ *
+ * @return		The number of chunks we evicted
+ */
+static int ostor_clock_sweep_shard(struct ostor *ostor,
+		struct ostor_shard *shard, struct fast_log_buf *fb,
+		time_t cur_time, int *need)
 {
+	int steps, evicted = 0;
 	struct ochunk *ch;
 
-	ch = RB_MIN(ochunks_by_atime, &ostor->atime_head);
-	while (ch) {
+	/* If we are desperate to evict something, we may have to go around
+	 * twice: once to clear the reference bits, and once to evict. */
+	steps = shard->ring_len;
+	if (*need > 0)
+		steps *= 2;
+	for (; steps > 0; --steps) {
+		ch = shard->hand;
+		if (!ch)
+			ch = TAILQ_FIRST(&shard->ring);
+		if (!ch)
+			break;
+		shard->hand = TAILQ_NEXT(ch, clock_entry);
 		/* We can't remove a chunk that someone is using */
-		if (ch->refcnt != 0) {
-			ch = RB_NEXT(ochunks_by_atime, &ostor->atime_head, ch);
+		if (ch->refcnt != 0)
 			continue;
+		if ((ch->atime + ostor->atime_timeo) > cur_time) {
+			/* If we're not desperate to evict something, leave
+			 * chunks that were used recently alone. */
+			if (*need <= 0)
+				continue;
+			if (ch->referenced) {
+				ch->referenced = 0;
+				continue;
+			}
+			(*need)--;
 		}
-		/* If we're not desperate to evict something, make sure the
-		 * chunk is old enough to evict. */
-		if ((ostor->need_lru == 0) &&
-				((ch->atime + ostor->atime_timeo) > cur_time))
-			return NULL;
-		return ch;
+		/* Someone may have taken a reference after we looked */
+		if (!__sync_bool_compare_and_swap(&ch->refcnt, 0, -1))
+			continue;
+		ochunk_ring_remove(shard, ch);
+		ochunk_evict(ostor, shard, fb, ch);
+		evicted++;
+	}
+	return evicted;
+}
+
+/** Sweep the clock hand around every shard.
+ *
+ * Should be called with no locks held.
+ *
+ * @return		The number of chunks we evicted
+ */
+static int ostor_clock_sweep(struct ostor *ostor, struct fast_log_buf *fb,
+		time_t cur_time, int need)
+{
+	int i, evicted = 0;
+	struct ostor_shard *shard;
+
+	/* Start at a different shard each time, so that no one shard bears
+	 * the brunt of evictions. */
+	for (i = 0; i < OSTOR_NUM_SHARDS; ++i) {
+		shard = &ostor->shards[(ostor->clock_shard + i) %
+				OSTOR_NUM_SHARDS];
+		pthread_mutex_lock(&shard->lock);
+		evicted += ostor_clock_sweep_shard(ostor, shard, fb,
+				cur_time, &need);
+		pthread_mutex_unlock(&shard->lock);
 	}
-	return NULL;
+	ostor->clock_shard = (ostor->clock_shard + 1) % OSTOR_NUM_SHARDS;
+	return evicted;
 }
 
 static int ostor_lru_thread(struct redfish_thread *rt)
 {
-	int res;
+	int res, need;
+	uint64_t gen;
 	struct timespec ts;
 	struct ostor *ostor = rt->priv;
-	struct ochunk *ch;
 
-	pthread_mutex_lock(&ostor->lock);
 	while (1) {
+		pthread_mutex_lock(&ostor->lock);
 		if (ostor->shutdown) {
 			pthread_mutex_unlock(&ostor->lock);
 			return 0;
 		}
+		need = ostor->need_lru;
+		gen = ostor->lru_gen;
+		pthread_mutex_unlock(&ostor->lock);
 		res = clock_gettime(CLOCK_MONOTONIC, &ts);
 		if (res)
 			abort();
-		ch = ostor_find_dispoable_chunk(ostor, ts.tv_sec);
-		if (!ch) {
-			if (ostor->need_lru == 0)
-				timespec_add_sec(&ts, OSTOR_LRU_LONG_PERIOD_SEC);
-			else
-				timespec_add_nsec(&ts, OSTOR_LRU_SHORT_PERIOD_NSEC);
+		if (ostor_clock_sweep(ostor, rt->fb, ts.tv_sec, need) > 0)
+			continue;
+		pthread_mutex_lock(&ostor->lock);
+		/* If someone started waiting for a file descriptor, or released
+		 * a chunk that they were waiting for, while we were sweeping,
+		 * go around again right away.  Otherwise, sleep until that
+		 * happens, or until it's time to look for idle chunks. */
+		if ((!ostor->shutdown) && (ostor->lru_gen == gen)) {
+			timespec_add_sec(&ts, OSTOR_LRU_LONG_PERIOD_SEC);
 			fast_log_ostor(rt->fb, FLOS_LRU_SLEEP, 0, 0,
 				0, ostor->need_lru);
 			pthread_cond_timedwait(&ostor->lru_cond,
 					&ostor->lock, &ts);
 			fast_log_ostor(rt->fb, FLOS_LRU_WAKE, 0, 0,
 				0, ostor->need_lru);
-			continue;
 		}
-		ch->refcnt = -1;
-		RB_REMOVE(ochunks_by_atime, &ostor->atime_head, ch);
-		ochunk_evict(ostor, rt->fb, ch);
+		pthread_mutex_unlock(&ostor->lock);
 	}
 }
+
+/************************** stats *******************************/
+/** Add a wait to a wait time histogram
+ *
+ * @param hist		The histogram
+ * @param us		The length of the wait in microseconds
+ */
+static void ostor_wait_hist_add(struct ostor_wait_hist *hist, uint64_t us)
+{
+	int b = 0;
+	uint64_t v = us;
+
+	while ((v >>= 1) && (b < OSTOR_WAIT_HIST_BUCKETS - 1))
+		b++;
+	hist->buckets[b]++;
+	hist->count++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
+/** Add a wait to a wait time histogram that other threads may be adding to at
+ * the same time, without taking any lock.
+ *
+ * @param hist		The histogram
+ * @param us		The length of the wait in microseconds
+ */
+static void ostor_wait_hist_add_atomic(struct ostor_wait_hist *hist,
+		uint64_t us)
+{
+	int b = 0;
+	uint64_t v = us, max, old;
+
+	while ((v >>= 1) && (b < OSTOR_WAIT_HIST_BUCKETS - 1))
+		b++;
+	__sync_fetch_and_add(&hist->buckets[b], 1);
+	__sync_fetch_and_add(&hist->count, 1);
+	__sync_fetch_and_add(&hist->total_us, us);
+	max = hist->max_us;
+	while (us > max) {
+		old = __sync_val_compare_and_swap(&hist->max_us, max, us);
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+uint64_t ostor_wait_hist_pct(const struct ostor_wait_hist *hist, int pct)
+{
+	int b;
+	uint64_t target, seen = 0, bound;
+
+	if (hist->count == 0)
+		return 0;
+	target = ((hist->count * pct) + 99) / 100;
+	if (target == 0)
+		target = 1;
+	for (b = 0; b < OSTOR_WAIT_HIST_BUCKETS - 1; ++b) {
+		seen += hist->buckets[b];
+		if (seen >= target)
+			break;
+	}
+	if (b == OSTOR_WAIT_HIST_BUCKETS - 1)
+		return hist->max_us;
+	bound = (2ULL << b) - 1;
+	return (bound < hist->max_us) ? bound : hist->max_us;
+}
+
+void ostor_wait_hist_sub(struct ostor_wait_hist *hist,
+		const struct ostor_wait_hist *old)
+{
+	int i;
+
+	hist->count -= old->count;
+	hist->total_us -= old->total_us;
+	for (i = 0; i < OSTOR_WAIT_HIST_BUCKETS; ++i)
+		hist->buckets[i] -= old->buckets[i];
+}
+
+static void ostor_wait_hist_merge(struct ostor_wait_hist *dst,
+		const struct ostor_wait_hist *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->total_us += src->total_us;
+	if (src->max_us > dst->max_us)
+		dst->max_us = src->max_us;
+	for (i = 0; i < OSTOR_WAIT_HIST_BUCKETS; ++i)
+		dst->buckets[i] += src->buckets[i];
+}
+
+void ostor_get_stats(struct ostor *ostor, struct ostor_stats *stats)
+{
+	int i;
+	struct ostor_shard *shard;
+
+	memset(stats, 0, sizeof(struct ostor_stats));
+	pthread_mutex_lock(&ostor->lock);
+	ostor_wait_hist_merge(&stats->fd_wait, &ostor->fd_wait);
+	pthread_mutex_unlock(&ostor->lock);
+	for (i = 0; i < OSTOR_NUM_SHARDS; ++i) {
+		shard = &ostor->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		ostor_wait_hist_merge(&stats->busy_wait, &shard->busy_wait);
+		ostor_wait_hist_merge(&stats->unlink_wait,
+			&shard->unlink_wait);
+		ostor_wait_hist_merge(&stats->read_time, &shard->read_time);
+		ostor_wait_hist_merge(&stats->write_time,
+			&shard->write_time);
+		pthread_mutex_unlock(&shard->lock);
+	}
+	if (ostor->cache)
+		ocache_get_stats(ostor->cache, &stats->cache);
+}
+
+int ostor_get_space(struct ostor *ostor, struct ostor_space *space)
+{
+	struct statvfs st;
+
+	memset(space, 0, sizeof(struct ostor_space));
+	if (ostor->pack)
+		space->num_chunks = opack_num_chunks(ostor->pack);
+	else
+		space->num_chunks = ostor->num_chunks;
+	if (statvfs(ostor->dir_path, &st) < 0)
+		return -errno;
+	space->free_bytes = ((uint64_t)st.f_bavail) * st.f_frsize;
+	space->used_bytes = ((uint64_t)(st.f_blocks - st.f_bfree)) *
+		st.f_frsize;
+	return 0;
+}
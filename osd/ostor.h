@@ -19,6 +19,8 @@
 #ifndef REDFISH_OSD_OSTOR_DOT_H
 #define REDFISH_OSD_OSTOR_DOT_H
 
+#include "osd/ocache.h"
+
 #include <stdint.h> /* for uint64_t, etc. */
 
 struct fast_log_buf;
@@ -30,7 +32,101 @@ struct ostorc;
  * The OSD stores its objects on the local filesystem.  It makes an attempt to
  * keep recently used file descriptors open, to avoid the overhead of doing an
  * open() and a close() for each operation.
+ *
+ * Each chunk is divided into segments of OSTOR_CSUM_SEG bytes.  Next to the
+ * file holding the chunk data is a file holding the CRC32C of each segment,
+ * as a big-endian 32-bit number.  The checksums are updated on every write and
+ * checked on every read.  Chunks written before we kept checksums have no
+ * checksum file; they are read without being verified.
+ *
+ * If ostor_pack_mb is set, chunks are kept in the packed store instead, which
+ * appends them to a few large container files.  See osd/opack.h.
+ *
+ * If ostor_cache_mb is set, recently read segments are also kept in memory.
+ * See osd/ocache.h.
+ */
+
+/** log2 of the size of a checksummed segment */
+#define OSTOR_CSUM_SEG_SHIFT 16
+
+/** Size of a checksummed segment */
+#define OSTOR_CSUM_SEG (1 << OSTOR_CSUM_SEG_SHIFT)
+
+/** Number of buckets that ostor_list divides the chunks into */
+#define OSTOR_NUM_BUCKETS 256
+
+/** Number of buckets in a wait time histogram */
+#define OSTOR_WAIT_HIST_BUCKETS 20
+
+/** Histogram of the time spent waiting for something.
+ *
+ * Bucket 0 counts waits shorter than 2 microseconds.  Bucket N counts waits of
+ * at least 2^N microseconds, but less than 2^(N+1).  The last bucket also
+ * counts everything longer than that.
  */
+struct ostor_wait_hist {
+	/** Number of waits */
+	uint64_t count;
+	/** Total time spent waiting, in microseconds */
+	uint64_t total_us;
+	/** Longest wait, in microseconds */
+	uint64_t max_us;
+	/** The histogram */
+	uint64_t buckets[OSTOR_WAIT_HIST_BUCKETS];
+};
+
+/** Object store statistics */
+struct ostor_stats {
+	/** Waits for a file descriptor, because too many chunks were open */
+	struct ostor_wait_hist fd_wait;
+	/** Waits for another thread to finish creating or destroying a
+	 * chunk */
+	struct ostor_wait_hist busy_wait;
+	/** Waits in ostor_unlink for other threads to stop using a chunk */
+	struct ostor_wait_hist unlink_wait;
+	/** Time taken by ostor_read */
+	struct ostor_wait_hist read_time;
+	/** Time taken by ostor_write */
+	struct ostor_wait_hist write_time;
+	/** Segment cache statistics.  All zero if there is no cache. */
+	struct ocache_stats cache;
+};
+
+/** How much room the object store has */
+struct ostor_space {
+	/** Bytes free on the filesystem the ostor is on, for unprivileged
+	 * users */
+	uint64_t free_bytes;
+	/** Bytes used on the filesystem the ostor is on, by anyone */
+	uint64_t used_bytes;
+	/** Number of chunks in the ostor */
+	uint64_t num_chunks;
+};
+
+/** Find a percentile of a wait time histogram
+ *
+ * Since the histogram only knows which power of two each wait was in, this is
+ * an upper bound.
+ *
+ * @param hist		The histogram
+ * @param pct		The percentile, from 0 to 100
+ *
+ * @return		An upper bound on the given percentile, in
+ *			microseconds, or 0 if the histogram is empty
+ */
+extern uint64_t ostor_wait_hist_pct(const struct ostor_wait_hist *hist,
+		int pct);
+
+/** Subtract an earlier copy of a histogram from a later one, to get the waits
+ * which happened in between.
+ *
+ * max_us is left alone, since it can't be taken apart.
+ *
+ * @param hist		The later copy of the histogram.  This is modified.
+ * @param old		The earlier copy
+ */
+extern void ostor_wait_hist_sub(struct ostor_wait_hist *hist,
+		const struct ostor_wait_hist *old);
 
 /** Create the object store
  *
@@ -58,17 +154,29 @@ extern void ostor_shutdown(struct ostor *ostor);
 extern void ostor_free(struct ostor *ostor);
 
 /** Write to a chunk
+ *
+ * Chunks can only be appended to, but each write says where it goes, so that
+ * a write can safely be sent again if the sender didn't hear back about it.
+ * Any part of the write that is already in the chunk is compared with what is
+ * there, rather than written again.
  *
  * @param ostor		The ostor
  * @param fb		The fast log buffer
  * @param cid		The chunk ID
+ * @param off		Offset in the chunk to write at
  * @param data		The data to write
  * @param dlen		Length of the data to write
+ * @param crc		If non-NULL, the CRC32C that the data is supposed to
+ *			have.  If it doesn't match, nothing is written.
  *
- * @return		0 on success; error code otherwise
+ * @return		0 on success; -EBADMSG if the data didn't match crc;
+ *			-ERANGE if off is past the end of the chunk; -EEXIST
+ *			if the chunk already holds different data at off;
+ *			error code otherwise
  */
 extern int ostor_write(struct ostor *ostor, struct fast_log_buf *fb,
-		uint64_t cid, const char *data, int32_t dlen);
+		uint64_t cid, uint64_t off, const char *data, int32_t dlen,
+		const uint32_t *crc);
 
 /** Read from a chunk
  *
@@ -79,12 +187,16 @@ extern int ostor_write(struct ostor *ostor, struct fast_log_buf *fb,
  * @param data		(out param) The buffer to read into.  Must be at least
  *			dlen bytes long.
  * @param dlen		The amount to read
+ * @param crc		(out param) If non-NULL, the CRC32C of the data that
+ *			was read
  *
- * @return		the number of bytes read on success; a negative error
+ * @return		the number of bytes read on success; -EIO if the data
+ *			on disk didn't match its checksum; a negative error
  *			code otherwise
  */
 extern int32_t ostor_read(struct ostor *ostor, struct fast_log_buf *fb,
-		uint64_t cid, uint64_t off, char *data, int32_t dlen);
+		uint64_t cid, uint64_t off, char *data, int32_t dlen,
+		uint32_t *crc);
 
 /** Unlink a chunk
  *
@@ -101,15 +213,72 @@ extern int ostor_unlink(struct ostor *ostor, struct fast_log_buf *fb,
 		uint64_t cid);
 
 /** Validate a chunk
+ *
+ * This checks that the chunk exists, and that its checksum file covers all of
+ * its data.  It doesn't read the data.
  *
  * @param ostor		The ostor
  * @param fb		The fast log buffer
  * @param cid		The chunk ID
  *
- * @return		0 if the chunk exists; -ENOENT if it does not;
- *			other error code on I/O error
+ * @return		0 if the chunk exists; -ENOENT if it does not; -EIO if
+ *			its checksum file doesn't cover all of its data; other
+ *			error code on I/O error
  */
 extern int ostor_verify(struct ostor *ostor, struct fast_log_buf *fb,
 		uint64_t cid);
 
+/** Read from a chunk for scrubbing
+ *
+ * This is like ostor_read, except that it always reads from the disk, and
+ * leaves the segment cache alone.  Chunks written before we kept checksums
+ * are read without being verified.
+ *
+ * @param ostor		The ostor
+ * @param fb		The fast log buffer
+ * @param cid		The chunk ID
+ * @param off		The offset to read from
+ * @param data		(out param) The buffer to read into
+ * @param dlen		The amount to read
+ *
+ * @return		the number of bytes read on success; -EIO if the data
+ *			on disk didn't match its checksum; a negative error
+ *			code otherwise
+ */
+extern int32_t ostor_scrub_read(struct ostor *ostor, struct fast_log_buf *fb,
+		uint64_t cid, uint64_t off, char *data, int32_t dlen);
+
+/** List the chunks in one bucket
+ *
+ * Every chunk is in exactly one bucket.  Chunks which are being written while
+ * we list them may or may not show up.
+ *
+ * @param ostor		The ostor
+ * @param bucket	The bucket, from 0 to OSTOR_NUM_BUCKETS - 1
+ * @param cids		(out param) a malloced array of chunk IDs, in
+ *			ascending order, or NULL if there are none
+ *
+ * @return		The number of chunks listed; a negative error code
+ *			otherwise
+ */
+extern int ostor_list(struct ostor *ostor, int bucket, uint64_t **cids);
+
+/** Get object store statistics
+ *
+ * @param ostor		The ostor
+ * @param stats		(out param) the statistics
+ */
+extern void ostor_get_stats(struct ostor *ostor, struct ostor_stats *stats);
+
+/** Find out how much room the object store has
+ *
+ * @param ostor		The ostor
+ * @param space		(out param) the free space, used space, and number of
+ *			chunks.  The number of chunks is filled in even if
+ *			we fail.
+ *
+ * @return		0 on success; error code otherwise
+ */
+extern int ostor_get_space(struct ostor *ostor, struct ostor_space *space);
+
 #endif
@@ -20,6 +20,7 @@
 #include "common/config/ostorc.h"
 #include "core/process_ctx.h"
 #include "osd/ostor.h"
+#include "util/crc32c.h"
 #include "util/error.h"
 #include "util/fast_log.h"
 #include "util/string.h"
@@ -29,6 +30,7 @@
 #include "util/time.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
@@ -37,6 +39,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/** Length of the chunk written by ostoru_csum_test */
+#define OSTORU_CSUM_LEN ((3 * OSTOR_CSUM_SEG) + 1234)
+
+/** Length of the chunk written by ostoru_offset_test.  This is long enough
+ * that the O_DIRECT part of a write has to be split between buffers. */
+#define OSTORU_OFFSET_LEN ((3 * 1024 * 1024) + 12345)
+
+/** O_DIRECT threshold to use when testing O_DIRECT, in kilobytes */
+#define OSTORU_DIRECT_KB 64
+
+/** Queue depth to use when testing asynchronous I/O */
+#define OSTORU_AIO_DEPTH 32
+
+/** Container size, in megabytes, to use when testing the packed store */
+#define OSTORU_PACK_MB 1
+
+/** If nonzero, the tests which support it use the packed store */
+static int ostoru_pack_mb;
+
+/** Segment cache size, in megabytes, to use when testing the cache */
+#define OSTORU_CACHE_MB 4
+
+/** If nonzero, the tests which support it read through the segment cache */
+static int ostoru_cache_mb;
 
 static const char TEST_DATA1[] = "1234567890";
 
@@ -53,6 +81,7 @@ static int ostoru_test_open_close(const char *ostor_path)
 	EXPECT_NOT_ERRPTR(oconf);
 	oconf->ostor_max_open = 10;
 	oconf->ostor_timeo = 10;
+	oconf->ostor_aio_depth = 0;
 	oconf->ostor_path = strdup(ostor_path);
 	EXPECT_NOT_EQ(oconf->ostor_path, NULL);
 	ostor = ostor_init(oconf);
@@ -64,10 +93,12 @@ static int ostoru_test_open_close(const char *ostor_path)
 }
 
 static int ostoru_simple_test(const char *ostor_path, struct fast_log_buf *fb,
-		int max_open)
+		int max_open, int aio_depth)
 {
 	struct ostorc *oconf;
 	struct ostor *ostor;
+	struct ostor_space space;
+	struct ostor_stats stats;
 	int32_t amt;
 	char buf[1024];
 
@@ -75,37 +106,81 @@ static int ostoru_simple_test(const char *ostor_path, struct fast_log_buf *fb,
 	EXPECT_NOT_ERRPTR(oconf);
 	oconf->ostor_max_open = max_open;
 	oconf->ostor_timeo = 10;
+	oconf->ostor_aio_depth = aio_depth;
+	oconf->ostor_pack_mb = ostoru_pack_mb;
+	oconf->ostor_pack_compact_pct = 50;
+	oconf->ostor_cache_mb = ostoru_cache_mb;
+	oconf->ostor_cache_readahead = 4;
 	oconf->ostor_path = strdup(ostor_path);
 	EXPECT_NOT_EQ(oconf->ostor_path, NULL);
 	ostor = ostor_init(oconf);
 	EXPECT_NOT_ERRPTR(ostor);
-	EXPECT_ZERO(ostor_write(ostor, fb, 123, TEST_DATA1,
-			strlen(TEST_DATA1)));
-	EXPECT_ZERO(ostor_write(ostor, fb, 456, TEST_DATA2,
-			strlen(TEST_DATA2)));
-	EXPECT_ZERO(ostor_write(ostor, fb, 789, TEST_DATA3,
-			strlen(TEST_DATA3)));
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 0, TEST_DATA1,
+			strlen(TEST_DATA1), NULL));
+	EXPECT_ZERO(ostor_write(ostor, fb, 456, 0, TEST_DATA2,
+			strlen(TEST_DATA2), NULL));
+	EXPECT_ZERO(ostor_write(ostor, fb, 789, 0, TEST_DATA3,
+			strlen(TEST_DATA3), NULL));
 	memset(buf, 0, sizeof(buf));
-	amt = ostor_read(ostor, fb, 123, 0, buf, sizeof(buf));
+	amt = ostor_read(ostor, fb, 123, 0, buf, sizeof(buf), NULL);
 	EXPECT_EQ(amt, strlen(TEST_DATA1));
 	EXPECT_ZERO(memcmp(buf, TEST_DATA1, strlen(TEST_DATA1)));
-	amt = ostor_read(ostor, fb, 456, 1, buf, sizeof(buf));
+	amt = ostor_read(ostor, fb, 456, 1, buf, sizeof(buf), NULL);
 	EXPECT_EQ(amt, strlen(TEST_DATA2) - 1);
 	EXPECT_ZERO(memcmp(buf, TEST_DATA2 + 1, strlen(TEST_DATA2) - 1));
-	amt = ostor_read(ostor, fb, 333, 0, buf, sizeof(buf));
+	amt = ostor_read(ostor, fb, 333, 0, buf, sizeof(buf), NULL);
 	EXPECT_EQ(amt, -ENOENT);
 	EXPECT_ZERO(ostor_unlink(ostor, fb, 123));
 	EXPECT_EQ(ostor_unlink(ostor, fb, 123), -ENOENT);
-	amt = ostor_read(ostor, fb, 123, 0, buf, sizeof(buf));
+	amt = ostor_read(ostor, fb, 123, 0, buf, sizeof(buf), NULL);
 	EXPECT_EQ(amt, -ENOENT);
-	amt = ostor_read(ostor, fb, 789, 0, buf, sizeof(buf));
+	amt = ostor_read(ostor, fb, 789, 0, buf, sizeof(buf), NULL);
 	EXPECT_EQ(amt, 0);
+	ostor_get_stats(ostor, &stats);
+	EXPECT_EQ(stats.write_time.count, 3);
+	EXPECT_EQ(stats.read_time.count, 5);
+	EXPECT_ZERO(ostor_get_space(ostor, &space));
+	EXPECT_EQ(space.num_chunks, 2);
+	EXPECT_GT(space.used_bytes + space.free_bytes, 0);
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+
+	/* The chunks are counted again when the ostor is reopened */
+	ostor = ostor_init(oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+	EXPECT_ZERO(ostor_get_space(ostor, &space));
+	EXPECT_EQ(space.num_chunks, 2);
 	ostor_shutdown(ostor);
 	ostor_free(ostor);
 	JORM_FREE_ostorc(oconf);
 	return 0;
 }
 
+static int ostoru_wait_hist_test(void)
+{
+	struct ostor_wait_hist hist, old;
+
+	memset(&hist, 0, sizeof(hist));
+	EXPECT_ZERO(ostor_wait_hist_pct(&hist, 50));
+	hist.buckets[0] = 50;
+	hist.buckets[3] = 49;
+	hist.buckets[10] = 1;
+	hist.count = 100;
+	hist.max_us = 1500;
+	EXPECT_EQ(ostor_wait_hist_pct(&hist, 50), 1);
+	EXPECT_EQ(ostor_wait_hist_pct(&hist, 99), 15);
+	EXPECT_EQ(ostor_wait_hist_pct(&hist, 100), 1500);
+
+	memset(&old, 0, sizeof(old));
+	old.buckets[0] = 50;
+	old.count = 50;
+	ostor_wait_hist_sub(&hist, &old);
+	EXPECT_EQ(hist.count, 50);
+	EXPECT_EQ(ostor_wait_hist_pct(&hist, 50), 15);
+	EXPECT_EQ(ostor_wait_hist_pct(&hist, 99), 1500);
+	return 0;
+}
+
 static sem_t ostoru_threaded_test_sem1;
 static sem_t ostoru_threaded_test_sem2;
 
@@ -114,15 +189,16 @@ static int ostoru_thread1(struct redfish_thread *rt)
 	char buf[1024];
 	struct ostor *ostor = rt->priv;
 
-	EXPECT_ZERO(ostor_write(ostor, rt->fb, 123, TEST_DATA1,
-		strlen(TEST_DATA1)));
+	EXPECT_ZERO(ostor_write(ostor, rt->fb, 123, 0, TEST_DATA1,
+		strlen(TEST_DATA1), NULL));
 	sem_post(&ostoru_threaded_test_sem2);
 	sem_wait(&ostoru_threaded_test_sem1);
-	EXPECT_EQ(ostor_read(ostor, rt->fb, 123, 0, buf, sizeof(buf)),
+	EXPECT_EQ(ostor_read(ostor, rt->fb, 123, 0, buf, sizeof(buf),
+		NULL),
 		-ENOENT);
 	EXPECT_EQ(ostor_unlink(ostor, rt->fb, 123), -ENOENT);
-	EXPECT_ZERO(ostor_write(ostor, rt->fb, 456, TEST_DATA2,
-		strlen(TEST_DATA2)));
+	EXPECT_ZERO(ostor_write(ostor, rt->fb, 456, 0, TEST_DATA2,
+		strlen(TEST_DATA2), NULL));
 	sem_post(&ostoru_threaded_test_sem2);
 	sem_wait(&ostoru_threaded_test_sem1);
 	ostor_shutdown(ostor);
@@ -136,29 +212,33 @@ static int ostoru_thread2(struct redfish_thread *rt)
 	struct ostor *ostor = rt->priv;
 
 	sem_wait(&ostoru_threaded_test_sem2);
-	EXPECT_EQ(ostor_read(ostor, rt->fb, 123, 0, buf, sizeof(buf)),
+	EXPECT_EQ(ostor_read(ostor, rt->fb, 123, 0, buf, sizeof(buf),
+		NULL),
 		strlen(TEST_DATA1));
 	EXPECT_ZERO(memcmp(buf, TEST_DATA1, strlen(TEST_DATA1)));
-	EXPECT_EQ(ostor_read(ostor, rt->fb, 123, 0, buf, 1), 1);
+	EXPECT_EQ(ostor_read(ostor, rt->fb, 123, 0, buf, 1, NULL), 1);
 	EXPECT_ZERO(memcmp(buf, TEST_DATA1, 1));
 	EXPECT_ZERO(ostor_unlink(ostor, rt->fb, 123));
 	sem_post(&ostoru_threaded_test_sem1);
 	sem_wait(&ostoru_threaded_test_sem2);
-	EXPECT_ZERO(ostor_write(ostor, rt->fb, 456, TEST_DATA2,
-		strlen(TEST_DATA2)));
-	EXPECT_EQ(ostor_read(ostor, rt->fb, 456, 0, buf, sizeof(buf)),
+	EXPECT_ZERO(ostor_write(ostor, rt->fb, 456, strlen(TEST_DATA2),
+		TEST_DATA2, strlen(TEST_DATA2), NULL));
+	EXPECT_EQ(ostor_read(ostor, rt->fb, 456, 0, buf, sizeof(buf),
+		NULL),
 		2 * strlen(TEST_DATA2));
 	EXPECT_ZERO(memcmp(buf, TEST_DATA2, strlen(TEST_DATA2)));
 	EXPECT_ZERO(memcmp(buf + strlen(TEST_DATA2), TEST_DATA2,
 		strlen(TEST_DATA2)));
 	sem_post(&ostoru_threaded_test_sem1);
 	sem_wait(&ostoru_threaded_test_sem2);
-	EXPECT_EQ(ostor_read(ostor, rt->fb, 456, 0, buf, sizeof(buf)),
+	EXPECT_EQ(ostor_read(ostor, rt->fb, 456, 0, buf, sizeof(buf),
+		NULL),
 		-ESHUTDOWN);
 	return 0;
 }
 
-static int ostoru_threaded_test(const char *ostor_path, int max_open)
+static int ostoru_threaded_test(const char *ostor_path, int max_open,
+		int aio_depth)
 {
 	struct ostorc *oconf;
 	struct ostor *ostor;
@@ -170,6 +250,11 @@ static int ostoru_threaded_test(const char *ostor_path, int max_open)
 	EXPECT_NOT_ERRPTR(oconf);
 	oconf->ostor_max_open = max_open;
 	oconf->ostor_timeo = 10;
+	oconf->ostor_aio_depth = aio_depth;
+	oconf->ostor_pack_mb = ostoru_pack_mb;
+	oconf->ostor_pack_compact_pct = 50;
+	oconf->ostor_cache_mb = ostoru_cache_mb;
+	oconf->ostor_cache_readahead = 4;
 	oconf->ostor_path = strdup(ostor_path);
 	EXPECT_NOT_EQ(oconf->ostor_path, NULL);
 	ostor = ostor_init(oconf);
@@ -187,8 +272,289 @@ static int ostoru_threaded_test(const char *ostor_path, int max_open)
 	return 0;
 }
 
+/** Number of threads used by ostoru_many_chunks_test */
+#define OSTORU_MANY_THREADS 4
+
+/** Number of chunks each thread uses in ostoru_many_chunks_test */
+#define OSTORU_MANY_CHUNKS 50
+
+/** Number of times each chunk is written in ostoru_many_chunks_test */
+#define OSTORU_MANY_ROUNDS 3
+
+/** Used to give each thread in ostoru_many_chunks_test its own chunks */
+static int ostoru_many_next_thread;
+
+static int ostoru_many_chunks_thread(struct redfish_thread *rt)
+{
+	int i, round;
+	uint64_t cid, base;
+	char buf[1024];
+	struct ostor *ostor = rt->priv;
+
+	/* Chunk file names only use the low 8 and the high 48 bits of the
+	 * chunk ID, so keep each thread's chunk IDs apart in the high bits. */
+	base = (uint64_t)(__sync_fetch_and_add(&ostoru_many_next_thread, 1)
+		+ 1) << 16;
+	for (round = 0; round < OSTORU_MANY_ROUNDS; ++round) {
+		for (i = 0; i < OSTORU_MANY_CHUNKS; ++i) {
+			cid = base + i;
+			EXPECT_ZERO(ostor_write(ostor, rt->fb, cid,
+				round * strlen(TEST_DATA1), TEST_DATA1,
+				strlen(TEST_DATA1), NULL));
+		}
+	}
+	for (i = 0; i < OSTORU_MANY_CHUNKS; ++i) {
+		cid = base + i;
+		EXPECT_EQ(ostor_read(ostor, rt->fb, cid, 0, buf,
+			sizeof(buf), NULL),
+			OSTORU_MANY_ROUNDS * strlen(TEST_DATA1));
+		EXPECT_ZERO(memcmp(buf, TEST_DATA1, strlen(TEST_DATA1)));
+		if (i & 1)
+			EXPECT_ZERO(ostor_unlink(ostor, rt->fb, cid));
+	}
+	for (i = 0; i < OSTORU_MANY_CHUNKS; ++i) {
+		cid = base + i;
+		EXPECT_EQ(ostor_read(ostor, rt->fb, cid, 0, buf,
+			sizeof(buf), NULL), (i & 1) ? -ENOENT :
+			(int32_t)(OSTORU_MANY_ROUNDS * strlen(TEST_DATA1)));
+	}
+	return 0;
+}
+
+/** Have several threads use many more chunks than we are allowed to keep open
+ * at once, so that chunks in every shard are constantly being opened and
+ * evicted. */
+static int ostoru_many_chunks_test(const char *ostor_path, int max_open,
+		int aio_depth)
+{
+	int i;
+	uint64_t total;
+	struct ostorc *oconf;
+	struct ostor *ostor;
+	struct ostor_stats stats;
+	struct redfish_thread threads[OSTORU_MANY_THREADS];
+
+	oconf = JORM_INIT_ostorc();
+	EXPECT_NOT_ERRPTR(oconf);
+	oconf->ostor_max_open = max_open;
+	oconf->ostor_timeo = 10;
+	oconf->ostor_aio_depth = aio_depth;
+	oconf->ostor_path = strdup(ostor_path);
+	EXPECT_NOT_EQ(oconf->ostor_path, NULL);
+	ostor = ostor_init(oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+	for (i = 0; i < OSTORU_MANY_THREADS; ++i) {
+		EXPECT_ZERO(redfish_thread_create(g_fast_log_mgr,
+			&threads[i], ostoru_many_chunks_thread, ostor));
+	}
+	for (i = 0; i < OSTORU_MANY_THREADS; ++i) {
+		EXPECT_ZERO(redfish_thread_join(&threads[i]));
+	}
+	/* We used more chunks than we could open at once, so we must have
+	 * waited for file descriptors. */
+	ostor_get_stats(ostor, &stats);
+	EXPECT_GT(stats.fd_wait.count, 0);
+	for (i = 0, total = 0; i < OSTOR_WAIT_HIST_BUCKETS; ++i)
+		total += stats.fd_wait.buckets[i];
+	EXPECT_EQ(total, stats.fd_wait.count);
+	EXPECT_GE(stats.fd_wait.total_us, stats.fd_wait.max_us);
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+	JORM_FREE_ostorc(oconf);
+	return 0;
+}
+
+/** Read a range of the chunk written by ostoru_csum_test, and check both the
+ * data and the checksum that we get back */
+static int ostoru_csum_check_read(struct ostor *ostor, struct fast_log_buf *fb,
+		const char *data, char *buf, uint64_t off, int32_t len)
+{
+	int32_t amt, expect;
+	uint32_t crc;
+
+	expect = len;
+	if (off + len > OSTORU_CSUM_LEN)
+		expect = OSTORU_CSUM_LEN - off;
+	memset(buf, 0, len);
+	amt = ostor_read(ostor, fb, 123, off, buf, len, &crc);
+	EXPECT_EQ(amt, expect);
+	EXPECT_ZERO(memcmp(buf, data + off, expect));
+	EXPECT_EQ(crc, crc32c(CRC32C_INIT, data + off, expect));
+	return 0;
+}
+
+static int ostoru_csum_test(const char *ostor_path, struct fast_log_buf *fb,
+		int aio_depth)
+{
+	struct ostorc *oconf;
+	struct ostor *ostor;
+	int i, fd, res;
+	uint32_t crc;
+	char *data, *buf, path[PATH_MAX], b;
+
+	data = malloc(OSTORU_CSUM_LEN);
+	EXPECT_NOT_EQ(data, NULL);
+	buf = malloc(OSTORU_CSUM_LEN + 100);
+	EXPECT_NOT_EQ(buf, NULL);
+	for (i = 0; i < OSTORU_CSUM_LEN; ++i)
+		data[i] = random();
+	oconf = JORM_INIT_ostorc();
+	EXPECT_NOT_ERRPTR(oconf);
+	oconf->ostor_max_open = 10;
+	oconf->ostor_timeo = 10;
+	oconf->ostor_aio_depth = aio_depth;
+	oconf->ostor_path = strdup(ostor_path);
+	EXPECT_NOT_EQ(oconf->ostor_path, NULL);
+	ostor = ostor_init(oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+
+	/* Appends that start and end in the middle of segments */
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 0, data, 1000, NULL));
+	crc = crc32c(CRC32C_INIT, data + 1000, OSTOR_CSUM_SEG * 2);
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 1000, data + 1000,
+		OSTOR_CSUM_SEG * 2, &crc));
+	/* Data that doesn't match its checksum is not written */
+	crc = crc32c(CRC32C_INIT, data + 1000 + (OSTOR_CSUM_SEG * 2),
+		OSTORU_CSUM_LEN - 1000 - (OSTOR_CSUM_SEG * 2)) ^ 1;
+	EXPECT_EQ(ostor_write(ostor, fb, 123, 1000 + (OSTOR_CSUM_SEG * 2),
+		data + 1000 + (OSTOR_CSUM_SEG * 2),
+		OSTORU_CSUM_LEN - 1000 - (OSTOR_CSUM_SEG * 2), &crc),
+		-EBADMSG);
+	crc ^= 1;
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 1000 + (OSTOR_CSUM_SEG * 2),
+		data + 1000 + (OSTOR_CSUM_SEG * 2),
+		OSTORU_CSUM_LEN - 1000 - (OSTOR_CSUM_SEG * 2), &crc));
+	EXPECT_ZERO(ostor_verify(ostor, fb, 123));
+
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf, 0,
+		OSTORU_CSUM_LEN));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf, 0,
+		OSTORU_CSUM_LEN + 100));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf, 1,
+		OSTOR_CSUM_SEG));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf,
+		OSTOR_CSUM_SEG, OSTOR_CSUM_SEG * 2));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf,
+		OSTOR_CSUM_SEG - 10, 20));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf, 100,
+		OSTOR_CSUM_SEG * 2));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf,
+		OSTOR_CSUM_SEG * 3, 1234));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf,
+		OSTORU_CSUM_LEN - 5, 5));
+	EXPECT_EQ(ostor_read(ostor, fb, 123, OSTORU_CSUM_LEN, buf, 10, &crc),
+		0);
+	EXPECT_EQ(crc, 0);
+
+	/* Flip a bit in the second segment behind the ostor's back */
+	EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/%02x/%014x", ostor_path,
+		123, 0));
+	fd = open(path, O_RDWR);
+	EXPECT_GT(fd, -1);
+	EXPECT_EQ(pread(fd, &b, 1, OSTOR_CSUM_SEG + 100), 1);
+	b ^= 0x10;
+	EXPECT_EQ(pwrite(fd, &b, 1, OSTOR_CSUM_SEG + 100), 1);
+	RETRY_ON_EINTR(res, close(fd));
+	EXPECT_EQ(ostor_read(ostor, fb, 123, 0, buf, OSTORU_CSUM_LEN, NULL),
+		-EIO);
+	EXPECT_EQ(ostor_read(ostor, fb, 123, OSTOR_CSUM_SEG + 200, buf, 10,
+		NULL), -EIO);
+	/* The other segments can still be read */
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf, 0,
+		OSTOR_CSUM_SEG));
+	EXPECT_ZERO(ostoru_csum_check_read(ostor, fb, data, buf,
+		OSTOR_CSUM_SEG * 2, OSTOR_CSUM_SEG + 1234));
+
+	/* Losing checksums is noticed by ostor_verify */
+	EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/%02x/%014x.crc",
+		ostor_path, 123, 0));
+	EXPECT_ZERO(truncate(path, 4));
+	EXPECT_EQ(ostor_verify(ostor, fb, 123), -EIO);
+	EXPECT_ZERO(ostor_unlink(ostor, fb, 123));
+	EXPECT_EQ(ostor_verify(ostor, fb, 123), -ENOENT);
+	EXPECT_EQ(access(path, F_OK), -1);
+
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+	JORM_FREE_ostorc(oconf);
+	free(buf);
+	free(data);
+	return 0;
+}
+
+static int ostoru_offset_test(const char *ostor_path, struct fast_log_buf *fb,
+		int aio_depth, int direct_kb)
+{
+	struct ostorc *oconf;
+	struct ostor *ostor;
+	int i;
+	uint32_t crc;
+	char *data, *buf;
+
+	data = malloc(OSTORU_OFFSET_LEN);
+	EXPECT_NOT_EQ(data, NULL);
+	buf = malloc(OSTORU_OFFSET_LEN);
+	EXPECT_NOT_EQ(buf, NULL);
+	for (i = 0; i < OSTORU_OFFSET_LEN; ++i)
+		data[i] = random();
+	oconf = JORM_INIT_ostorc();
+	EXPECT_NOT_ERRPTR(oconf);
+	oconf->ostor_max_open = 10;
+	oconf->ostor_timeo = 10;
+	oconf->ostor_aio_depth = aio_depth;
+	oconf->ostor_pack_mb = ostoru_pack_mb;
+	oconf->ostor_pack_compact_pct = 50;
+	oconf->ostor_cache_mb = ostoru_cache_mb;
+	oconf->ostor_cache_readahead = 4;
+	oconf->ostor_direct_kb = direct_kb;
+	oconf->ostor_path = strdup(ostor_path);
+	EXPECT_NOT_EQ(oconf->ostor_path, NULL);
+	ostor = ostor_init(oconf);
+	EXPECT_NOT_ERRPTR(ostor);
+
+	/* Chunks can't have holes in them */
+	EXPECT_EQ(ostor_write(ostor, fb, 123, 100, data, 100, NULL), -ERANGE);
+	EXPECT_EQ(ostor_read(ostor, fb, 123, 0, buf, 100, NULL), -ENOENT);
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 0, data, 1000, NULL));
+	EXPECT_EQ(ostor_write(ostor, fb, 123, 1001, data + 1001, 100, NULL),
+		-ERANGE);
+
+	/* A big write, which starts and ends in the middle of pages */
+	crc = crc32c(CRC32C_INIT, data + 1000, OSTORU_OFFSET_LEN - 5000);
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 1000, data + 1000,
+		OSTORU_OFFSET_LEN - 5000, &crc));
+	/* Sending it again changes nothing */
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, 1000, data + 1000,
+		OSTORU_OFFSET_LEN - 5000, &crc));
+	crc ^= 1;
+	EXPECT_EQ(ostor_write(ostor, fb, 123, 1000, data + 1000,
+		OSTORU_OFFSET_LEN - 5000, &crc), -EBADMSG);
+	EXPECT_EQ(ostor_write(ostor, fb, 123, 999, data + 1000, 10, NULL),
+		-EEXIST);
+	/* A write that was partly done before is finished */
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, OSTORU_OFFSET_LEN - 5000,
+		data + OSTORU_OFFSET_LEN - 5000, 5000, NULL));
+	EXPECT_ZERO(ostor_write(ostor, fb, 123, OSTORU_OFFSET_LEN - 10000,
+		data + OSTORU_OFFSET_LEN - 10000, 10000, NULL));
+	EXPECT_ZERO(ostor_verify(ostor, fb, 123));
+
+	memset(buf, 0, OSTORU_OFFSET_LEN);
+	EXPECT_EQ(ostor_read(ostor, fb, 123, 0, buf, OSTORU_OFFSET_LEN,
+		&crc), OSTORU_OFFSET_LEN);
+	EXPECT_ZERO(memcmp(buf, data, OSTORU_OFFSET_LEN));
+	EXPECT_EQ(crc, crc32c(CRC32C_INIT, data, OSTORU_OFFSET_LEN));
+
+	ostor_shutdown(ostor);
+	ostor_free(ostor);
+	JORM_FREE_ostorc(oconf);
+	free(buf);
+	free(data);
+	return 0;
+}
+
 int main(POSSIBLY_UNUSED(int argc), char **argv)
 {
+	int i, aio_depth;
 	char tdir[PATH_MAX];
 	struct fast_log_buf *fb;
 	timer_t timer;
@@ -203,18 +569,73 @@ int main(POSSIBLY_UNUSED(int argc), char **argv)
 	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
 	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
 	EXPECT_ZERO(ostoru_test_open_close(tdir));
+	EXPECT_ZERO(ostoru_wait_hist_test());
+
+	/* Run everything with synchronous I/O, and then again with the
+	 * asynchronous I/O ring, if this platform has one. */
+	for (i = 0; i < 2; ++i) {
+		aio_depth = i ? OSTORU_AIO_DEPTH : 0;
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_simple_test(tdir, fb, 100, aio_depth));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_simple_test(tdir, fb, 1, aio_depth));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_threaded_test(tdir, 10, aio_depth));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_csum_test(tdir, fb, aio_depth));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_many_chunks_test(tdir, 5, aio_depth));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_offset_test(tdir, fb, aio_depth, 0));
+
+		EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+		EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+		EXPECT_ZERO(ostoru_offset_test(tdir, fb, aio_depth,
+			OSTORU_DIRECT_KB));
+	}
+
+	/* The packed store doesn't keep a file per chunk, so the tests which
+	 * look at those files, or at file descriptor waits, don't apply. */
+	ostoru_pack_mb = OSTORU_PACK_MB;
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(ostoru_simple_test(tdir, fb, 1, 0));
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(ostoru_threaded_test(tdir, 10, 0));
+
+	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
+	EXPECT_ZERO(ostoru_offset_test(tdir, fb, 0, 0));
 
+	/* The checksum test corrupts chunk files behind the ostor's back,
+	 * which the segment cache can't know about. */
+	ostoru_pack_mb = 0;
+	ostoru_cache_mb = OSTORU_CACHE_MB;
 	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
 	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
-	EXPECT_ZERO(ostoru_simple_test(tdir, fb, 100));
+	EXPECT_ZERO(ostoru_simple_test(tdir, fb, 1, 0));
 
 	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
 	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
-	EXPECT_ZERO(ostoru_simple_test(tdir, fb, 1));
+	EXPECT_ZERO(ostoru_threaded_test(tdir, 10, 0));
 
 	EXPECT_ZERO(get_tempdir(tdir, sizeof(tdir), 0755));
 	EXPECT_ZERO(register_tempdir_for_cleanup(tdir));
-	EXPECT_ZERO(ostoru_threaded_test(tdir, 10));
+	EXPECT_ZERO(ostoru_offset_test(tdir, fb, OSTORU_AIO_DEPTH,
+		OSTORU_DIRECT_KB));
 
 	EXPECT_ZERO(mt_deactivate_alarm(timer));
 	fast_log_free(fb);
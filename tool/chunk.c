@@ -27,6 +27,7 @@
 #include "msg/xdr.h"
 #include "tool/common.h"
 #include "tool/tool.h"
+#include "util/crc32c.h"
 #include "util/error.h"
 #include "util/packed.h"
 #include "util/safe_io.h"
@@ -57,14 +58,67 @@ struct chunk_op_ctx {
 	int oid;
 	int fd;
 	struct osdc *osdc;
+	/** OSDs which the OSD we contact should replicate writes to */
+	struct endpoint chain[RF_MAX_OID];
+	/** Number of entries in chain */
+	int num_chain;
 };
 
+/** Parse a comma-separated list of OSD IDs into a replication chain
+ *
+ * @param cct		The chunk operation context
+ * @param str		The list of OSD IDs
+ *
+ * @return		0 on success; -EINVAL otherwise
+ */
+static int chunk_op_ctx_parse_chain(struct chunk_op_ctx *cct,
+		const char *str)
+{
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err);
+	char *buf, *tok, *state = NULL;
+	struct daemon_info *oinfo;
+	int oid, ret = 0;
+
+	buf = strdup(str);
+	if (!buf)
+		return -ENOMEM;
+	for (tok = strtok_r(buf, ",", &state); tok;
+			tok = strtok_r(NULL, ",", &state)) {
+		if (cct->num_chain >= RF_MAX_OID) {
+			glitch_log("You can't replicate to more than %d "
+				"OSDs.\n", RF_MAX_OID);
+			ret = -EINVAL;
+			break;
+		}
+		oid = str_to_int(tok, err, err_len);
+		if (err[0]) {
+			glitch_log("error parsing OSD ID: %s", err);
+			ret = -EINVAL;
+			break;
+		}
+		oinfo = cmap_get_oinfo(cct->rrc->cmap, oid);
+		if (!oinfo) {
+			glitch_log("Error: no such OSD as %d found in the "
+				"cluster map.\n", oid);
+			ret = -EINVAL;
+			break;
+		}
+		cct->chain[cct->num_chain].ip = oinfo->ip;
+		cct->chain[cct->num_chain].port =
+			oinfo->port[RF_ENTITY_TY_OSD];
+		cct->num_chain++;
+	}
+	free(buf);
+	return ret;
+}
+
 static struct chunk_op_ctx *chunk_op_ctx_alloc(struct fishtool_params *params)
 {
 	char err[512] = { 0 };
 	size_t err_len = sizeof(err);
 	struct chunk_op_ctx *cct;
-	const char *cid_str, *oid_str;
+	const char *cid_str, *oid_str, *chain_str;
 	int ret;
 
 	cct = calloc(1, sizeof(struct chunk_op_ctx));
@@ -108,6 +162,9 @@ static struct chunk_op_ctx *chunk_op_ctx_alloc(struct fishtool_params *params)
 			"config.", cct->oid);
 		goto error_free_rrc;
 	}
+	chain_str = params->lowercase_args[ALPHA_IDX('r')];
+	if (chain_str && chunk_op_ctx_parse_chain(cct, chain_str))
+		goto error_free_rrc;
 	return cct;
 
 error_free_rrc:
@@ -130,8 +187,8 @@ static void chunk_op_ctx_free(struct chunk_op_ctx *cct)
 	free(cct);
 }
 
-static int do_chunk_write(struct chunk_op_ctx *cct, const char *buf,
-		size_t buf_len)
+static int do_chunk_write(struct chunk_op_ctx *cct, uint64_t off,
+		const char *buf, size_t buf_len)
 {
 	int32_t ret;
 	struct mmm_osd_hflush_req req;
@@ -144,7 +201,11 @@ static int do_chunk_write(struct chunk_op_ctx *cct, const char *buf,
 	if (!oinfo)
 		return -EINVAL;
 	req.cid = cct->cid;
-	req.flags = 0;
+	req.off = off;
+	req.flags = MMM_OSD_FLAG_CRC32C;
+	req.crc = crc32c(CRC32C_INIT, buf, buf_len);
+	req.chain.chain_len = cct->num_chain;
+	req.chain.chain_val = cct->chain;
 	m = msg_xdr_extalloc(mmm_osd_hflush_req_ty,
 		(xdrproc_t)xdr_mmm_osd_hflush_req,
 		&req, buf_len, (void**)&extra);
@@ -176,14 +237,29 @@ static int do_chunk_write(struct chunk_op_ctx *cct, const char *buf,
 int fishtool_chunk_write(struct fishtool_params *params)
 {
 	int ret;
+	char err[512] = { 0 };
+	size_t err_len = sizeof(err);
 	struct chunk_op_ctx *cct = NULL;
-	const char *local;
+	const char *local, *start_str;
+	uint64_t off;
 
 	cct = chunk_op_ctx_alloc(params);
 	if (!cct) {
 		ret = -EIO;
 		goto done;
 	}
+	start_str = params->lowercase_args[ALPHA_IDX('s')];
+	if (start_str) {
+		off = str_to_u64(start_str, err, err_len);
+		if (err[0]) {
+			glitch_log("error parsing start: %s", err);
+			ret = -EINVAL;
+			goto done;
+		}
+	}
+	else {
+		off = 0;
+	}
 	local = params->lowercase_args[ALPHA_IDX('i')];
 	if (local) {
 		cct->fd = open(local, O_RDONLY);
@@ -212,12 +288,13 @@ int fishtool_chunk_write(struct fishtool_params *params)
 		if (amt == 0) {
 			break;
 		}
-		ret = do_chunk_write(cct, buf, amt);
+		ret = do_chunk_write(cct, off, buf, amt);
 		if (ret) {
 			fprintf(stderr, "do_chunk_write: error writing "
 				"%d bytes to %s: %d\n", amt, local, ret);
 			goto done;
 		}
+		off += amt;
 	}
 	ret =0;
 done:
@@ -236,13 +313,16 @@ static const char *fishtool_chunk_write_usage[] = {
 	"-i <file>      input file",
 	"               If no local file is given, stdin will be used.",
 	"-k <oid>       OSD ID to contact",
+	"-r <oids>      comma-separated list of OSD IDs which the OSD should",
+	"               pass the data on to, in order",
+	"-s <start>     starting offset within the chunk (default: 0)",
 	NULL,
 };
 
 struct fishtool_act g_fishtool_chunk_write = {
 	.name = "chunk_write",
 	.fn = fishtool_chunk_write,
-	.getopt_str = "i:k:",
+	.getopt_str = "i:k:r:s:",
 	.usage = fishtool_chunk_write_usage,
 };
 
@@ -288,6 +368,14 @@ static int do_chunk_read(struct chunk_op_ctx *cct, const char *fname,
 			"response type %d\n", unpack_from_be16(&tr->m->ty));
 		goto done;
 	}
+	if ((rr.flags & MMM_OSD_FLAG_CRC32C) &&
+			(crc32c(CRC32C_INIT, extra, m_len) != rr.crc)) {
+		ret = -EIO;
+		glitch_log("checksum mismatch in the data read from offset "
+			"%" PRIu64 "\n", start);
+		xdr_free((xdrproc_t)xdr_mmm_osd_read_resp, (void*)&rr);
+		goto done;
+	}
 	ret = FORCE_NEGATIVE(safe_write(fd, extra, m_len));
 	xdr_free((xdrproc_t)xdr_mmm_osd_read_resp, (void*)&rr);
 	if (ret) {
@@ -44,7 +44,7 @@ struct tool_rrctx *tool_rrctx_alloc(const char *cpath)
 	int ret;
 	char err[512] = { 0 };
 	size_t err_len = sizeof(err);
-	const struct msgr_conf mconf = {
+	struct msgr_conf mconf = {
 		.max_conn = 1024,
 		.max_tran = 1024,
 		.tcp_teardown_timeo = 10,
@@ -87,6 +87,7 @@ struct tool_rrctx *tool_rrctx_alloc(const char *cpath)
 		ret = PTR_ERR(rrc->ctx);
 		goto err_free_cmap;
 	}
+	mconf.compress_thresh = unitaryc_compress_thresh(rrc->conf);
 	rrc->msgr = msgr_init(err, err_len, &mconf);
 	if (IS_ERR(rrc->msgr)) {
 		ret = PTR_ERR(rrc->msgr);
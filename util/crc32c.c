@@ -0,0 +1,162 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/crc32c.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/** The Castagnoli polynomial, with the bits reversed */
+#define CRC32C_POLY 0x82f63b78U
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_HAVE_HW 1
+#endif
+
+typedef uint32_t (*crc32c_fn_t)(uint32_t crc, const uint8_t *p, size_t len);
+
+static pthread_once_t g_crc32c_once = PTHREAD_ONCE_INIT;
+
+/** The implementation we picked */
+static crc32c_fn_t g_crc32c_fn;
+
+/** Tables for the software implementation.  g_crc32c_tab[k][b] is the effect
+ * of byte b followed by k zero bytes. */
+static uint32_t g_crc32c_tab[8][256];
+
+/** g_crc32c_x2n[k] is x^(2^k) modulo the polynomial */
+static uint32_t g_crc32c_x2n[32];
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8) {
+		crc ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+			((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		crc = g_crc32c_tab[7][crc & 0xff] ^
+			g_crc32c_tab[6][(crc >> 8) & 0xff] ^
+			g_crc32c_tab[5][(crc >> 16) & 0xff] ^
+			g_crc32c_tab[4][crc >> 24] ^
+			g_crc32c_tab[3][p[4]] ^
+			g_crc32c_tab[2][p[5]] ^
+			g_crc32c_tab[1][p[6]] ^
+			g_crc32c_tab[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = g_crc32c_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		--len;
+	}
+	return crc;
+}
+
+#ifdef CRC32C_HAVE_HW
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t c = crc, v;
+
+	while (len >= 8) {
+		memcpy(&v, p, sizeof(v));
+		c = __builtin_ia32_crc32di(c, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c;
+	while (len > 0) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+		--len;
+	}
+	return crc;
+}
+#endif
+
+/** Multiply a and b modulo the polynomial.  Bit 31 is the x^0 term. */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31, p = 0;
+
+	while (m) {
+		if (a & m)
+			p ^= b;
+		m >>= 1;
+		b = (b & 1) ? ((b >> 1) ^ CRC32C_POLY) : (b >> 1);
+	}
+	return p;
+}
+
+static void crc32c_init(void)
+{
+	int i, k;
+	uint32_t c;
+
+	for (i = 0; i < 256; ++i) {
+		c = i;
+		for (k = 0; k < 8; ++k)
+			c = (c & 1) ? ((c >> 1) ^ CRC32C_POLY) : (c >> 1);
+		g_crc32c_tab[0][i] = c;
+	}
+	for (i = 0; i < 256; ++i) {
+		c = g_crc32c_tab[0][i];
+		for (k = 1; k < 8; ++k) {
+			c = g_crc32c_tab[0][c & 0xff] ^ (c >> 8);
+			g_crc32c_tab[k][i] = c;
+		}
+	}
+	c = 1U << 30; /* x^1 */
+	g_crc32c_x2n[0] = c;
+	for (k = 1; k < 32; ++k) {
+		c = crc32c_multmodp(c, c);
+		g_crc32c_x2n[k] = c;
+	}
+	g_crc32c_fn = crc32c_sw;
+#ifdef CRC32C_HAVE_HW
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		g_crc32c_fn = crc32c_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&g_crc32c_once, crc32c_init);
+	return ~g_crc32c_fn(~crc, buf, len);
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+{
+	int k;
+	uint32_t p;
+
+	pthread_once(&g_crc32c_once, crc32c_init);
+	/* Shift crc_a past len_b bytes of zeroes by multiplying it by
+	 * x^(8 * len_b), and then add in crc_b. */
+	p = 1U << 31; /* x^0 */
+	for (k = 3; len_b; len_b >>= 1, ++k) {
+		if (len_b & 1)
+			p = crc32c_multmodp(g_crc32c_x2n[k & 31], p);
+	}
+	return crc32c_multmodp(p, crc_a) ^ crc_b;
+}
+
+int crc32c_is_hw(void)
+{
+	pthread_once(&g_crc32c_once, crc32c_init);
+	return g_crc32c_fn != crc32c_sw;
+}
@@ -0,0 +1,67 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_CRC32C_DOT_H
+#define REDFISH_UTIL_CRC32C_DOT_H
+
+#include <stdint.h> /* for uint32_t */
+#include <unistd.h> /* for size_t */
+
+/* CRC32C (the Castagnoli polynomial, as used by iSCSI and ext4.)
+ *
+ * On x86 processors with SSE4.2, this uses the crc32 instruction.  Everywhere
+ * else, it uses a table-driven implementation that handles 8 bytes at a time.
+ * The choice is made the first time a checksum is computed.
+ */
+
+/** Checksum of zero bytes */
+#define CRC32C_INIT 0
+
+/** Extend a CRC32C checksum
+ *
+ * crc32c(crc32c(CRC32C_INIT, a, a_len), b, b_len) is the checksum of a
+ * followed by b.
+ *
+ * @param crc		The checksum of the data that came before buf
+ * @param buf		The data
+ * @param len		Length of buf
+ *
+ * @return		The checksum of the data that came before buf, followed
+ *			by buf
+ */
+extern uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/** Combine two CRC32C checksums without looking at the data
+ *
+ * This takes time proportional to log(len_b).
+ *
+ * @param crc_a		Checksum of the first piece of data
+ * @param crc_b		Checksum of the second piece of data
+ * @param len_b		Length of the second piece of data
+ *
+ * @return		The checksum of the first piece followed by the second
+ */
+extern uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+
+/** Determine whether the hardware CRC32C implementation is in use
+ *
+ * @return		1 if the crc32 instruction is used; 0 otherwise
+ */
+extern int crc32c_is_hw(void);
+
+#endif
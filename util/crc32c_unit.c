@@ -0,0 +1,91 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/crc32c.h"
+#include "util/test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CRC32C_UNIT_BUF_LEN 4099
+
+static uint8_t g_buf[CRC32C_UNIT_BUF_LEN];
+
+/** One bit at a time, straight from the definition */
+static uint32_t crc32c_slow(const uint8_t *p, size_t len)
+{
+	int k;
+	uint32_t crc = 0xffffffffU;
+
+	while (len--) {
+		crc ^= *p++;
+		for (k = 0; k < 8; ++k)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0x82f63b78U) :
+				(crc >> 1);
+	}
+	return ~crc;
+}
+
+static int test_crc32c_vectors(void)
+{
+	int i;
+
+	/* from RFC 3720, section B.4 */
+	memset(g_buf, 0, 32);
+	EXPECT_EQ(crc32c(CRC32C_INIT, g_buf, 32), 0x8a9136aaU);
+	memset(g_buf, 0xff, 32);
+	EXPECT_EQ(crc32c(CRC32C_INIT, g_buf, 32), 0x62a8ab43U);
+	for (i = 0; i < 32; ++i)
+		g_buf[i] = i;
+	EXPECT_EQ(crc32c(CRC32C_INIT, g_buf, 32), 0x46dd794eU);
+	EXPECT_EQ(crc32c(CRC32C_INIT, "123456789", 9), 0xe3069283U);
+	EXPECT_EQ(crc32c(CRC32C_INIT, "", 0), 0);
+	return 0;
+}
+
+static int test_crc32c_pieces(void)
+{
+	size_t i, len, split;
+	uint32_t whole, a, b;
+
+	for (i = 0; i < CRC32C_UNIT_BUF_LEN; ++i)
+		g_buf[i] = random();
+	for (len = 0; len < 80; ++len) {
+		/* unaligned starting points, too */
+		EXPECT_EQ(crc32c(CRC32C_INIT, g_buf + 3, len),
+			crc32c_slow(g_buf + 3, len));
+	}
+	len = CRC32C_UNIT_BUF_LEN;
+	whole = crc32c(CRC32C_INIT, g_buf, len);
+	EXPECT_EQ(whole, crc32c_slow(g_buf, len));
+	for (split = 0; split <= len; split += 37) {
+		a = crc32c(CRC32C_INIT, g_buf, split);
+		b = crc32c(CRC32C_INIT, g_buf + split, len - split);
+		EXPECT_EQ(crc32c(a, g_buf + split, len - split), whole);
+		EXPECT_EQ(crc32c_combine(a, b, len - split), whole);
+	}
+	return 0;
+}
+
+int main(void)
+{
+	printf("using %s crc32c\n", crc32c_is_hw() ? "hardware" : "software");
+	EXPECT_ZERO(test_crc32c_vectors());
+	EXPECT_ZERO(test_crc32c_pieces());
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/hmap.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define HMAP_MIN_CAP 8
+
+static uint32_t hmap_hash(uint64_t key)
+{
+	/* The finalizer from MurmurHash3.  Our keys tend to be sequential
+	 * transaction IDs or IP addresses that differ only in a few bits, so
+	 * we need to mix things up before using the low bits as an index. */
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+static int hmap_alloc_slots(struct hmap *h, uint32_t cap)
+{
+	h->slots = calloc(cap, sizeof(struct hmap_slot));
+	if (!h->slots)
+		return -ENOMEM;
+	h->mask = cap - 1;
+	h->num = 0;
+	return 0;
+}
+
+int hmap_init(struct hmap *h, uint32_t init_cap)
+{
+	uint32_t cap;
+
+	cap = HMAP_MIN_CAP;
+	while (cap < init_cap)
+		cap <<= 1;
+	return hmap_alloc_slots(h, cap);
+}
+
+void hmap_free(struct hmap *h)
+{
+	free(h->slots);
+	h->slots = NULL;
+	h->mask = 0;
+	h->num = 0;
+}
+
+void *hmap_get(const struct hmap *h, uint64_t key)
+{
+	uint32_t idx;
+	const struct hmap_slot *slot;
+
+	idx = hmap_hash(key) & h->mask;
+	while (1) {
+		slot = &h->slots[idx];
+		if (!slot->val)
+			return NULL;
+		if (slot->key == key)
+			return slot->val;
+		idx = (idx + 1) & h->mask;
+	}
+}
+
+static void hmap_insert_unique(struct hmap *h, uint64_t key, void *val)
+{
+	uint32_t idx;
+
+	idx = hmap_hash(key) & h->mask;
+	while (h->slots[idx].val)
+		idx = (idx + 1) & h->mask;
+	h->slots[idx].key = key;
+	h->slots[idx].val = val;
+	h->num++;
+}
+
+static int hmap_grow(struct hmap *h)
+{
+	uint32_t i, old_cap;
+	struct hmap_slot *old_slots;
+	int ret;
+
+	old_slots = h->slots;
+	old_cap = h->mask + 1;
+	ret = hmap_alloc_slots(h, old_cap << 1);
+	if (ret) {
+		h->slots = old_slots;
+		return ret;
+	}
+	for (i = 0; i < old_cap; ++i) {
+		if (old_slots[i].val)
+			hmap_insert_unique(h, old_slots[i].key,
+					old_slots[i].val);
+	}
+	free(old_slots);
+	return 0;
+}
+
+int hmap_put(struct hmap *h, uint64_t key, void *val)
+{
+	int ret;
+
+	if (hmap_get(h, key))
+		return -EEXIST;
+	if ((h->num + 1) * 4 > (h->mask + 1) * 3) {
+		ret = hmap_grow(h);
+		if (ret)
+			return ret;
+	}
+	hmap_insert_unique(h, key, val);
+	return 0;
+}
+
+void *hmap_remove(struct hmap *h, uint64_t key)
+{
+	uint32_t idx, next, home;
+	void *val;
+
+	idx = hmap_hash(key) & h->mask;
+	while (1) {
+		if (!h->slots[idx].val)
+			return NULL;
+		if (h->slots[idx].key == key)
+			break;
+		idx = (idx + 1) & h->mask;
+	}
+	val = h->slots[idx].val;
+	h->num--;
+	/* Shift later members of the probe sequence back into the hole, so
+	 * that lookups never stop early at an empty slot.  An entry can move
+	 * into the hole only if its home slot is not cyclically between the
+	 * hole and its current position. */
+	next = idx;
+	while (1) {
+		next = (next + 1) & h->mask;
+		if (!h->slots[next].val)
+			break;
+		home = hmap_hash(h->slots[next].key) & h->mask;
+		if (((next - home) & h->mask) < ((next - idx) & h->mask))
+			continue;
+		h->slots[idx] = h->slots[next];
+		idx = next;
+	}
+	h->slots[idx].key = 0;
+	h->slots[idx].val = NULL;
+	return val;
+}
@@ -0,0 +1,112 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_HMAP_DOT_H
+#define REDFISH_UTIL_HMAP_DOT_H
+
+#include <stdint.h> /* for uint64_t, etc. */
+
+/* An open-addressing hash table mapping 64-bit keys to non-NULL pointers.
+ *
+ * Collisions are resolved with linear probing, and deletions shift later
+ * entries backwards, so there are never any tombstones.  Keys are stored
+ * inline in the slot array, so a lookup usually costs a single cache miss
+ * rather than the chain of pointer dereferences that a tree would need.
+ *
+ * The table grows by doubling whenever it becomes 3/4 full.  It never shrinks.
+ *
+ * hmap does no locking of its own.
+ */
+
+struct hmap_slot {
+	/** The key */
+	uint64_t key;
+	/** The value, or NULL if this slot is empty */
+	void *val;
+};
+
+struct hmap {
+	/** Array of (mask + 1) slots */
+	struct hmap_slot *slots;
+	/** Number of slots minus one.  The number of slots is a power of 2. */
+	uint32_t mask;
+	/** Number of occupied slots */
+	uint32_t num;
+};
+
+/** Initialize a hash map
+ *
+ * @param h		The hash map
+ * @param init_cap	Initial number of slots.  Will be rounded up to a
+ *			power of 2.
+ *
+ * @return		0 on success; -ENOMEM on OOM
+ */
+extern int hmap_init(struct hmap *h, uint32_t init_cap);
+
+/** Free the memory associated with a hash map
+ *
+ * The values are not freed.
+ *
+ * @param h		The hash map
+ */
+extern void hmap_free(struct hmap *h);
+
+/** Look up a value in the hash map
+ *
+ * @param h		The hash map
+ * @param key		The key to look for
+ *
+ * @return		The value, or NULL if there is no such key
+ */
+extern void *hmap_get(const struct hmap *h, uint64_t key);
+
+/** Insert a value into the hash map
+ *
+ * @param h		The hash map
+ * @param key		The key
+ * @param val		The value.  Must not be NULL.
+ *
+ * @return		0 on success; -EEXIST if the key is already present;
+ *			-ENOMEM if we needed to grow the table and couldn't
+ */
+extern int hmap_put(struct hmap *h, uint64_t key, void *val);
+
+/** Remove a value from the hash map
+ *
+ * Removing entries invalidates any HMAP_FOREACH iteration in progress.
+ *
+ * @param h		The hash map
+ * @param key		The key to remove
+ *
+ * @return		The value that was removed, or NULL if there was no
+ *			such key
+ */
+extern void *hmap_remove(struct hmap *h, uint64_t key);
+
+/** Iterate over all values in the hash map, in no particular order.
+ *
+ * @param h		The hash map
+ * @param idx		A uint32_t to use as the iteration index
+ * @param v		A pointer which will be set to each value in turn
+ */
+#define HMAP_FOREACH(h, idx, v) \
+	for ((idx) = 0; (h)->slots && ((idx) <= (h)->mask); ++(idx)) \
+		if (((v) = (h)->slots[(idx)].val) != NULL)
+
+#endif
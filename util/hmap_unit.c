@@ -0,0 +1,94 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/hmap.h"
+#include "util/test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HMAP_UNIT_NUM_KEYS 5000
+
+static void *key_to_val(uint64_t key)
+{
+	return (void*)(uintptr_t)(key + 1);
+}
+
+static int test_hmap_simple(void)
+{
+	struct hmap h;
+
+	EXPECT_ZERO(hmap_init(&h, 0));
+	EXPECT_EQ(hmap_get(&h, 123), NULL);
+	EXPECT_ZERO(hmap_put(&h, 123, key_to_val(123)));
+	EXPECT_EQ(hmap_put(&h, 123, key_to_val(123)), -EEXIST);
+	EXPECT_EQ(hmap_get(&h, 123), key_to_val(123));
+	EXPECT_EQ(hmap_get(&h, 456), NULL);
+	EXPECT_EQ(hmap_remove(&h, 456), NULL);
+	EXPECT_EQ(hmap_remove(&h, 123), key_to_val(123));
+	EXPECT_EQ(hmap_get(&h, 123), NULL);
+	EXPECT_EQ(h.num, 0);
+	hmap_free(&h);
+	return 0;
+}
+
+static int test_hmap_many(void)
+{
+	struct hmap h;
+	uint64_t key;
+	uint32_t idx;
+	void *v;
+	int i, num_seen;
+
+	EXPECT_ZERO(hmap_init(&h, 4));
+	/* Use keys that differ only in their high bits, to make sure that the
+	 * hash function mixes them properly. */
+	for (i = 0; i < HMAP_UNIT_NUM_KEYS; ++i) {
+		key = ((uint64_t)i) << 32;
+		EXPECT_ZERO(hmap_put(&h, key, key_to_val(key)));
+	}
+	EXPECT_EQ(h.num, HMAP_UNIT_NUM_KEYS);
+	/* Remove every third key.  This exercises the backwards shift. */
+	for (i = 0; i < HMAP_UNIT_NUM_KEYS; i += 3) {
+		key = ((uint64_t)i) << 32;
+		EXPECT_EQ(hmap_remove(&h, key), key_to_val(key));
+	}
+	for (i = 0; i < HMAP_UNIT_NUM_KEYS; ++i) {
+		key = ((uint64_t)i) << 32;
+		if ((i % 3) == 0) {
+			EXPECT_EQ(hmap_get(&h, key), NULL);
+		}
+		else {
+			EXPECT_EQ(hmap_get(&h, key), key_to_val(key));
+		}
+	}
+	num_seen = 0;
+	HMAP_FOREACH(&h, idx, v) {
+		++num_seen;
+	}
+	EXPECT_EQ(num_seen, (int)h.num);
+	hmap_free(&h);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ZERO(test_hmap_simple());
+	EXPECT_ZERO(test_hmap_many());
+	return EXIT_SUCCESS;
+}
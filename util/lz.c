@@ -0,0 +1,252 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/lz.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+/** log2 of the number of entries in the compressor's hash table */
+#define LZ_HASH_BITS 12
+
+/** Largest distance back that a match can be */
+#define LZ_MAX_OFFSET 65535
+
+/** The last match must start at least this many bytes before the end of the
+ * input.  This leaves room for LZ_LAST_LITERALS, and keeps the 4-byte reads in
+ * the match loop inside the buffer. */
+#define LZ_MF_LIMIT 12
+
+/** The input always ends with at least this many literals */
+#define LZ_LAST_LITERALS 5
+
+/** Length field value meaning that more length bytes follow */
+#define LZ_LEN_EXT 15
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t lz_read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/** Write an extended length.
+ *
+ * @return		The new output position, or NULL if there was no room
+ */
+static uint8_t *lz_put_len(uint8_t *op, const uint8_t *oend, size_t len)
+{
+	while (len >= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op >= oend)
+		return NULL;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/** Write out a sequence.  If mlen is 0, this is the last sequence, which has
+ * no match.
+ *
+ * @return		The new output position, or NULL if there was no room
+ */
+static uint8_t *lz_put_seq(uint8_t *op, const uint8_t *oend,
+		const uint8_t *lit, size_t llen, size_t off, size_t mlen)
+{
+	uint8_t *token;
+	size_t ml;
+
+	if (op >= oend)
+		return NULL;
+	token = op++;
+	if (llen >= LZ_LEN_EXT) {
+		*token = LZ_LEN_EXT << 4;
+		op = lz_put_len(op, oend, llen - LZ_LEN_EXT);
+		if (!op)
+			return NULL;
+	}
+	else {
+		*token = llen << 4;
+	}
+	if ((size_t)(oend - op) < llen)
+		return NULL;
+	memcpy(op, lit, llen);
+	op += llen;
+	if (mlen == 0)
+		return op;
+	if (oend - op < 2)
+		return NULL;
+	*op++ = off & 0xff;
+	*op++ = off >> 8;
+	ml = mlen - LZ_MIN_MATCH;
+	if (ml >= LZ_LEN_EXT) {
+		*token |= LZ_LEN_EXT;
+		op = lz_put_len(op, oend, ml - LZ_LEN_EXT);
+	}
+	else {
+		*token |= ml;
+	}
+	return op;
+}
+
+size_t lz_compress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	const uint8_t *in = src;
+	uint8_t *op = dst;
+	const uint8_t *oend = op + dst_len;
+	size_t ip, anchor, ref, mlen, mflimit, limit;
+	uint32_t seq, h;
+
+	anchor = 0;
+	if (src_len > LZ_MF_LIMIT) {
+		memset(table, 0, sizeof(table));
+		mflimit = src_len - LZ_MF_LIMIT;
+		limit = src_len - LZ_LAST_LITERALS;
+		ip = 1;
+		while (ip < mflimit) {
+			seq = lz_read32(in + ip);
+			h = lz_hash(seq);
+			ref = table[h];
+			table[h] = ip;
+			if ((ip - ref > LZ_MAX_OFFSET) ||
+					(lz_read32(in + ref) != seq)) {
+				/* Skip ahead faster the longer it has been
+				 * since the last match. */
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			mlen = LZ_MIN_MATCH;
+			while ((ip + mlen + sizeof(uint64_t) <= limit) &&
+					(lz_read64(in + ref + mlen) ==
+					 lz_read64(in + ip + mlen)))
+				mlen += sizeof(uint64_t);
+			while ((ip + mlen < limit) &&
+					(in[ref + mlen] == in[ip + mlen]))
+				mlen++;
+			op = lz_put_seq(op, oend, in + anchor, ip - anchor,
+				ip - ref, mlen);
+			if (!op)
+				return 0;
+			ip += mlen;
+			anchor = ip;
+		}
+	}
+	op = lz_put_seq(op, oend, in + anchor, src_len - anchor, 0, 0);
+	if (!op)
+		return 0;
+	return op - (uint8_t*)dst;
+}
+
+/** Read an extended length.
+ *
+ * @return		0 on success; -EINVAL if the input ran out or the
+ *			length is absurd
+ */
+static int lz_get_len(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return -EINVAL;
+		b = *(*ip)++;
+		*len += b;
+		if (*len > SIZE_MAX / 2)
+			return -EINVAL;
+	} while (b == 255);
+	return 0;
+}
+
+int lz_decompress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + src_len;
+	uint8_t *op = dst;
+	uint8_t *oend = op + dst_len;
+	const uint8_t *match;
+	size_t llen, mlen, off;
+	uint8_t token;
+
+	while (1) {
+		if (ip >= iend)
+			return -EINVAL;
+		token = *ip++;
+		llen = token >> 4;
+		if ((llen == LZ_LEN_EXT) && lz_get_len(&ip, iend, &llen))
+			return -EINVAL;
+		if (((size_t)(iend - ip) < llen) ||
+				((size_t)(oend - op) < llen))
+			return -EINVAL;
+		memcpy(op, ip, llen);
+		ip += llen;
+		op += llen;
+		if (ip == iend)
+			break;
+		if (iend - ip < 2)
+			return -EINVAL;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((off == 0) || (off > (size_t)(op - (uint8_t*)dst)))
+			return -EINVAL;
+		mlen = token & LZ_LEN_EXT;
+		if ((mlen == LZ_LEN_EXT) && lz_get_len(&ip, iend, &mlen))
+			return -EINVAL;
+		mlen += LZ_MIN_MATCH;
+		if ((size_t)(oend - op) < mlen)
+			return -EINVAL;
+		match = op - off;
+		if (off >= mlen) {
+			memcpy(op, match, mlen);
+			op += mlen;
+			continue;
+		}
+		/* The match overlaps the bytes we are writing.  As long as it
+		 * starts at least 8 bytes back, we can still copy 8 bytes at a
+		 * time. */
+		if (off >= sizeof(uint64_t)) {
+			while (mlen >= sizeof(uint64_t)) {
+				memcpy(op, match, sizeof(uint64_t));
+				op += sizeof(uint64_t);
+				match += sizeof(uint64_t);
+				mlen -= sizeof(uint64_t);
+			}
+		}
+		while (mlen--)
+			*op++ = *match++;
+	}
+	return (op == oend) ? 0 : -EINVAL;
+}
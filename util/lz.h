@@ -0,0 +1,78 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_LZ_DOT_H
+#define REDFISH_UTIL_LZ_DOT_H
+
+#include <stdint.h> /* for uint8_t, etc. */
+#include <unistd.h> /* for size_t */
+
+/* A fast LZ77 compressor, in the style of LZ4.
+ *
+ * The compressed data is a series of sequences.  Each sequence starts with a
+ * token byte.  The high 4 bits of the token are the number of literal bytes
+ * which follow, and the low 4 bits are the length of the match after them,
+ * minus LZ_MIN_MATCH.  A value of 15 in either field means that more length
+ * bytes follow; each is added to the length, and the last one is less than
+ * 255.  After the literals comes a 16-bit little-endian offset back into the
+ * output, from which the match is copied.  The last sequence has no offset
+ * and no match; it just ends with the input.
+ *
+ * The compressor favors speed over ratio.  It uses a single hash table of
+ * recent positions and takes the first match it finds.
+ */
+
+/** Shortest match the compressor will use */
+#define LZ_MIN_MATCH 4
+
+/** Largest number of bytes that one byte of compressed data can turn into */
+#define LZ_MAX_RATIO 255
+
+/** Largest size that compressing n bytes can produce */
+#define LZ_COMPRESS_BOUND(n) ((n) + ((n) / 255) + 16)
+
+/** Compress a buffer
+ *
+ * @param src		The data to compress
+ * @param src_len	Length of src
+ * @param dst		(out param) The compressed data
+ * @param dst_len	Length of dst
+ *
+ * @return		The length of the compressed data, or 0 if it would not
+ *			fit in dst_len bytes
+ */
+extern size_t lz_compress(const void *src, size_t src_len,
+		void *dst, size_t dst_len);
+
+/** Decompress a buffer
+ *
+ * This is safe to use on untrusted input.  It never reads or writes outside of
+ * the buffers it is given.
+ *
+ * @param src		The compressed data
+ * @param src_len	Length of src
+ * @param dst		(out param) The decompressed data
+ * @param dst_len	The exact length of the decompressed data
+ *
+ * @return		0 on success; -EINVAL if the data was corrupt or did
+ *			not decompress to exactly dst_len bytes
+ */
+extern int lz_decompress(const void *src, size_t src_len,
+		void *dst, size_t dst_len);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/lz.h"
+#include "util/test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_UNIT_BUF_LEN 262144
+
+static uint8_t g_src[LZ_UNIT_BUF_LEN];
+static uint8_t g_comp[LZ_COMPRESS_BOUND(LZ_UNIT_BUF_LEN)];
+static uint8_t g_out[LZ_UNIT_BUF_LEN];
+
+/** Compress and decompress src_len bytes of g_src.
+ *
+ * @return		The compressed length, or a negative number on error
+ */
+static int lz_round_trip(size_t src_len)
+{
+	size_t clen;
+
+	clen = lz_compress(g_src, src_len, g_comp,
+		LZ_COMPRESS_BOUND(src_len));
+	EXPECT_GT(clen, 0);
+	EXPECT_ZERO(lz_decompress(g_comp, clen, g_out, src_len));
+	EXPECT_ZERO(memcmp(g_src, g_out, src_len));
+	/* Claiming the wrong length is detected */
+	if (src_len > 0) {
+		EXPECT_EQ(lz_decompress(g_comp, clen, g_out, src_len - 1),
+			-EINVAL);
+	}
+	EXPECT_EQ(lz_decompress(g_comp, clen, g_out, src_len + 1), -EINVAL);
+	return (int)clen;
+}
+
+static int test_lz_text(void)
+{
+	static const char *words[] = { "the ", "quick ", "brown ", "fox ",
+		"jumps ", "over ", "lazy ", "dog ", "redfish ", "chunk " };
+	size_t i, wl;
+	int clen;
+
+	i = 0;
+	while (i < LZ_UNIT_BUF_LEN) {
+		const char *w = words[random() % 10];
+		wl = strlen(w);
+		if (wl > LZ_UNIT_BUF_LEN - i)
+			wl = LZ_UNIT_BUF_LEN - i;
+		memcpy(g_src + i, w, wl);
+		i += wl;
+	}
+	clen = lz_round_trip(LZ_UNIT_BUF_LEN);
+	EXPECT_GT(clen, 0);
+	/* Text like this should compress by at least a factor of 2 */
+	EXPECT_LT(clen, LZ_UNIT_BUF_LEN / 2);
+	/* Long runs compress very well */
+	memset(g_src, 'a', LZ_UNIT_BUF_LEN);
+	clen = lz_round_trip(LZ_UNIT_BUF_LEN);
+	EXPECT_GT(clen, 0);
+	EXPECT_LT(clen, (LZ_UNIT_BUF_LEN / LZ_MAX_RATIO) + 64);
+	return 0;
+}
+
+static int test_lz_random(void)
+{
+	size_t i, clen;
+
+	for (i = 0; i < LZ_UNIT_BUF_LEN; ++i)
+		g_src[i] = random();
+	EXPECT_GT(lz_round_trip(LZ_UNIT_BUF_LEN), 0);
+	/* Random data doesn't fit into its original size */
+	clen = lz_compress(g_src, LZ_UNIT_BUF_LEN, g_comp, LZ_UNIT_BUF_LEN);
+	EXPECT_ZERO(clen);
+	/* Short inputs of every length */
+	for (i = 0; i < 100; ++i) {
+		EXPECT_GT(lz_round_trip(i), 0);
+	}
+	memset(g_src, 0, 100);
+	for (i = 0; i < 100; ++i) {
+		EXPECT_GT(lz_round_trip(i), 0);
+	}
+	return 0;
+}
+
+static int test_lz_corrupt(void)
+{
+	size_t i, j, clen;
+
+	memset(g_src, 'x', 1000);
+	memcpy(g_src + 500, "some text some text some text", 29);
+	clen = lz_compress(g_src, 1000, g_comp, sizeof(g_comp));
+	EXPECT_GT(clen, 0);
+	/* Truncated input */
+	for (i = 0; i < clen; ++i) {
+		EXPECT_EQ(lz_decompress(g_comp, i, g_out, 1000), -EINVAL);
+	}
+	/* Random damage must never make us read or write out of bounds.
+	 * Whether the result is an error depends on the damage. */
+	for (i = 0; i < 10000; ++i) {
+		lz_compress(g_src, 1000, g_comp, sizeof(g_comp));
+		for (j = 0; j < 3; ++j)
+			g_comp[random() % clen] = random();
+		lz_decompress(g_comp, clen, g_out, 1000);
+	}
+	/* An offset pointing before the start of the output */
+	g_comp[0] = (1 << 4);
+	g_comp[1] = 'a';
+	g_comp[2] = 2;
+	g_comp[3] = 0;
+	EXPECT_EQ(lz_decompress(g_comp, 4, g_out, 1 + LZ_MIN_MATCH), -EINVAL);
+	return 0;
+}
+
+int main(void)
+{
+	srandom(0);
+	EXPECT_ZERO(test_lz_text());
+	EXPECT_ZERO(test_lz_random());
+	EXPECT_ZERO(test_lz_corrupt());
+	return EXIT_SUCCESS;
+}
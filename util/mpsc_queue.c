@@ -0,0 +1,62 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/mpsc_queue.h"
+
+#include <stdlib.h>
+
+void mpsc_queue_init(struct mpsc_queue *q)
+{
+	q->head = NULL;
+}
+
+int mpsc_queue_push(struct mpsc_queue *q, struct mpsc_node *node)
+{
+	struct mpsc_node *old, *cur;
+
+	old = q->head;
+	while (1) {
+		node->next = old;
+		/* __sync_val_compare_and_swap is a full barrier, so the
+		 * consumer will see everything we wrote to the node before
+		 * pushing it. */
+		cur = __sync_val_compare_and_swap(&q->head, old, node);
+		if (cur == old)
+			break;
+		old = cur;
+	}
+	return (old == NULL);
+}
+
+struct mpsc_node *mpsc_queue_take_all(struct mpsc_queue *q)
+{
+	struct mpsc_node *node, *next, *prev;
+
+	/* __sync_lock_test_and_set is an acquire barrier, which is all we
+	 * need to see the contents of the nodes that we're taking. */
+	node = __sync_lock_test_and_set(&q->head, NULL);
+	/* The nodes are in LIFO order.  Reverse them. */
+	prev = NULL;
+	while (node) {
+		next = node->next;
+		node->next = prev;
+		prev = node;
+		node = next;
+	}
+	return prev;
+}
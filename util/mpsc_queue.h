@@ -0,0 +1,85 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_MPSC_QUEUE_DOT_H
+#define REDFISH_UTIL_MPSC_QUEUE_DOT_H
+
+/* A lock-free multi-producer, single-consumer queue.
+ *
+ * Any number of threads may push nodes onto the queue concurrently.  A single
+ * consumer takes everything that has been pushed so far in one atomic
+ * operation, and gets it back as a FIFO-ordered list.
+ *
+ * Internally, this is just a Treiber stack.  Producers push with a
+ * compare-and-swap; the consumer swaps the head with NULL and reverses the
+ * batch it got.  Since the consumer never pops individual nodes, there is no
+ * ABA problem.
+ *
+ * mpsc_queue_push tells the caller whether the queue was empty before the
+ * push.  If the consumer is woken up only on that transition, there is
+ * exactly one wakeup per batch, and none are lost: anything pushed after the
+ * consumer takes a batch sees an empty queue, and wakes the consumer again.
+ */
+
+struct mpsc_node {
+	struct mpsc_node *next;
+};
+
+struct mpsc_queue {
+	/** Most recently pushed node, or NULL if the queue is empty */
+	struct mpsc_node *head;
+};
+
+#define MPSC_QUEUE_INITIALIZER { NULL }
+
+/** Initialize an MPSC queue
+ *
+ * @param q		The queue
+ */
+extern void mpsc_queue_init(struct mpsc_queue *q);
+
+/** Push a node onto an MPSC queue.  May be called from any thread.
+ *
+ * @param q		The queue
+ * @param node		The node to push
+ *
+ * @return		1 if the queue was empty before this push; 0 otherwise
+ */
+extern int mpsc_queue_push(struct mpsc_queue *q, struct mpsc_node *node);
+
+/** Take everything that is currently in an MPSC queue.  Must only be called
+ * by the consumer.
+ *
+ * @param q		The queue
+ *
+ * @return		The first node that was pushed, or NULL if the queue
+ *			was empty.  Follow the 'next' pointers to get the rest
+ *			of the nodes, in the order they were pushed.
+ */
+extern struct mpsc_node *mpsc_queue_take_all(struct mpsc_queue *q);
+
+/** Determine whether an MPSC queue is empty.  The answer may be stale by the
+ * time the caller looks at it, unless all producers have stopped.
+ *
+ * @param q		The queue
+ *
+ * @return		1 if the queue is empty; 0 otherwise
+ */
+#define mpsc_queue_empty(q) (((volatile struct mpsc_queue*)(q))->head == NULL)
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/macro.h"
+#include "util/mpsc_queue.h"
+#include "util/test.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_PRODUCERS 4
+#define NUM_PUSHES_PER_PRODUCER 100000
+
+struct test_node {
+	struct mpsc_node node;
+	int producer;
+	int seq;
+};
+
+struct producer {
+	pthread_t thread;
+	int idx;
+	struct test_node *nodes;
+	/** Number of times this producer saw the queue go from empty to
+	 * non-empty */
+	int num_wakeups;
+};
+
+static struct mpsc_queue g_q = MPSC_QUEUE_INITIALIZER;
+
+static int test_mpsc_queue_simple(void)
+{
+	struct mpsc_queue q;
+	struct test_node a, b, c;
+	struct mpsc_node *node;
+
+	mpsc_queue_init(&q);
+	EXPECT_EQ(mpsc_queue_empty(&q), 1);
+	EXPECT_EQ(mpsc_queue_take_all(&q), NULL);
+	EXPECT_EQ(mpsc_queue_push(&q, &a.node), 1);
+	EXPECT_EQ(mpsc_queue_push(&q, &b.node), 0);
+	EXPECT_EQ(mpsc_queue_push(&q, &c.node), 0);
+	EXPECT_EQ(mpsc_queue_empty(&q), 0);
+	node = mpsc_queue_take_all(&q);
+	EXPECT_EQ(mpsc_queue_empty(&q), 1);
+	EXPECT_EQ(node, &a.node);
+	EXPECT_EQ(node->next, &b.node);
+	EXPECT_EQ(node->next->next, &c.node);
+	EXPECT_EQ(node->next->next->next, NULL);
+	/* The queue is empty again, so the next push should tell us so */
+	EXPECT_EQ(mpsc_queue_push(&q, &a.node), 1);
+	EXPECT_EQ(mpsc_queue_take_all(&q), &a.node);
+	return 0;
+}
+
+static void *producer_thread(void *v)
+{
+	struct producer *p = (struct producer*)v;
+	int i;
+
+	for (i = 0; i < NUM_PUSHES_PER_PRODUCER; ++i) {
+		p->nodes[i].producer = p->idx;
+		p->nodes[i].seq = i;
+		if (mpsc_queue_push(&g_q, &p->nodes[i].node))
+			p->num_wakeups++;
+	}
+	return NULL;
+}
+
+static int test_mpsc_queue_threaded(void)
+{
+	struct producer producers[NUM_PRODUCERS];
+	int i, next_seq[NUM_PRODUCERS], num_taken, num_batches, num_wakeups;
+	struct mpsc_node *node;
+	struct test_node *tn;
+
+	memset(producers, 0, sizeof(producers));
+	memset(next_seq, 0, sizeof(next_seq));
+	for (i = 0; i < NUM_PRODUCERS; ++i) {
+		producers[i].idx = i;
+		producers[i].nodes = calloc(NUM_PUSHES_PER_PRODUCER,
+					sizeof(struct test_node));
+		EXPECT_NOT_EQ(producers[i].nodes, NULL);
+	}
+	for (i = 0; i < NUM_PRODUCERS; ++i) {
+		EXPECT_ZERO(pthread_create(&producers[i].thread, NULL,
+				producer_thread, &producers[i]));
+	}
+	num_taken = 0;
+	num_batches = 0;
+	while (num_taken < NUM_PRODUCERS * NUM_PUSHES_PER_PRODUCER) {
+		node = mpsc_queue_take_all(&g_q);
+		if (!node)
+			continue;
+		num_batches++;
+		for (; node; node = node->next) {
+			tn = GET_OUTER(node, struct test_node, node);
+			/* Each producer's nodes must come out in the order
+			 * they went in. */
+			EXPECT_EQ(tn->seq, next_seq[tn->producer]);
+			next_seq[tn->producer]++;
+			num_taken++;
+		}
+	}
+	num_wakeups = 0;
+	for (i = 0; i < NUM_PRODUCERS; ++i) {
+		EXPECT_ZERO(pthread_join(producers[i].thread, NULL));
+		EXPECT_EQ(next_seq[i], NUM_PUSHES_PER_PRODUCER);
+		num_wakeups += producers[i].num_wakeups;
+		free(producers[i].nodes);
+	}
+	/* Every non-empty batch started with exactly one push that found the
+	 * queue empty. */
+	EXPECT_EQ(num_wakeups, num_batches);
+	EXPECT_EQ(mpsc_queue_empty(&g_q), 1);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ZERO(test_mpsc_queue_simple());
+	EXPECT_ZERO(test_mpsc_queue_threaded());
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_PLATFORM_AIO_DOT_H
+#define REDFISH_UTIL_PLATFORM_AIO_DOT_H
+
+#include <stdint.h> /* for uint32_t, etc. */
+
+/* An asynchronous I/O ring lets a thread hand the kernel a batch of
+ * positional reads and writes with a single system call, and lets many
+ * threads have I/O in flight at once through the same ring.
+ *
+ * On Linux, this is implemented with io_uring.  Elsewhere, or on kernels
+ * without io_uring, aio_ring_init fails with EOPNOTSUPP, and the caller should
+ * fall back to doing synchronous I/O.
+ */
+
+struct aio_ring;
+
+enum aio_op_ty {
+	AIO_OP_PREAD = 0,
+	AIO_OP_PWRITE = 1,
+};
+
+/** A positional read or write */
+struct aio_op {
+	/** enum aio_op_ty */
+	int ty;
+	/** The file descriptor */
+	int fd;
+	/** The slot that the file descriptor was registered in, or -1 if it
+	 * isn't registered */
+	int slot;
+	/** The buffer to read into or write from */
+	void *buf;
+	/** Number of bytes to transfer */
+	uint32_t len;
+	/** Offset in the file */
+	uint64_t off;
+	/** If nonzero, the next operation in the batch is only carried out
+	 * after this one has transferred everything.  Otherwise, the next
+	 * operation fails with -ECANCELED. */
+	int link;
+	/** (out param) Number of bytes transferred, or a negative error code.
+	 * This is only less than len if a read hit the end of the file. */
+	int32_t res;
+	/** Private to the ring */
+	int done;
+};
+
+/** Create an asynchronous I/O ring
+ *
+ * @param depth		Maximum number of operations to submit at once
+ * @param num_slots	Number of file descriptors that can be registered
+ *			with the ring.  If the kernel won't let us register
+ *			that many, none can be registered.
+ *
+ * @return		The ring, or an error pointer.  EOPNOTSUPP means that
+ *			this platform has no asynchronous I/O.
+ */
+extern struct aio_ring *aio_ring_init(unsigned int depth, int num_slots);
+
+/** Register a file descriptor with an asynchronous I/O ring
+ *
+ * Operations on registered file descriptors are a little cheaper, since the
+ * kernel doesn't have to look the file up each time.
+ *
+ * @param ring		The ring
+ * @param fd		The file descriptor
+ *
+ * @return		The slot that the file descriptor was registered in, or
+ *			-1 if it couldn't be registered
+ */
+extern int aio_ring_register(struct aio_ring *ring, int fd);
+
+/** Unregister a file descriptor from an asynchronous I/O ring
+ *
+ * There must be no operations in flight which use the slot.
+ *
+ * @param ring		The ring
+ * @param slot		The slot returned by aio_ring_register
+ */
+extern void aio_ring_unregister(struct aio_ring *ring, int slot);
+
+/** Submit a batch of operations, and wait for all of them to finish
+ *
+ * The operations may be carried out in any order, or all at once.
+ *
+ * @param ring		The ring
+ * @param ops		The operations
+ * @param nops		Number of operations
+ *
+ * @return		0 if the operations were carried out.  Their results
+ *			are in ops[i].res.  A negative error code if the ring
+ *			couldn't take the batch; none of the operations have
+ *			been started.
+ */
+extern int aio_ring_run(struct aio_ring *ring, struct aio_op *ops, int nops);
+
+/** Free an asynchronous I/O ring
+ *
+ * There must be no operations in flight.
+ *
+ * @param ring		The ring
+ */
+extern void aio_ring_free(struct aio_ring *ring);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/error.h"
+#include "util/platform/aio.h"
+#include "util/string.h"
+#include "util/tempfile.h"
+#include "util/test.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define AIOU_DEPTH 8
+
+#define AIOU_BLOCK 4096
+
+#define AIOU_NUM_THREADS 4
+
+#define AIOU_NUM_BATCHES 200
+
+static void aiou_fill(char *buf, int len, int seed)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = (char)((i * 7) + seed);
+}
+
+static void aiou_set_op(struct aio_op *op, int ty, int fd, int slot,
+		void *buf, uint32_t len, uint64_t off)
+{
+	memset(op, 0, sizeof(*op));
+	op->ty = ty;
+	op->fd = fd;
+	op->slot = slot;
+	op->buf = buf;
+	op->len = len;
+	op->off = off;
+}
+
+/** Write AIOU_DEPTH blocks with one batch, then read them back with
+ * another. */
+static int aiou_write_read(struct aio_ring *ring, int fd, int slot, int seed)
+{
+	int i;
+	struct aio_op ops[AIOU_DEPTH];
+	char *wbuf, *rbuf;
+
+	wbuf = malloc(AIOU_DEPTH * AIOU_BLOCK);
+	EXPECT_NOT_EQ(wbuf, NULL);
+	rbuf = calloc(1, AIOU_DEPTH * AIOU_BLOCK);
+	EXPECT_NOT_EQ(rbuf, NULL);
+	aiou_fill(wbuf, AIOU_DEPTH * AIOU_BLOCK, seed);
+	for (i = 0; i < AIOU_DEPTH; ++i) {
+		aiou_set_op(&ops[i], AIO_OP_PWRITE, fd, slot,
+			wbuf + (i * AIOU_BLOCK), AIOU_BLOCK,
+			(uint64_t)seed * AIOU_DEPTH * AIOU_BLOCK +
+			(i * AIOU_BLOCK));
+	}
+	EXPECT_ZERO(aio_ring_run(ring, ops, AIOU_DEPTH));
+	for (i = 0; i < AIOU_DEPTH; ++i) {
+		EXPECT_EQ(ops[i].res, AIOU_BLOCK);
+		ops[i].ty = AIO_OP_PREAD;
+		ops[i].buf = rbuf + (i * AIOU_BLOCK);
+	}
+	EXPECT_ZERO(aio_ring_run(ring, ops, AIOU_DEPTH));
+	for (i = 0; i < AIOU_DEPTH; ++i)
+		EXPECT_EQ(ops[i].res, AIOU_BLOCK);
+	EXPECT_ZERO(memcmp(wbuf, rbuf, AIOU_DEPTH * AIOU_BLOCK));
+	free(wbuf);
+	free(rbuf);
+	return 0;
+}
+
+static int aiou_simple_test(struct aio_ring *ring, int fd)
+{
+	int slot;
+	char buf[100];
+	struct aio_op ops[AIOU_DEPTH + 1];
+
+	/* with and without a registered file descriptor */
+	EXPECT_ZERO(aiou_write_read(ring, fd, -1, 0));
+	slot = aio_ring_register(ring, fd);
+	EXPECT_GE(slot, 0);
+	EXPECT_ZERO(aiou_write_read(ring, fd, slot, 1));
+
+	/* reading past the end of the file gives a short read */
+	aiou_set_op(&ops[0], AIO_OP_PREAD, fd, slot, buf, sizeof(buf),
+		(2 * AIOU_DEPTH * AIOU_BLOCK) - 10);
+	aiou_set_op(&ops[1], AIO_OP_PREAD, fd, slot, buf, sizeof(buf),
+		1000 * AIOU_BLOCK);
+	EXPECT_ZERO(aio_ring_run(ring, ops, 2));
+	EXPECT_EQ(ops[0].res, 10);
+	EXPECT_EQ(ops[1].res, 0);
+
+	/* errors are reported per operation */
+	aiou_set_op(&ops[0], AIO_OP_PREAD, -1, -1, buf, sizeof(buf), 0);
+	EXPECT_ZERO(aio_ring_run(ring, ops, 1));
+	EXPECT_EQ(ops[0].res, -EBADF);
+
+	/* a failed operation cancels the one linked after it */
+	aiou_set_op(&ops[0], AIO_OP_PREAD, -1, -1, buf, sizeof(buf), 0);
+	ops[0].link = 1;
+	aiou_set_op(&ops[1], AIO_OP_PREAD, fd, slot, buf, sizeof(buf), 0);
+	aiou_set_op(&ops[2], AIO_OP_PREAD, fd, slot, buf, sizeof(buf), 0);
+	EXPECT_ZERO(aio_ring_run(ring, ops, 3));
+	EXPECT_EQ(ops[0].res, -EBADF);
+	EXPECT_EQ(ops[1].res, -ECANCELED);
+	EXPECT_EQ(ops[2].res, sizeof(buf));
+
+	/* batches which are too big are turned away */
+	EXPECT_EQ(aio_ring_run(ring, ops, AIOU_DEPTH + 1), -EINVAL);
+	aio_ring_unregister(ring, slot);
+	return 0;
+}
+
+struct aiou_thread_args {
+	struct aio_ring *ring;
+	int fd;
+	int slot;
+	int seed;
+	int ret;
+};
+
+static void *aiou_thread(void *v)
+{
+	int i;
+	struct aiou_thread_args *args = v;
+
+	for (i = 0; i < AIOU_NUM_BATCHES; ++i) {
+		if (aiou_write_read(args->ring, args->fd, args->slot,
+				args->seed)) {
+			args->ret = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/** Several threads share one ring */
+static int aiou_threaded_test(struct aio_ring *ring, int fd)
+{
+	int i;
+	pthread_t threads[AIOU_NUM_THREADS];
+	struct aiou_thread_args args[AIOU_NUM_THREADS];
+
+	for (i = 0; i < AIOU_NUM_THREADS; ++i) {
+		args[i].ring = ring;
+		args[i].fd = fd;
+		args[i].slot = (i & 1) ? aio_ring_register(ring, fd) : -1;
+		args[i].seed = 10 + i;
+		args[i].ret = 0;
+		EXPECT_ZERO(pthread_create(&threads[i], NULL, aiou_thread,
+			&args[i]));
+	}
+	for (i = 0; i < AIOU_NUM_THREADS; ++i) {
+		EXPECT_ZERO(pthread_join(threads[i], NULL));
+		EXPECT_ZERO(args[i].ret);
+		aio_ring_unregister(ring, args[i].slot);
+	}
+	return 0;
+}
+
+int main(void)
+{
+	int fd;
+	struct aio_ring *ring;
+	char tempdir[PATH_MAX], path[PATH_MAX];
+
+	ring = aio_ring_init(AIOU_DEPTH, 4);
+	if (IS_ERR(ring)) {
+		EXPECT_EQ(PTR_ERR(ring), EOPNOTSUPP);
+		fprintf(stderr, "aio_unit: no asynchronous I/O on this "
+			"platform.  Skipping.\n");
+		return EXIT_SUCCESS;
+	}
+	EXPECT_ZERO(get_tempdir(tempdir, PATH_MAX, 0775));
+	EXPECT_ZERO(register_tempdir_for_cleanup(tempdir));
+	EXPECT_ZERO(zsnprintf(path, sizeof(path), "%s/data", tempdir));
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	EXPECT_GE(fd, 0);
+	EXPECT_ZERO(aiou_simple_test(ring, fd));
+	EXPECT_ZERO(aiou_threaded_test(ring, fd));
+	close(fd);
+	aio_ring_free(ring);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_PLATFORM_IOPRIO_DOT_H
+#define REDFISH_UTIL_PLATFORM_IOPRIO_DOT_H
+
+/** Give the calling thread's disk I/O the lowest priority.
+ *
+ * Once this has been called, the thread only gets disk time when nobody else
+ * wants it.  This is meant for background work, like scrubbing, which should
+ * not slow down anything else.
+ *
+ * @return		0 on success; -ENOTSUP if the platform has no I/O
+ *			priorities; another negative error code otherwise
+ */
+extern int set_idle_io_prio(void);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/error.h"
+#include "util/platform/aio.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* We talk to io_uring with raw system calls, rather than through liburing, so
+ * that we don't pick up another dependency.
+ *
+ * Any number of threads may use the ring at once.  Each thread fills in its
+ * submission queue entries and submits them with ring->lock held.  Then it
+ * waits for its operations to complete.  Only one thread at a time waits in
+ * the kernel; it hands out the completions it reaps to their owners, and wakes
+ * everyone up.  The others wait on ring->cond.
+ */
+
+struct aio_ring {
+	/** Protects everything in the ring */
+	pthread_mutex_t lock;
+	/** Broadcast when operations complete, or when the reaper leaves */
+	pthread_cond_t cond;
+	/** The io_uring file descriptor */
+	int ring_fd;
+	/** Nonzero if some thread is waiting in the kernel for completions */
+	int reaping;
+	/** Number of operations which have been submitted, but not reaped.
+	 * We never let this exceed cq_entries, so the completion queue can't
+	 * overflow. */
+	unsigned int inflight;
+	/** Size of the submission queue */
+	unsigned int sq_entries;
+	/** Size of the completion queue */
+	unsigned int cq_entries;
+	volatile unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	volatile unsigned int *cq_head;
+	volatile unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/** The mappings of the submission queue ring, completion queue ring,
+	 * and submission queue entries.  cq_ptr may be the same as sq_ptr. */
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+	/** Number of file descriptor slots we registered.  0 if the kernel
+	 * wouldn't let us register any. */
+	int num_slots;
+	/** Number of entries in free_slots */
+	int num_free;
+	/** Stack of slots which are not in use */
+	int *free_slots;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+		unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg,
+		unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int aio_ring_map(struct aio_ring *ring, struct io_uring_params *p)
+{
+	ring->sq_len = p->sq_off.array +
+		(p->sq_entries * sizeof(unsigned int));
+	ring->cq_len = p->cq_off.cqes +
+		(p->cq_entries * sizeof(struct io_uring_cqe));
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		return errno;
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	}
+	else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->ring_fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			munmap(ring->sq_ptr, ring->sq_len);
+			return errno;
+		}
+	}
+	ring->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_ptr != ring->sq_ptr)
+			munmap(ring->cq_ptr, ring->cq_len);
+		munmap(ring->sq_ptr, ring->sq_len);
+		return errno;
+	}
+	ring->sq_tail = (unsigned int*)((char*)ring->sq_ptr + p->sq_off.tail);
+	ring->sq_mask = (unsigned int*)
+		((char*)ring->sq_ptr + p->sq_off.ring_mask);
+	ring->sq_array = (unsigned int*)
+		((char*)ring->sq_ptr + p->sq_off.array);
+	ring->cq_head = (unsigned int*)((char*)ring->cq_ptr + p->cq_off.head);
+	ring->cq_tail = (unsigned int*)((char*)ring->cq_ptr + p->cq_off.tail);
+	ring->cq_mask = (unsigned int*)
+		((char*)ring->cq_ptr + p->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)
+		((char*)ring->cq_ptr + p->cq_off.cqes);
+	ring->sq_entries = p->sq_entries;
+	ring->cq_entries = p->cq_entries;
+	return 0;
+}
+
+static void aio_ring_unmap(struct aio_ring *ring)
+{
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	munmap(ring->sq_ptr, ring->sq_len);
+}
+
+/** Register a table of empty file descriptor slots.  If this fails, we just
+ * don't use registered files. */
+static void aio_ring_init_slots(struct aio_ring *ring, int num_slots)
+{
+	int i, *fds;
+
+	if (num_slots <= 0)
+		return;
+	fds = malloc(num_slots * sizeof(int));
+	if (!fds)
+		return;
+	ring->free_slots = malloc(num_slots * sizeof(int));
+	if (!ring->free_slots) {
+		free(fds);
+		return;
+	}
+	for (i = 0; i < num_slots; ++i)
+		fds[i] = -1;
+	if (io_uring_register(ring->ring_fd, IORING_REGISTER_FILES, fds,
+			num_slots) < 0) {
+		free(ring->free_slots);
+		ring->free_slots = NULL;
+		free(fds);
+		return;
+	}
+	free(fds);
+	/* Hand out the lowest slots first */
+	for (i = 0; i < num_slots; ++i)
+		ring->free_slots[i] = num_slots - 1 - i;
+	ring->num_slots = num_slots;
+	ring->num_free = num_slots;
+}
+
+struct aio_ring *aio_ring_init(unsigned int depth, int num_slots)
+{
+	int ret;
+	struct aio_ring *ring;
+	struct io_uring_params p;
+
+	if (depth == 0)
+		return ERR_PTR(EINVAL);
+	ring = calloc(1, sizeof(struct aio_ring));
+	if (!ring)
+		return ERR_PTR(ENOMEM);
+	memset(&p, 0, sizeof(p));
+	ring->ring_fd = io_uring_setup(depth, &p);
+	if (ring->ring_fd < 0) {
+		/* ENOSYS if the kernel is too old; EPERM if io_uring has been
+		 * disabled. */
+		ret = EOPNOTSUPP;
+		goto error_free_ring;
+	}
+	/* IORING_OP_READ and IORING_OP_WRITE arrived in the same kernel
+	 * release as this feature flag. */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		ret = EOPNOTSUPP;
+		goto error_close_ring_fd;
+	}
+	ret = aio_ring_map(ring, &p);
+	if (ret)
+		goto error_close_ring_fd;
+	ret = pthread_mutex_init(&ring->lock, NULL);
+	if (ret)
+		goto error_unmap;
+	ret = pthread_cond_init(&ring->cond, NULL);
+	if (ret)
+		goto error_destroy_lock;
+	aio_ring_init_slots(ring, num_slots);
+	return ring;
+
+error_destroy_lock:
+	pthread_mutex_destroy(&ring->lock);
+error_unmap:
+	aio_ring_unmap(ring);
+error_close_ring_fd:
+	close(ring->ring_fd);
+error_free_ring:
+	free(ring);
+	return ERR_PTR(ret);
+}
+
+int aio_ring_register(struct aio_ring *ring, int fd)
+{
+	int slot;
+	struct io_uring_files_update up;
+
+	pthread_mutex_lock(&ring->lock);
+	if (ring->num_free == 0) {
+		pthread_mutex_unlock(&ring->lock);
+		return -1;
+	}
+	slot = ring->free_slots[--ring->num_free];
+	pthread_mutex_unlock(&ring->lock);
+	memset(&up, 0, sizeof(up));
+	up.offset = slot;
+	up.fds = (uintptr_t)&fd;
+	if (io_uring_register(ring->ring_fd, IORING_REGISTER_FILES_UPDATE,
+			&up, 1) != 1) {
+		pthread_mutex_lock(&ring->lock);
+		ring->free_slots[ring->num_free++] = slot;
+		pthread_mutex_unlock(&ring->lock);
+		return -1;
+	}
+	return slot;
+}
+
+void aio_ring_unregister(struct aio_ring *ring, int slot)
+{
+	int fd = -1;
+	struct io_uring_files_update up;
+
+	if (slot < 0)
+		return;
+	memset(&up, 0, sizeof(up));
+	up.offset = slot;
+	up.fds = (uintptr_t)&fd;
+	io_uring_register(ring->ring_fd, IORING_REGISTER_FILES_UPDATE,
+		&up, 1);
+	pthread_mutex_lock(&ring->lock);
+	ring->free_slots[ring->num_free++] = slot;
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/** Hand out the completions that are waiting in the completion queue.
+ *
+ * Should be called with ring->lock held.
+ */
+static void aio_ring_reap(struct aio_ring *ring)
+{
+	unsigned int head, tail;
+	struct io_uring_cqe *cqe;
+	struct aio_op *op;
+
+	head = *ring->cq_head;
+	tail = *ring->cq_tail;
+	/* Don't look at the entries until we've seen the new tail */
+	__sync_synchronize();
+	if (head == tail)
+		return;
+	for (; head != tail; ++head) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		op = (struct aio_op*)(uintptr_t)cqe->user_data;
+		op->res = cqe->res;
+		op->done = 1;
+		ring->inflight--;
+	}
+	/* Don't let the kernel reuse the entries until we're done with
+	 * them */
+	__sync_synchronize();
+	*ring->cq_head = head;
+	pthread_cond_broadcast(&ring->cond);
+}
+
+/** Put a batch of operations into the submission queue, and submit them.
+ *
+ * Should be called with ring->lock held.
+ *
+ * @return		0 on success; a negative error code if nothing was
+ *			submitted
+ */
+static int aio_ring_submit(struct aio_ring *ring, struct aio_op *ops,
+		int nops)
+{
+	int i, res = 0;
+	unsigned int tail, idx, submitted = 0;
+	struct io_uring_sqe *sqe;
+
+	tail = *ring->sq_tail;
+	for (i = 0; i < nops; ++i) {
+		idx = tail & *ring->sq_mask;
+		sqe = &ring->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = (ops[i].ty == AIO_OP_PREAD) ?
+			IORING_OP_READ : IORING_OP_WRITE;
+		if (ops[i].slot >= 0) {
+			sqe->fd = ops[i].slot;
+			sqe->flags = IOSQE_FIXED_FILE;
+		}
+		else {
+			sqe->fd = ops[i].fd;
+		}
+		if (ops[i].link && (i < nops - 1))
+			sqe->flags |= IOSQE_IO_LINK;
+		sqe->addr = (uintptr_t)ops[i].buf;
+		sqe->len = ops[i].len;
+		sqe->off = ops[i].off;
+		sqe->user_data = (uintptr_t)&ops[i];
+		ring->sq_array[idx] = idx;
+		ops[i].done = 0;
+		ops[i].res = 0;
+		tail++;
+	}
+	/* The kernel must see the entries before it sees the new tail */
+	__sync_synchronize();
+	*ring->sq_tail = tail;
+	while (submitted < (unsigned int)nops) {
+		res = io_uring_enter(ring->ring_fd, nops - submitted, 0, 0);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			res = -errno;
+			break;
+		}
+		submitted += res;
+	}
+	ring->inflight += submitted;
+	if (submitted == (unsigned int)nops)
+		return 0;
+	/* Nobody else can submit while we hold the lock, so the entries the
+	 * kernel hasn't consumed are all ours.  Take them back. */
+	*ring->sq_tail = tail - (nops - submitted);
+	if (submitted == 0)
+		return res;
+	for (i = submitted; i < nops; ++i) {
+		ops[i].res = res;
+		ops[i].done = 1;
+	}
+	return 0;
+}
+
+/** Finish an operation that the kernel only partly carried out, with
+ * ordinary system calls.  This is rare. */
+static void aio_op_finish_short(struct aio_op *op)
+{
+	ssize_t res;
+
+	while ((uint32_t)op->res < op->len) {
+		if (op->ty == AIO_OP_PREAD)
+			res = pread(op->fd, (char*)op->buf + op->res,
+				op->len - op->res, op->off + op->res);
+		else
+			res = pwrite(op->fd, (char*)op->buf + op->res,
+				op->len - op->res, op->off + op->res);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			op->res = -errno;
+			return;
+		}
+		if (res == 0) {
+			/* end of file */
+			if (op->ty == AIO_OP_PWRITE)
+				op->res = -EIO;
+			return;
+		}
+		op->res += res;
+	}
+}
+
+int aio_ring_run(struct aio_ring *ring, struct aio_op *ops, int nops)
+{
+	int i, ret;
+
+	if ((nops <= 0) || ((unsigned int)nops > ring->sq_entries))
+		return -EINVAL;
+	pthread_mutex_lock(&ring->lock);
+	/* Make sure that there will be room in the completion queue */
+	while (ring->inflight + nops > ring->cq_entries)
+		pthread_cond_wait(&ring->cond, &ring->lock);
+	ret = aio_ring_submit(ring, ops, nops);
+	if (ret) {
+		pthread_mutex_unlock(&ring->lock);
+		return ret;
+	}
+	i = 0;
+	while (1) {
+		for (; i < nops; ++i) {
+			if (!ops[i].done)
+				break;
+		}
+		if (i == nops)
+			break;
+		if (ring->reaping) {
+			pthread_cond_wait(&ring->cond, &ring->lock);
+			continue;
+		}
+		ring->reaping = 1;
+		pthread_mutex_unlock(&ring->lock);
+		io_uring_enter(ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+		pthread_mutex_lock(&ring->lock);
+		ring->reaping = 0;
+		aio_ring_reap(ring);
+		/* Let someone else take over reaping, if we're done */
+		pthread_cond_broadcast(&ring->cond);
+	}
+	pthread_mutex_unlock(&ring->lock);
+	for (i = 0; i < nops; ++i) {
+		if ((ops[i].res == -ECANCELED) && (i > 0) && ops[i - 1].link &&
+				((uint32_t)ops[i - 1].res == ops[i - 1].len)) {
+			/* The kernel broke the link because the previous
+			 * operation came up short, but we finished it. */
+			ops[i].res = 0;
+			aio_op_finish_short(&ops[i]);
+		}
+		else if ((ops[i].res > 0) &&
+				((uint32_t)ops[i].res < ops[i].len)) {
+			aio_op_finish_short(&ops[i]);
+		}
+	}
+	return 0;
+}
+
+void aio_ring_free(struct aio_ring *ring)
+{
+	pthread_cond_destroy(&ring->cond);
+	pthread_mutex_destroy(&ring->lock);
+	aio_ring_unmap(ring);
+	close(ring->ring_fd);
+	free(ring->free_slots);
+	free(ring);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/compiler.h"
+#include "util/error.h"
+#include "util/platform/aio.h"
+
+#include <errno.h>
+
+/* POSIX AIO signals completions one operation at a time, and is implemented
+ * with threads on many platforms anyway.  It wouldn't buy us anything over
+ * doing synchronous I/O, so we don't bother with it. */
+
+struct aio_ring *aio_ring_init(POSSIBLY_UNUSED(unsigned int depth),
+		POSSIBLY_UNUSED(int num_slots))
+{
+	return ERR_PTR(EOPNOTSUPP);
+}
+
+int aio_ring_register(POSSIBLY_UNUSED(struct aio_ring *ring),
+		POSSIBLY_UNUSED(int fd))
+{
+	return -1;
+}
+
+void aio_ring_unregister(POSSIBLY_UNUSED(struct aio_ring *ring),
+		POSSIBLY_UNUSED(int slot))
+{
+}
+
+int aio_ring_run(POSSIBLY_UNUSED(struct aio_ring *ring),
+		POSSIBLY_UNUSED(struct aio_op *ops), POSSIBLY_UNUSED(int nops))
+{
+	return -EOPNOTSUPP;
+}
+
+void aio_ring_free(POSSIBLY_UNUSED(struct aio_ring *ring))
+{
+}
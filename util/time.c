@@ -16,11 +16,16 @@
 
 #include "util/time.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+#define MSEC_PER_SEC 1000
+#define NSEC_PER_USEC 1000
+#define USEC_PER_SEC 1000000
 
 time_t mt_time(void)
 {
@@ -33,6 +38,30 @@ time_t mt_time(void)
 	return ts.tv_sec;
 }
 
+uint64_t mt_time_ms(void)
+{
+	int res;
+	struct timespec ts;
+
+	res = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (res)
+		abort();
+	return (((uint64_t)ts.tv_sec) * MSEC_PER_SEC) +
+		(ts.tv_nsec / NSEC_PER_MSEC);
+}
+
+uint64_t mt_time_us(void)
+{
+	int res;
+	struct timespec ts;
+
+	res = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (res)
+		abort();
+	return (((uint64_t)ts.tv_sec) * USEC_PER_SEC) +
+		(ts.tv_nsec / NSEC_PER_USEC);
+}
+
 void mt_sleep_until(time_t until)
 {
 	int res;
@@ -43,6 +43,7 @@ static int test_timespec_utils(void)
 int main(void)
 {
 	time_t cur, next, after;
+	uint64_t cur_ms, after_ms, cur_us, after_us;
 
 	EXPECT_ZERO(test_timespec_utils());
 	cur = mt_time();
@@ -55,6 +56,16 @@ int main(void)
 	mt_msleep(1);
 	after = mt_time();
 	EXPECT_GE(after, cur);
+	cur_ms = mt_time_ms();
+	mt_sleep_until(mt_time() + 1);
+	after_ms = mt_time_ms();
+	EXPECT_GT(after_ms, cur_ms);
+	EXPECT_LT(cur_ms / 1000, (uint64_t)mt_time() + 1);
+	cur_us = mt_time_us();
+	mt_msleep(2);
+	after_us = mt_time_us();
+	EXPECT_GT(after_us, cur_us);
+	EXPECT_LT(cur_us / 1000, mt_time_ms() + 1);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,173 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/queue.h"
+#include "util/timer_wheel.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/** Get the index of 'tick' in the given level */
+#define TWHEEL_IDX(tick, level) \
+	(((tick) >> ((level) * TWHEEL_SLOT_BITS)) & TWHEEL_SLOT_MASK)
+
+void twheel_init(struct twheel *tw, uint64_t now)
+{
+	int i, j;
+
+	memset(tw, 0, sizeof(struct twheel));
+	tw->cur = now;
+	for (i = 0; i < TWHEEL_LEVELS; ++i) {
+		for (j = 0; j < TWHEEL_SLOTS; ++j) {
+			LIST_INIT(&tw->slots[i][j]);
+		}
+	}
+}
+
+void twheel_tm_init(struct twheel_tm *tm, twheel_cb_t cb)
+{
+	memset(tm, 0, sizeof(struct twheel_tm));
+	tm->cb = cb;
+}
+
+/** Put a timer into the appropriate slot, based on how far in the future it
+ * expires.  Timers that have already expired go into the slot for tw->cur.
+ */
+static void twheel_insert(struct twheel *tw, struct twheel_tm *tm)
+{
+	uint64_t expire, delta;
+	int level;
+
+	expire = tm->expire;
+	if (expire < tw->cur)
+		expire = tw->cur;
+	delta = expire - tw->cur;
+	if (delta > TWHEEL_MAX_TICKS) {
+		delta = TWHEEL_MAX_TICKS;
+		expire = tw->cur + delta;
+	}
+	for (level = 0; level < TWHEEL_LEVELS - 1; ++level) {
+		if (delta < (1ULL << ((level + 1) * TWHEEL_SLOT_BITS)))
+			break;
+	}
+	LIST_INSERT_HEAD(&tw->slots[level][TWHEEL_IDX(expire, level)],
+			tm, entry);
+}
+
+void twheel_add(struct twheel *tw, struct twheel_tm *tm, uint64_t expire)
+{
+	twheel_del(tw, tm);
+	tm->expire = expire;
+	twheel_insert(tw, tm);
+	tw->num++;
+}
+
+void twheel_del(struct twheel *tw, struct twheel_tm *tm)
+{
+	if (!twheel_tm_armed(tm))
+		return;
+	LIST_REMOVE(tm, entry);
+	tm->entry.le_prev = NULL;
+	tw->num--;
+}
+
+/** Move all the timers in a slot of a higher level into lower levels.
+ *
+ * @return		The index of the slot
+ */
+static int twheel_cascade(struct twheel *tw, int level, int idx)
+{
+	struct twheel_slot tmp = LIST_HEAD_INITIALIZER(tmp);
+	struct twheel_tm *tm;
+
+	LIST_SWAP(&tmp, &tw->slots[level][idx], twheel_tm, entry);
+	while (1) {
+		tm = LIST_FIRST(&tmp);
+		if (!tm)
+			break;
+		LIST_REMOVE(tm, entry);
+		twheel_insert(tw, tm);
+	}
+	return idx;
+}
+
+void twheel_advance(struct twheel *tw, uint64_t now)
+{
+	struct twheel_slot work = LIST_HEAD_INITIALIZER(work);
+	struct twheel_tm *tm;
+	int idx, level;
+
+	while (tw->cur <= now) {
+		if (tw->num == 0) {
+			/* Nothing to do; skip ahead. */
+			tw->cur = now + 1;
+			return;
+		}
+		idx = TWHEEL_IDX(tw->cur, 0);
+		if (idx == 0) {
+			/* We have gone all the way around level 0.  Cascade the
+			 * next slot of level 1 into it.  If we have gone all
+			 * the way around level 1 too, cascade level 2 into
+			 * level 1 first, and so on. */
+			for (level = 1; level < TWHEEL_LEVELS; ++level) {
+				if (twheel_cascade(tw, level,
+						TWHEEL_IDX(tw->cur, level)))
+					break;
+			}
+		}
+		tw->cur++;
+		LIST_SWAP(&work, &tw->slots[0][idx], twheel_tm, entry);
+		while (1) {
+			tm = LIST_FIRST(&work);
+			if (!tm)
+				break;
+			LIST_REMOVE(tm, entry);
+			tm->entry.le_prev = NULL;
+			tw->num--;
+			tm->cb(tm);
+		}
+	}
+}
+
+uint64_t twheel_next(const struct twheel *tw)
+{
+	uint64_t span, start;
+	int level, idx, i;
+
+	if (tw->num == 0)
+		return UINT64_MAX;
+	for (level = 0; level < TWHEEL_LEVELS; ++level) {
+		/* The slots in this level are only visited on ticks which are
+		 * a multiple of 'span'. */
+		span = 1ULL << (level * TWHEEL_SLOT_BITS);
+		start = (tw->cur + span - 1) & ~(span - 1);
+		idx = TWHEEL_IDX(start, level);
+		for (i = idx; i < TWHEEL_SLOTS; ++i) {
+			if (!LIST_EMPTY(&tw->slots[level][i]))
+				return start + ((i - idx) * span);
+		}
+		/* Slots before idx won't be visited until this level wraps
+		 * around, which is when the next level cascades. */
+		span <<= TWHEEL_SLOT_BITS;
+		for (i = 0; i < idx; ++i) {
+			if (!LIST_EMPTY(&tw->slots[level][i]))
+				return (tw->cur + span - 1) & ~(span - 1);
+		}
+	}
+	return UINT64_MAX;
+}
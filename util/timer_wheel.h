@@ -0,0 +1,140 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ *
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REDFISH_UTIL_TIMER_WHEEL_DOT_H
+#define REDFISH_UTIL_TIMER_WHEEL_DOT_H
+
+#include "util/queue.h"
+
+#include <stdint.h> /* for uint64_t, etc. */
+
+/* A hierarchical timer wheel.
+ *
+ * Time is measured in ticks.  The wheel doesn't care how long a tick is, but
+ * the messenger uses milliseconds.
+ *
+ * The wheel has TWHEEL_LEVELS levels of TWHEEL_SLOTS slots each.  Level 0 has
+ * one slot per tick; each higher level has one slot per TWHEEL_SLOTS slots of
+ * the level below it.  Timers that are far in the future sit in a high level,
+ * and are cascaded down into lower levels as their expiry time approaches.
+ * Adding or removing a timer is O(1).  Timers further in the future than
+ * TWHEEL_MAX_TICKS are parked in the top level and re-filed each time it comes
+ * around, so they still fire on time.
+ *
+ * timer_wheel does no locking of its own.
+ */
+
+#define TWHEEL_SLOT_BITS 6
+#define TWHEEL_SLOTS (1 << TWHEEL_SLOT_BITS)
+#define TWHEEL_SLOT_MASK (TWHEEL_SLOTS - 1)
+#define TWHEEL_LEVELS 4
+#define TWHEEL_MAX_TICKS ((1ULL << (TWHEEL_LEVELS * TWHEEL_SLOT_BITS)) - 1)
+
+struct twheel_tm;
+
+typedef void (*twheel_cb_t)(struct twheel_tm *tm);
+
+struct twheel_tm {
+	/** Entry in a wheel slot.  le_prev is NULL when the timer is not
+	 * armed. */
+	LIST_ENTRY(twheel_tm) entry;
+	/** The tick at which this timer should fire */
+	uint64_t expire;
+	/** Callback to invoke when the timer fires.  The timer is no longer
+	 * armed when this is called, so the callback may re-arm it. */
+	twheel_cb_t cb;
+};
+
+LIST_HEAD(twheel_slot, twheel_tm);
+
+struct twheel {
+	/** The next tick which has not yet been processed */
+	uint64_t cur;
+	/** Number of armed timers */
+	uint32_t num;
+	/** The slots */
+	struct twheel_slot slots[TWHEEL_LEVELS][TWHEEL_SLOTS];
+};
+
+/** Initialize a timer wheel
+ *
+ * @param tw		The timer wheel
+ * @param now		The current tick
+ */
+extern void twheel_init(struct twheel *tw, uint64_t now);
+
+/** Initialize a timer.
+ *
+ * @param tm		The timer
+ * @param cb		Callback to invoke when the timer fires
+ */
+extern void twheel_tm_init(struct twheel_tm *tm, twheel_cb_t cb);
+
+/** Determine whether a timer is armed
+ *
+ * @param tm		The timer
+ *
+ * @return		1 if the timer is armed; 0 otherwise
+ */
+#define twheel_tm_armed(tm) ((tm)->entry.le_prev != NULL)
+
+/** Arm a timer.
+ *
+ * If the timer is already armed, it will be re-armed with the new expiry time.
+ * If the expiry time has already passed, the timer will fire the next time
+ * twheel_advance is called.
+ *
+ * @param tw		The timer wheel
+ * @param tm		The timer
+ * @param expire	The tick at which the timer should fire
+ */
+extern void twheel_add(struct twheel *tw, struct twheel_tm *tm,
+		uint64_t expire);
+
+/** Disarm a timer.
+ *
+ * It is safe to call this on a timer that is not armed.
+ *
+ * @param tw		The timer wheel
+ * @param tm		The timer
+ */
+extern void twheel_del(struct twheel *tw, struct twheel_tm *tm);
+
+/** Fire all timers which expire at or before 'now'
+ *
+ * Callbacks may freely add and delete timers, including other timers that
+ * were due to fire during this call.
+ *
+ * @param tw		The timer wheel
+ * @param now		The current tick
+ */
+extern void twheel_advance(struct twheel *tw, uint64_t now);
+
+/** Get a lower bound on the next tick at which a timer will fire
+ *
+ * The bound is exact for timers that are less than TWHEEL_SLOTS ticks away.
+ * Otherwise, it may be a tick at which timers will merely be cascaded into a
+ * lower level.
+ *
+ * @param tw		The timer wheel
+ *
+ * @return		The tick, or UINT64_MAX if no timers are armed
+ */
+extern uint64_t twheel_next(const struct twheel *tw);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2012 the Redfish authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/macro.h"
+#include "util/test.h"
+#include "util/timer_wheel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_TEST_TM 2000
+#define TEST_START_TICK 12345
+
+struct test_tm {
+	struct twheel_tm tm;
+	/** The tick at which the timer actually fired, or 0 */
+	uint64_t fired_at;
+	/** Number of times the timer fired */
+	int num_fired;
+};
+
+static struct twheel g_tw;
+
+static void test_tm_cb(struct twheel_tm *tm)
+{
+	struct test_tm *ttm = GET_OUTER(tm, struct test_tm, tm);
+
+	/* g_tw.cur has already been advanced past the tick being processed */
+	ttm->fired_at = g_tw.cur - 1;
+	ttm->num_fired++;
+}
+
+static int test_twheel_expiry(void)
+{
+	int i;
+	uint64_t now, next;
+	struct test_tm *ttms;
+
+	ttms = calloc(NUM_TEST_TM, sizeof(struct test_tm));
+	EXPECT_NOT_EQ(ttms, NULL);
+	twheel_init(&g_tw, TEST_START_TICK);
+	for (i = 0; i < NUM_TEST_TM; ++i) {
+		twheel_tm_init(&ttms[i].tm, test_tm_cb);
+		/* Spread timers across all levels of the wheel */
+		twheel_add(&g_tw, &ttms[i].tm, TEST_START_TICK +
+			((uint64_t)i * i * 7) % 300000);
+	}
+	/* Delete every tenth timer */
+	for (i = 0; i < NUM_TEST_TM; i += 10) {
+		twheel_del(&g_tw, &ttms[i].tm);
+		EXPECT_EQ(twheel_tm_armed(&ttms[i].tm), 0);
+	}
+	now = TEST_START_TICK;
+	while (1) {
+		next = twheel_next(&g_tw);
+		if (next == UINT64_MAX)
+			break;
+		EXPECT_GE(next, now);
+		/* Jump straight to the next interesting tick, the way the
+		 * messenger does. */
+		now = next;
+		twheel_advance(&g_tw, now);
+	}
+	EXPECT_EQ(g_tw.num, 0);
+	for (i = 0; i < NUM_TEST_TM; ++i) {
+		if ((i % 10) == 0) {
+			EXPECT_EQ(ttms[i].num_fired, 0);
+			continue;
+		}
+		EXPECT_EQ(ttms[i].num_fired, 1);
+		EXPECT_EQ(ttms[i].fired_at, ttms[i].tm.expire);
+	}
+	free(ttms);
+	return 0;
+}
+
+static struct test_tm g_rearm_ttm;
+
+static void test_rearm_cb(struct twheel_tm *tm)
+{
+	struct test_tm *ttm = GET_OUTER(tm, struct test_tm, tm);
+
+	ttm->num_fired++;
+	if (ttm->num_fired < 3)
+		twheel_add(&g_tw, tm, tm->expire + 100);
+}
+
+static int test_twheel_rearm(void)
+{
+	twheel_init(&g_tw, 0);
+	twheel_tm_init(&g_rearm_ttm.tm, test_rearm_cb);
+	twheel_add(&g_tw, &g_rearm_ttm.tm, 50);
+	/* Re-adding an armed timer just moves it */
+	twheel_add(&g_tw, &g_rearm_ttm.tm, 60);
+	EXPECT_EQ(g_tw.num, 1);
+	twheel_advance(&g_tw, 59);
+	EXPECT_EQ(g_rearm_ttm.num_fired, 0);
+	twheel_advance(&g_tw, 60);
+	EXPECT_EQ(g_rearm_ttm.num_fired, 1);
+	twheel_advance(&g_tw, 1000);
+	EXPECT_EQ(g_rearm_ttm.num_fired, 3);
+	EXPECT_EQ(g_tw.num, 0);
+	EXPECT_EQ(twheel_next(&g_tw), UINT64_MAX);
+	return 0;
+}
+
+static int test_twheel_past_and_far(void)
+{
+	struct test_tm past, far;
+
+	memset(&past, 0, sizeof(past));
+	memset(&far, 0, sizeof(far));
+	twheel_init(&g_tw, 1000);
+	twheel_tm_init(&past.tm, test_tm_cb);
+	twheel_tm_init(&far.tm, test_tm_cb);
+	/* A timer which has already expired fires on the next advance */
+	twheel_add(&g_tw, &past.tm, 10);
+	/* A timer beyond the range of the wheel still fires on time */
+	twheel_add(&g_tw, &far.tm, 1000 + TWHEEL_MAX_TICKS * 2);
+	EXPECT_EQ(twheel_next(&g_tw), 1000);
+	twheel_advance(&g_tw, 1000);
+	EXPECT_EQ(past.num_fired, 1);
+	EXPECT_EQ(far.num_fired, 0);
+	twheel_advance(&g_tw, 1000 + TWHEEL_MAX_TICKS);
+	EXPECT_EQ(far.num_fired, 0);
+	twheel_advance(&g_tw, 1000 + TWHEEL_MAX_TICKS * 2);
+	EXPECT_EQ(far.num_fired, 1);
+	EXPECT_EQ(far.fired_at, far.tm.expire);
+	return 0;
+}
+
+int main(void)
+{
+	EXPECT_ZERO(test_twheel_expiry());
+	EXPECT_ZERO(test_twheel_rearm());
+	EXPECT_ZERO(test_twheel_past_and_far());
+	return EXIT_SUCCESS;
+}